@@ -35,6 +35,7 @@
 #include "qom/object.h"
 
 int tcg_tb_size;
+const char *tcg_tb_cache;
 static bool tcg_allowed = true;
 
 static int tcg_init(MachineState *ms)
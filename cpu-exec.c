@@ -35,6 +35,7 @@
 #endif
 #include "sysemu/cpus.h"
 #include "sysemu/replay.h"
+#include "tb-worker.h"
 
 /* -icount align implementation. */
 
@@ -309,10 +310,8 @@ static bool tb_cmp(const void *p, const void *d)
     return false;
 }
 
-static TranslationBlock *tb_htable_lookup(CPUState *cpu,
-                                          target_ulong pc,
-                                          target_ulong cs_base,
-                                          uint32_t flags)
+TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
+                                   target_ulong cs_base, uint32_t flags)
 {
     tb_page_addr_t phys_pc;
     struct tb_desc desc;
@@ -328,6 +327,52 @@ static TranslationBlock *tb_htable_lookup(CPUState *cpu,
     return qht_lookup(&tcg_ctx.tb_ctx.htable, tb_cmp, &desc, h);
 }
 
+/* Only the vCPU fills its jump cache.  tb_phys_invalidate may clear the
+ * entries of a TB from another thread meanwhile and miss one the vCPU
+ * just moved, such a TB is invalid and never hits.
+ */
+static inline TranslationBlock *tb_jmp_cache_lookup(CPUState *cpu,
+                                                    target_ulong pc,
+                                                    target_ulong cs_base,
+                                                    uint32_t flags)
+{
+    TranslationBlock **set = &cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)];
+    TranslationBlock *tb;
+    unsigned int i;
+
+    for (i = 0; i < TB_JMP_CACHE_WAYS; i++) {
+        tb = atomic_rcu_read(&set[i]);
+        if (tb && tb->pc == pc && tb->cs_base == cs_base &&
+            tb->flags == flags && !atomic_read(&tb->invalid)) {
+            if (i) {
+                atomic_set(&set[i], atomic_read(&set[0]));
+                atomic_set(&set[0], tb);
+            }
+#ifdef CONFIG_PROFILER
+            cpu->tb_jmp_cache_hits++;
+#endif
+            return tb;
+        }
+    }
+#ifdef CONFIG_PROFILER
+    cpu->tb_jmp_cache_misses++;
+#endif
+    return NULL;
+}
+
+/* the least recently used entry of the set goes */
+static inline void tb_jmp_cache_insert(CPUState *cpu, TranslationBlock *tb)
+{
+    unsigned int h = tb_jmp_cache_hash_func(tb->pc);
+    TranslationBlock **set = &cpu->tb_jmp_cache[h];
+    unsigned int i;
+
+    for (i = TB_JMP_CACHE_WAYS - 1; i > 0; i--) {
+        atomic_set(&set[i], atomic_read(&set[i - 1]));
+    }
+    atomic_set(&set[0], tb);
+}
+
 static inline TranslationBlock *tb_find(CPUState *cpu,
                                         TranslationBlock *last_tb,
                                         int tb_exit)
@@ -337,16 +382,26 @@ static inline TranslationBlock *tb_find(CPUState *cpu,
     target_ulong cs_base, pc;
     uint32_t flags;
     bool have_tb_lock = false;
+#ifdef CONFIG_PROFILER
+    int64_t stall;
+#endif
+
+#ifdef CONFIG_PROFILER
+    cpu->tb_find_count++;
+#endif
 
     /* we record a subset of the CPU state. It will
        always be the same before a given translated block
        is executed. */
     cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
-    tb = atomic_rcu_read(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)]);
-    if (unlikely(!tb || tb->pc != pc || tb->cs_base != cs_base ||
-                 tb->flags != flags)) {
+    tb = tb_jmp_cache_lookup(cpu, pc, cs_base, flags);
+    if (unlikely(!tb)) {
         tb = tb_htable_lookup(cpu, pc, cs_base, flags);
         if (!tb) {
+#ifdef CONFIG_PROFILER
+            /* the time the vCPU waits for code, see tb-worker.c */
+            stall = get_clock();
+#endif
 
             /* mmap_lock is needed by tb_gen_code, and mmap_lock must be
              * taken outside tb_lock. As system emulation is currently
@@ -362,19 +417,29 @@ static inline TranslationBlock *tb_find(CPUState *cpu,
             tb = tb_htable_lookup(cpu, pc, cs_base, flags);
             if (!tb) {
                 /* if no translated code available, then translate it now */
-                tb = tb_gen_code(cpu, pc, cs_base, flags, 0);
+                tb = tb_gen_code(cpu, pc, cs_base, flags,
+                                 tcg_tb_hot ? CF_COLD : 0);
             }
 
             mmap_unlock();
+#ifdef CONFIG_PROFILER
+            tcg_ctx.tb_ctx.tb_stall_count++;
+            tcg_ctx.tb_ctx.tb_stall_ns += get_clock() - stall;
+#endif
         }
 
         /* We add the TB in the virtual pc hash table for the fast lookup */
-        atomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
+        tb_jmp_cache_insert(cpu, tb);
+        /* the translator thread got there first */
+        if (unlikely(atomic_read(&tb->prefetch))) {
+            tb_worker_reached(tb);
+        }
     }
-#ifndef CONFIG_USER_ONLY
+#if !defined(CONFIG_USER_ONLY) && !defined(TARGET_FIXED_CODE_MAPPING)
     /* We don't take care of direct jumps when address mapping changes in
      * system emulation. So it's not safe to make a direct jump to a TB
      * spanning two pages because the mapping for the second page can change.
+     * Targets whose code mapping is fixed define TARGET_FIXED_CODE_MAPPING.
      */
     if (tb->page_addr[1] != -1) {
         last_tb = NULL;
@@ -594,6 +659,11 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
          * or cpu->interrupt_request.
          */
         smp_mb();
+        /* a cold TB became hot */
+        if (unlikely(tb->cflags & CF_COLD)
+            && atomic_read(&tb->hot_left) <= 0) {
+            tb_gen_hot(cpu, tb);
+        }
         return;
     }
 
@@ -196,6 +196,8 @@ static bool default_mttcg_enabled(void)
 void qemu_tcg_configure(QemuOpts *opts, Error **errp)
 {
     const char *t = qemu_opt_get(opts, "thread");
+    uint64_t jmp_cache, ways, max;
+
     if (t) {
         if (strcmp(t, "multi") == 0) {
             if (TCG_OVERSIZED_GUEST) {
@@ -222,6 +224,34 @@ void qemu_tcg_configure(QemuOpts *opts, Error **errp)
     } else {
         mttcg_enabled = default_mttcg_enabled();
     }
+
+    tcg_tb_hot = qemu_opt_get_number(opts, "hot", 0);
+    tcg_tb_trace = qemu_opt_get_bool(opts, "trace", false);
+    if (tcg_tb_trace && !tcg_tb_hot) {
+        error_setg(errp, "'trace' needs 'hot' to find the hot TBs");
+    }
+    tcg_tb_prefetch = qemu_opt_get_number(opts, "prefetch", 0);
+#ifndef TARGET_FIXED_CODE_MAPPING
+    if (tcg_tb_prefetch) {
+        error_setg(errp, "'prefetch' needs a target with a fixed code mapping");
+    }
+#endif
+
+    /* the jump cache hash takes at most TARGET_PAGE_BITS bits of the offset
+     * of a pc in its page, see tb-hash.h
+     */
+    jmp_cache = qemu_opt_get_number(opts, "jmp-cache", 1 << TB_JMP_CACHE_BITS);
+    ways = qemu_opt_get_number(opts, "jmp-cache-ways", 1);
+    max = ways << MIN(2 * TARGET_PAGE_BITS + 1, 24);
+    if (ways != 1 && ways != 2 && ways != 4) {
+        error_setg(errp, "'jmp-cache-ways' must be 1, 2 or 4");
+    } else if (!is_power_of_2(jmp_cache) || jmp_cache < 16 || jmp_cache > max) {
+        error_setg(errp, "'jmp-cache' must be a power of two from 16 to %"
+                   PRIu64, max);
+    } else {
+        tb_jmp_cache_bits = ctz64(jmp_cache);
+        tb_jmp_cache_way_bits = ctz64(ways);
+    }
 }
 
 /* The current number of executed instructions is based on what we
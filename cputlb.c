@@ -32,6 +32,7 @@
 #include "exec/log.h"
 #include "exec/helper-proto.h"
 #include "qemu/atomic.h"
+#include "tb-worker.h"
 
 /* DEBUG defines, enable DEBUG_TLB_LOG to log to the CPU_LOG_MMU target */
 /* #define DEBUG_TLB */
@@ -118,7 +119,8 @@ static void tlb_flush_nocheck(CPUState *cpu)
 
     memset(env->tlb_table, -1, sizeof(env->tlb_table));
     memset(env->tlb_v_table, -1, sizeof(env->tlb_v_table));
-    memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
+    memset(cpu->tb_jmp_cache, 0,
+           TB_JMP_CACHE_SIZE * sizeof(cpu->tb_jmp_cache[0]));
 
     env->vtlb_index = 0;
     env->tlb_flush_addr = -1;
@@ -183,7 +185,8 @@ static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
         }
     }
 
-    memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
+    memset(cpu->tb_jmp_cache, 0,
+           TB_JMP_CACHE_SIZE * sizeof(cpu->tb_jmp_cache[0]));
 
     tlb_debug("done\n");
 
@@ -746,6 +749,31 @@ static inline ram_addr_t qemu_ram_addr_from_host_nofail(void *ptr)
     return ram_addr;
 }
 
+#ifdef TARGET_FIXED_CODE_MAPPING
+/* The code mapping never changes, so it is known without the TLB, which
+ * only the vCPU may fill. For the translator thread, see tb-worker.c.
+ * Returns -1 for code which is not in RAM or ROM.
+ */
+static tb_page_addr_t get_page_addr_code_fixed(CPUState *cpu,
+                                               target_ulong addr)
+{
+    hwaddr paddr, xlat, len = 1;
+    MemoryRegion *mr;
+    tb_page_addr_t ram_addr = -1;
+
+    paddr = cpu_get_phys_page_debug(cpu, addr & TARGET_PAGE_MASK)
+            + (addr & ~TARGET_PAGE_MASK);
+    rcu_read_lock();
+    mr = address_space_translate(cpu->as, paddr, &xlat, &len, false);
+    if (memory_region_is_ram(mr) || memory_region_is_romd(mr)) {
+        ram_addr = memory_region_get_ram_addr(mr) + xlat;
+    }
+    rcu_read_unlock();
+
+    return ram_addr;
+}
+#endif
+
 /* NOTE: this function can trigger an exception */
 /* NOTE2: the returned address is not exactly the physical address: it
  * is actually a ram_addr_t (in system mode; the user mode emulation
@@ -759,6 +787,12 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr)
     CPUState *cpu = ENV_GET_CPU(env1);
     CPUIOTLBEntry *iotlbentry;
 
+#ifdef TARGET_FIXED_CODE_MAPPING
+    if (unlikely(tb_worker_thread)) {
+        return get_page_addr_code_fixed(cpu, addr);
+    }
+#endif
+
     page_index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     mmu_idx = cpu_mmu_index(env1, true);
     if (unlikely(env1->tlb_table[mmu_idx][page_index].addr_code !=
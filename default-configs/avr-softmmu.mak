@@ -19,3 +19,13 @@
 #
 
 # Default configuration for avr-softmmu
+CONFIG_AVR_INTC=y
+CONFIG_AVR_TIMER=y
+CONFIG_AVR_USART=y
+CONFIG_AVR_GPIO=y
+CONFIG_AVR_NVM=y
+CONFIG_AVR_EEPROM=y
+CONFIG_AVR_FLASH=y
+CONFIG_AVR_SNAPSHOT=y
+CONFIG_AVR_BATCH=y
+CONFIG_AVR_LINK=y
@@ -0,0 +1,197 @@
+/*
+ * AVR disassembler
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+/*
+ *  The disassembler uses the decode index of the translator and the
+ *  assembler syntax of avr.yaml, both are generated from it so decoding
+ *  and disassembly always agree. Branch targets are printed as a comment,
+ *  like avr-objdump does.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitops.h"
+#include "qemu/bswap.h"
+#include "disas/bfd.h"
+
+#include "target/avr/translate-inst.h"
+#include "target/avr/decode-index.h"
+#include "target/avr/disas.inc.c"
+
+#define AVR_DISAS_OPERANDS 4
+
+/* relative branches wrap around in the 8 MiB flash address space */
+#define AVR_DISAS_ADDR_MASK 0x7fffff
+
+/*
+ *  the operands are formatted by hand, snprintf dominates the cost of a
+ *  line otherwise
+ */
+static char *avr_disas_hex(char *p, uint32_t v, int digits)
+{
+    static const char hex[] = "0123456789abcdef";
+    int i;
+
+    *p++ = '0';
+    *p++ = 'x';
+    for (i = digits - 1; i >= 0; i--) {
+        p[i] = hex[v & 0xf];
+        v >>= 4;
+    }
+    return p + digits;
+}
+
+static char *avr_disas_dec(char *p, uint32_t v)
+{
+    char tmp[10];
+    int n = 0;
+
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n) {
+        *p++ = tmp[--n];
+    }
+    return p;
+}
+
+static char *avr_disas_reg(char *p, uint32_t v)
+{
+    *p++ = 'r';
+    return avr_disas_dec(p, v);
+}
+
+/* code addresses are printed without leading zeroes */
+static int avr_disas_digits(uint32_t v)
+{
+    int digits = 1;
+
+    while (v >>= 4) {
+        digits++;
+    }
+    return digits;
+}
+
+/* @buf has to hold at least AVR_DISAS_LINE bytes */
+#define AVR_DISAS_LINE 64
+
+static void avr_disas_format(char *buf, bfd_vma addr, uint32_t length,
+                             const char *format, const uint32_t *op)
+{
+    char *p = buf;
+    uint32_t target = 0;
+    bool branch = false;
+
+    /* mnemonic */
+    while (*format && *format != ' ') {
+        *p++ = *format++;
+    }
+    if (*format) {
+        *p++ = '\t';
+        format++;
+    }
+
+    for (; *format; format++) {
+        uint32_t v;
+        int32_t rel;
+
+        if (*format != '%') {
+            *p++ = *format;
+            continue;
+        }
+        v = *op++;
+
+        switch (*++format) {
+        case 'r':
+            p = avr_disas_reg(p, v);
+            break;
+        case 'u':
+            p = avr_disas_reg(p, 16 + v);
+            break;
+        case 'w':
+            p = avr_disas_reg(p, 2 * v);
+            break;
+        case 'a':
+            p = avr_disas_reg(p, 24 + 2 * v);
+            break;
+        case 'i':
+        case 'p':
+            p = avr_disas_hex(p, v, 2);
+            break;
+        case 'd':
+            p = avr_disas_hex(p, v, 4);
+            break;
+        case 'n':
+            p = avr_disas_dec(p, v);
+            break;
+        case 'j':
+        case 'J':
+            rel = sextract32(v, 0, *format == 'j' ? 7 : 12) * 2;
+            target = (addr + length / 8 + rel) & AVR_DISAS_ADDR_MASK;
+            branch = true;
+            *p++ = '.';
+            *p++ = rel < 0 ? '-' : '+';
+            p = avr_disas_dec(p, rel < 0 ? -rel : rel);
+            break;
+        case 'A':
+            v *= 2;
+            p = avr_disas_hex(p, v, avr_disas_digits(v));
+            break;
+        default:
+            g_assert_not_reached();
+        }
+    }
+    if (branch) {
+        *p++ = '\t';
+        *p++ = ';';
+        *p++ = ' ';
+        p = avr_disas_hex(p, target, avr_disas_digits(target));
+    }
+    *p = '\0';
+    assert(p < buf + AVR_DISAS_LINE);
+}
+
+int print_insn_avr(bfd_vma addr, disassemble_info *info)
+{
+    uint32_t op[AVR_DISAS_OPERANDS];
+    bfd_byte buffer[2];
+    uint32_t opcode;
+    uint32_t length;
+    uint32_t idx;
+    char text[AVR_DISAS_LINE];
+    int status;
+
+    status = info->read_memory_func(addr, buffer, 2, info);
+    if (status) {
+        info->memory_error_func(status, addr, info);
+        return -1;
+    }
+    opcode = lduw_le_p(buffer);
+    idx = avr_decode_index[opcode];
+    length = avr_disas_insn[idx].length;
+
+    if (idx == 0) {
+        info->fprintf_func(info->stream, ".word\t0x%04x", opcode);
+        return 2;
+    }
+
+    if (length == 32) {
+        status = info->read_memory_func(addr + 2, buffer, 2, info);
+        if (status) {
+            info->memory_error_func(status, addr + 2, info);
+            return -1;
+        }
+        /* the first word is the high half, like in the translator */
+        opcode = (opcode << 16) | lduw_le_p(buffer);
+    }
+
+    avr_disas_operands(idx, opcode, op);
+    avr_disas_format(text, addr, length, avr_disas_insn[idx].format, op);
+    info->fprintf_func(info->stream, "%s", text);
+
+    return length / 8;
+}
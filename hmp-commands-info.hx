@@ -771,6 +771,40 @@ STEXI
 @item info skeys @var{address}
 @findex skeys
 Display the value of a storage key (s390 only)
+ETEXI
+
+#if defined(TARGET_AVR)
+    {
+        .name       = "avr-profile",
+        .args_type  = "top:i?",
+        .params     = "[top]",
+        .help       = "show the most frequent samples of the profiler",
+        .cmd        = hmp_info_avr_profile,
+    },
+#endif
+
+STEXI
+@item info avr-profile [@var{top}]
+@findex avr-profile
+Show the @var{top} (default 20) most frequent locations found by the
+sampling profiler of every CPU, see -global avr.profile (AVR only)
+ETEXI
+
+#if defined(TARGET_AVR)
+    {
+        .name       = "avr-snapshot",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show the in-memory snapshot and restore statistics",
+        .cmd        = hmp_info_avr_snapshot,
+    },
+#endif
+
+STEXI
+@item info avr-snapshot
+@findex avr-snapshot
+Show the size of the in-memory snapshot of the machine and how many pages
+a restore copies back on average (AVR only)
 ETEXI
 
     {
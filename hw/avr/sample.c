@@ -29,11 +29,48 @@
  *
  *      Currently used for AVR CPU validation
  *
+ *      The CPU is an avr5 unless -cpu selects another, e.g. avr6 for ELPM
+ *      and RAMPZ.
+ *
+ *      The peripherals follow the ATmega328P: register addresses and
+ *      interrupt vectors of PORTB..PORTD, TIMER0 (8 bit), TIMER1 (16 bit)
+ *      and USART0 which is connected to the first serial port.
+ *
+ *      Flash & EEPROM can be kept in files, e.g.
+ *          -global avr-flash.filename=flash.bin
+ *          -global avr-eeprom.filename=eeprom.bin
+ *      The firmware given with -bios is loaded over the flash at reset.
+ *
+ *      -global avr.profile=10000 samples the PC every 10000 cycles, the
+ *      histogram is shown by "info avr-profile" and query-avr-profile.
+ *
+ *      Writing 1 to 0xff (SNAPCTL) saves the machine in memory, writing 2
+ *      restores it, see avr_snapshot.c. "info avr-snapshot" shows the cost.
+ *
+ *      -global avr.coverage=afl counts the edges between TBs in the map of
+ *      afl-fuzz, see target/avr/coverage.c.
+ *
+ *      A test ends by writing its exit code to 0xfe (EXIT), QEMU exits
+ *      with it. -global avr-batch.list=FILE runs the firmware images listed
+ *      in FILE one after the other instead, see avr_batch.c.
+ *
+ *      sample-multi has -smp MCUs of this board without SNAPCTL & EXIT,
+ *      up to 8. Each has its own address space and, with MTTCG, a thread of
+ *      its own. MCU n uses the serial port n. Two links (see avr_link.c) at
+ *      0xf8 (SR, DR) and 0xfa connect the MCUs in a ring, link 0 of an MCU
+ *      sends to link 1 of the next. -bios is loaded into every flash. A
+ *      file backs one flash or EEPROM only, -global avr-flash.filename
+ *      and avr-eeprom.filename are refused with more than one MCU.
+ *
+ *      The MCUs of sample-multi run in quanta of 10 us, no MCU starts a
+ *      quantum before all ended the one before, see target/avr/quantum.c.
+ *      -M sample-multi,quantum=N sets it to N ns.
  */
 
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 #include "qemu-common.h"
+#include "qapi/visitor.h"
 #include "cpu.h"
 #include "hw/hw.h"
 #include "sysemu/sysemu.h"
@@ -45,6 +82,15 @@
 #include "qemu/error-report.h"
 #include "exec/address-spaces.h"
 #include "include/hw/sysbus.h"
+#include "hw/intc/avr_intc.h"
+#include "hw/timer/avr_timer.h"
+#include "hw/char/avr_usart.h"
+#include "hw/gpio/avr_gpio.h"
+#include "hw/misc/avr_flash.h"
+#include "hw/nvram/avr_eeprom.h"
+#include "hw/misc/avr_snapshot.h"
+#include "hw/misc/avr_batch.h"
+#include "hw/misc/avr_link.h"
 
 #define VIRT_BASE_FLASH 0x00000000
 #define VIRT_BASE_ISRAM 0x00000100
@@ -55,6 +101,7 @@
 #define SIZE_ISRAM 0x00001000
 #define SIZE_EXMEM 0x00010000
 #define SIZE_EEPROM 0x00001000
+#define SIZE_FLASH_PAGE 0x00000100
 #define SIZE_IOREG SIZE_REGS
 
 #define PHYS_BASE_FLASH (PHYS_BASE_CODE)
@@ -65,28 +112,238 @@
 
 #define PHYS_BASE_IOREG (PHYS_BASE_REGS + 0x20)
 
+/* data space addresses of the peripheral registers */
+#define ADDR_PINB 0x23
+#define ADDR_PINC 0x26
+#define ADDR_PIND 0x29
+#define ADDR_TIFR0 0x35
+#define ADDR_TIFR1 0x36
+#define ADDR_GPIOR0 0x3e
+#define ADDR_EECR 0x3f
+#define ADDR_TCCR0A 0x44
+#define ADDR_GPIOR1 0x4a
+#define ADDR_GPIOR2 0x4b
+#define ADDR_MCUCR 0x55
+#define ADDR_SPMCSR 0x57
+#define ADDR_TIMSK0 0x6e
+#define ADDR_TIMSK1 0x6f
+#define ADDR_TCCR1A 0x80
+#define ADDR_UCSR0A 0xc0
+#define ADDR_LINK0 0xf8
+#define ADDR_LINK1 0xfa
+#define ADDR_EXIT 0xfe
+#define ADDR_SNAPCTL 0xff
+
+/* interrupt lines, vector - 1 */
+#define IRQ_TIMER1_CAPT 9
+#define IRQ_TIMER0_COMPA 13
+#define IRQ_USART_RX 17
+#define IRQ_EE_READY 22
+#define IRQ_SPM_READY 25
+#define IRQ_LINK0_RX 26
+#define IRQ_LINK1_RX 27
+
+#define MULTI_MAX_MCUS 8
+
+/* of sample-multi, in ns */
+static uint32_t multi_quantum_ns = 10000;
+
+/* boot section of the largest size, the vectors are moved there by IVSEL */
+#define BOOT_BASE_W ((SIZE_FLASH - 0x2000) / 2)
+
+static void main_cpu_reset(void *opaque)
+{
+    AVRCPU *cpu = opaque;
+
+    cpu_reset(CPU(cpu));
+}
+
+/*
+ *  maps the registers into the IO window and the IO dispatch of the CPU,
+ *  the window is in the address space of the CPU, each MCU has its own
+ */
+static void sample_map(AVRCPU *cpu, DeviceState *dev, int n, hwaddr addr)
+{
+    MemoryRegion *mr = sysbus_mmio_get_region(SYS_BUS_DEVICE(dev), n);
+
+    memory_region_add_subregion(CPU(cpu)->memory, PHYS_BASE_REGS + addr, mr);
+    avr_cpu_map_io(cpu, addr, mr);
+}
+
+/* connects n interrupt lines of dev from line on to the intc from irq on */
+static void sample_connect_irqs(DeviceState *intc, DeviceState *dev,
+                                int line, int irq, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        sysbus_connect_irq(SYS_BUS_DEVICE(dev), line + i,
+                           qdev_get_gpio_in(intc, irq + i));
+        qdev_connect_gpio_out_named(intc, "ack", irq + i,
+                                    qdev_get_gpio_in_named(dev, "ack",
+                                                           line + i));
+    }
+}
+
+static void sample_timer(AVRCPU *cpu, DeviceState *intc, int width,
+                         hwaddr regs, hwaddr tifr, hwaddr timsk,
+                         int line, int irq)
+{
+    DeviceState *dev = qdev_create(NULL, TYPE_AVR_TIMER);
+
+    qdev_prop_set_uint32(dev, "width", width);
+    qdev_prop_set_uint32(dev, "clock-frequency", cpu->freq_hz);
+    qdev_init_nofail(dev);
+    sample_map(cpu, dev, 0, regs);
+    sample_map(cpu, dev, 1, tifr);
+    avr_cpu_io_peek(cpu, tifr, 1);
+    sample_map(cpu, dev, 2, timsk);
+    sample_connect_irqs(intc, dev, line, irq, AVR_TIMER_IRQS - line);
+}
+
+/* returns the EEPROM, the RAMs are named after mcu if it is not NULL */
+static DeviceState *sample_nvm(AVRCPU *cpu, DeviceState *intc,
+                               const char *mcu)
+{
+    MemoryRegion *memory = CPU(cpu)->memory;
+    DeviceState *dev;
+    char *name;
+
+    dev = qdev_create(NULL, TYPE_AVR_FLASH);
+    qdev_prop_set_uint32(dev, "size", SIZE_FLASH);
+    qdev_prop_set_uint32(dev, "page-size", SIZE_FLASH_PAGE);
+    if (mcu) {
+        name = g_strdup_printf("%s.flash", mcu);
+        qdev_prop_set_string(dev, "name", name);
+        g_free(name);
+    }
+    qdev_init_nofail(dev);
+    sample_map(cpu, dev, 0, ADDR_SPMCSR);
+    memory_region_add_subregion(memory, PHYS_BASE_FLASH,
+                                sysbus_mmio_get_region(SYS_BUS_DEVICE(dev), 1));
+    sysbus_connect_irq(SYS_BUS_DEVICE(dev), 0,
+                       qdev_get_gpio_in(intc, IRQ_SPM_READY));
+    cpu->env.flash = dev;
+
+    dev = qdev_create(NULL, TYPE_AVR_EEPROM);
+    qdev_prop_set_uint32(dev, "size", SIZE_EEPROM);
+    if (mcu) {
+        name = g_strdup_printf("%s.eeprom", mcu);
+        qdev_prop_set_string(dev, "name", name);
+        g_free(name);
+    }
+    qdev_init_nofail(dev);
+    sample_map(cpu, dev, 0, ADDR_EECR);
+    avr_cpu_io_peek(cpu, ADDR_EECR, 1);
+    memory_region_add_subregion(memory, PHYS_BASE_EEPROM,
+                                sysbus_mmio_get_region(SYS_BUS_DEVICE(dev), 1));
+    sysbus_connect_irq(SYS_BUS_DEVICE(dev), 0,
+                       qdev_get_gpio_in(intc, IRQ_EE_READY));
+    return dev;
+}
+
+static void sample_snapshot(AVRCPU *cpu, MemoryRegion *ram,
+                            DeviceState *eeprom)
+{
+    DeviceState *dev = qdev_create(NULL, TYPE_AVR_SNAPSHOT);
+
+    qdev_init_nofail(dev);
+    sample_map(cpu, dev, 0, ADDR_SNAPCTL);
+    avr_cpu_io_stop(cpu, ADDR_SNAPCTL);
+    avr_snapshot_attach(AVR_SNAPSHOT(dev), cpu, ram);
+    avr_snapshot_add_nvm(AVR_SNAPSHOT(dev), &AVR_EEPROM(eeprom)->nvm);
+}
+
+static void sample_batch(AVRCPU *cpu, MemoryRegion *ram, DeviceState *eeprom,
+                         DeviceState *usart)
+{
+    DeviceState *dev = qdev_create(NULL, TYPE_AVR_BATCH);
+
+    avr_batch_attach(AVR_BATCH(dev), cpu, ram, &AVR_EEPROM(eeprom)->nvm,
+                     AVR_USART(usart));
+    qdev_init_nofail(dev);
+    sample_map(cpu, dev, 0, ADDR_EXIT);
+    avr_cpu_io_stop(cpu, ADDR_EXIT);
+}
+
+/* the peripherals of one MCU, returns the EEPROM and in usart the USART */
+static DeviceState *sample_peripherals(AVRCPU *cpu, Chardev *chr,
+                                       const char *mcu, DeviceState **usart)
+{
+    static const hwaddr gpio[] = { ADDR_PINB, ADDR_PINC, ADDR_PIND };
+    DeviceState *intc;
+    DeviceState *eeprom;
+    DeviceState *dev;
+    int i;
+
+    intc = qdev_create(NULL, TYPE_AVR_INTC);
+    qdev_prop_set_uint32(intc, "boot-base", BOOT_BASE_W);
+    qdev_init_nofail(intc);
+    sample_map(cpu, intc, 0, ADDR_MCUCR);
+    for (i = 0; i < AVR_INTC_IRQS; i++) {
+        qdev_connect_gpio_out(intc, i, qdev_get_gpio_in(DEVICE(cpu), i));
+    }
+    cpu->env.intc = intc;
+
+    eeprom = sample_nvm(cpu, intc, mcu);
+
+    /* TIMER0 has no input capture */
+    sample_timer(cpu, intc, 8, ADDR_TCCR0A, ADDR_TIFR0, ADDR_TIMSK0,
+                 AVR_TIMER_IRQ_COMPA, IRQ_TIMER0_COMPA);
+    sample_timer(cpu, intc, 16, ADDR_TCCR1A, ADDR_TIFR1, ADDR_TIMSK1,
+                 AVR_TIMER_IRQ_CAPT, IRQ_TIMER1_CAPT);
+
+    dev = qdev_create(NULL, TYPE_AVR_USART);
+    qdev_prop_set_chr(dev, "chardev", chr);
+    qdev_init_nofail(dev);
+    sample_map(cpu, dev, 0, ADDR_UCSR0A);
+    sample_connect_irqs(intc, dev, 0, IRQ_USART_RX, AVR_USART_IRQS);
+    *usart = dev;
+
+    for (i = 0; i < ARRAY_SIZE(gpio); i++) {
+        dev = qdev_create(NULL, TYPE_AVR_GPIO);
+        qdev_init_nofail(dev);
+        sample_map(cpu, dev, 0, gpio[i]);
+        avr_cpu_io_peek(cpu, gpio[i], 3);
+    }
+
+    /* general purpose IO registers are plain storage */
+    avr_cpu_map_io_ram(cpu, ADDR_GPIOR0, 1);
+    avr_cpu_map_io_ram(cpu, ADDR_GPIOR1, 2);
+    return eeprom;
+}
+
 static void sample_init(MachineState *machine)
 {
     MemoryRegion *address_space_mem;
     MemoryRegion *ram;
-    MemoryRegion *flash;
     unsigned ram_size = SIZE_ISRAM + SIZE_EXMEM;
-    AVRCPU *cpu_avr ATTRIBUTE_UNUSED;
+    AVRCPU *cpu_avr;
+    DeviceState *eeprom;
+    DeviceState *usart;
     const char *firmware = NULL;
     const char *filename;
 
     address_space_mem = get_system_memory();
     ram = g_new(MemoryRegion, 1);
-    flash = g_new(MemoryRegion, 1);
 
-    cpu_avr = cpu_avr_init("avr5");
+    if (!machine->cpu_model) {
+        machine->cpu_model = "avr5";
+    }
+    cpu_avr = cpu_avr_init(machine->cpu_model);
+    if (cpu_avr == NULL) {
+        error_report("unknown CPU %s", machine->cpu_model);
+        exit(1);
+    }
+    /* before the reset of the batch runner, which halts it at the end */
+    qemu_register_reset(main_cpu_reset, cpu_avr);
 
     memory_region_allocate_system_memory(ram, NULL, "avr.ram", ram_size);
     memory_region_add_subregion(address_space_mem, PHYS_BASE_ISRAM, ram);
 
-    memory_region_init_rom(flash, NULL, "avr.flash", SIZE_FLASH, &error_fatal);
-    memory_region_add_subregion(address_space_mem, PHYS_BASE_FLASH, flash);
-    vmstate_register_ram_global(flash);
+    eeprom = sample_peripherals(cpu_avr, serial_hds[0], NULL, &usart);
+    sample_snapshot(cpu_avr, ram, eeprom);
+    sample_batch(cpu_avr, ram, eeprom, usart);
 
     if (machine->firmware) {
         firmware = machine->firmware;
@@ -106,3 +363,126 @@ static void sample_machine_init(MachineClass *mc)
 }
 
 DEFINE_MACHINE("sample", sample_machine_init)
+
+/* one MCU of sample-multi with its own address space, returns its CPU */
+static AVRCPU *sample_mcu(int n, AVRLinkState **link)
+{
+    MemoryRegion *memory = g_new(MemoryRegion, 1);
+    MemoryRegion *ram = g_new(MemoryRegion, 1);
+    char *mcu = g_strdup_printf("mcu%d", n);
+    char *name;
+    Object *cpu;
+    DeviceState *dev;
+    int i;
+
+    memory_region_init(memory, NULL, mcu, UINT64_MAX);
+
+    cpu = object_new("avr5-" TYPE_AVR_CPU);
+    object_property_set_link(cpu, OBJECT(memory), "memory", &error_abort);
+    object_property_set_bool(cpu, true, "realized", &error_fatal);
+    qemu_register_reset(main_cpu_reset, cpu);
+
+    name = g_strdup_printf("%s.ram", mcu);
+    memory_region_init_ram(ram, NULL, name, SIZE_ISRAM + SIZE_EXMEM,
+                           &error_fatal);
+    vmstate_register_ram_global(ram);
+    memory_region_add_subregion(memory, PHYS_BASE_ISRAM, ram);
+    g_free(name);
+
+    sample_peripherals(AVR_CPU(cpu),
+                       n < MAX_SERIAL_PORTS ? serial_hds[n] : NULL, mcu,
+                       &dev);
+
+    for (i = 0; i < 2; i++) {
+        dev = qdev_create(NULL, TYPE_AVR_LINK);
+        qdev_init_nofail(dev);
+        sample_map(AVR_CPU(cpu), dev, 0, i ? ADDR_LINK1 : ADDR_LINK0);
+        sysbus_connect_irq(SYS_BUS_DEVICE(dev), 0,
+                           qdev_get_gpio_in(AVR_CPU(cpu)->env.intc,
+                                            i ? IRQ_LINK1_RX : IRQ_LINK0_RX));
+        link[i] = AVR_LINK(dev);
+    }
+
+    g_free(mcu);
+    return AVR_CPU(cpu);
+}
+
+static void sample_multi_init(MachineState *machine)
+{
+    AVRLinkState *link[MULTI_MAX_MCUS][2];
+    AVRQuantum *quantum;
+    AVRCPU *cpu;
+    char *filename = NULL;
+    gchar *firmware = NULL;
+    gsize len = 0;
+    int i;
+
+    if (machine->firmware) {
+        filename = qemu_find_file(QEMU_FILE_TYPE_BIOS, machine->firmware);
+        if (!filename || !g_file_get_contents(filename, &firmware, &len, NULL)
+                || len > SIZE_FLASH) {
+            error_report("cannot load %s into the flash", machine->firmware);
+            exit(1);
+        }
+        g_free(filename);
+    }
+
+    quantum = avr_quantum_new(multi_quantum_ns);
+    for (i = 0; i < smp_cpus; i++) {
+        cpu = sample_mcu(i, link[i]);
+        avr_quantum_add(quantum, cpu, &error_fatal);
+        if (firmware) {
+            avr_flash_load(AVR_FLASH(cpu->env.flash), (uint8_t *)firmware, len);
+        }
+    }
+
+    /* a ring, link 0 of an MCU sends to link 1 of the next */
+    for (i = 0; i < smp_cpus; i++) {
+        avr_link_connect(link[i][0], link[(i + 1) % smp_cpus][1], quantum);
+    }
+
+    g_free(firmware);
+}
+
+static void sample_multi_get_quantum(Object *obj, Visitor *v,
+                                     const char *name, void *opaque,
+                                     Error **errp)
+{
+    visit_type_uint32(v, name, &multi_quantum_ns, errp);
+}
+
+static void sample_multi_set_quantum(Object *obj, Visitor *v,
+                                     const char *name, void *opaque,
+                                     Error **errp)
+{
+    Error *local_err = NULL;
+    uint32_t value;
+
+    visit_type_uint32(v, name, &value, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return;
+    }
+    if (value == 0) {
+        error_setg(errp, "the quantum cannot be 0");
+        return;
+    }
+    multi_quantum_ns = value;
+}
+
+static void sample_multi_machine_init(MachineClass *mc)
+{
+    mc->desc = "AVR sample board with an MCU per CPU (-smp)";
+    mc->init = sample_multi_init;
+    mc->max_cpus = MULTI_MAX_MCUS;
+
+    object_class_property_add(OBJECT_CLASS(mc), "quantum", "uint32",
+                              sample_multi_get_quantum,
+                              sample_multi_set_quantum,
+                              NULL, NULL, &error_abort);
+    object_class_property_set_description(OBJECT_CLASS(mc), "quantum",
+            "ns the MCUs run before they wait for each other",
+            &error_abort);
+}
+
+DEFINE_MACHINE("sample-multi", sample_multi_machine_init)
@@ -0,0 +1,270 @@
+/*
+ * AVR USART
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+/*
+ *  Frames are sent and received at once, the baud rate is not modelled.
+ *  A write to UDR hands the frame to the chardev, UDRE is clear until the
+ *  chardev took it.
+ */
+
+#include "qemu/osdep.h"
+#include "hw/char/avr_usart.h"
+#include "qemu/log.h"
+
+static void avr_usart_update_irq(AVRUsartState *s)
+{
+    uint8_t a = s->ucsra;
+    uint8_t b = s->ucsrb;
+
+    qemu_set_irq(s->irq[AVR_USART_IRQ_RX],
+                 (a & USART_UCSRA_RXC) && (b & USART_UCSRB_RXCIE));
+    qemu_set_irq(s->irq[AVR_USART_IRQ_UDRE],
+                 (a & USART_UCSRA_UDRE) && (b & USART_UCSRB_UDRIE));
+    qemu_set_irq(s->irq[AVR_USART_IRQ_TX],
+                 (a & USART_UCSRA_TXC) && (b & USART_UCSRB_TXCIE));
+}
+
+static int avr_usart_can_receive(void *opaque)
+{
+    AVRUsartState *s = opaque;
+
+    return (s->ucsrb & USART_UCSRB_RXEN) && !(s->ucsra & USART_UCSRA_RXC);
+}
+
+static void avr_usart_receive(void *opaque, const uint8_t *buf, int size)
+{
+    AVRUsartState *s = opaque;
+
+    s->rx_data = *buf;
+    s->ucsra |= USART_UCSRA_RXC;
+    avr_usart_update_irq(s);
+}
+
+static gboolean avr_usart_transmit(GIOChannel *chan, GIOCondition cond,
+                                   void *opaque)
+{
+    AVRUsartState *s = opaque;
+
+    s->watch_tag = 0;
+    if (s->ucsra & USART_UCSRA_UDRE) {
+        return FALSE;
+    }
+
+    /* the frame is dropped without a chardev that could take it later */
+    if (qemu_chr_fe_get_driver(&s->chr) &&
+        qemu_chr_fe_write(&s->chr, &s->tx_data, 1) != 1) {
+        s->watch_tag = qemu_chr_fe_add_watch(&s->chr, G_IO_OUT | G_IO_HUP,
+                                             avr_usart_transmit, s);
+        if (s->watch_tag) {
+            return FALSE;
+        }
+    }
+
+    s->ucsra |= USART_UCSRA_UDRE | USART_UCSRA_TXC;
+    avr_usart_update_irq(s);
+    return FALSE;
+}
+
+/* the CPU executes the vector of line n, only TXC is cleared by it */
+static void avr_usart_ack(void *opaque, int n, int level)
+{
+    AVRUsartState *s = opaque;
+
+    if (level && n == AVR_USART_IRQ_TX) {
+        s->ucsra &= ~USART_UCSRA_TXC;
+        avr_usart_update_irq(s);
+    }
+}
+
+static void avr_usart_reset(DeviceState *dev)
+{
+    AVRUsartState *s = AVR_USART(dev);
+
+    if (s->watch_tag) {
+        g_source_remove(s->watch_tag);
+        s->watch_tag = 0;
+    }
+    s->ucsra = USART_UCSRA_UDRE;
+    s->ucsrb = 0;
+    s->ucsrc = 0x06; /* 8 data bits */
+    s->ubrr = 0;
+    s->rx_data = 0;
+    s->tx_data = 0;
+    avr_usart_update_irq(s);
+}
+
+static uint64_t avr_usart_read(void *opaque, hwaddr offset, unsigned size)
+{
+    AVRUsartState *s = opaque;
+
+    switch (offset) {
+    case USART_UCSRA:
+        return s->ucsra;
+    case USART_UCSRB:
+        return s->ucsrb;
+    case USART_UCSRC:
+        return s->ucsrc;
+    case USART_UBRRL:
+        return s->ubrr & 0xff;
+    case USART_UBRRH:
+        return s->ubrr >> 8;
+    case USART_UDR:
+        s->ucsra &= ~USART_UCSRA_RXC;
+        avr_usart_update_irq(s);
+        qemu_chr_fe_accept_input(&s->chr);
+        return s->rx_data;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Bad offset 0x%"HWADDR_PRIx"\n", __func__, offset);
+        return 0;
+    }
+}
+
+static void avr_usart_write(void *opaque, hwaddr offset, uint64_t val64,
+                            unsigned size)
+{
+    AVRUsartState *s = opaque;
+    uint8_t value = val64;
+
+    switch (offset) {
+    case USART_UCSRA:
+        /* TXC is cleared by writing a one, U2X & MPCM are not modelled */
+        s->ucsra &= ~(value & USART_UCSRA_TXC);
+        s->ucsra = (s->ucsra & ~0x03) | (value & 0x03);
+        break;
+    case USART_UCSRB:
+        s->ucsrb = value;
+        if (value & USART_UCSRB_RXEN) {
+            qemu_chr_fe_accept_input(&s->chr);
+        }
+        break;
+    case USART_UCSRC:
+        s->ucsrc = value;
+        break;
+    case USART_UBRRL:
+        s->ubrr = (s->ubrr & 0x0f00) | value;
+        break;
+    case USART_UBRRH:
+        s->ubrr = (s->ubrr & 0x00ff) | ((value & 0x0f) << 8);
+        break;
+    case USART_UDR:
+        if (!(s->ucsrb & USART_UCSRB_TXEN)) {
+            break;
+        }
+        if (!(s->ucsra & USART_UCSRA_UDRE)) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "%s: UDR written while not empty\n", __func__);
+            break;
+        }
+        s->tx_data = value;
+        s->ucsra &= ~USART_UCSRA_UDRE;
+        if (s->tap) {
+            s->tap(s->tap_opaque, value);
+        }
+        avr_usart_transmit(NULL, G_IO_OUT, s);
+        return;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Bad offset 0x%"HWADDR_PRIx"\n", __func__, offset);
+        return;
+    }
+    avr_usart_update_irq(s);
+}
+
+static const MemoryRegionOps avr_usart_ops = {
+    .read = avr_usart_read,
+    .write = avr_usart_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .impl = { .min_access_size = 1, .max_access_size = 1 },
+};
+
+/* a frame the chardev did not take yet is sent again */
+static int avr_usart_post_load(void *opaque, int version_id)
+{
+    AVRUsartState *s = opaque;
+
+    if (!(s->ucsra & USART_UCSRA_UDRE) && !s->watch_tag) {
+        avr_usart_transmit(NULL, G_IO_OUT, s);
+    }
+    return 0;
+}
+
+static const VMStateDescription vmstate_avr_usart = {
+    .name = TYPE_AVR_USART,
+    .version_id = 2,
+    .minimum_version_id = 2,
+    .post_load = avr_usart_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT8(ucsra, AVRUsartState),
+        VMSTATE_UINT8(ucsrb, AVRUsartState),
+        VMSTATE_UINT8(ucsrc, AVRUsartState),
+        VMSTATE_UINT16(ubrr, AVRUsartState),
+        VMSTATE_UINT8(rx_data, AVRUsartState),
+        VMSTATE_UINT8(tx_data, AVRUsartState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property avr_usart_properties[] = {
+    DEFINE_PROP_CHR("chardev", AVRUsartState, chr),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+/* tap sees the frames sent too, whether the chardev takes them or not */
+void avr_usart_set_tap(AVRUsartState *s, AVRUsartTap *tap, void *opaque)
+{
+    s->tap = tap;
+    s->tap_opaque = opaque;
+}
+
+static void avr_usart_init(Object *obj)
+{
+    AVRUsartState *s = AVR_USART(obj);
+    int i;
+
+    for (i = 0; i < AVR_USART_IRQS; i++) {
+        sysbus_init_irq(SYS_BUS_DEVICE(obj), &s->irq[i]);
+    }
+    qdev_init_gpio_in_named(DEVICE(obj), avr_usart_ack, "ack", AVR_USART_IRQS);
+
+    memory_region_init_io(&s->iomem, obj, &avr_usart_ops, s,
+                          TYPE_AVR_USART, USART_SIZE);
+    sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->iomem);
+}
+
+static void avr_usart_realize(DeviceState *dev, Error **errp)
+{
+    AVRUsartState *s = AVR_USART(dev);
+
+    qemu_chr_fe_set_handlers(&s->chr, avr_usart_can_receive,
+                             avr_usart_receive, NULL, s, NULL, true);
+}
+
+static void avr_usart_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+
+    dc->reset = avr_usart_reset;
+    dc->realize = avr_usart_realize;
+    dc->props = avr_usart_properties;
+    dc->vmsd = &vmstate_avr_usart;
+}
+
+static const TypeInfo avr_usart_info = {
+    .name          = TYPE_AVR_USART,
+    .parent        = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(AVRUsartState),
+    .instance_init = avr_usart_init,
+    .class_init    = avr_usart_class_init,
+};
+
+static void avr_usart_register_types(void)
+{
+    type_register_static(&avr_usart_info);
+}
+
+type_init(avr_usart_register_types)
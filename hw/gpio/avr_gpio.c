@@ -0,0 +1,148 @@
+/*
+ * AVR GPIO port
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+/*
+ *  Output pins drive the out lines with their PORT bit, input pins read the
+ *  level of the in lines. Pull-ups are not modelled.
+ */
+
+#include "qemu/osdep.h"
+#include "hw/gpio/avr_gpio.h"
+#include "qemu/log.h"
+
+static void avr_gpio_update_out(AVRGpioState *s)
+{
+    uint8_t level = s->port & s->ddr;
+    uint8_t changed = level ^ s->out_level;
+    int i;
+
+    s->out_level = level;
+    for (i = 0; i < AVR_GPIO_PINS; i++) {
+        if (changed & (1 << i)) {
+            qemu_set_irq(s->out[i], (level >> i) & 1);
+        }
+    }
+}
+
+static void avr_gpio_set_in(void *opaque, int n, int level)
+{
+    AVRGpioState *s = opaque;
+
+    if (level) {
+        s->in |= 1 << n;
+    } else {
+        s->in &= ~(1 << n);
+    }
+}
+
+static void avr_gpio_reset(DeviceState *dev)
+{
+    AVRGpioState *s = AVR_GPIO(dev);
+
+    s->ddr = 0;
+    s->port = 0;
+    avr_gpio_update_out(s);
+}
+
+static uint64_t avr_gpio_read(void *opaque, hwaddr offset, unsigned size)
+{
+    AVRGpioState *s = opaque;
+
+    switch (offset) {
+    case GPIO_PIN:
+        return (s->port & s->ddr) | (s->in & ~s->ddr);
+    case GPIO_DDR:
+        return s->ddr;
+    case GPIO_PORT:
+        return s->port;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Bad offset 0x%"HWADDR_PRIx"\n", __func__, offset);
+        return 0;
+    }
+}
+
+static void avr_gpio_write(void *opaque, hwaddr offset, uint64_t val64,
+                           unsigned size)
+{
+    AVRGpioState *s = opaque;
+    uint8_t value = val64;
+
+    switch (offset) {
+    case GPIO_PIN:
+        /* writing a one to PIN toggles the PORT bit */
+        s->port ^= value;
+        break;
+    case GPIO_DDR:
+        s->ddr = value;
+        break;
+    case GPIO_PORT:
+        s->port = value;
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Bad offset 0x%"HWADDR_PRIx"\n", __func__, offset);
+        return;
+    }
+    avr_gpio_update_out(s);
+}
+
+static const MemoryRegionOps avr_gpio_ops = {
+    .read = avr_gpio_read,
+    .write = avr_gpio_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .impl = { .min_access_size = 1, .max_access_size = 1 },
+};
+
+static const VMStateDescription vmstate_avr_gpio = {
+    .name = TYPE_AVR_GPIO,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT8(ddr, AVRGpioState),
+        VMSTATE_UINT8(port, AVRGpioState),
+        VMSTATE_UINT8(in, AVRGpioState),
+        VMSTATE_UINT8(out_level, AVRGpioState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static void avr_gpio_init(Object *obj)
+{
+    AVRGpioState *s = AVR_GPIO(obj);
+    DeviceState *dev = DEVICE(obj);
+
+    qdev_init_gpio_in(dev, avr_gpio_set_in, AVR_GPIO_PINS);
+    qdev_init_gpio_out(dev, s->out, AVR_GPIO_PINS);
+
+    memory_region_init_io(&s->iomem, obj, &avr_gpio_ops, s,
+                          TYPE_AVR_GPIO, GPIO_SIZE);
+    sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->iomem);
+}
+
+static void avr_gpio_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+
+    dc->reset = avr_gpio_reset;
+    dc->vmsd = &vmstate_avr_gpio;
+}
+
+static const TypeInfo avr_gpio_info = {
+    .name          = TYPE_AVR_GPIO,
+    .parent        = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(AVRGpioState),
+    .instance_init = avr_gpio_init,
+    .class_init    = avr_gpio_class_init,
+};
+
+static void avr_gpio_register_types(void)
+{
+    type_register_static(&avr_gpio_info);
+}
+
+type_init(avr_gpio_register_types)
@@ -0,0 +1,141 @@
+/*
+ * AVR interrupt controller
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+/*
+ *  The devices raise a line as long as their interrupt flag and its enable
+ *  bit are set, the controller passes the lines on to the CPU which takes
+ *  the lowest pending vector. When it does, the controller pulses the "ack"
+ *  line of the vector, devices whose flag is cleared by hardware clear it.
+ *
+ *  MCUCR IVSEL moves the vectors to the boot section, IVSEL can only be
+ *  changed by the write right after the one that set IVCE.
+ */
+
+#include "qemu/osdep.h"
+#include "hw/intc/avr_intc.h"
+#include "qemu/log.h"
+#include "cpu.h"
+
+static void avr_intc_set_irq(void *opaque, int irq, int level)
+{
+    AVRIntcState *s = opaque;
+    uint64_t mask = 1ull << irq;
+
+    if (!!(s->level & mask) == !!level) {
+        return;
+    }
+    if (level) {
+        s->level |= mask;
+    } else {
+        s->level &= ~mask;
+    }
+    qemu_set_irq(s->irq[irq], level);
+}
+
+void avr_intc_acknowledge_irq(void *opaque, int irq)
+{
+    AVRIntcState *s = opaque;
+
+    qemu_irq_pulse(s->ack[irq]);
+}
+
+uint32_t avr_intc_vector_base(void *opaque)
+{
+    AVRIntcState *s = opaque;
+
+    return s->mcucr & MCUCR_IVSEL ? s->boot_base : 0;
+}
+
+static void avr_intc_reset(DeviceState *dev)
+{
+    AVRIntcState *s = AVR_INTC(dev);
+
+    s->mcucr = 0;
+    s->ivce = false;
+}
+
+static uint64_t avr_intc_read(void *opaque, hwaddr offset, unsigned size)
+{
+    AVRIntcState *s = opaque;
+
+    return s->mcucr;
+}
+
+static void avr_intc_write(void *opaque, hwaddr offset, uint64_t val64,
+                           unsigned size)
+{
+    AVRIntcState *s = opaque;
+    uint8_t value = val64;
+
+    if (!s->ivce) {
+        value = (value & ~MCUCR_IVSEL) | (s->mcucr & MCUCR_IVSEL);
+    }
+    s->ivce = (value & MCUCR_IVCE) != 0;
+    s->mcucr = value & ~MCUCR_IVCE;
+}
+
+static const MemoryRegionOps avr_intc_ops = {
+    .read = avr_intc_read,
+    .write = avr_intc_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .impl = { .min_access_size = 1, .max_access_size = 1 },
+};
+
+static const VMStateDescription vmstate_avr_intc = {
+    .name = TYPE_AVR_INTC,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT64(level, AVRIntcState),
+        VMSTATE_UINT8(mcucr, AVRIntcState),
+        VMSTATE_BOOL(ivce, AVRIntcState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property avr_intc_properties[] = {
+    DEFINE_PROP_UINT32("boot-base", AVRIntcState, boot_base, 0),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void avr_intc_init(Object *obj)
+{
+    AVRIntcState *s = AVR_INTC(obj);
+    DeviceState *dev = DEVICE(obj);
+
+    qdev_init_gpio_in(dev, avr_intc_set_irq, AVR_INTC_IRQS);
+    qdev_init_gpio_out(dev, s->irq, AVR_INTC_IRQS);
+    qdev_init_gpio_out_named(dev, s->ack, "ack", AVR_INTC_IRQS);
+
+    memory_region_init_io(&s->iomem, obj, &avr_intc_ops, s,
+                          TYPE_AVR_INTC, 1);
+    sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->iomem);
+}
+
+static void avr_intc_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+
+    dc->reset = avr_intc_reset;
+    dc->props = avr_intc_properties;
+    dc->vmsd = &vmstate_avr_intc;
+}
+
+static const TypeInfo avr_intc_info = {
+    .name          = TYPE_AVR_INTC,
+    .parent        = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(AVRIntcState),
+    .instance_init = avr_intc_init,
+    .class_init    = avr_intc_class_init,
+};
+
+static void avr_intc_register_types(void)
+{
+    type_register_static(&avr_intc_info);
+}
+
+type_init(avr_intc_register_types)
@@ -0,0 +1,289 @@
+/*
+ * AVR batch runner & test exit
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+/*
+ *  A test firmware ends by writing its exit code to EXIT. Without a list
+ *  QEMU exits with that status, like isa-debug-exit. The CPU is halted
+ *  right after the write and pending interrupts do not wake it up again,
+ *  the exit is a shutdown which runs the exit notifiers like any other.
+ *
+ *  With -global avr-batch.list=FILE one QEMU process runs the firmware
+ *  images listed in FILE, one per line, one after the other. Every system
+ *  reset loads the next image into the flash, clears the SRAM and erases
+ *  the EEPROM, the exit of an image or its timeout requests the reset.
+ *  This saves the start of a QEMU process for every image. A line per image
+ *  with its exit code and what it sent on the USART, escaped like a C
+ *  string and cut off after AVR_BATCH_OUTPUT_MAX bytes, is reported like
+ *  errors are, on the monitor or on stderr. QEMU exits with status 1 if an
+ *  image failed, with 0 otherwise.
+ *
+ *  The images are written to the flash and the EEPROM is erased, a backing
+ *  file of either would be overwritten by every image and is refused.
+ *
+ *  One process runs one machine, several lists may run in parallel
+ *  processes. -no-reboot turns the resets into shutdowns, it stops the
+ *  batch after the first image. -bios would be loaded over every image.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "hw/misc/avr_batch.h"
+#include "hw/misc/avr_flash.h"
+#include "qemu/error-report.h"
+#include "qemu/timer.h"
+#include "sysemu/sysemu.h"
+
+/* the CPU runs nothing more until the reset or the exit */
+static void avr_batch_halt(AVRBatchState *s)
+{
+    CPUState *cs = CPU(s->cpu);
+
+    s->cpu->env.exited = true;
+    cs->halted = 1;
+    cpu_exit(cs);
+}
+
+/* prints the result of the running image */
+static void avr_batch_report(AVRBatchState *s, bool passed, const char *result)
+{
+    int64_t ms = (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - s->start_ns)
+                 / SCALE_MS;
+    gchar *output;
+
+    if (s->current < 0) {
+        return;
+    }
+    timer_del(s->timer);
+    output = g_strescape(s->output->str, NULL);
+    error_printf("batch: %s: %s, %" PRId64 " ms, output \"%s%s\"\n",
+                 s->images[s->current], result, ms, output,
+                 s->output_cut ? "..." : "");
+    g_free(output);
+    if (passed) {
+        s->passed++;
+    } else {
+        s->failed++;
+    }
+    s->current = -1;
+}
+
+/* ends the running image, the reset loads the next */
+static void avr_batch_end(AVRBatchState *s, bool passed, const char *result)
+{
+    if (s->current >= 0) {
+        avr_batch_report(s, passed, result);
+        qemu_system_reset_request(SHUTDOWN_CAUSE_GUEST_RESET);
+    }
+}
+
+/* a frame the running image sent on the USART */
+static void avr_batch_output(void *opaque, uint8_t data)
+{
+    AVRBatchState *s = opaque;
+
+    if (s->current < 0) {
+        return;
+    }
+    if (s->output->len == AVR_BATCH_OUTPUT_MAX) {
+        s->output_cut = true;
+        return;
+    }
+    g_string_append_c(s->output, data);
+}
+
+static void avr_batch_timeout(void *opaque)
+{
+    avr_batch_end(opaque, false, "timeout");
+}
+
+/* loads image n, false if it cannot be loaded */
+static bool avr_batch_load(AVRBatchState *s, int n)
+{
+    AVRFlashState *flash = AVR_FLASH(s->cpu->env.flash);
+    GError *err = NULL;
+    gchar *data;
+    gsize len;
+
+    if (!g_file_get_contents(s->images[n], &data, &len, &err)) {
+        error_printf("batch: %s: %s\n", s->images[n], err->message);
+        g_error_free(err);
+        return false;
+    }
+    if (len > flash->size) {
+        error_printf("batch: %s: larger than the flash\n", s->images[n]);
+        g_free(data);
+        return false;
+    }
+
+    avr_flash_load(flash, (uint8_t *)data, len);
+    g_free(data);
+    return true;
+}
+
+static void avr_batch_reset(void *opaque)
+{
+    AVRBatchState *s = opaque;
+
+    /* an image which did not end was reset, e.g. from the monitor */
+    avr_batch_report(s, false, "reset");
+
+    while (s->next < s->count && !avr_batch_load(s, s->next)) {
+        s->failed++;
+        s->next++;
+    }
+    if (s->next == s->count) {
+        error_printf("batch: %d images, %d passed, %d failed\n",
+                     s->count, s->passed, s->failed);
+        avr_batch_halt(s);
+        qemu_system_exit_request(s->failed ? 1 : 0);
+        return;
+    }
+
+    memset(memory_region_get_ram_ptr(s->ram), 0, memory_region_size(s->ram));
+    if (s->eeprom) {
+        memset(s->eeprom->data, 0xff, s->eeprom->size);
+        avr_nvm_set_dirty(s->eeprom, 0, s->eeprom->size);
+    }
+
+    s->current = s->next++;
+    s->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    g_string_truncate(s->output, 0);
+    s->output_cut = false;
+    if (s->timeout_ms) {
+        timer_mod(s->timer, qemu_clock_get_ms(QEMU_CLOCK_VIRTUAL)
+                            + s->timeout_ms);
+    }
+}
+
+static uint64_t avr_batch_read(void *opaque, hwaddr offset, unsigned size)
+{
+    return 0;
+}
+
+static void avr_batch_write(void *opaque, hwaddr offset, uint64_t val64,
+                            unsigned size)
+{
+    AVRBatchState *s = opaque;
+    char *result;
+
+    avr_batch_halt(s);
+    if (s->images == NULL) {
+        qemu_system_exit_request(val64);
+        return;
+    }
+
+    result = g_strdup_printf("exit %d", (int)val64);
+    avr_batch_end(s, val64 == 0, result);
+    g_free(result);
+}
+
+static const MemoryRegionOps avr_batch_ops = {
+    .read = avr_batch_read,
+    .write = avr_batch_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .impl = { .min_access_size = 1, .max_access_size = 1 },
+};
+
+/*
+ *  the CPU, whose flash is loaded, the memories cleared between images and
+ *  the USART whose output is reported, before the batch runner is realized
+ */
+void avr_batch_attach(AVRBatchState *s, AVRCPU *cpu, MemoryRegion *ram,
+                      AVRNvm *eeprom, AVRUsartState *usart)
+{
+    s->cpu = cpu;
+    s->ram = ram;
+    s->eeprom = eeprom;
+    s->usart = usart;
+}
+
+static Property avr_batch_properties[] = {
+    DEFINE_PROP_STRING("list", AVRBatchState, list),
+    DEFINE_PROP_UINT32("timeout", AVRBatchState, timeout_ms, 10000),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void avr_batch_init(Object *obj)
+{
+    AVRBatchState *s = AVR_BATCH(obj);
+
+    memory_region_init_io(&s->iomem, obj, &avr_batch_ops, s,
+                          TYPE_AVR_BATCH, 1);
+    sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->iomem);
+}
+
+static void avr_batch_realize(DeviceState *dev, Error **errp)
+{
+    AVRBatchState *s = AVR_BATCH(dev);
+    GError *err = NULL;
+    gchar *contents;
+    int i;
+
+    s->current = -1;
+    if (s->list == NULL) {
+        return;
+    }
+    if (AVR_FLASH(s->cpu->env.flash)->nvm.fd >= 0
+            || (s->eeprom && s->eeprom->fd >= 0)) {
+        error_setg(errp, "the images would overwrite the backing files of "
+                   "the flash & EEPROM, avr-batch.list takes none");
+        return;
+    }
+
+    if (!g_file_get_contents(s->list, &contents, NULL, &err)) {
+        error_setg(errp, "cannot read %s: %s", s->list, err->message);
+        g_error_free(err);
+        return;
+    }
+    s->images = g_strsplit(contents, "\n", -1);
+    g_free(contents);
+
+    /* without empty lines & comments */
+    for (i = 0; s->images[i]; i++) {
+        g_strstrip(s->images[i]);
+        if (s->images[i][0] == '\0' || s->images[i][0] == '#') {
+            g_free(s->images[i]);
+        } else {
+            s->images[s->count++] = s->images[i];
+        }
+    }
+    s->images[s->count] = NULL;
+    if (s->count == 0) {
+        error_setg(errp, "no firmware images in %s", s->list);
+        return;
+    }
+
+    s->output = g_string_new(NULL);
+    if (s->usart) {
+        avr_usart_set_tap(s->usart, avr_batch_output, s);
+    }
+    s->timer = timer_new_ms(QEMU_CLOCK_VIRTUAL, avr_batch_timeout, s);
+    qemu_register_reset(avr_batch_reset, s);
+}
+
+static void avr_batch_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+
+    dc->realize = avr_batch_realize;
+    dc->props = avr_batch_properties;
+}
+
+static const TypeInfo avr_batch_info = {
+    .name          = TYPE_AVR_BATCH,
+    .parent        = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(AVRBatchState),
+    .instance_init = avr_batch_init,
+    .class_init    = avr_batch_class_init,
+};
+
+static void avr_batch_register_types(void)
+{
+    type_register_static(&avr_batch_info);
+}
+
+type_init(avr_batch_register_types)
@@ -0,0 +1,235 @@
+/*
+ * AVR flash & self-programming controller
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+/*
+ *  The CPU cannot store to the flash, SPM changes it through this
+ *  controller as selected by SPMCSR: fill a word of the page buffer, erase
+ *  a page or write the page buffer into a page. Erase & write complete at
+ *  once and invalidate the TBs of the changed page, the code pages are not
+ *  constant. Lock & fuse bits are not modelled, neither is the 4 cycles
+ *  limit after writing SPMCSR.
+ *
+ *  The contents may be kept in a file, see avr_nvm.c
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "hw/misc/avr_flash.h"
+#include "qemu/log.h"
+#include "cpu.h"
+#include "tcg.h"
+#include "translate-all.h"
+
+static void avr_flash_update_irq(AVRFlashState *s)
+{
+    /* SPM is never busy */
+    qemu_set_irq(s->irq, (s->spmcsr & SPMCSR_SPMIE) != 0);
+}
+
+/* the page at addr was changed by an erase or a write */
+static void avr_flash_changed(AVRFlashState *s, uint32_t addr)
+{
+    ram_addr_t ram = memory_region_get_ram_addr(&s->flash) + addr;
+    uint32_t i;
+
+    avr_nvm_set_dirty(&s->nvm, addr, s->page_size);
+
+    tb_lock();
+    for (i = 0; i < s->page_size; i += TARGET_PAGE_SIZE) {
+        tb_invalidate_phys_page_range(ram + i,
+                                      ram + MIN(i + TARGET_PAGE_SIZE,
+                                                s->page_size), 0);
+    }
+    tb_unlock();
+
+    s->spmcsr |= SPMCSR_RWWSB;
+}
+
+/*
+ *  replaces the contents with len bytes of data, the rest is erased. Only
+ *  the pages which differ are changed, e.g. for the next firmware image
+ */
+void avr_flash_load(AVRFlashState *s, const uint8_t *data, uint32_t len)
+{
+    uint8_t page[AVR_FLASH_PAGE_MAX];
+    uint32_t addr;
+
+    for (addr = 0; addr < s->size; addr += s->page_size) {
+        uint32_t n = addr < len ? MIN(s->page_size, len - addr) : 0;
+
+        if (n) {
+            memcpy(page, data + addr, n);
+        }
+        memset(page + n, 0xff, s->page_size - n);
+        if (memcmp(page, &s->nvm.data[addr], s->page_size)) {
+            memcpy(&s->nvm.data[addr], page, s->page_size);
+            avr_flash_changed(s, addr);
+        }
+    }
+    /* nothing is being programmed */
+    s->spmcsr &= ~SPMCSR_RWWSB;
+}
+
+void avr_flash_spm(void *opaque, uint32_t addr, uint16_t data)
+{
+    AVRFlashState *s = opaque;
+    uint32_t offset = addr & (s->page_size - 1);
+    uint8_t *page;
+    uint32_t i;
+
+    if (addr >= s->size) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Bad address 0x%x\n", __func__, addr);
+        return;
+    }
+    addr -= offset;
+    page = &s->nvm.data[addr];
+
+    switch (s->spmcsr & SPMCSR_OPS) {
+    case SPMCSR_SELFPRGEN:
+        offset &= ~1;
+        s->buffer[offset] = data;
+        s->buffer[offset + 1] = data >> 8;
+        break;
+    case SPMCSR_PGERS | SPMCSR_SELFPRGEN:
+        memset(page, 0xff, s->page_size);
+        avr_flash_changed(s, addr);
+        break;
+    case SPMCSR_PGWRT | SPMCSR_SELFPRGEN:
+        for (i = 0; i < s->page_size; i++) {
+            page[i] &= s->buffer[i]; /* programming clears bits only */
+        }
+        memset(s->buffer, 0xff, sizeof(s->buffer));
+        avr_flash_changed(s, addr);
+        break;
+    case SPMCSR_RWWSRE | SPMCSR_SELFPRGEN:
+        s->spmcsr &= ~SPMCSR_RWWSB;
+        break;
+    case 0:
+        /* SPM without SELFPRGEN does nothing */
+        break;
+    default:
+        qemu_log_mask(LOG_UNIMP, "%s: SPMCSR 0x%02x not implemented\n",
+                      __func__, s->spmcsr);
+    }
+
+    s->spmcsr &= ~SPMCSR_OPS;
+    avr_flash_update_irq(s);
+}
+
+static void avr_flash_reset(DeviceState *dev)
+{
+    AVRFlashState *s = AVR_FLASH(dev);
+
+    s->spmcsr = 0;
+    memset(s->buffer, 0xff, sizeof(s->buffer));
+    avr_flash_update_irq(s);
+}
+
+static uint64_t avr_flash_read(void *opaque, hwaddr offset, unsigned size)
+{
+    AVRFlashState *s = opaque;
+
+    return s->spmcsr;
+}
+
+static void avr_flash_write(void *opaque, hwaddr offset, uint64_t val64,
+                            unsigned size)
+{
+    AVRFlashState *s = opaque;
+
+    s->spmcsr = (s->spmcsr & SPMCSR_RWWSB) | (val64 & ~SPMCSR_RWWSB);
+    avr_flash_update_irq(s);
+}
+
+static const MemoryRegionOps avr_flash_ops = {
+    .read = avr_flash_read,
+    .write = avr_flash_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .impl = { .min_access_size = 1, .max_access_size = 1 },
+};
+
+static const VMStateDescription vmstate_avr_flash = {
+    .name = TYPE_AVR_FLASH,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT8(spmcsr, AVRFlashState),
+        VMSTATE_UINT8_ARRAY(buffer, AVRFlashState, AVR_FLASH_PAGE_MAX),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property avr_flash_properties[] = {
+    DEFINE_PROP_UINT32("size", AVRFlashState, size, 0x8000),
+    DEFINE_PROP_UINT32("page-size", AVRFlashState, page_size, 128),
+    DEFINE_PROP_STRING("filename", AVRFlashState, filename),
+    DEFINE_PROP_STRING("name", AVRFlashState, name),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void avr_flash_init(Object *obj)
+{
+    AVRFlashState *s = AVR_FLASH(obj);
+
+    sysbus_init_irq(SYS_BUS_DEVICE(obj), &s->irq);
+
+    memory_region_init_io(&s->iomem, obj, &avr_flash_ops, s,
+                          TYPE_AVR_FLASH, 1);
+    sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->iomem);
+}
+
+static void avr_flash_realize(DeviceState *dev, Error **errp)
+{
+    AVRFlashState *s = AVR_FLASH(dev);
+    Error *err = NULL;
+
+    if (!is_power_of_2(s->page_size) || s->page_size > AVR_FLASH_PAGE_MAX
+            || s->size % s->page_size) {
+        error_setg(errp, "invalid page size %u", s->page_size);
+        return;
+    }
+
+    avr_nvm_init(&s->nvm, s->filename, s->size, s->page_size, &err);
+    if (err) {
+        error_propagate(errp, err);
+        return;
+    }
+
+    memory_region_init_ram_ptr(&s->flash, OBJECT(dev),
+                               s->name ? s->name : "avr.flash", s->size,
+                               s->nvm.data);
+    memory_region_set_readonly(&s->flash, true);
+    s->nvm.mr = &s->flash;
+    vmstate_register_ram(&s->flash, dev);
+    sysbus_init_mmio(SYS_BUS_DEVICE(dev), &s->flash);
+}
+
+static void avr_flash_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+
+    dc->reset = avr_flash_reset;
+    dc->realize = avr_flash_realize;
+    dc->props = avr_flash_properties;
+    dc->vmsd = &vmstate_avr_flash;
+}
+
+static const TypeInfo avr_flash_info = {
+    .name          = TYPE_AVR_FLASH,
+    .parent        = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(AVRFlashState),
+    .instance_init = avr_flash_init,
+    .class_init    = avr_flash_class_init,
+};
+
+static void avr_flash_register_types(void)
+{
+    type_register_static(&avr_flash_info);
+}
+
+type_init(avr_flash_register_types)
@@ -0,0 +1,224 @@
+/*
+ * AVR inter-chip link
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+/*
+ *  A byte link between two MCUs of a board, e.g. a UART line. Each
+ *  direction is a single producer single consumer queue, the CPU of the
+ *  sender writes its head and the CPU of the receiver its tail. With MTTCG
+ *  the CPUs run in threads of their own, DR & SR are accessed without the
+ *  BQL.
+ *
+ *  The MCUs run in quanta, see target/avr/quantum.c: no MCU starts quantum
+ *  N + 1 before all have ended quantum N. A byte sent in quantum N is
+ *  received at the start of quantum N + 1, RX complete is raised when the
+ *  quantum starts. So a reply can come back at the earliest two quanta
+ *  after the request was sent, however the threads are scheduled. A byte
+ *  written while the queue is full is lost, SR tells if there is room.
+ */
+
+#include "qemu/osdep.h"
+#include "hw/misc/avr_link.h"
+#include "qemu/log.h"
+#include "qemu/main-loop.h"
+
+/* the byte at the tail of q if it is received in quantum now */
+static bool avr_link_pending(AVRLinkQueue *q, uint32_t now)
+{
+    uint32_t tail = q->tail;
+
+    if (atomic_read(&q->head) == tail) {
+        return false;
+    }
+    /* the slot is read after head, see avr_link_send */
+    smp_rmb();
+    return (int32_t)(now - q->slot[tail % AVR_LINK_QUEUE].quantum) >= 0;
+}
+
+static bool avr_link_rx_level(AVRLinkState *s)
+{
+    return s->rx && s->rxcie
+           && avr_link_pending(s->rx, avr_quantum_now(s->quantum));
+}
+
+/* changes the irq, the BQL is taken only if its level changes */
+static void avr_link_update_irq(AVRLinkState *s)
+{
+    bool locked;
+
+    if (avr_link_rx_level(s) == atomic_read(&s->level)) {
+        return;
+    }
+
+    locked = qemu_mutex_iothread_locked();
+    if (!locked) {
+        qemu_mutex_lock_iothread();
+    }
+    s->level = avr_link_rx_level(s);
+    qemu_set_irq(s->irq, s->level);
+    if (!locked) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
+/* a quantum starts, the bytes sent in the one before are received */
+static void avr_link_quantum(Notifier *n, void *data)
+{
+    AVRLinkState *s = container_of(n, AVRLinkState, quantum_notifier);
+
+    avr_link_update_irq(s);
+}
+
+static void avr_link_send(AVRLinkState *s, uint8_t data)
+{
+    AVRLinkQueue *q = s->tx;
+    uint32_t head;
+
+    if (q == NULL) {
+        return;
+    }
+    head = q->head;
+    if (head - atomic_read(&q->tail) == AVR_LINK_QUEUE) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: queue full\n", __func__);
+        return;
+    }
+
+    q->slot[head % AVR_LINK_QUEUE].data = data;
+    q->slot[head % AVR_LINK_QUEUE].quantum = avr_quantum_now(s->quantum) + 1;
+    /* the receiver reads the slot after head */
+    smp_wmb();
+    atomic_set(&q->head, head + 1);
+}
+
+static uint8_t avr_link_receive(AVRLinkState *s)
+{
+    AVRLinkQueue *q = s->rx;
+    uint8_t data;
+
+    if (q == NULL || !avr_link_pending(q, avr_quantum_now(s->quantum))) {
+        return 0;
+    }
+    data = q->slot[q->tail % AVR_LINK_QUEUE].data;
+    /* the sender may reuse the slot once tail moves on */
+    smp_mb();
+    atomic_set(&q->tail, q->tail + 1);
+
+    avr_link_update_irq(s);
+    return data;
+}
+
+static uint64_t avr_link_read(void *opaque, hwaddr offset, unsigned size)
+{
+    AVRLinkState *s = opaque;
+    uint8_t sr;
+
+    switch (offset) {
+    case LINK_SR:
+        sr = s->rxcie;
+        if (s->rx && avr_link_pending(s->rx, avr_quantum_now(s->quantum))) {
+            sr |= LINK_SR_RXC;
+        }
+        if (s->tx && s->tx->head - atomic_read(&s->tx->tail)
+                     < AVR_LINK_QUEUE) {
+            sr |= LINK_SR_TXR;
+        }
+        return sr;
+    case LINK_DR:
+        return avr_link_receive(s);
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: Bad offset 0x%" HWADDR_PRIx "\n",
+                      __func__, offset);
+        return 0;
+    }
+}
+
+static void avr_link_write(void *opaque, hwaddr offset, uint64_t val64,
+                           unsigned size)
+{
+    AVRLinkState *s = opaque;
+
+    switch (offset) {
+    case LINK_SR:
+        atomic_set(&s->rxcie, val64 & LINK_SR_RXCIE);
+        avr_link_update_irq(s);
+        break;
+    case LINK_DR:
+        avr_link_send(s, val64);
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: Bad offset 0x%" HWADDR_PRIx "\n",
+                      __func__, offset);
+    }
+}
+
+static const MemoryRegionOps avr_link_ops = {
+    .read = avr_link_read,
+    .write = avr_link_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .impl = { .min_access_size = 1, .max_access_size = 1 },
+};
+
+static void avr_link_attach(AVRLinkState *s, AVRQuantum *quantum)
+{
+    s->quantum = quantum;
+    s->quantum_notifier.notify = avr_link_quantum;
+    avr_quantum_add_notifier(quantum, &s->quantum_notifier);
+}
+
+/* connects a and b in both directions, their MCUs run in quantum */
+void avr_link_connect(AVRLinkState *a, AVRLinkState *b, AVRQuantum *quantum)
+{
+    a->tx = b->rx = g_new0(AVRLinkQueue, 1);
+    b->tx = a->rx = g_new0(AVRLinkQueue, 1);
+    avr_link_attach(a, quantum);
+    avr_link_attach(b, quantum);
+}
+
+/* the CPUs are stopped, the bytes in flight to this end are dropped */
+static void avr_link_reset(DeviceState *dev)
+{
+    AVRLinkState *s = AVR_LINK(dev);
+
+    if (s->rx) {
+        s->rx->tail = s->rx->head;
+    }
+    s->rxcie = 0;
+    avr_link_update_irq(s);
+}
+
+static void avr_link_init(Object *obj)
+{
+    AVRLinkState *s = AVR_LINK(obj);
+
+    sysbus_init_irq(SYS_BUS_DEVICE(obj), &s->irq);
+
+    memory_region_init_io(&s->iomem, obj, &avr_link_ops, s,
+                          TYPE_AVR_LINK, LINK_SIZE);
+    memory_region_clear_global_locking(&s->iomem);
+    sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->iomem);
+}
+
+static void avr_link_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+
+    dc->reset = avr_link_reset;
+}
+
+static const TypeInfo avr_link_info = {
+    .name          = TYPE_AVR_LINK,
+    .parent        = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(AVRLinkState),
+    .instance_init = avr_link_init,
+    .class_init    = avr_link_class_init,
+};
+
+static void avr_link_register_types(void)
+{
+    type_register_static(&avr_link_info);
+}
+
+type_init(avr_link_register_types)
@@ -0,0 +1,310 @@
+/*
+ * AVR in-memory snapshots
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+/*
+ *  A fuzzing harness runs the firmware up to the point where it takes its
+ *  input, saves the machine there and restores it after every run. The
+ *  firmware (or the harness through the gdbstub) does this by writing
+ *  SNAPCTL, no file or migration stream is involved.
+ *
+ *  A snapshot holds the state of the CPU and of every device with a
+ *  vmstate in a buffer which is allocated by the first save, a copy of the
+ *  SRAM and of the EEPROM. Writes to the SRAM are tracked by dirty logging
+ *  and those to the EEPROM by the NVM, a restore copies back only the
+ *  256 byte pages written since the save. The flash is not rolled back.
+ *
+ *  The CPU state is consistent only between TBs, the request is queued as
+ *  work for the CPU. The board makes the write to SNAPCTL the last
+ *  instruction of its TB (avr_cpu_io_stop), the work is done right after
+ *  it, before the next instruction.
+ */
+
+#include "qemu/osdep.h"
+#include "hw/misc/avr_snapshot.h"
+#include "qemu/error-report.h"
+#include "qemu/iov.h"
+#include "qemu/log.h"
+#include "qemu/timer.h"
+#include "migration/qemu-file.h"
+#include "monitor/monitor.h"
+#include "monitor/hmp-target.h"
+
+static ssize_t avr_snapshot_writev(void *opaque, struct iovec *iov,
+                                   int iovcnt, int64_t pos)
+{
+    AVRSnapshotState *s = opaque;
+    size_t len = iov_size(iov, iovcnt);
+
+    if (pos + len > s->state_size) {
+        s->state_size = MAX(s->state_size * 2, pos + len);
+        s->state = g_realloc(s->state, s->state_size);
+    }
+    iov_to_buf(iov, iovcnt, 0, s->state + pos, len);
+    s->state_len = pos + len;
+    return len;
+}
+
+static ssize_t avr_snapshot_get_buffer(void *opaque, uint8_t *buf,
+                                       int64_t pos, size_t size)
+{
+    AVRSnapshotState *s = opaque;
+    size_t len;
+
+    if (pos >= s->state_len) {
+        return 0;
+    }
+    len = MIN(size, s->state_len - pos);
+    memcpy(buf, s->state + pos, len);
+    return len;
+}
+
+static int avr_snapshot_close(void *opaque)
+{
+    return 0;
+}
+
+static const QEMUFileOps avr_snapshot_write_ops = {
+    .writev_buffer = avr_snapshot_writev,
+    .close = avr_snapshot_close,
+};
+
+static const QEMUFileOps avr_snapshot_read_ops = {
+    .get_buffer = avr_snapshot_get_buffer,
+    .close = avr_snapshot_close,
+};
+
+/* collects the devices with a vmstate, the CPU is saved on its own */
+static int avr_snapshot_find(Object *obj, void *opaque)
+{
+    AVRSnapshotState *s = opaque;
+    DeviceState *dev = (DeviceState *)object_dynamic_cast(obj, TYPE_DEVICE);
+
+    if (dev && dev != DEVICE(s) && DEVICE_GET_CLASS(dev)->vmsd
+            && !object_dynamic_cast(obj, TYPE_CPU)) {
+        g_ptr_array_add(s->devices, dev);
+    }
+    return 0;
+}
+
+static void avr_snapshot_put(AVRSnapshotState *s, QEMUFile *f)
+{
+    CPUState *cs = CPU(s->cpu);
+    int i;
+
+    vmstate_save_state(f, &vmstate_cpu_common, cs, NULL);
+    vmstate_save_state(f, CPU_GET_CLASS(cs)->vmsd, s->cpu, NULL);
+    for (i = 0; i < s->devices->len; i++) {
+        DeviceState *dev = g_ptr_array_index(s->devices, i);
+
+        vmstate_save_state(f, DEVICE_GET_CLASS(dev)->vmsd, dev, NULL);
+    }
+}
+
+static int avr_snapshot_get(AVRSnapshotState *s, QEMUFile *f)
+{
+    CPUState *cs = CPU(s->cpu);
+    const VMStateDescription *vmsd;
+    int ret;
+    int i;
+
+    ret = vmstate_load_state(f, &vmstate_cpu_common, cs,
+                             vmstate_cpu_common.version_id);
+    if (ret < 0) {
+        return ret;
+    }
+    vmsd = CPU_GET_CLASS(cs)->vmsd;
+    ret = vmstate_load_state(f, vmsd, s->cpu, vmsd->version_id);
+    for (i = 0; ret == 0 && i < s->devices->len; i++) {
+        DeviceState *dev = g_ptr_array_index(s->devices, i);
+
+        vmsd = DEVICE_GET_CLASS(dev)->vmsd;
+        ret = vmstate_load_state(f, vmsd, dev, vmsd->version_id);
+    }
+    return ret;
+}
+
+static void avr_snapshot_save(CPUState *cs, run_on_cpu_data data)
+{
+    AVRSnapshotState *s = data.host_ptr;
+    uint64_t size = memory_region_size(s->ram);
+    QEMUFile *f;
+    int i;
+
+    if (!s->devices) {
+        s->devices = g_ptr_array_new();
+        object_child_foreach_recursive(qdev_get_machine(), avr_snapshot_find,
+                                       s);
+    }
+
+    f = qemu_fopen_ops(s, &avr_snapshot_write_ops);
+    avr_snapshot_put(s, f);
+    qemu_fclose(f);
+
+    if (!s->ram_copy) {
+        s->ram_copy = g_malloc(size);
+        memory_region_set_log(s->ram, true, DIRTY_MEMORY_VGA);
+    }
+    memcpy(s->ram_copy, memory_region_get_ram_ptr(s->ram), size);
+    memory_region_reset_dirty(s->ram, 0, size, DIRTY_MEMORY_VGA);
+
+    for (i = 0; i < s->nvms; i++) {
+        avr_nvm_snapshot(s->nvm[i]);
+    }
+
+    s->valid = true;
+    s->saves++;
+}
+
+static void avr_snapshot_restore(CPUState *cs, run_on_cpu_data data)
+{
+    AVRSnapshotState *s = data.host_ptr;
+    int64_t start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    uint64_t size = memory_region_size(s->ram);
+    uint8_t *ram = memory_region_get_ram_ptr(s->ram);
+    DirtyBitmapSnapshot *dirty;
+    QEMUFile *f;
+    uint64_t addr;
+    int ret;
+    int i;
+
+    if (!s->valid) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: no snapshot\n", __func__);
+        return;
+    }
+
+    f = qemu_fopen_ops(s, &avr_snapshot_read_ops);
+    ret = avr_snapshot_get(s, f);
+    qemu_fclose(f);
+    if (ret < 0) {
+        error_report("avr-snapshot: cannot restore the state: %s",
+                     strerror(-ret));
+    }
+
+    dirty = memory_region_snapshot_and_clear_dirty(s->ram, 0, size,
+                                                   DIRTY_MEMORY_VGA);
+    for (addr = 0; addr < size; addr += TARGET_PAGE_SIZE) {
+        if (memory_region_snapshot_get_dirty(s->ram, dirty, addr,
+                                             TARGET_PAGE_SIZE)) {
+            memcpy(ram + addr, s->ram_copy + addr, TARGET_PAGE_SIZE);
+            s->ram_pages++;
+        }
+    }
+    g_free(dirty);
+
+    for (i = 0; i < s->nvms; i++) {
+        s->nvm_pages += avr_nvm_restore(s->nvm[i]);
+    }
+
+    /* every run starts without a previous TB for the edge coverage */
+    s->cpu->env.cov_prev = 0;
+
+    s->restores++;
+    s->restore_ns += qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
+}
+
+static uint64_t avr_snapshot_read(void *opaque, hwaddr offset, unsigned size)
+{
+    AVRSnapshotState *s = opaque;
+
+    return s->valid ? SNAPCTL_VALID : 0;
+}
+
+static void avr_snapshot_write(void *opaque, hwaddr offset, uint64_t val64,
+                               unsigned size)
+{
+    AVRSnapshotState *s = opaque;
+
+    if (!s->cpu) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: not attached\n", __func__);
+        return;
+    }
+
+    switch (val64) {
+    case SNAPCTL_SAVE:
+        async_run_on_cpu(CPU(s->cpu), avr_snapshot_save,
+                         RUN_ON_CPU_HOST_PTR(s));
+        break;
+    case SNAPCTL_RESTORE:
+        async_run_on_cpu(CPU(s->cpu), avr_snapshot_restore,
+                         RUN_ON_CPU_HOST_PTR(s));
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: Bad value 0x%" PRIx64 "\n",
+                      __func__, val64);
+    }
+}
+
+static const MemoryRegionOps avr_snapshot_ops = {
+    .read = avr_snapshot_read,
+    .write = avr_snapshot_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .impl = { .min_access_size = 1, .max_access_size = 1 },
+};
+
+/* the CPU and the RAM of the board, ram must be a RAM region */
+void avr_snapshot_attach(AVRSnapshotState *s, AVRCPU *cpu, MemoryRegion *ram)
+{
+    s->cpu = cpu;
+    s->ram = ram;
+}
+
+/* EEPROM or other NVM which is rolled back by a restore */
+void avr_snapshot_add_nvm(AVRSnapshotState *s, AVRNvm *nvm)
+{
+    assert(s->nvms < AVR_SNAPSHOT_NVMS);
+    s->nvm[s->nvms++] = nvm;
+}
+
+void hmp_info_avr_snapshot(Monitor *mon, const QDict *qdict)
+{
+    Object *obj = object_resolve_path_type("", TYPE_AVR_SNAPSHOT, NULL);
+    AVRSnapshotState *s;
+
+    if (obj == NULL) {
+        monitor_printf(mon, "no snapshot device\n");
+        return;
+    }
+    s = AVR_SNAPSHOT(obj);
+
+    if (!s->valid) {
+        monitor_printf(mon, "no snapshot\n");
+        return;
+    }
+    monitor_printf(mon, "state: %zu bytes\n", s->state_len);
+    monitor_printf(mon, "saves: %" PRIu64 "\n", s->saves);
+    monitor_printf(mon, "restores: %" PRIu64 "\n", s->restores);
+    if (s->restores) {
+        monitor_printf(mon, "per restore: %" PRIu64 " ns, "
+                       "%.1f SRAM pages, %.1f NVM pages\n",
+                       s->restore_ns / s->restores,
+                       (double)s->ram_pages / s->restores,
+                       (double)s->nvm_pages / s->restores);
+    }
+}
+
+static void avr_snapshot_init(Object *obj)
+{
+    AVRSnapshotState *s = AVR_SNAPSHOT(obj);
+
+    memory_region_init_io(&s->iomem, obj, &avr_snapshot_ops, s,
+                          TYPE_AVR_SNAPSHOT, 1);
+    sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->iomem);
+}
+
+static const TypeInfo avr_snapshot_info = {
+    .name          = TYPE_AVR_SNAPSHOT,
+    .parent        = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(AVRSnapshotState),
+    .instance_init = avr_snapshot_init,
+};
+
+static void avr_snapshot_register_types(void)
+{
+    type_register_static(&avr_snapshot_info);
+}
+
+type_init(avr_snapshot_register_types)
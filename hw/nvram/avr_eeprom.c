@@ -0,0 +1,230 @@
+/*
+ * AVR EEPROM
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+/*
+ *  Reads & writes complete at once, EEPE is never seen set and EE_READY
+ *  is raised whenever EERIE is set. A write needs EEMPE, which is cleared
+ *  by the write of EEPE, by a write of EECR without it and, with -icount,
+ *  4 cycles after it was set. Without -icount the cycles are not counted.
+ *  The contents may be kept in a file, see avr_nvm.c
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "hw/nvram/avr_eeprom.h"
+#include "qemu/log.h"
+#include "qemu/timer.h"
+#include "sysemu/cpus.h"
+
+/* cycles after which EEMPE is cleared */
+#define EEMPE_CYCLES 4
+
+static void avr_eeprom_update_irq(AVREepromState *s)
+{
+    qemu_set_irq(s->irq, (s->eecr & EECR_EERIE) != 0);
+}
+
+static void avr_eeprom_program(AVREepromState *s)
+{
+    uint32_t addr = s->eear;
+    uint8_t *cell;
+
+    if (addr >= s->size) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Bad address 0x%x\n", __func__, addr);
+        return;
+    }
+    cell = &s->nvm.data[addr];
+
+    switch (s->eecr & EECR_EEPM) {
+    case EECR_EEPM_ERASE_WRITE:
+        *cell = s->eedr;
+        break;
+    case EECR_EEPM_ERASE:
+        *cell = 0xff;
+        break;
+    case EECR_EEPM_WRITE:
+        *cell &= s->eedr; /* programming clears bits only */
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Bad programming mode\n", __func__);
+        return;
+    }
+    avr_nvm_set_dirty(&s->nvm, addr, 1);
+}
+
+static void avr_eeprom_eempe_timeout(void *opaque)
+{
+    AVREepromState *s = opaque;
+
+    s->eecr &= ~EECR_EEMPE;
+}
+
+static void avr_eeprom_reset(DeviceState *dev)
+{
+    AVREepromState *s = AVR_EEPROM(dev);
+
+    timer_del(s->eempe_timer);
+    s->eecr = 0;
+    s->eedr = 0;
+    s->eear = 0;
+    avr_eeprom_update_irq(s);
+}
+
+static uint64_t avr_eeprom_read(void *opaque, hwaddr offset, unsigned size)
+{
+    AVREepromState *s = opaque;
+
+    switch (offset) {
+    case EEPROM_EECR:
+        return s->eecr;
+    case EEPROM_EEDR:
+        return s->eedr;
+    case EEPROM_EEARL:
+        return s->eear & 0xff;
+    case EEPROM_EEARH:
+        return s->eear >> 8;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Bad offset 0x%"HWADDR_PRIx"\n", __func__, offset);
+        return 0;
+    }
+}
+
+static void avr_eeprom_write(void *opaque, hwaddr offset, uint64_t val64,
+                             unsigned size)
+{
+    AVREepromState *s = opaque;
+    uint8_t value = val64;
+
+    switch (offset) {
+    case EEPROM_EECR:
+        if ((value & EECR_EEPE) && (s->eecr & EECR_EEMPE)) {
+            s->eecr = (s->eecr & ~EECR_EEPM) | (value & EECR_EEPM);
+            avr_eeprom_program(s);
+        }
+        if ((value & EECR_EERE) && s->eear < s->size) {
+            s->eedr = s->nvm.data[s->eear];
+        }
+        /* EEPE & EERE complete, EEMPE is used up by EEPE */
+        s->eecr = value & (EECR_EEPM | EECR_EERIE | EECR_EEMPE);
+        if (value & EECR_EEPE) {
+            s->eecr &= ~EECR_EEMPE;
+        }
+        if (s->eecr & EECR_EEMPE) {
+            if (use_icount) {
+                timer_mod(s->eempe_timer,
+                          qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL)
+                          + cpu_icount_to_ns(EEMPE_CYCLES));
+            }
+        } else {
+            timer_del(s->eempe_timer);
+        }
+        avr_eeprom_update_irq(s);
+        break;
+    case EEPROM_EEDR:
+        s->eedr = value;
+        break;
+    case EEPROM_EEARL:
+        s->eear = (s->eear & 0xff00) | value;
+        break;
+    case EEPROM_EEARH:
+        s->eear = (s->eear & 0x00ff) | (value << 8);
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Bad offset 0x%"HWADDR_PRIx"\n", __func__, offset);
+    }
+}
+
+static const MemoryRegionOps avr_eeprom_ops = {
+    .read = avr_eeprom_read,
+    .write = avr_eeprom_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .impl = { .min_access_size = 1, .max_access_size = 1 },
+};
+
+static const VMStateDescription vmstate_avr_eeprom = {
+    .name = TYPE_AVR_EEPROM,
+    .version_id = 2,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT8(eecr, AVREepromState),
+        VMSTATE_UINT8(eedr, AVREepromState),
+        VMSTATE_UINT16(eear, AVREepromState),
+        VMSTATE_TIMER_PTR_V(eempe_timer, AVREepromState, 2),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property avr_eeprom_properties[] = {
+    DEFINE_PROP_UINT32("size", AVREepromState, size, 0x400),
+    DEFINE_PROP_STRING("filename", AVREepromState, filename),
+    DEFINE_PROP_STRING("name", AVREepromState, name),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void avr_eeprom_init(Object *obj)
+{
+    AVREepromState *s = AVR_EEPROM(obj);
+
+    sysbus_init_irq(SYS_BUS_DEVICE(obj), &s->irq);
+
+    memory_region_init_io(&s->iomem, obj, &avr_eeprom_ops, s,
+                          TYPE_AVR_EEPROM, EEPROM_SIZE);
+    sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->iomem);
+
+    s->eempe_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                  avr_eeprom_eempe_timeout, s);
+}
+
+static void avr_eeprom_realize(DeviceState *dev, Error **errp)
+{
+    AVREepromState *s = AVR_EEPROM(dev);
+    Error *err = NULL;
+
+    /* pages of 4 bytes like the ATmega328P, syncs are per host page */
+    avr_nvm_init(&s->nvm, s->filename, s->size, 4, &err);
+    if (err) {
+        error_propagate(errp, err);
+        return;
+    }
+
+    memory_region_init_ram_ptr(&s->mem, OBJECT(dev),
+                               s->name ? s->name : "avr.eeprom", s->size,
+                               s->nvm.data);
+    memory_region_set_readonly(&s->mem, true);
+    s->nvm.mr = &s->mem;
+    vmstate_register_ram(&s->mem, dev);
+    sysbus_init_mmio(SYS_BUS_DEVICE(dev), &s->mem);
+}
+
+static void avr_eeprom_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+
+    dc->reset = avr_eeprom_reset;
+    dc->realize = avr_eeprom_realize;
+    dc->props = avr_eeprom_properties;
+    dc->vmsd = &vmstate_avr_eeprom;
+}
+
+static const TypeInfo avr_eeprom_info = {
+    .name          = TYPE_AVR_EEPROM,
+    .parent        = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(AVREepromState),
+    .instance_init = avr_eeprom_init,
+    .class_init    = avr_eeprom_class_init,
+};
+
+static void avr_eeprom_register_types(void)
+{
+    type_register_static(&avr_eeprom_info);
+}
+
+type_init(avr_eeprom_register_types)
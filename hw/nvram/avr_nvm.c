@@ -0,0 +1,196 @@
+/*
+ * AVR non-volatile memory backing
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+/*
+ *  Flash and EEPROM contents are kept in a file which is mapped shared, the
+ *  devices modify the mapping directly. Modified pages are synced to the
+ *  file a moment after the last write and when QEMU exits, so an update
+ *  survives even if the guest or QEMU is killed right after it.
+ *
+ *  Without a file the contents live in memory only. Both start erased.
+ *
+ *  A file backs one memory only. Two MCUs which share the flash mapping
+ *  would see each other's SPM writes without invalidating their TBs.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/bitmap.h"
+#include "qemu/error-report.h"
+#include "sysemu/sysemu.h"
+#include "hw/nvram/avr_nvm.h"
+
+#define AVR_NVM_ERASED 0xff
+
+/* the memories with a backing file */
+static QLIST_HEAD(, AVRNvm) avr_nvm_files =
+    QLIST_HEAD_INITIALIZER(avr_nvm_files);
+
+void avr_nvm_flush(AVRNvm *nvm)
+{
+    uint32_t pages = DIV_ROUND_UP(nvm->size, nvm->page_size);
+    uintptr_t host_page = getpagesize();
+    unsigned long page;
+
+    if (nvm->fd < 0) {
+        return;
+    }
+
+    timer_del(nvm->timer);
+    for (page = find_first_bit(nvm->dirty, pages); page < pages;
+         page = find_next_bit(nvm->dirty, pages, page + 1)) {
+        uintptr_t start = (uintptr_t)nvm->data + page * nvm->page_size;
+        uintptr_t end = start + MIN(nvm->page_size,
+                                    nvm->size - page * nvm->page_size);
+
+        start = QEMU_ALIGN_DOWN(start, host_page);
+        if (msync((void *)start, end - start, MS_SYNC) < 0) {
+            error_report("avr-nvm: cannot sync page %lu: %s",
+                         page, strerror(errno));
+        }
+    }
+    bitmap_zero(nvm->dirty, pages);
+}
+
+static void avr_nvm_timer(void *opaque)
+{
+    avr_nvm_flush(opaque);
+}
+
+static void avr_nvm_exit(Notifier *n, void *data)
+{
+    AVRNvm *nvm = container_of(n, AVRNvm, exit);
+
+    avr_nvm_flush(nvm);
+}
+
+/* for the memory region, the snapshot and the backing file */
+void avr_nvm_set_dirty(AVRNvm *nvm, uint32_t addr, uint32_t len)
+{
+    long first = addr / nvm->page_size;
+    long n = (addr + len - 1) / nvm->page_size - first + 1;
+
+    if (len == 0) {
+        return;
+    }
+    if (nvm->mr) {
+        memory_region_set_dirty(nvm->mr, addr, len);
+    }
+    if (nvm->changed) {
+        bitmap_set(nvm->changed, first, n);
+    }
+    if (nvm->fd < 0) {
+        return;
+    }
+
+    bitmap_set(nvm->dirty, first, n);
+    if (!timer_pending(nvm->timer)) {
+        timer_mod(nvm->timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME)
+                              + AVR_NVM_WRITEBACK_MS);
+    }
+}
+
+/* remembers the contents, pages written from now on are tracked */
+void avr_nvm_snapshot(AVRNvm *nvm)
+{
+    uint32_t pages = DIV_ROUND_UP(nvm->size, nvm->page_size);
+
+    if (!nvm->snapshot) {
+        nvm->snapshot = g_malloc(nvm->size);
+        nvm->changed = bitmap_new(pages);
+    }
+    memcpy(nvm->snapshot, nvm->data, nvm->size);
+    bitmap_zero(nvm->changed, pages);
+}
+
+/* copies back the pages written since the snapshot, returns their number */
+uint32_t avr_nvm_restore(AVRNvm *nvm)
+{
+    uint32_t pages = DIV_ROUND_UP(nvm->size, nvm->page_size);
+    uint32_t n = 0;
+    unsigned long page;
+
+    if (!nvm->snapshot) {
+        return 0;
+    }
+
+    for (page = find_first_bit(nvm->changed, pages); page < pages;
+         page = find_next_bit(nvm->changed, pages, page + 1)) {
+        uint32_t addr = page * nvm->page_size;
+        uint32_t len = MIN(nvm->page_size, nvm->size - addr);
+
+        memcpy(nvm->data + addr, nvm->snapshot + addr, len);
+        avr_nvm_set_dirty(nvm, addr, len);
+        n++;
+    }
+    bitmap_zero(nvm->changed, pages);
+    return n;
+}
+
+void avr_nvm_init(AVRNvm *nvm, const char *filename, uint32_t size,
+                  uint32_t page_size, Error **errp)
+{
+    struct stat st;
+    AVRNvm *other;
+    void *data;
+    int fd;
+
+    nvm->size = size;
+    nvm->page_size = page_size;
+    nvm->fd = -1;
+    nvm->mr = NULL;
+
+    if (!filename) {
+        nvm->data = g_malloc(size);
+        memset(nvm->data, AVR_NVM_ERASED, size);
+        return;
+    }
+
+    fd = qemu_open(filename, O_RDWR | O_CREAT | O_BINARY, 0644);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        error_setg_errno(errp, errno, "cannot open %s", filename);
+        goto fail;
+    }
+    QLIST_FOREACH(other, &avr_nvm_files, next) {
+        if (other->dev == st.st_dev && other->ino == st.st_ino) {
+            error_setg(errp, "%s backs another flash or EEPROM already",
+                       filename);
+            goto fail;
+        }
+    }
+    if (st.st_size < size && ftruncate(fd, size) < 0) {
+        error_setg_errno(errp, errno, "cannot resize %s", filename);
+        goto fail;
+    }
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        error_setg_errno(errp, errno, "cannot map %s", filename);
+        goto fail;
+    }
+
+    nvm->data = data;
+    nvm->fd = fd;
+    nvm->dev = st.st_dev;
+    nvm->ino = st.st_ino;
+    QLIST_INSERT_HEAD(&avr_nvm_files, nvm, next);
+    nvm->dirty = bitmap_new(DIV_ROUND_UP(size, page_size));
+    nvm->timer = timer_new_ms(QEMU_CLOCK_REALTIME, avr_nvm_timer, nvm);
+    nvm->exit.notify = avr_nvm_exit;
+    qemu_add_exit_notifier(&nvm->exit);
+
+    /* a new or short file is erased */
+    if (st.st_size < size) {
+        memset(nvm->data + st.st_size, AVR_NVM_ERASED, size - st.st_size);
+        avr_nvm_set_dirty(nvm, st.st_size, size - st.st_size);
+    }
+    return;
+
+fail:
+    if (fd >= 0) {
+        qemu_close(fd);
+    }
+}
@@ -0,0 +1,585 @@
+/*
+ * AVR 8 and 16 bit timer/counter
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+/*
+ *  The counter is not incremented by the CPU. It is computed from the
+ *  virtual clock when it is read and a QEMU timer fires at the next tick
+ *  which sets a flag. The prescaler divides the clock of the CPU: with
+ *  -icount a cycle of the CPU takes one instruction count of the virtual
+ *  clock, without it clock-frequency tells how long. Phase correct PWM modes count like the fast PWM modes,
+ *  the output compare pins are not connected.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "hw/timer/avr_timer.h"
+#include "qemu/log.h"
+#include "sysemu/cpus.h"
+
+enum {
+    TOP_MAX,
+    TOP_0FF,
+    TOP_1FF,
+    TOP_3FF,
+    TOP_OCRA,
+    TOP_ICR,
+};
+
+/* top of the count for every waveform generation mode, reserved ones: MAX */
+static const uint8_t avr_timer8_top[8] = {
+    TOP_MAX, TOP_MAX, TOP_OCRA, TOP_MAX, TOP_MAX, TOP_OCRA, TOP_MAX, TOP_OCRA,
+};
+
+static const uint8_t avr_timer16_top[16] = {
+    TOP_MAX, TOP_0FF, TOP_1FF, TOP_3FF, TOP_OCRA, TOP_0FF, TOP_1FF, TOP_3FF,
+    TOP_ICR, TOP_OCRA, TOP_ICR, TOP_OCRA, TOP_ICR, TOP_MAX, TOP_ICR, TOP_OCRA,
+};
+
+static const uint16_t avr_timer_prescale[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+
+static const uint8_t avr_timer_irq_flag[AVR_TIMER_IRQS] = {
+    [AVR_TIMER_IRQ_CAPT] = TIMER_ICF,
+    [AVR_TIMER_IRQ_COMPA] = TIMER_OCFA,
+    [AVR_TIMER_IRQ_COMPB] = TIMER_OCFB,
+    [AVR_TIMER_IRQ_OVF] = TIMER_TOV,
+};
+
+static int avr_timer_wgm(AVRTimerState *s)
+{
+    if (s->width == 8) {
+        return (s->tccra & 0x03) | ((s->tccrb >> 1) & 0x04);
+    }
+    return (s->tccra & 0x03) | ((s->tccrb >> 1) & 0x0c);
+}
+
+static bool avr_timer_ctc(AVRTimerState *s)
+{
+    int wgm = avr_timer_wgm(s);
+
+    return s->width == 8 ? wgm == 2 : wgm == 4 || wgm == 12;
+}
+
+static uint32_t avr_timer_max(AVRTimerState *s)
+{
+    return s->width == 8 ? 0xff : 0xffff;
+}
+
+static uint32_t avr_timer_top(AVRTimerState *s)
+{
+    int wgm = avr_timer_wgm(s);
+
+    switch (s->width == 8 ? avr_timer8_top[wgm] : avr_timer16_top[wgm]) {
+    case TOP_0FF:
+        return 0x0ff;
+    case TOP_1FF:
+        return 0x1ff;
+    case TOP_3FF:
+        return 0x3ff;
+    case TOP_OCRA:
+        return s->ocra;
+    case TOP_ICR:
+        return s->icr;
+    default:
+        return avr_timer_max(s);
+    }
+}
+
+/* TOV is set when the counter wraps, in CTC mode only when it wraps at MAX */
+static bool avr_timer_tov(AVRTimerState *s, uint32_t top)
+{
+    return !avr_timer_ctc(s) || top == avr_timer_max(s);
+}
+
+static unsigned avr_timer_ps(AVRTimerState *s)
+{
+    return avr_timer_prescale[s->tccrb & 0x07];
+}
+
+/* clock cycles since virtual clock 0 */
+static uint64_t avr_timer_clocks(AVRTimerState *s, int64_t now)
+{
+    if (use_icount) {
+        return now / cpu_icount_to_ns(1);
+    }
+    return muldiv64(now, s->freq_hz, NANOSECONDS_PER_SECOND);
+}
+
+/* virtual clock of the clock cycle */
+static int64_t avr_timer_ns(AVRTimerState *s, uint64_t clock)
+{
+    if (use_icount) {
+        return clock * cpu_icount_to_ns(1);
+    }
+    return muldiv64(clock, NANOSECONDS_PER_SECOND, s->freq_hz) + 1;
+}
+
+/* ticks from the counter value until it reaches c */
+static uint64_t avr_timer_distance(uint32_t cnt, uint32_t c, uint32_t period)
+{
+    return (c + period - cnt - 1) % period + 1;
+}
+
+/* brings the counter and the flags up to the virtual clock */
+static void avr_timer_update_cnt(AVRTimerState *s, int64_t now)
+{
+    uint32_t top = avr_timer_top(s);
+    uint32_t period = top + 1;
+    unsigned ps = avr_timer_ps(s);
+    uint64_t d;
+
+    if (ps == 0) {
+        return; /* stopped */
+    }
+    /* the cycles of a tick not yet complete are left in base */
+    d = (avr_timer_clocks(s, now) - s->base) / ps;
+    s->base += d * ps;
+    if (d == 0) {
+        return;
+    }
+
+    if (s->cnt > top) {
+        /* e.g. OCRA was set below the counter, it runs up to MAX first */
+        uint64_t wrap = avr_timer_max(s) + 1 - s->cnt;
+
+        if (d < wrap) {
+            s->cnt += d;
+            return;
+        }
+        d -= wrap;
+        s->cnt = 0;
+        s->ifr |= TIMER_TOV;
+        if (s->ocra == 0) {
+            s->ifr |= TIMER_OCFA;
+        }
+        if (s->ocrb == 0) {
+            s->ifr |= TIMER_OCFB;
+        }
+        if (d == 0) {
+            return;
+        }
+    }
+
+    if (s->ocra <= top && avr_timer_distance(s->cnt, s->ocra, period) <= d) {
+        s->ifr |= TIMER_OCFA;
+    }
+    if (s->ocrb <= top && avr_timer_distance(s->cnt, s->ocrb, period) <= d) {
+        s->ifr |= TIMER_OCFB;
+    }
+    if (period - s->cnt <= d && avr_timer_tov(s, top)) {
+        s->ifr |= TIMER_TOV;
+    }
+    s->cnt = (s->cnt + d) % period;
+}
+
+/* arms the timer for the next tick which sets a flag */
+static void avr_timer_schedule(AVRTimerState *s)
+{
+    uint32_t top = avr_timer_top(s);
+    uint32_t period = top + 1;
+    uint64_t next = UINT64_MAX;
+
+    if (avr_timer_ps(s) == 0) {
+        timer_del(s->timer);
+        return;
+    }
+
+    if (s->cnt > top) {
+        next = avr_timer_max(s) + 1 - s->cnt;
+    } else {
+        if (!(s->ifr & TIMER_OCFA) && s->ocra <= top) {
+            next = MIN(next, avr_timer_distance(s->cnt, s->ocra, period));
+        }
+        if (!(s->ifr & TIMER_OCFB) && s->ocrb <= top) {
+            next = MIN(next, avr_timer_distance(s->cnt, s->ocrb, period));
+        }
+        if (!(s->ifr & TIMER_TOV) && avr_timer_tov(s, top)) {
+            next = MIN(next, period - s->cnt);
+        }
+    }
+
+    if (next == UINT64_MAX) {
+        timer_del(s->timer);
+    } else {
+        timer_mod(s->timer,
+                  avr_timer_ns(s, s->base + next * avr_timer_ps(s)));
+    }
+}
+
+static void avr_timer_update_irq(AVRTimerState *s)
+{
+    uint8_t pending = s->ifr & s->imsk;
+    int i;
+
+    for (i = 0; i < AVR_TIMER_IRQS; i++) {
+        qemu_set_irq(s->irq[i], (pending & avr_timer_irq_flag[i]) != 0);
+    }
+}
+
+static void avr_timer_interrupt(void *opaque)
+{
+    AVRTimerState *s = opaque;
+
+    avr_timer_update_cnt(s, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
+    avr_timer_update_irq(s);
+    avr_timer_schedule(s);
+}
+
+/* the CPU executes the vector of line n, this clears its flag */
+static void avr_timer_ack(void *opaque, int n, int level)
+{
+    AVRTimerState *s = opaque;
+
+    if (level) {
+        s->ifr &= ~avr_timer_irq_flag[n];
+        avr_timer_update_irq(s);
+        avr_timer_schedule(s);
+    }
+}
+
+static void avr_timer_reset(DeviceState *dev)
+{
+    AVRTimerState *s = AVR_TIMER(dev);
+
+    timer_del(s->timer);
+    s->base = 0;
+    s->cnt = 0;
+    s->tccra = 0;
+    s->tccrb = 0;
+    s->tccrc = 0;
+    s->ocra = 0;
+    s->ocrb = 0;
+    s->icr = 0;
+    s->temp = 0;
+    s->ifr = 0;
+    s->imsk = 0;
+    avr_timer_update_irq(s);
+}
+
+/* 16 bit registers are read low byte first, which latches the high byte */
+static uint8_t avr_timer_read16(AVRTimerState *s, uint16_t val, bool high)
+{
+    if (high) {
+        return s->temp;
+    }
+    s->temp = val >> 8;
+    return val;
+}
+
+/* 16 bit registers are written high byte first, into the temp register */
+static bool avr_timer_write16(AVRTimerState *s, uint16_t *reg, uint8_t val,
+                              bool high)
+{
+    if (high) {
+        s->temp = val;
+        return false;
+    }
+    *reg = (s->temp << 8) | val;
+    return true;
+}
+
+static uint64_t avr_timer_read(void *opaque, hwaddr offset, unsigned size)
+{
+    AVRTimerState *s = opaque;
+
+    avr_timer_update_cnt(s, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
+
+    if (s->width == 8) {
+        switch (offset) {
+        case T8_TCCRA:
+            return s->tccra;
+        case T8_TCCRB:
+            return s->tccrb & 0x0f;
+        case T8_TCNT:
+            return s->cnt;
+        case T8_OCRA:
+            return s->ocra;
+        case T8_OCRB:
+            return s->ocrb;
+        }
+    } else {
+        switch (offset) {
+        case T16_TCCRA:
+            return s->tccra;
+        case T16_TCCRB:
+            return s->tccrb;
+        case T16_TCCRC:
+            return 0;
+        case T16_TCNTL:
+        case T16_TCNTH:
+            return avr_timer_read16(s, s->cnt, offset == T16_TCNTH);
+        case T16_ICRL:
+        case T16_ICRH:
+            return avr_timer_read16(s, s->icr, offset == T16_ICRH);
+        case T16_OCRAL:
+        case T16_OCRAH:
+            return avr_timer_read16(s, s->ocra, offset == T16_OCRAH);
+        case T16_OCRBL:
+        case T16_OCRBH:
+            return avr_timer_read16(s, s->ocrb, offset == T16_OCRBH);
+        }
+    }
+
+    qemu_log_mask(LOG_GUEST_ERROR,
+                  "%s: Bad offset 0x%"HWADDR_PRIx"\n", __func__, offset);
+    return 0;
+}
+
+static void avr_timer_write(void *opaque, hwaddr offset, uint64_t val64,
+                            unsigned size)
+{
+    AVRTimerState *s = opaque;
+    uint8_t value = val64;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    bool stopped = avr_timer_ps(s) == 0;
+    uint16_t cnt = s->cnt;
+
+    /* count with the old settings up to now */
+    avr_timer_update_cnt(s, now);
+
+    if (s->width == 8) {
+        switch (offset) {
+        case T8_TCCRA:
+            s->tccra = value;
+            break;
+        case T8_TCCRB:
+            s->tccrb = value & 0x0f; /* FOCnA & FOCnB are not implemented */
+            break;
+        case T8_TCNT:
+            s->cnt = value;
+            break;
+        case T8_OCRA:
+            s->ocra = value;
+            break;
+        case T8_OCRB:
+            s->ocrb = value;
+            break;
+        default:
+            qemu_log_mask(LOG_GUEST_ERROR, "%s: Bad offset 0x%"HWADDR_PRIx"\n",
+                          __func__, offset);
+            return;
+        }
+    } else {
+        switch (offset) {
+        case T16_TCCRA:
+            s->tccra = value;
+            break;
+        case T16_TCCRB:
+            s->tccrb = value;
+            break;
+        case T16_TCCRC:
+            break; /* FOCnA & FOCnB are not implemented */
+        case T16_TCNTL:
+        case T16_TCNTH:
+            if (avr_timer_write16(s, &cnt, value, offset == T16_TCNTH)) {
+                s->cnt = cnt;
+            }
+            break;
+        case T16_ICRL:
+        case T16_ICRH:
+            avr_timer_write16(s, &s->icr, value, offset == T16_ICRH);
+            break;
+        case T16_OCRAL:
+        case T16_OCRAH:
+            avr_timer_write16(s, &s->ocra, value, offset == T16_OCRAH);
+            break;
+        case T16_OCRBL:
+        case T16_OCRBH:
+            avr_timer_write16(s, &s->ocrb, value, offset == T16_OCRBH);
+            break;
+        default:
+            qemu_log_mask(LOG_GUEST_ERROR, "%s: Bad offset 0x%"HWADDR_PRIx"\n",
+                          __func__, offset);
+            return;
+        }
+    }
+
+    if ((s->tccrb & 0x07) >= 6) {
+        qemu_log_mask(LOG_UNIMP, "%s: external clock source\n", __func__);
+    }
+
+    /*
+     *  a new prescaler continues from the cycles counted towards the tick,
+     *  a stopped timer starts counting from now
+     */
+    if (stopped && avr_timer_ps(s)) {
+        s->base = avr_timer_clocks(s, now);
+    }
+    avr_timer_schedule(s);
+}
+
+static uint64_t avr_timer_ifr_read(void *opaque, hwaddr offset, unsigned size)
+{
+    AVRTimerState *s = opaque;
+
+    avr_timer_update_cnt(s, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
+    return s->ifr;
+}
+
+static void avr_timer_ifr_write(void *opaque, hwaddr offset, uint64_t val64,
+                                unsigned size)
+{
+    AVRTimerState *s = opaque;
+
+    avr_timer_update_cnt(s, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
+    /* flags are cleared by writing a one */
+    s->ifr &= ~val64;
+    avr_timer_update_irq(s);
+    avr_timer_schedule(s);
+}
+
+static uint64_t avr_timer_imsk_read(void *opaque, hwaddr offset, unsigned size)
+{
+    AVRTimerState *s = opaque;
+
+    return s->imsk;
+}
+
+static void avr_timer_imsk_write(void *opaque, hwaddr offset, uint64_t val64,
+                                 unsigned size)
+{
+    AVRTimerState *s = opaque;
+
+    s->imsk = val64 & (TIMER_TOV | TIMER_OCFA | TIMER_OCFB |
+                       (s->width == 16 ? TIMER_ICF : 0));
+    avr_timer_update_cnt(s, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
+    avr_timer_update_irq(s);
+}
+
+static const MemoryRegionOps avr_timer_ops = {
+    .read = avr_timer_read,
+    .write = avr_timer_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .impl = { .min_access_size = 1, .max_access_size = 1 },
+};
+
+static const MemoryRegionOps avr_timer_ifr_ops = {
+    .read = avr_timer_ifr_read,
+    .write = avr_timer_ifr_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .impl = { .min_access_size = 1, .max_access_size = 1 },
+};
+
+static const MemoryRegionOps avr_timer_imsk_ops = {
+    .read = avr_timer_imsk_read,
+    .write = avr_timer_imsk_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .impl = { .min_access_size = 1, .max_access_size = 1 },
+};
+
+/*
+ *  Only the counter is saved, it continues from the virtual clock of the
+ *  load. This keeps the timing relative when the state is restored into a
+ *  machine whose clock went on, like a snapshot restored for every run.
+ */
+static void avr_timer_pre_save(void *opaque)
+{
+    AVRTimerState *s = opaque;
+
+    avr_timer_update_cnt(s, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
+}
+
+static int avr_timer_post_load(void *opaque, int version_id)
+{
+    AVRTimerState *s = opaque;
+
+    if (avr_timer_ps(s)) {
+        s->base = avr_timer_clocks(s, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
+    }
+    avr_timer_update_irq(s);
+    avr_timer_schedule(s);
+    return 0;
+}
+
+static const VMStateDescription vmstate_avr_timer = {
+    .name = TYPE_AVR_TIMER,
+    .version_id = 2,
+    .minimum_version_id = 2,
+    .pre_save = avr_timer_pre_save,
+    .post_load = avr_timer_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(cnt, AVRTimerState),
+        VMSTATE_UINT8(tccra, AVRTimerState),
+        VMSTATE_UINT8(tccrb, AVRTimerState),
+        VMSTATE_UINT8(tccrc, AVRTimerState),
+        VMSTATE_UINT16(ocra, AVRTimerState),
+        VMSTATE_UINT16(ocrb, AVRTimerState),
+        VMSTATE_UINT16(icr, AVRTimerState),
+        VMSTATE_UINT8(temp, AVRTimerState),
+        VMSTATE_UINT8(ifr, AVRTimerState),
+        VMSTATE_UINT8(imsk, AVRTimerState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property avr_timer_properties[] = {
+    DEFINE_PROP_UINT32("width", AVRTimerState, width, 8),
+    DEFINE_PROP_UINT32("clock-frequency", AVRTimerState, freq_hz, 16000000),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void avr_timer_init(Object *obj)
+{
+    AVRTimerState *s = AVR_TIMER(obj);
+    int i;
+
+    for (i = 0; i < AVR_TIMER_IRQS; i++) {
+        sysbus_init_irq(SYS_BUS_DEVICE(obj), &s->irq[i]);
+    }
+    qdev_init_gpio_in_named(DEVICE(obj), avr_timer_ack, "ack", AVR_TIMER_IRQS);
+
+    s->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, avr_timer_interrupt, s);
+}
+
+static void avr_timer_realize(DeviceState *dev, Error **errp)
+{
+    AVRTimerState *s = AVR_TIMER(dev);
+    SysBusDevice *sbd = SYS_BUS_DEVICE(dev);
+
+    if (s->width != 8 && s->width != 16) {
+        error_setg(errp, "avr-timer: width must be 8 or 16");
+        return;
+    }
+    if (s->freq_hz == 0) {
+        error_setg(errp, "avr-timer: clock-frequency must not be 0");
+        return;
+    }
+
+    memory_region_init_io(&s->iomem, OBJECT(s), &avr_timer_ops, s,
+                          TYPE_AVR_TIMER, s->width == 8 ? T8_SIZE : T16_SIZE);
+    memory_region_init_io(&s->ifr_iomem, OBJECT(s), &avr_timer_ifr_ops, s,
+                          TYPE_AVR_TIMER "-ifr", 1);
+    memory_region_init_io(&s->imsk_iomem, OBJECT(s), &avr_timer_imsk_ops, s,
+                          TYPE_AVR_TIMER "-imsk", 1);
+    sysbus_init_mmio(sbd, &s->iomem);
+    sysbus_init_mmio(sbd, &s->ifr_iomem);
+    sysbus_init_mmio(sbd, &s->imsk_iomem);
+}
+
+static void avr_timer_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+
+    dc->reset = avr_timer_reset;
+    dc->realize = avr_timer_realize;
+    dc->props = avr_timer_properties;
+    dc->vmsd = &vmstate_avr_timer;
+}
+
+static const TypeInfo avr_timer_info = {
+    .name          = TYPE_AVR_TIMER,
+    .parent        = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(AVRTimerState),
+    .instance_init = avr_timer_init,
+    .class_init    = avr_timer_class_init,
+};
+
+static void avr_timer_register_types(void)
+{
+    type_register_static(&avr_timer_info);
+}
+
+type_init(avr_timer_register_types)
@@ -8,11 +8,39 @@
 static int icount_start_insn_idx;
 static TCGLabel *exitreq_label;
 
+/* a CF_COLD TB exits before it runs for the hot_left-th time, so that it
+   is translated again with the optimizer. With MTTCG several vCPUs may
+   run the TB at once and the plain decrement may lose counts or step over
+   0, so every run from 0 on exits until the TB is replaced */
+static inline void gen_tb_hot_count(TranslationBlock *tb)
+{
+    TCGv_ptr ptr = tcg_const_ptr(&tb->hot_left);
+    TCGv_i32 left = tcg_temp_new_i32();
+    TCGv_i32 stop = tcg_const_i32(-1);
+    TCGLabel *cold = gen_new_label();
+
+    tcg_gen_ld_i32(left, ptr, 0);
+    tcg_gen_subi_i32(left, left, 1);
+    tcg_gen_st_i32(left, ptr, 0);
+    tcg_gen_brcondi_i32(TCG_COND_GT, left, 0, cold);
+    tcg_gen_st16_i32(stop, cpu_env,
+                     -ENV_OFFSET + offsetof(CPUState, icount_decr.u16.high));
+    tcg_gen_br(exitreq_label);
+    gen_set_label(cold);
+
+    tcg_temp_free_ptr(ptr);
+    tcg_temp_free_i32(left);
+    tcg_temp_free_i32(stop);
+}
+
 static inline void gen_tb_start(TranslationBlock *tb)
 {
     TCGv_i32 count, imm;
 
     exitreq_label = gen_new_label();
+    if (tb->cflags & CF_COLD) {
+        gen_tb_hot_count(tb);
+    }
     if (tb->cflags & CF_USE_ICOUNT) {
         count = tcg_temp_local_new_i32();
     } else {
@@ -25,8 +53,8 @@ static inline void gen_tb_start(TranslationBlock *tb)
     if (tb->cflags & CF_USE_ICOUNT) {
         imm = tcg_temp_new_i32();
         /* We emit a movi with a dummy immediate argument. Keep the insn index
-         * of the movi so that we later (when we know the actual insn count)
-         * can update the immediate argument with the actual insn count.  */
+         * of the movi so that we later (when we know the actual count)
+         * can update the immediate argument with the actual count.  */
         icount_start_insn_idx = tcg_op_buf_count();
         tcg_gen_movi_i32(imm, 0xdeadbeef);
 
@@ -44,12 +72,15 @@ static inline void gen_tb_start(TranslationBlock *tb)
     tcg_temp_free_i32(count);
 }
 
-static void gen_tb_end(TranslationBlock *tb, int num_insns)
+/* icount is what the TB takes from the icount budget: the number of guest
+   instructions for most targets, the clock cycles for targets which count
+   those (AVR).  */
+static void gen_tb_end(TranslationBlock *tb, int icount)
 {
     if (tb->cflags & CF_USE_ICOUNT) {
-        /* Update the num_insn immediate parameter now that we know
-         * the actual insn count.  */
-        tcg_set_insn_param(icount_start_insn_idx, 1, num_insns);
+        /* Update the count immediate parameter now that we know
+         * the actual count.  */
+        tcg_set_insn_param(icount_start_insn_idx, 1, icount);
     }
 
     gen_set_label(exitreq_label);
@@ -40,6 +40,14 @@ struct TBContext {
     /* statistics */
     unsigned tb_flush_count;
     int tb_phys_invalidate_count;
+    int tb_hot_count;
+    int tb_trace_count;
+    int tb_trace_len;
+#ifdef CONFIG_PROFILER
+    /* misses of tb_find which waited for code, and the time of the wait */
+    unsigned int tb_stall_count;
+    int64_t tb_stall_ns;
+#endif
 };
 
 #endif
@@ -22,19 +22,27 @@
 
 #include "exec/tb-hash-xx.h"
 
+/* The jump cache is split into sets of TB_JMP_CACHE_WAYS entries, the
+   hash of a pc selects the set.  The entries of a set are kept most
+   recently used first.  */
+#define TB_JMP_CACHE_WAYS (1 << tb_jmp_cache_way_bits)
+#define TB_JMP_SET_BITS (tb_jmp_cache_bits - tb_jmp_cache_way_bits)
+
 /* Only the bottom TB_JMP_PAGE_BITS of the jump cache hash bits vary for
    addresses on the same page.  The top bits are the same.  This allows
    TLB invalidation to quickly clear a subset of the hash table.  */
-#define TB_JMP_PAGE_BITS (TB_JMP_CACHE_BITS / 2)
+#define TB_JMP_PAGE_BITS (TB_JMP_SET_BITS / 2)
 #define TB_JMP_PAGE_SIZE (1 << TB_JMP_PAGE_BITS)
 #define TB_JMP_ADDR_MASK (TB_JMP_PAGE_SIZE - 1)
-#define TB_JMP_PAGE_MASK (TB_JMP_CACHE_SIZE - TB_JMP_PAGE_SIZE)
+#define TB_JMP_PAGE_MASK ((1 << TB_JMP_SET_BITS) - TB_JMP_PAGE_SIZE)
 
+/* Both return the index of the first entry of a set.  */
 static inline unsigned int tb_jmp_cache_hash_page(target_ulong pc)
 {
     target_ulong tmp;
     tmp = pc ^ (pc >> (TARGET_PAGE_BITS - TB_JMP_PAGE_BITS));
-    return (tmp >> (TARGET_PAGE_BITS - TB_JMP_PAGE_BITS)) & TB_JMP_PAGE_MASK;
+    return ((tmp >> (TARGET_PAGE_BITS - TB_JMP_PAGE_BITS)) & TB_JMP_PAGE_MASK)
+           << tb_jmp_cache_way_bits;
 }
 
 static inline unsigned int tb_jmp_cache_hash_func(target_ulong pc)
@@ -42,7 +50,7 @@ static inline unsigned int tb_jmp_cache_hash_func(target_ulong pc)
     target_ulong tmp;
     tmp = pc ^ (pc >> (TARGET_PAGE_BITS - TB_JMP_PAGE_BITS));
     return (((tmp >> (TARGET_PAGE_BITS - TB_JMP_PAGE_BITS)) & TB_JMP_PAGE_MASK)
-           | (tmp & TB_JMP_ADDR_MASK));
+            | (tmp & TB_JMP_ADDR_MASK)) << tb_jmp_cache_way_bits;
 }
 
 static inline
@@ -0,0 +1,70 @@
+/*
+ * AVR USART
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#ifndef HW_AVR_USART_H
+#define HW_AVR_USART_H
+
+#include "hw/sysbus.h"
+#include "sysemu/char.h"
+
+/* register offsets, e.g. UCSR0A at 0xc0 */
+#define USART_UCSRA 0x00
+#define USART_UCSRB 0x01
+#define USART_UCSRC 0x02
+#define USART_UBRRL 0x04
+#define USART_UBRRH 0x05
+#define USART_UDR   0x06
+#define USART_SIZE  0x07
+
+#define USART_UCSRA_RXC  (1 << 7)
+#define USART_UCSRA_TXC  (1 << 6)
+#define USART_UCSRA_UDRE (1 << 5)
+
+#define USART_UCSRB_RXCIE (1 << 7)
+#define USART_UCSRB_TXCIE (1 << 6)
+#define USART_UCSRB_UDRIE (1 << 5)
+#define USART_UCSRB_RXEN  (1 << 4)
+#define USART_UCSRB_TXEN  (1 << 3)
+
+/* interrupt lines, in the order of their vectors */
+enum {
+    AVR_USART_IRQ_RX,
+    AVR_USART_IRQ_UDRE,
+    AVR_USART_IRQ_TX,
+    AVR_USART_IRQS
+};
+
+/* sees every frame written to UDR, see avr_usart_set_tap */
+typedef void AVRUsartTap(void *opaque, uint8_t data);
+
+#define TYPE_AVR_USART "avr-usart"
+#define AVR_USART(obj) OBJECT_CHECK(AVRUsartState, (obj), TYPE_AVR_USART)
+
+typedef struct AVRUsartState {
+    /* <private> */
+    SysBusDevice parent_obj;
+
+    /* <public> */
+    MemoryRegion iomem;
+    CharBackend chr;
+    qemu_irq irq[AVR_USART_IRQS];
+
+    uint8_t ucsra;
+    uint8_t ucsrb;
+    uint8_t ucsrc;
+    uint16_t ubrr;
+    uint8_t rx_data;
+    uint8_t tx_data; /* sent while UDRE is clear */
+    guint watch_tag;
+
+    AVRUsartTap *tap;
+    void *tap_opaque;
+} AVRUsartState;
+
+void avr_usart_set_tap(AVRUsartState *s, AVRUsartTap *tap, void *opaque);
+
+#endif /* HW_AVR_USART_H */
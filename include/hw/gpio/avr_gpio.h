@@ -0,0 +1,38 @@
+/*
+ * AVR GPIO port
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#ifndef HW_AVR_GPIO_H
+#define HW_AVR_GPIO_H
+
+#include "hw/sysbus.h"
+
+/* register offsets, e.g. PINB at 0x23 */
+#define GPIO_PIN  0x00
+#define GPIO_DDR  0x01
+#define GPIO_PORT 0x02
+#define GPIO_SIZE 0x03
+
+#define AVR_GPIO_PINS 8
+
+#define TYPE_AVR_GPIO "avr-gpio"
+#define AVR_GPIO(obj) OBJECT_CHECK(AVRGpioState, (obj), TYPE_AVR_GPIO)
+
+typedef struct AVRGpioState {
+    /* <private> */
+    SysBusDevice parent_obj;
+
+    /* <public> */
+    MemoryRegion iomem;
+    qemu_irq out[AVR_GPIO_PINS];
+
+    uint8_t ddr;
+    uint8_t port;
+    uint8_t in; /* levels driven from outside */
+    uint8_t out_level; /* levels last driven on out */
+} AVRGpioState;
+
+#endif /* HW_AVR_GPIO_H */
@@ -0,0 +1,39 @@
+/*
+ * AVR interrupt controller
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#ifndef HW_AVR_INTC_H
+#define HW_AVR_INTC_H
+
+#include "hw/sysbus.h"
+
+/* interrupt vectors after RESET, line n is vector n + 1 */
+#define AVR_INTC_IRQS 37
+
+/* MCUCR bits */
+#define MCUCR_IVCE (1 << 0)
+#define MCUCR_IVSEL (1 << 1)
+
+#define TYPE_AVR_INTC "avr-intc"
+#define AVR_INTC(obj) OBJECT_CHECK(AVRIntcState, (obj), TYPE_AVR_INTC)
+
+typedef struct AVRIntcState {
+    /* <private> */
+    SysBusDevice parent_obj;
+
+    /* <public> */
+    MemoryRegion iomem; /* MCUCR */
+    qemu_irq irq[AVR_INTC_IRQS]; /* to the CPU */
+    qemu_irq ack[AVR_INTC_IRQS]; /* to the devices */
+
+    uint32_t boot_base; /* words, vectors are here when IVSEL is set */
+
+    uint64_t level;
+    uint8_t mcucr;
+    bool ivce; /* the last MCUCR write set IVCE */
+} AVRIntcState;
+
+#endif /* HW_AVR_INTC_H */
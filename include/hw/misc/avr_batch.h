@@ -0,0 +1,52 @@
+/*
+ * AVR batch runner & test exit
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#ifndef HW_AVR_BATCH_H
+#define HW_AVR_BATCH_H
+
+#include "hw/sysbus.h"
+#include "hw/nvram/avr_nvm.h"
+#include "hw/char/avr_usart.h"
+#include "cpu.h"
+
+#define TYPE_AVR_BATCH "avr-batch"
+#define AVR_BATCH(obj) OBJECT_CHECK(AVRBatchState, (obj), TYPE_AVR_BATCH)
+
+/* USART output of an image kept for its report, the rest is cut off */
+#define AVR_BATCH_OUTPUT_MAX 1024
+
+typedef struct AVRBatchState {
+    /* <private> */
+    SysBusDevice parent_obj;
+
+    /* <public> */
+    MemoryRegion iomem; /* EXIT */
+    QEMUTimer *timer;
+
+    AVRCPU *cpu;
+    MemoryRegion *ram;
+    AVRNvm *eeprom;
+    AVRUsartState *usart; /* whose output is reported, may be NULL */
+
+    char *list; /* file of the firmware images, one per line */
+    uint32_t timeout_ms; /* of virtual time for one image, 0 for none */
+
+    char **images;
+    int count;
+    int next; /* the image loaded by the next reset */
+    int current; /* the running image, -1 after it ended */
+    int64_t start_ns;
+    GString *output; /* sent on the USART by the running image */
+    bool output_cut; /* it sent more than AVR_BATCH_OUTPUT_MAX bytes */
+    int passed;
+    int failed;
+} AVRBatchState;
+
+void avr_batch_attach(AVRBatchState *s, AVRCPU *cpu, MemoryRegion *ram,
+                      AVRNvm *eeprom, AVRUsartState *usart);
+
+#endif /* HW_AVR_BATCH_H */
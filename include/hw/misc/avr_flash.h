@@ -0,0 +1,54 @@
+/*
+ * AVR flash & self-programming controller
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#ifndef HW_AVR_FLASH_H
+#define HW_AVR_FLASH_H
+
+#include "hw/sysbus.h"
+#include "hw/nvram/avr_nvm.h"
+
+/* SPMCSR, e.g. at 0x57 */
+#define SPMCSR_SELFPRGEN (1 << 0)
+#define SPMCSR_PGERS     (1 << 1)
+#define SPMCSR_PGWRT     (1 << 2)
+#define SPMCSR_BLBSET    (1 << 3)
+#define SPMCSR_RWWSRE    (1 << 4)
+#define SPMCSR_SIGRD     (1 << 5)
+#define SPMCSR_RWWSB     (1 << 6)
+#define SPMCSR_SPMIE     (1 << 7)
+
+/* the bits which select what SPM does, cleared by SPM */
+#define SPMCSR_OPS (SPMCSR_SIGRD | SPMCSR_RWWSRE | SPMCSR_BLBSET \
+                    | SPMCSR_PGWRT | SPMCSR_PGERS | SPMCSR_SELFPRGEN)
+
+#define AVR_FLASH_PAGE_MAX 512
+
+#define TYPE_AVR_FLASH "avr-flash"
+#define AVR_FLASH(obj) OBJECT_CHECK(AVRFlashState, (obj), TYPE_AVR_FLASH)
+
+typedef struct AVRFlashState {
+    /* <private> */
+    SysBusDevice parent_obj;
+
+    /* <public> */
+    MemoryRegion iomem;
+    MemoryRegion flash;
+    qemu_irq irq; /* SPM_READY */
+
+    uint32_t size;
+    uint32_t page_size;
+    char *filename;
+    char *name; /* of the RAM, unique per board */
+    AVRNvm nvm;
+
+    uint8_t spmcsr;
+    uint8_t buffer[AVR_FLASH_PAGE_MAX]; /* the temporary page buffer */
+} AVRFlashState;
+
+void avr_flash_load(AVRFlashState *s, const uint8_t *data, uint32_t len);
+
+#endif /* HW_AVR_FLASH_H */
@@ -0,0 +1,63 @@
+/*
+ * AVR inter-chip link
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#ifndef HW_AVR_LINK_H
+#define HW_AVR_LINK_H
+
+#include "hw/sysbus.h"
+#include "cpu.h"
+
+/* register offsets */
+#define LINK_SR   0x00
+#define LINK_DR   0x01
+#define LINK_SIZE 0x02
+
+#define LINK_SR_RXC   (1 << 7) /* a byte can be read from DR */
+#define LINK_SR_TXR   (1 << 5) /* a byte can be written to DR */
+#define LINK_SR_RXCIE (1 << 4)
+
+/* bytes in flight in one direction */
+#define AVR_LINK_QUEUE 64
+
+typedef struct AVRLinkState AVRLinkState;
+
+/*
+ *  one direction of a link, head is written by the sending CPU only and
+ *  tail by the receiving CPU only
+ */
+typedef struct AVRLinkQueue {
+    uint32_t head;
+    uint32_t tail;
+    struct {
+        uint32_t quantum; /* the byte is received from this quantum on */
+        uint8_t data;
+    } slot[AVR_LINK_QUEUE];
+} AVRLinkQueue;
+
+#define TYPE_AVR_LINK "avr-link"
+#define AVR_LINK(obj) OBJECT_CHECK(AVRLinkState, (obj), TYPE_AVR_LINK)
+
+struct AVRLinkState {
+    /* <private> */
+    SysBusDevice parent_obj;
+
+    /* <public> */
+    MemoryRegion iomem;
+    qemu_irq irq; /* RX complete */
+
+    AVRQuantum *quantum;
+    Notifier quantum_notifier;
+    AVRLinkQueue *tx;
+    AVRLinkQueue *rx;
+
+    uint8_t rxcie;
+    bool level; /* of irq, changed with the BQL */
+};
+
+void avr_link_connect(AVRLinkState *a, AVRLinkState *b, AVRQuantum *quantum);
+
+#endif /* HW_AVR_LINK_H */
@@ -0,0 +1,59 @@
+/*
+ * AVR in-memory snapshots
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#ifndef HW_AVR_SNAPSHOT_H
+#define HW_AVR_SNAPSHOT_H
+
+#include "hw/sysbus.h"
+#include "hw/nvram/avr_nvm.h"
+#include "cpu.h"
+
+/* SNAPCTL, writes */
+#define SNAPCTL_SAVE    1
+#define SNAPCTL_RESTORE 2
+
+/* SNAPCTL, reads */
+#define SNAPCTL_VALID   (1 << 0)
+
+#define AVR_SNAPSHOT_NVMS 2
+
+#define TYPE_AVR_SNAPSHOT "avr-snapshot"
+#define AVR_SNAPSHOT(obj) \
+    OBJECT_CHECK(AVRSnapshotState, (obj), TYPE_AVR_SNAPSHOT)
+
+typedef struct AVRSnapshotState {
+    /* <private> */
+    SysBusDevice parent_obj;
+
+    /* <public> */
+    MemoryRegion iomem; /* SNAPCTL */
+
+    AVRCPU *cpu;
+    MemoryRegion *ram;
+    AVRNvm *nvm[AVR_SNAPSHOT_NVMS];
+    int nvms;
+
+    /* the state of the CPU & the devices, the contents of ram */
+    bool valid;
+    GPtrArray *devices;
+    uint8_t *state;
+    size_t state_size;
+    size_t state_len;
+    uint8_t *ram_copy;
+
+    /* statistics */
+    uint64_t saves;
+    uint64_t restores;
+    uint64_t restore_ns;
+    uint64_t ram_pages;
+    uint64_t nvm_pages;
+} AVRSnapshotState;
+
+void avr_snapshot_attach(AVRSnapshotState *s, AVRCPU *cpu, MemoryRegion *ram);
+void avr_snapshot_add_nvm(AVRSnapshotState *s, AVRNvm *nvm);
+
+#endif /* HW_AVR_SNAPSHOT_H */
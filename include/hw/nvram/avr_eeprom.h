@@ -0,0 +1,54 @@
+/*
+ * AVR EEPROM
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#ifndef HW_AVR_EEPROM_H
+#define HW_AVR_EEPROM_H
+
+#include "hw/sysbus.h"
+#include "hw/nvram/avr_nvm.h"
+
+/* register offsets, e.g. EECR at 0x3f */
+#define EEPROM_EECR  0x00
+#define EEPROM_EEDR  0x01
+#define EEPROM_EEARL 0x02
+#define EEPROM_EEARH 0x03
+#define EEPROM_SIZE  0x04
+
+#define EECR_EERE  (1 << 0)
+#define EECR_EEPE  (1 << 1)
+#define EECR_EEMPE (1 << 2)
+#define EECR_EERIE (1 << 3)
+#define EECR_EEPM  (3 << 4)
+
+#define EECR_EEPM_ERASE_WRITE (0 << 4)
+#define EECR_EEPM_ERASE       (1 << 4)
+#define EECR_EEPM_WRITE       (2 << 4)
+
+#define TYPE_AVR_EEPROM "avr-eeprom"
+#define AVR_EEPROM(obj) OBJECT_CHECK(AVREepromState, (obj), TYPE_AVR_EEPROM)
+
+typedef struct AVREepromState {
+    /* <private> */
+    SysBusDevice parent_obj;
+
+    /* <public> */
+    MemoryRegion iomem;
+    MemoryRegion mem; /* the contents, for loaders & debuggers */
+    qemu_irq irq; /* EE_READY */
+    QEMUTimer *eempe_timer; /* clears EEMPE */
+
+    uint32_t size;
+    char *filename;
+    char *name; /* of the RAM, unique per board */
+    AVRNvm nvm;
+
+    uint8_t eecr;
+    uint8_t eedr;
+    uint16_t eear;
+} AVREepromState;
+
+#endif /* HW_AVR_EEPROM_H */
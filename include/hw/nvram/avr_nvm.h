@@ -0,0 +1,42 @@
+/*
+ * AVR non-volatile memory backing
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#ifndef HW_AVR_NVM_H
+#define HW_AVR_NVM_H
+
+#include "exec/memory.h"
+#include "qemu/timer.h"
+#include "qemu/notify.h"
+#include "qemu/queue.h"
+
+/* written pages are synced to the backing file after this delay */
+#define AVR_NVM_WRITEBACK_MS 100
+
+typedef struct AVRNvm {
+    uint8_t *data;
+    uint32_t size;
+    uint32_t page_size;
+    int fd; /* -1 without a backing file */
+    dev_t dev; /* of the backing file */
+    ino_t ino;
+    QLIST_ENTRY(AVRNvm) next;
+    MemoryRegion *mr; /* the RAM region over data, may be NULL */
+    unsigned long *dirty; /* pages not synced yet */
+    uint8_t *snapshot; /* contents at avr_nvm_snapshot() */
+    unsigned long *changed; /* pages written since the snapshot */
+    QEMUTimer *timer;
+    Notifier exit;
+} AVRNvm;
+
+void avr_nvm_init(AVRNvm *nvm, const char *filename, uint32_t size,
+                  uint32_t page_size, Error **errp);
+void avr_nvm_set_dirty(AVRNvm *nvm, uint32_t addr, uint32_t len);
+void avr_nvm_flush(AVRNvm *nvm);
+void avr_nvm_snapshot(AVRNvm *nvm);
+uint32_t avr_nvm_restore(AVRNvm *nvm);
+
+#endif /* HW_AVR_NVM_H */
@@ -0,0 +1,86 @@
+/*
+ * AVR 8 and 16 bit timer/counter
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#ifndef HW_AVR_TIMER_H
+#define HW_AVR_TIMER_H
+
+#include "hw/sysbus.h"
+#include "qemu/timer.h"
+
+/* register offsets of the 8 bit timer, e.g. TCCR0A at 0x44 */
+#define T8_TCCRA    0x00
+#define T8_TCCRB    0x01
+#define T8_TCNT     0x02
+#define T8_OCRA     0x03
+#define T8_OCRB     0x04
+#define T8_SIZE     0x05
+
+/* register offsets of the 16 bit timer, e.g. TCCR1A at 0x80 */
+#define T16_TCCRA   0x00
+#define T16_TCCRB   0x01
+#define T16_TCCRC   0x02
+#define T16_TCNTL   0x04
+#define T16_TCNTH   0x05
+#define T16_ICRL    0x06
+#define T16_ICRH    0x07
+#define T16_OCRAL   0x08
+#define T16_OCRAH   0x09
+#define T16_OCRBL   0x0a
+#define T16_OCRBH   0x0b
+#define T16_SIZE    0x0c
+
+/* TIFRn & TIMSKn bits */
+#define TIMER_TOV   (1 << 0)
+#define TIMER_OCFA  (1 << 1)
+#define TIMER_OCFB  (1 << 2)
+#define TIMER_ICF   (1 << 5)
+
+/* interrupt lines, in the order of their vectors */
+enum {
+    AVR_TIMER_IRQ_CAPT,
+    AVR_TIMER_IRQ_COMPA,
+    AVR_TIMER_IRQ_COMPB,
+    AVR_TIMER_IRQ_OVF,
+    AVR_TIMER_IRQS
+};
+
+#define TYPE_AVR_TIMER "avr-timer"
+#define AVR_TIMER(obj) OBJECT_CHECK(AVRTimerState, (obj), TYPE_AVR_TIMER)
+
+typedef struct AVRTimerState {
+    /* <private> */
+    SysBusDevice parent_obj;
+
+    /* <public> */
+    MemoryRegion iomem; /* TCCRnA .. OCRnB */
+    MemoryRegion ifr_iomem; /* TIFRn */
+    MemoryRegion imsk_iomem; /* TIMSKn */
+    QEMUTimer *timer;
+    qemu_irq irq[AVR_TIMER_IRQS];
+
+    uint32_t width; /* 8 or 16 bits */
+    uint32_t freq_hz; /* CPU clock */
+
+    /*
+     *  the counter is cnt at clock cycle base, cycles count from virtual
+     *  clock 0
+     */
+    uint64_t base;
+    uint32_t cnt;
+
+    uint8_t tccra;
+    uint8_t tccrb;
+    uint8_t tccrc;
+    uint16_t ocra;
+    uint16_t ocrb;
+    uint16_t icr;
+    uint8_t temp; /* high byte of 16 bit accesses */
+    uint8_t ifr;
+    uint8_t imsk;
+} AVRTimerState;
+
+#endif /* HW_AVR_TIMER_H */
@@ -46,5 +46,7 @@ void hmp_info_tlb(Monitor *mon, const QDict *qdict);
 void hmp_mce(Monitor *mon, const QDict *qdict);
 void hmp_info_local_apic(Monitor *mon, const QDict *qdict);
 void hmp_info_io_apic(Monitor *mon, const QDict *qdict);
+void hmp_info_avr_profile(Monitor *mon, const QDict *qdict);
+void hmp_info_avr_snapshot(Monitor *mon, const QDict *qdict);
 
 #endif /* MONITOR_HMP_TARGET_H */
@@ -233,8 +233,13 @@ struct kvm_run;
 
 struct hax_vcpu_state;
 
+/* The jump cache has 1 << tb_jmp_cache_bits entries in sets of
+ * 1 << tb_jmp_cache_way_bits, see -accel tcg,jmp-cache and tb-hash.h.
+ */
 #define TB_JMP_CACHE_BITS 12
-#define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
+#define TB_JMP_CACHE_SIZE (1 << tb_jmp_cache_bits)
+extern unsigned int tb_jmp_cache_bits;
+extern unsigned int tb_jmp_cache_way_bits;
 
 /* work queue */
 
@@ -349,7 +354,14 @@ struct CPUState {
     void *env_ptr; /* CPUArchState */
 
     /* Writes protected by tb_lock, reads not thread-safe  */
-    struct TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_SIZE];
+    struct TranslationBlock **tb_jmp_cache;
+#ifdef CONFIG_PROFILER
+    /* lookups of the vCPU in tb_jmp_cache, shown by "info jit" */
+    uint64_t tb_jmp_cache_hits;
+    uint64_t tb_jmp_cache_misses;
+    /* TB lookups of the vCPU, per vCPU as MTTCG runs them in parallel */
+    uint64_t tb_find_count;
+#endif
 
     struct GDBRegisterState *gdb_regs;
     int gdb_num_regs;
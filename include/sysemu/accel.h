@@ -55,6 +55,7 @@ typedef struct AccelClass {
     OBJECT_GET_CLASS(AccelClass, (obj), TYPE_ACCEL)
 
 extern int tcg_tb_size;
+extern const char *tcg_tb_cache;
 
 void configure_accelerator(MachineState *ms);
 
@@ -986,6 +986,9 @@ static void qmp_unregister_commands_hack(void)
 #ifndef TARGET_ARM
     qmp_unregister_command(&qmp_commands, "query-gic-capabilities");
 #endif
+#ifndef TARGET_AVR
+    qmp_unregister_command(&qmp_commands, "query-avr-profile");
+#endif
 #if !defined(TARGET_S390X) && !defined(TARGET_I386)
     qmp_unregister_command(&qmp_commands, "query-cpu-model-expansion");
 #endif
@@ -4225,6 +4228,16 @@ GICCapabilityList *qmp_query_gic_capabilities(Error **errp)
 }
 #endif
 
+#ifndef TARGET_AVR
+AvrProfileList *qmp_query_avr_profile(bool has_top, int64_t top,
+                                      bool has_reset, bool reset,
+                                      Error **errp)
+{
+    error_setg(errp, QERR_FEATURE_DISABLED, "query-avr-profile");
+    return NULL;
+}
+#endif
+
 HotpluggableCPUList *qmp_query_hotpluggable_cpus(Error **errp)
 {
     MachineState *ms = MACHINE(qdev_get_machine());
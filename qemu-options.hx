@@ -100,9 +100,15 @@ Select CPU model (@code{-cpu help} for list and additional feature selection)
 ETEXI
 
 DEF("accel", HAS_ARG, QEMU_OPTION_accel,
-    "-accel [accel=]accelerator[,thread=single|multi]\n"
+    "-accel [accel=]accelerator[,thread=single|multi][,hot=n][,trace=on|off]\n"
+    "                [,prefetch=n][,jmp-cache=n][,jmp-cache-ways=1|2|4]\n"
     "                select accelerator (kvm, xen, hax or tcg; use 'help' for a list)\n"
-    "                thread=single|multi (enable multi-threaded TCG)", QEMU_ARCH_ALL)
+    "                thread=single|multi (enable multi-threaded TCG)\n"
+    "                hot=n (optimize TCG code after n executions)\n"
+    "                trace=on|off (translate hot loops as one block)\n"
+    "                prefetch=n (translate code n jumps ahead in a thread)\n"
+    "                jmp-cache=n (entries of the TB jump cache of a CPU)\n"
+    "                jmp-cache-ways=1|2|4 (entries of a set of the jump cache)", QEMU_ARCH_ALL)
 STEXI
 @item -accel @var{name}[,prop=@var{value}[,...]]
 @findex -accel
@@ -116,6 +122,30 @@ Controls number of TCG threads. When the TCG is multi-threaded there will be one
 thread per vCPU therefor taking advantage of additional host cores. The default
 is to enable multi-threading where both the back-end and front-ends support it and
 no incompatible TCG features have been enabled (e.g. icount/replay).
+@item hot=@var{n}
+Translates guest code without the TCG optimizer at first and translates it
+again with the optimizer once it has run @var{n} times, so that code which
+runs only a few times is translated faster. The default, 0, optimizes all
+code at once.
+@item trace=on|off
+When a block of code becomes hot, translates it again together with the
+blocks it loops through, so that the loop runs without leaving translated
+code. Needs @option{hot}. Targets whose translator does not follow the
+loop, and @option{-icount}, translate the block alone. The default is off.
+@item prefetch=@var{n}
+Translates the targets of the jumps of translated code in a thread of its
+own, up to @var{n} jumps ahead of the code the CPUs run, so that the CPUs
+rarely wait for code to be translated. "info jit" shows the time the CPUs
+waited. Needs a target whose code mapping never changes, e.g. AVR. The
+default, 0, translates code when a CPU reaches it.
+@item jmp-cache=@var{n}
+Sets the number of entries of the cache of every CPU which maps guest
+addresses to translated code, a power of two. The default is 4096. "info jit"
+shows how many lookups hit the cache.
+@item jmp-cache-ways=1|2|4
+Splits the jump cache into sets of 2 or 4 entries, so that blocks of code
+whose addresses hash alike evict each other less often. The default, 1, is a
+direct mapped cache.
 @end table
 ETEXI
 
@@ -3691,6 +3721,22 @@ STEXI
 Set TB size.
 ETEXI
 
+DEF("tb-cache", HAS_ARG, QEMU_OPTION_tb_cache, \
+    "-tb-cache file  keep the translated code in file across runs\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -tb-cache @var{file}
+@findex -tb-cache
+Load the translated code saved in @var{file} at the first translation and
+save it there at exit, so that a run of the same firmware does not translate
+it again. The code is used only by the same QEMU binary, with the same machine,
+CPUs and RAM, and if it is generated at the same host address: configure
+QEMU with --disable-pie or run it with address space randomization off
+(setarch -R). Translation blocks whose guest code changed are translated
+again. The number of blocks loaded and the translation time saved are shown
+by @code{info jit} and at exit.
+ETEXI
+
 DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming tcp:[host]:port[,to=maxport][,ipv4][,ipv6]\n" \
     "-incoming rdma:host:port[,ipv4][,ipv6]\n" \
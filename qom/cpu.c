@@ -31,6 +31,10 @@
 #include "hw/qdev-properties.h"
 #include "trace-root.h"
 
+/* set by qemu_tcg_configure before the CPUs are created */
+unsigned int tb_jmp_cache_bits = TB_JMP_CACHE_BITS;
+unsigned int tb_jmp_cache_way_bits;
+
 bool cpu_exists(int64_t id)
 {
     CPUState *cpu;
@@ -396,6 +400,7 @@ static void cpu_common_initfn(Object *obj)
     qemu_mutex_init(&cpu->work_mutex);
     QTAILQ_INIT(&cpu->breakpoints);
     QTAILQ_INIT(&cpu->watchpoints);
+    cpu->tb_jmp_cache = g_new0(struct TranslationBlock *, TB_JMP_CACHE_SIZE);
 
     count = trace_get_vcpu_event_count();
     if (count) {
@@ -409,6 +414,7 @@ static void cpu_common_finalize(Object *obj)
 {
     CPUState *cpu = CPU(obj);
     g_free(cpu->trace_dstate);
+    g_free(cpu->tb_jmp_cache);
 }
 
 static int64_t cpu_common_get_arch_id(CPUState *cpu)
@@ -0,0 +1,307 @@
+#!/usr/bin/env python
+#
+# Generate the AVR decode table from avr.yaml
+#
+# This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+# See the COPYING.LIB file in the top-level directory.
+#
+# usage: avr-decode.py index|table|disas avr.yaml > output
+#
+#   index   target/avr/decode-index.c, the index into the table of every
+#           first opcode word, shared by the translator and the disassembler
+#   table   target/avr/decode-table.inc.c, the translate function, length
+#           and cycles of every index, included by the translator
+#   disas   target/avr/disas.inc.c, the assembler syntax and the operand
+#           fields of every index, included by the disassembler
+#
+# All three are generated by one rule of the top Makefile from the same
+# table, so the translator and the disassembler cannot disagree on an index.
+#
+# The instructions are divided into a tree exactly as cpugen divides them
+# for the nested switch of decode.inc.c, and every word is looked up in it
+# like the switch does, so the table and the switch always agree. Only the
+# first opcode word is known, the bits of longer opcodes beyond it are
+# ignored.
+
+import re
+import sys
+
+LICENSE = """/*
+ * QEMU AVR CPU
+ *
+ * Copyright (c) 2016 Michael Rolnik
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see
+ * <http://www.gnu.org/licenses/lgpl-2.1.html>
+ */
+
+"""
+
+
+class Insn(object):
+    def __init__(self, name):
+        self.name = name
+        self.opcode = ''
+        self.cycles = None
+        self.cycles_xmega = None
+        self.format = None
+        self.operands = []
+
+    def parse_opcode(self, text):
+        bits = ''
+        for tok in text.split():
+            m = re.match(r'^\w+\[(\d+)\]$', tok)
+            if m:
+                bits += 'x' * int(m.group(1))
+            elif re.match(r'^[-01]+$', tok):
+                bits += tok
+            else:
+                sys.exit('%s: bad opcode field %s' % (self.name, tok))
+        if len(bits) % 16:
+            sys.exit('%s: opcode of %d bits' % (self.name, len(bits)))
+        self.opcode = bits
+
+    def parse_asm(self, text):
+        """splits "adc %r(Rd), %r(Rr)" into the format "adc %r, %r" and the
+        operand fields Rd and Rr"""
+        operand = r'%([a-zA-Z])\(([a-zA-Z][a-zA-Z0-9]*)\)'
+        self.format = re.sub(operand, r'%\1', text)
+        self.operands = [m.group(2) for m in re.finditer(operand, text)]
+
+    def bits(self, length, chr):
+        return int(''.join('1' if c == chr else '0'
+                           for c in self.opcode[:length]), 2)
+
+
+def parse(filename):
+    insns = []
+    insn = None
+    for line in open(filename):
+        line = line.split('#', 1)[0].rstrip()
+        m = re.match(r'^\s+- (\w+):$', line)
+        if m:
+            insn = Insn(m.group(1))
+            insns.append(insn)
+            continue
+        m = re.match(r'^\s+([\w-]+):\s*(.*)$', line)
+        if not m or insn is None:
+            continue
+        key, value = m.groups()
+        if key == 'opcode':
+            insn.parse_opcode(value)
+        elif key == 'cycles':
+            insn.cycles = int(value)
+        elif key == 'cycles-xmega':
+            insn.cycles_xmega = int(value)
+        elif key == 'asm':
+            insn.parse_asm(value)
+    for insn in insns:
+        if not insn.opcode:
+            sys.exit('%s: no opcode' % insn.name)
+        if insn.format is None:
+            sys.exit('%s: no asm' % insn.name)
+        if insn.cycles is None:
+            insn.cycles = 1
+        if insn.cycles_xmega is None:
+            insn.cycles_xmega = insn.cycles
+    return insns
+
+
+def encode(mask, value):
+    """deposits the bits of value into the set bits of mask"""
+    v = 0
+    j = 0
+    for i in range(64):
+        if mask & (1 << i):
+            if value & (1 << j):
+                v |= 1 << i
+            j += 1
+    return v
+
+
+def divide(insns):
+    """the decoding tree of cpugen, a list of nodes
+        ('match', bits, mask, value, insn)
+        ('switch', bits, mask, [(value, [nodes]), ...])"""
+    minlen = min(len(i.opcode) for i in insns)
+    bits = min(minlen, 64)
+    all0 = all1 = allx = (1 << bits) - 1
+    for i in insns:
+        field0 = i.bits(minlen, '0')
+        field1 = i.bits(minlen, '1')
+        all0 &= field0
+        all1 &= field1
+        allx &= field0 | field1
+    diff = allx ^ (all0 | all1)
+
+    if diff == 0:
+        insns = sorted(insns, reverse=True,
+                       key=lambda i: i.bits(minlen, '0') | i.bits(minlen, '1'))
+        return [('match', bits, i.bits(minlen, '0') | i.bits(minlen, '1'),
+                 i.bits(minlen, '1'), i) for i in insns]
+
+    cases = []
+    for s in range(1 << bin(diff).count('1')):
+        index = encode(diff, s)
+        subset = [i for i in insns
+                  if i.bits(minlen, '0') & diff == ~index & diff
+                  and i.bits(minlen, '1') & diff == index & diff]
+        if len(subset) == 1:
+            cases.append((index, [('insn', subset[0])]))
+        elif subset:
+            cases.append((index, divide(subset)))
+        else:
+            cases.append((index, []))
+    return [('switch', bits, diff, cases)]
+
+
+def lookup(nodes, word):
+    """walks the tree like the switch of decode.inc.c does"""
+    for node in nodes:
+        if node[0] == 'insn':
+            return node[1]
+        bits = node[1]
+        opc = word << (bits - 16)
+        mask = node[2] & ~((1 << (bits - 16)) - 1)
+        if node[0] == 'match':
+            if opc & mask == node[3] & mask:
+                return node[4]
+            continue
+        for value, children in node[3]:
+            if opc & mask == value:
+                return lookup(children, word)
+        return None
+    return None
+
+
+def decode(insns):
+    """returns the instructions in the order of their first word and the
+    index into them of every word, 0 for words which decode to nothing"""
+    tree = divide(insns)
+    table = []
+    index = []
+    for word in range(0x10000):
+        insn = lookup(tree, word)
+        if insn is None:
+            index.append(0)
+            continue
+        if insn not in table:
+            table.append(insn)
+        index.append(table.index(insn) + 1)
+    return table, index
+
+
+def gen_index(out, table, index):
+    out.write(LICENSE)
+    out.write('/* generated by scripts/avr-decode.py from avr.yaml */\n'
+              '#include "qemu/osdep.h"\n'
+              '#include "target/avr/decode-index.h"\n'
+              '\n'
+              'const uint8_t avr_decode_index[0x10000] = {\n')
+    first = 0
+    while first < 0x10000:
+        last = first
+        while last + 1 < 0x10000 and index[last + 1] == index[first]:
+            last += 1
+        if index[first]:
+            if first == last:
+                out.write('    [0x%04x] = ' % first)
+            else:
+                out.write('    [0x%04x ... 0x%04x] = ' % (first, last))
+            out.write('%d, /* %s */\n' %
+                      (index[first], table[index[first] - 1].name))
+        first = last + 1
+    out.write('};\n')
+
+
+def gen_table(out, table):
+    out.write(LICENSE)
+    out.write('/* generated by scripts/avr-decode.py from avr.yaml */\n'
+              'static const struct {\n'
+              '    translate_function_t translate;\n'
+              '    uint32_t length;\n'
+              '    uint32_t cycles;\n'
+              '    uint32_t cycles_xmega;\n'
+              '} avr_decode_insn[] = {\n'
+              '    { NULL, 16, 1, 1 },\n')
+    for i in table:
+        out.write('    { &avr_translate_%s, %d, %d, %d },\n' %
+                  (i.name, len(i.opcode), i.cycles, i.cycles_xmega))
+    out.write('''};
+
+static void avr_decode_table(uint32_t pc, uint32_t *l, uint32_t c,
+                             translate_function_t *t)
+{
+    uint32_t idx = avr_decode_index[extract32(c, 0, 16)];
+
+    *l = avr_decode_insn[idx].length;
+    *t = avr_decode_insn[idx].translate;
+}
+
+static uint32_t avr_decode_cycles(uint32_t c, bool xmega)
+{
+    uint32_t idx = avr_decode_index[extract32(c, 0, 16)];
+
+    return xmega ? avr_decode_insn[idx].cycles_xmega
+                 : avr_decode_insn[idx].cycles;
+}
+''')
+
+
+def gen_disas(out, table):
+    out.write(LICENSE)
+    out.write('/* generated by scripts/avr-decode.py from avr.yaml */\n'
+              '\n'
+              '/*\n'
+              ' *  assembler syntax of every decode index, see the asm key of '
+              'avr.yaml\n'
+              ' */\n'
+              'static const struct {\n'
+              '    const char *format;\n'
+              '    uint32_t length;\n'
+              '} avr_disas_insn[] = {\n'
+              '    { NULL, 16 },\n')
+    for i in table:
+        out.write('    { "%s", %d },\n' % (i.format, len(i.opcode)))
+    out.write('};\n'
+              '\n'
+              'static void avr_disas_operands(uint32_t idx, uint32_t opcode,\n'
+              '                               uint32_t *op)\n'
+              '{\n'
+              '    switch (idx) {\n')
+    for n, i in enumerate(table, 1):
+        if not i.operands:
+            continue
+        out.write('    case %d: /* %s */\n' % (n, i.name))
+        for k, field in enumerate(i.operands):
+            out.write('        op[%d] = %s_%s(opcode);\n' % (k, i.name, field))
+        out.write('        break;\n')
+    out.write('    }\n'
+              '}\n')
+
+
+def main(args):
+    if len(args) != 3 or args[1] not in ('index', 'table', 'disas'):
+        sys.exit('usage: avr-decode.py index|table|disas avr.yaml')
+    table, index = decode(parse(args[2]))
+    if args[1] == 'index':
+        gen_index(sys.stdout, table, index)
+    elif args[1] == 'table':
+        gen_table(sys.stdout, table)
+    else:
+        gen_disas(sys.stdout, table)
+
+
+if __name__ == '__main__':
+    main(sys.argv)
@@ -0,0 +1,177 @@
+#!/usr/bin/env python
+#
+# Profile of an AVR execution trace
+#
+# Reads the trace written with -global avr.trace=FILE (see
+# target/avr/exec-trace.h) and prints a flat histogram of the TB entry
+# addresses, the call graph taken from the CALL and RET records and, if the
+# trace has them, the most used data addresses.
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+
+import argparse
+import array
+import bisect
+import collections
+import struct
+import sys
+
+MAGIC = b'AVRTRACE'
+VERSION = 1
+FLAG_MEM = 1
+
+TB, LD, ST, CALL, RET, INT = range(6)
+
+KIND_SHIFT = 24
+ADDR_MASK = 0x00ffffff
+
+
+class Symbols(object):
+    '''Symbols from the output of avr-nm -n'''
+
+    def __init__(self, filename=None):
+        self.addrs = []
+        self.names = []
+        if filename is None:
+            return
+        with open(filename) as f:
+            for line in f:
+                fields = line.split()
+                if len(fields) != 3:
+                    continue
+                self.addrs.append(int(fields[0], 16))
+                self.names.append(fields[2])
+
+    def name(self, addr, base=0):
+        i = bisect.bisect_right(self.addrs, base + addr) - 1
+        if i < 0:
+            return '0x%06x' % addr
+        offset = base + addr - self.addrs[i]
+        if offset:
+            return '%s+0x%x' % (self.names[i], offset)
+        return self.names[i]
+
+
+class Profile(object):
+    def __init__(self):
+        self.tbs = collections.Counter()
+        self.edges = collections.Counter()
+        self.loads = collections.Counter()
+        self.stores = collections.Counter()
+        # per CPU: function of the last TB, stack of the callers and
+        # whether the next TB is the entry of a callee
+        self.function = {}
+        self.stack = {}
+        self.called = {}
+
+    def add(self, cpu, records):
+        function = self.function.get(cpu)
+        stack = self.stack.setdefault(cpu, [])
+        called = self.called.get(cpu, False)
+
+        for record in records:
+            kind = record >> KIND_SHIFT
+            addr = record & ADDR_MASK
+            if kind == TB:
+                self.tbs[addr] += 1
+                if called or function is None:
+                    self.edges[(function, addr)] += 1
+                    function = addr
+                    called = False
+            elif kind == LD:
+                self.loads[addr] += 1
+            elif kind == ST:
+                self.stores[addr] += 1
+            elif kind == CALL or kind == INT:
+                stack.append(function)
+                called = True
+            elif kind == RET:
+                if stack:
+                    function = stack.pop()
+
+        self.function[cpu] = function
+        self.called[cpu] = called
+
+
+def read_trace(filename, cpus):
+    profile = Profile()
+    swap = sys.byteorder != 'little'
+
+    with open(filename, 'rb') as f:
+        if f.read(len(MAGIC)) != MAGIC:
+            raise ValueError('%s is not an AVR trace' % filename)
+        version, flags = struct.unpack('<II', f.read(8))
+        if version != VERSION:
+            raise ValueError('unsupported trace version %d' % version)
+
+        while True:
+            header = f.read(8)
+            if len(header) < 8:
+                break
+            cpu, count = struct.unpack('<II', header)
+            records = array.array('I')
+            records.fromfile(f, count)
+            if swap:
+                records.byteswap()
+            if cpus is None or cpu in cpus:
+                profile.add(cpu, records)
+
+    return profile, flags
+
+
+def print_counts(title, counts, total, top, name):
+    print('%s' % title)
+    print('%10s %7s  %s' % ('count', '%', 'address'))
+    for addr, count in counts.most_common(top):
+        print('%10d %6.2f%%  %s' % (count, 100.0 * count / total, name(addr)))
+    print('')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='AVR execution trace profile')
+    parser.add_argument('trace', help='trace file')
+    parser.add_argument('-s', '--symbols',
+                        help='symbols, the output of avr-nm -n')
+    parser.add_argument('-c', '--cpu', type=int, action='append',
+                        help='only this CPU, may be repeated')
+    parser.add_argument('-n', '--top', type=int, default=30,
+                        help='number of lines of each table')
+    args = parser.parse_args()
+
+    symbols = Symbols(args.symbols)
+    profile, flags = read_trace(args.trace, args.cpu)
+
+    def code(addr):
+        return symbols.name(addr)
+
+    def data(addr):
+        # avr-nm shows the data space at 0x800000
+        return symbols.name(addr, 0x800000)
+
+    total = sum(profile.tbs.values())
+    if total == 0:
+        print('no TB entries in %s' % args.trace)
+        return
+
+    print_counts('TB entries', profile.tbs, total, args.top, code)
+
+    print('call graph')
+    print('%10s  %s' % ('calls', 'caller -> callee'))
+    for (caller, callee), count in profile.edges.most_common(args.top):
+        if caller is None:
+            continue
+        print('%10d  %s -> %s' % (count, code(caller), code(callee)))
+    print('')
+
+    if flags & FLAG_MEM:
+        loads = sum(profile.loads.values())
+        stores = sum(profile.stores.values())
+        if loads:
+            print_counts('loads', profile.loads, loads, args.top, data)
+        if stores:
+            print_counts('stores', profile.stores, stores, args.top, data)
+
+
+if __name__ == '__main__':
+    main()
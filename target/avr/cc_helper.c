@@ -0,0 +1,121 @@
+/*
+ * QEMU AVR CPU
+ *
+ * Copyright (c) 2016 Michael Rolnik
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see
+ * <http://www.gnu.org/licenses/lgpl-2.1.html>
+ */
+
+#include "qemu/osdep.h"
+
+#include "cpu.h"
+
+/*
+ *  the functions below return C, Z, N, V, S & H flags in SREG layout,
+ *  i.e. C is bit 0 and H is bit 5
+ */
+static uint32_t compute_all_add(CPUAVRState *env)
+{
+    uint32_t R = env->cc_dst;
+    uint32_t Rd = env->cc_src;
+    uint32_t Rr = env->cc_src2;
+    uint32_t t = (Rd & Rr) | (Rd & ~R) | (Rr & ~R); /* carry vector */
+    uint32_t C = (t >> 7) & 1;
+    uint32_t H = (t >> 3) & 1;
+    uint32_t V = (((Rd ^ R) & ~(Rd ^ Rr)) >> 7) & 1;
+    uint32_t N = (R >> 7) & 1;
+    uint32_t Z = R == 0;
+
+    return C | Z << 1 | N << 2 | V << 3 | (N ^ V) << 4 | H << 5;
+}
+
+static uint32_t compute_all_sub(CPUAVRState *env)
+{
+    uint32_t R = env->cc_dst;
+    uint32_t Rd = env->cc_src;
+    uint32_t Rr = env->cc_src2;
+    uint32_t t = (~Rd & Rr) | (~Rd & R) | (Rr & R); /* borrow vector */
+    uint32_t C = (t >> 7) & 1;
+    uint32_t H = (t >> 3) & 1;
+    uint32_t V = (((Rd ^ R) & (Rd ^ Rr)) >> 7) & 1;
+    uint32_t N = (R >> 7) & 1;
+    uint32_t Z = R == 0; /* bit 8 holds previous Z of SBC, SBCI & CPC */
+
+    return C | Z << 1 | N << 2 | V << 3 | (N ^ V) << 4 | H << 5;
+}
+
+static uint32_t compute_all_znv(CPUAVRState *env, uint32_t V)
+{
+    uint32_t R = env->cc_dst;
+    uint32_t C = env->sregC;
+    uint32_t H = env->sregH;
+    uint32_t N = (R >> 7) & 1;
+    uint32_t Z = R == 0;
+
+    return C | Z << 1 | N << 2 | V << 3 | (N ^ V) << 4 | H << 5;
+}
+
+static uint32_t compute_all_addw(CPUAVRState *env)
+{
+    uint32_t R = env->cc_dst;
+    uint32_t Rd = env->cc_src;
+    uint32_t C = ((Rd & ~R) >> 15) & 1;
+    uint32_t V = ((R & ~Rd) >> 15) & 1;
+    uint32_t N = (R >> 15) & 1;
+    uint32_t Z = R == 0;
+    uint32_t H = env->sregH;
+
+    return C | Z << 1 | N << 2 | V << 3 | (N ^ V) << 4 | H << 5;
+}
+
+static uint32_t compute_all_subw(CPUAVRState *env)
+{
+    uint32_t R = env->cc_dst;
+    uint32_t Rd = env->cc_src;
+    uint32_t C = ((R & ~Rd) >> 15) & 1;
+    uint32_t V = ((Rd & ~R) >> 15) & 1;
+    uint32_t N = (R >> 15) & 1;
+    uint32_t Z = R == 0;
+    uint32_t H = env->sregH;
+
+    return C | Z << 1 | N << 2 | V << 3 | (N ^ V) << 4 | H << 5;
+}
+
+uint32_t avr_cc_compute_all(CPUAVRState *env)
+{
+    switch (env->cc_op) {
+    case CC_OP_ADD:
+        return compute_all_add(env);
+    case CC_OP_SUB:
+        return compute_all_sub(env);
+    case CC_OP_LOGIC:
+        return compute_all_znv(env, 0);
+    case CC_OP_INC:
+        return compute_all_znv(env, env->cc_dst == 0x80);
+    case CC_OP_DEC:
+        return compute_all_znv(env, env->cc_dst == 0x7f);
+    case CC_OP_ADDW:
+        return compute_all_addw(env);
+    case CC_OP_SUBW:
+        return compute_all_subw(env);
+    default:
+        return (env->sregC & 0x01) << 0
+             | (env->sregZ == 0 ? 1 : 0) << 1
+             | (env->sregN) << 2
+             | (env->sregV) << 3
+             | (env->sregS) << 4
+             | (env->sregH) << 5;
+    }
+}
@@ -0,0 +1,80 @@
+/*
+ * QEMU AVR edge coverage
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+/*
+ *  With -global avr.coverage=NAME every TB increments the counter of the
+ *  edge from the previous TB, map[cur ^ prev] with prev = last cur >> 1 as
+ *  AFL does. The map is shared with the fuzzer:
+ *
+ *      afl     the System V segment of __AFL_SHM_ID, set by afl-fuzz
+ *      FILE    a file which is mapped shared, e.g. in /dev/shm
+ *
+ *  The TBs are instrumented while TB_FLAGS_COVERAGE is set, i.e. cov_map is
+ *  not NULL, the translated code of a CPU without a map is unchanged. All
+ *  CPUs may share one map, their counters are not updated atomically.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "cpu.h"
+#include "coverage.h"
+
+#include <sys/shm.h>
+
+static void *avr_coverage_afl(Error **errp)
+{
+    const char *id = getenv("__AFL_SHM_ID");
+    void *map;
+
+    if (id == NULL) {
+        error_setg(errp, "__AFL_SHM_ID is not set");
+        return NULL;
+    }
+    map = shmat(atoi(id), NULL, 0);
+    if (map == (void *)-1) {
+        error_setg_errno(errp, errno, "cannot attach the AFL map %s", id);
+        return NULL;
+    }
+    return map;
+}
+
+static void *avr_coverage_file(const char *filename, Error **errp)
+{
+    void *map;
+    int fd;
+
+    fd = qemu_open(filename, O_RDWR | O_CREAT | O_BINARY, 0644);
+    if (fd < 0) {
+        error_setg_errno(errp, errno, "cannot open %s", filename);
+        return NULL;
+    }
+    if (ftruncate(fd, AVR_COVERAGE_MAP_SIZE) < 0) {
+        error_setg_errno(errp, errno, "cannot resize %s", filename);
+        qemu_close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, AVR_COVERAGE_MAP_SIZE, PROT_READ | PROT_WRITE,
+               MAP_SHARED, fd, 0);
+    qemu_close(fd);
+    if (map == MAP_FAILED) {
+        error_setg_errno(errp, errno, "cannot map %s", filename);
+        return NULL;
+    }
+    return map;
+}
+
+void avr_coverage_init(AVRCPU *cpu, const char *name, Error **errp)
+{
+    CPUAVRState *env = &cpu->env;
+
+    if (strcmp(name, "afl") == 0) {
+        env->cov_map = avr_coverage_afl(errp);
+    } else {
+        env->cov_map = avr_coverage_file(name, errp);
+    }
+    env->cov_prev = 0;
+}
@@ -0,0 +1,21 @@
+/*
+ * QEMU AVR edge coverage
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#ifndef AVR_COVERAGE_H
+#define AVR_COVERAGE_H
+
+/* the map has a byte counter per edge, as the one of AFL */
+#define AVR_COVERAGE_MAP_BITS 16
+#define AVR_COVERAGE_MAP_SIZE (1 << AVR_COVERAGE_MAP_BITS)
+
+/* the location of the TB at word address pc in the map */
+#define AVR_COVERAGE_LOC(pc) \
+    ((uint32_t)((pc) * 0x9e3779b1u) >> (32 - AVR_COVERAGE_MAP_BITS))
+
+void avr_coverage_init(AVRCPU *cpu, const char *name, Error **errp);
+
+#endif
@@ -25,6 +25,8 @@
 
 #define TYPE_AVR_CPU "avr"
 
+typedef struct AVRProfiler AVRProfiler;
+
 #define AVR_CPU_CLASS(klass) \
                     OBJECT_CLASS_CHECK(AVRCPUClass, (klass), TYPE_AVR_CPU)
 #define AVR_CPU(obj) \
@@ -50,6 +52,12 @@ typedef struct AVRCPUClass {
 /**
  *  AVRCPU:
  *  @env: #CPUAVRState
+ *  @trace_file: file of the execution trace, NULL if not traced
+ *  @trace_mem: whether the execution trace has loads & stores
+ *  @freq_hz: clock frequency, for the profiler without -icount
+ *  @profile_period: cycles between two samples of the profiler, 0 if off
+ *  @profiler: the profiler, NULL if off
+ *  @coverage: "afl" or the file of the edge coverage map, NULL if off
  *
  *  A AVR CPU.
  */
@@ -59,6 +67,15 @@ typedef struct AVRCPU {
     /*< public >*/
 
     CPUAVRState env;
+
+    char *trace_file;
+    bool trace_mem;
+
+    uint32_t freq_hz;
+    uint32_t profile_period;
+    AVRProfiler *profiler;
+
+    char *coverage;
 } AVRCPU;
 
 static inline AVRCPU *avr_env_get_cpu(CPUAVRState *env)
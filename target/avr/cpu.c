@@ -23,6 +23,13 @@
 #include "cpu.h"
 #include "qemu-common.h"
 #include "migration/vmstate.h"
+#include "sysemu/cpus.h"
+#include "exec/memory.h"
+#include "qemu/range.h"
+#include "hw/qdev-properties.h"
+#include "exec-trace.h"
+#include "profile.h"
+#include "coverage.h"
 
 static void avr_cpu_set_pc(CPUState *cs, vaddr value)
 {
@@ -36,6 +43,15 @@ static bool avr_cpu_has_work(CPUState *cs)
     AVRCPU *cpu = AVR_CPU(cs);
     CPUAVRState *env = &cpu->env;
 
+    if (env->exited) {
+        return false; /* interrupts do not wake it, see avr_batch.c */
+    }
+    if (env->quantum_parked) {
+        return false; /* until the other CPUs end the quantum */
+    }
+    if (env->quantum_released) {
+        return true;
+    }
     return (cs->interrupt_request & (CPU_INTERRUPT_HARD | CPU_INTERRUPT_RESET))
             && cpu_interrupts_enabled(env);
 }
@@ -48,6 +64,20 @@ static void avr_cpu_synchronize_from_tb(CPUState *cs, TranslationBlock *tb)
     env->pc_w = tb->pc / 2; /* internally PC points to words */
 }
 
+static void avr_cpu_exec_enter(CPUState *cs)
+{
+    AVRCPU *cpu = AVR_CPU(cs);
+    CPUAVRState *env = &cpu->env;
+
+    if (use_icount && env->cycles_debt) {
+        avr_cpu_charge_cycles(env, 0);
+    }
+    env->quantum_released = false;
+    if (env->quantum_away) {
+        avr_quantum_join(env);
+    }
+}
+
 static void avr_cpu_reset(CPUState *s)
 {
     AVRCPU *cpu = AVR_CPU(s);
@@ -65,6 +95,10 @@ static void avr_cpu_reset(CPUState *s)
     env->sregS = 0;
     env->sregH = 0;
     env->sregT = 0;
+    env->cc_op = CC_OP_FLAGS;
+    env->cycles_debt = 0;
+    env->exited = false;
+    env->cov_prev = 0;
 
     env->rampD = 0;
     env->rampX = 0;
@@ -74,6 +108,7 @@ static void avr_cpu_reset(CPUState *s)
     env->sp = 0;
 
     memset(env->r, 0, sizeof(env->r));
+    memset(env->io_ram, 0, sizeof(env->io_ram));
 
     tlb_flush(s);
 }
@@ -81,12 +116,13 @@ static void avr_cpu_reset(CPUState *s)
 static void avr_cpu_disas_set_info(CPUState *cpu, disassemble_info *info)
 {
     info->mach = bfd_arch_avr;
-    info->print_insn = NULL;
+    info->print_insn = print_insn_avr;
 }
 
 static void avr_cpu_realizefn(DeviceState *dev, Error **errp)
 {
     CPUState *cs = CPU(dev);
+    AVRCPU *cpu = AVR_CPU(dev);
     AVRCPUClass *mcc = AVR_CPU_GET_CLASS(dev);
     Error *local_err = NULL;
 
@@ -95,12 +131,113 @@ static void avr_cpu_realizefn(DeviceState *dev, Error **errp)
         error_propagate(errp, local_err);
         return;
     }
+    if (cpu->trace_file) {
+        avr_trace_init(cpu, cpu->trace_file, cpu->trace_mem, &local_err);
+        if (local_err != NULL) {
+            error_propagate(errp, local_err);
+            return;
+        }
+    }
+    if (cpu->profile_period) {
+        avr_profile_init(cpu, cpu->profile_period, &local_err);
+        if (local_err != NULL) {
+            error_propagate(errp, local_err);
+            return;
+        }
+    }
+    if (cpu->coverage) {
+        avr_coverage_init(cpu, cpu->coverage, &local_err);
+        if (local_err != NULL) {
+            error_propagate(errp, local_err);
+            return;
+        }
+    }
     qemu_init_vcpu(cs);
     cpu_reset(cs);
 
     mcc->parent_realize(dev, errp);
 }
 
+/*
+ *  The IO registers are mapped before the CPU runs, the translated code
+ *  depends on which of them are plain. The memory region stays in the IO
+ *  window too, for debug accesses
+ */
+void avr_cpu_map_io(AVRCPU *cpu, uint32_t addr, MemoryRegion *mr)
+{
+    CPUAVRState *env = &cpu->env;
+    uint32_t size = memory_region_size(mr);
+    uint32_t i;
+
+    assert(mr->ops->read && mr->ops->write);
+    assert(addr >= AVR_CPU_IO_REGS_BASE
+           && addr + size <= AVR_EXT_IO_REGS_LAST + 1);
+    /* RAMPD .. SREG belong to the CPU */
+    assert(!ranges_overlap(addr, size, AVR_CPU_IO_REGS_BASE + 0x38, 8));
+
+    for (i = 0; i < size; i++) {
+        AVRIOHandler *io = &env->io[addr + i - AVR_CPU_IO_REGS_BASE];
+
+        io->opaque = mr->opaque;
+        io->read = mr->ops->read;
+        io->write = mr->ops->write;
+        io->offset = i;
+        io->ram = false;
+        io->lock = mr->global_locking;
+        io->stop = false;
+        io->peek = false;
+    }
+}
+
+/*
+ *  the instruction which writes the extended IO register at addr is the
+ *  last of its TB. Work the device queues for the CPU, e.g. to save its
+ *  state, is then done right after this instruction
+ */
+void avr_cpu_io_stop(AVRCPU *cpu, uint32_t addr)
+{
+    AVRIOHandler *io = &cpu->env.io[addr - AVR_CPU_IO_REGS_BASE];
+
+    /* only LD/ST reach it, OUT does not */
+    assert(addr >= AVR_EXT_IO_REGS_BASE && addr <= AVR_EXT_IO_REGS_LAST);
+    assert(!io->ram);
+    io->stop = true;
+}
+
+/*
+ *  reading the IO registers at addr has no side effects, e.g. PINx. A poll
+ *  loop of them may be skipped up to the next timer event, see avr_poll_loop
+ */
+void avr_cpu_io_peek(AVRCPU *cpu, uint32_t addr, uint32_t size)
+{
+    uint32_t i;
+
+    for (i = 0; i < size; i++) {
+        AVRIOHandler *io = &cpu->env.io[addr + i - AVR_CPU_IO_REGS_BASE];
+
+        assert(io->read);
+        io->peek = true;
+    }
+}
+
+void avr_cpu_map_io_ram(AVRCPU *cpu, uint32_t addr, uint32_t size)
+{
+    CPUAVRState *env = &cpu->env;
+    uint32_t i;
+
+    assert(addr >= AVR_CPU_IO_REGS_BASE
+           && addr + size <= AVR_EXT_IO_REGS_LAST + 1);
+    /* RAMPD .. SREG belong to the CPU */
+    assert(!ranges_overlap(addr, size, AVR_CPU_IO_REGS_BASE + 0x38, 8));
+
+    for (i = 0; i < size; i++) {
+        AVRIOHandler *io = &env->io[addr + i - AVR_CPU_IO_REGS_BASE];
+
+        memset(io, 0, sizeof(*io));
+        io->ram = true;
+    }
+}
+
 static void avr_cpu_set_int(void *opaque, int irq, int level)
 {
     AVRCPU *cpu = opaque;
@@ -161,6 +298,15 @@ static ObjectClass *avr_cpu_class_by_name(const char *cpu_model)
     return oc;
 }
 
+static Property avr_cpu_properties[] = {
+    DEFINE_PROP_STRING("trace", AVRCPU, trace_file),
+    DEFINE_PROP_BOOL("trace-mem", AVRCPU, trace_mem, false),
+    DEFINE_PROP_UINT32("clock-frequency", AVRCPU, freq_hz, 16000000),
+    DEFINE_PROP_UINT32("profile", AVRCPU, profile_period, 0),
+    DEFINE_PROP_STRING("coverage", AVRCPU, coverage),
+    DEFINE_PROP_END_OF_LIST()
+};
+
 static void avr_cpu_class_init(ObjectClass *oc, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(oc);
@@ -169,6 +315,7 @@ static void avr_cpu_class_init(ObjectClass *oc, void *data)
 
     mcc->parent_realize = dc->realize;
     dc->realize = avr_cpu_realizefn;
+    dc->props = avr_cpu_properties;
 
     mcc->parent_reset = cc->reset;
     cc->reset = avr_cpu_reset;
@@ -178,6 +325,7 @@ static void avr_cpu_class_init(ObjectClass *oc, void *data)
     cc->has_work = avr_cpu_has_work;
     cc->do_interrupt = avr_cpu_do_interrupt;
     cc->cpu_exec_interrupt = avr_cpu_exec_interrupt;
+    cc->cpu_exec_enter = avr_cpu_exec_enter;
     cc->dump_state = avr_cpu_dump_state;
     cc->set_pc = avr_cpu_set_pc;
 #if !defined(CONFIG_USER_ONLY)
@@ -236,6 +384,7 @@ static void avr_avr25_initfn(Object *obj)
     avr_set_feature(env, AVR_FEATURE_2_BYTE_SP);
     avr_set_feature(env, AVR_FEATURE_LPMX);
     avr_set_feature(env, AVR_FEATURE_MOVW);
+    avr_set_feature(env, AVR_FEATURE_SPM);
 }
 
 static void avr_avr3_initfn(Object *obj)
@@ -252,6 +401,7 @@ static void avr_avr3_initfn(Object *obj)
     avr_set_feature(env, AVR_FEATURE_2_BYTE_PC);
     avr_set_feature(env, AVR_FEATURE_2_BYTE_SP);
     avr_set_feature(env, AVR_FEATURE_JMP_CALL);
+    avr_set_feature(env, AVR_FEATURE_SPM);
 }
 
 static void avr_avr31_initfn(Object *obj)
@@ -270,6 +420,7 @@ static void avr_avr31_initfn(Object *obj)
     avr_set_feature(env, AVR_FEATURE_RAMPZ);
     avr_set_feature(env, AVR_FEATURE_ELPM);
     avr_set_feature(env, AVR_FEATURE_JMP_CALL);
+    avr_set_feature(env, AVR_FEATURE_SPM);
 }
 
 static void avr_avr35_initfn(Object *obj)
@@ -288,6 +439,7 @@ static void avr_avr35_initfn(Object *obj)
     avr_set_feature(env, AVR_FEATURE_JMP_CALL);
     avr_set_feature(env, AVR_FEATURE_LPMX);
     avr_set_feature(env, AVR_FEATURE_MOVW);
+    avr_set_feature(env, AVR_FEATURE_SPM);
 }
 
 static void avr_avr4_initfn(Object *obj)
@@ -306,6 +458,7 @@ static void avr_avr4_initfn(Object *obj)
     avr_set_feature(env, AVR_FEATURE_LPMX);
     avr_set_feature(env, AVR_FEATURE_MOVW);
     avr_set_feature(env, AVR_FEATURE_MUL);
+    avr_set_feature(env, AVR_FEATURE_SPM);
 }
 
 static void avr_avr5_initfn(Object *obj)
@@ -325,6 +478,7 @@ static void avr_avr5_initfn(Object *obj)
     avr_set_feature(env, AVR_FEATURE_LPMX);
     avr_set_feature(env, AVR_FEATURE_MOVW);
     avr_set_feature(env, AVR_FEATURE_MUL);
+    avr_set_feature(env, AVR_FEATURE_SPM);
 }
 
 static void avr_avr51_initfn(Object *obj)
@@ -347,6 +501,7 @@ static void avr_avr51_initfn(Object *obj)
     avr_set_feature(env, AVR_FEATURE_LPMX);
     avr_set_feature(env, AVR_FEATURE_MOVW);
     avr_set_feature(env, AVR_FEATURE_MUL);
+    avr_set_feature(env, AVR_FEATURE_SPM);
 }
 
 static void avr_avr6_initfn(Object *obj)
@@ -370,6 +525,7 @@ static void avr_avr6_initfn(Object *obj)
     avr_set_feature(env, AVR_FEATURE_LPMX);
     avr_set_feature(env, AVR_FEATURE_MOVW);
     avr_set_feature(env, AVR_FEATURE_MUL);
+    avr_set_feature(env, AVR_FEATURE_SPM);
 }
 
 static void avr_xmega2_initfn(Object *obj)
@@ -390,6 +546,9 @@ static void avr_xmega2_initfn(Object *obj)
     avr_set_feature(env, AVR_FEATURE_MOVW);
     avr_set_feature(env, AVR_FEATURE_MUL);
     avr_set_feature(env, AVR_FEATURE_RMW);
+    avr_set_feature(env, AVR_FEATURE_XMEGA);
+    avr_set_feature(env, AVR_FEATURE_SPM);
+    avr_set_feature(env, AVR_FEATURE_SPMX);
 }
 
 static void avr_xmega4_initfn(Object *obj)
@@ -413,6 +572,9 @@ static void avr_xmega4_initfn(Object *obj)
     avr_set_feature(env, AVR_FEATURE_MOVW);
     avr_set_feature(env, AVR_FEATURE_MUL);
     avr_set_feature(env, AVR_FEATURE_RMW);
+    avr_set_feature(env, AVR_FEATURE_XMEGA);
+    avr_set_feature(env, AVR_FEATURE_SPM);
+    avr_set_feature(env, AVR_FEATURE_SPMX);
 }
 
 static void avr_xmega5_initfn(Object *obj)
@@ -439,6 +601,9 @@ static void avr_xmega5_initfn(Object *obj)
     avr_set_feature(env, AVR_FEATURE_MOVW);
     avr_set_feature(env, AVR_FEATURE_MUL);
     avr_set_feature(env, AVR_FEATURE_RMW);
+    avr_set_feature(env, AVR_FEATURE_XMEGA);
+    avr_set_feature(env, AVR_FEATURE_SPM);
+    avr_set_feature(env, AVR_FEATURE_SPMX);
 }
 
 static void avr_xmega6_initfn(Object *obj)
@@ -463,6 +628,9 @@ static void avr_xmega6_initfn(Object *obj)
     avr_set_feature(env, AVR_FEATURE_MOVW);
     avr_set_feature(env, AVR_FEATURE_MUL);
     avr_set_feature(env, AVR_FEATURE_RMW);
+    avr_set_feature(env, AVR_FEATURE_XMEGA);
+    avr_set_feature(env, AVR_FEATURE_SPM);
+    avr_set_feature(env, AVR_FEATURE_SPMX);
 }
 
 static void avr_xmega7_initfn(Object *obj)
@@ -490,6 +658,9 @@ static void avr_xmega7_initfn(Object *obj)
     avr_set_feature(env, AVR_FEATURE_MOVW);
     avr_set_feature(env, AVR_FEATURE_MUL);
     avr_set_feature(env, AVR_FEATURE_RMW);
+    avr_set_feature(env, AVR_FEATURE_XMEGA);
+    avr_set_feature(env, AVR_FEATURE_SPM);
+    avr_set_feature(env, AVR_FEATURE_SPMX);
 }
 
 typedef struct AVRCPUInfo {
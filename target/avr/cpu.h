@@ -25,10 +25,20 @@
 
 #define TARGET_LONG_BITS 32
 
+/* the cores of a board share no memory, any order will do */
+#define TCG_GUEST_DEFAULT_MO (0)
+
+/*
+ *  the extra word keeps the correction of the cycle counter for restarting
+ *  the TB at this instruction, see restore_state_to_opc
+ */
+#define TARGET_INSN_START_EXTRA_WORDS 1
+
 #define CPUArchState struct CPUAVRState
 
 #include "exec/cpu-defs.h"
 #include "fpu/softfloat.h"
+#include "qemu/notify.h"
 
 /*
  *  TARGET_PAGE_BITS cannot be more than 8 bits because
@@ -50,6 +60,21 @@
 #define MMU_CODE_IDX 0
 #define MMU_DATA_IDX 1
 
+/*
+ *  code space is flash mapped 1:1, the mapping of a code page never
+ *  changes. Its contents may, SPM invalidates the TBs of a page it
+ *  changes, see avr_flash.c. TBs may cross a page boundary and still be
+ *  chained to.
+ */
+#define TARGET_FIXED_CODE_MAPPING
+
+/*
+ *  the flash of the largest devices, the ATxmega384 with 384 KiB and an
+ *  8 KiB boot section, translate-all.c sizes the code buffer & the TB hash
+ *  table for it, about 12 MiB. -tb-size overrides it
+ */
+#define TARGET_CODE_SIZE (392 * 1024)
+
 #define EXCP_RESET 1
 #define EXCP_INT(n) (EXCP_RESET + (n) + 1)
 
@@ -78,6 +103,36 @@
 #define AVR_CPU_REGS_LAST (AVR_CPU_REGS_BASE + AVR_CPU_REGS - 1)
 #define AVR_CPU_IO_REGS_LAST (AVR_CPU_IO_REGS_BASE + AVR_CPU_IO_REGS - 1)
 
+/*
+ *  extended IO registers, accessible by LD/ST only. They are in the same IO
+ *  window at PHYS_BASE_REGS as the CPU IO regs
+ */
+#define AVR_EXT_IO_REGS_BASE (AVR_CPU_IO_REGS_BASE + AVR_CPU_IO_REGS)
+#define AVR_EXT_IO_REGS_LAST 0x00ff
+
+/*
+ *  IO register dispatch. Each IO register (data space 0x20 .. 0xff) has an
+ *  entry which IN/OUT and LD/ST go through instead of the IO window.
+ *  Registers of a device call its read & write directly with the offset of
+ *  the register in the device, under the BQL unless the region does not
+ *  need it (memory_region_clear_global_locking). Plain registers without
+ *  side effects live in env->io_ram, the translator accesses them with
+ *  loads & stores. Registers without an entry are passed to the IO window
+ *  at PHYS_BASE_REGS in the address space of the CPU
+ */
+#define AVR_IO_REGS (AVR_EXT_IO_REGS_LAST + 1 - AVR_CPU_IO_REGS_BASE)
+
+typedef struct AVRIOHandler {
+    void *opaque;
+    uint64_t (*read)(void *opaque, hwaddr offset, unsigned size);
+    void (*write)(void *opaque, hwaddr offset, uint64_t data, unsigned size);
+    hwaddr offset;
+    bool ram;
+    bool lock; /* the handler needs the BQL, see global_locking */
+    bool stop; /* a write ends the TB, see avr_cpu_io_stop */
+    bool peek; /* a read has no side effects, see avr_cpu_io_peek */
+} AVRIOHandler;
+
 enum avr_features {
     AVR_FEATURE_SRAM,
 
@@ -112,9 +167,31 @@ enum avr_features {
     AVR_FEATURE_RAMPX,
     AVR_FEATURE_RAMPY,
     AVR_FEATURE_RAMPZ,
+
+    AVR_FEATURE_XMEGA, /* AVRxm instruction timing */
+};
+
+/*
+ *  SREG flags are evaluated lazily. ALU instructions record the result and
+ *  the operands of the last flag setting operation in cc_dst, cc_src and
+ *  cc_src2 together with the kind of operation in cc_op. The flags are
+ *  computed only when something actually reads them.
+ */
+enum {
+    CC_OP_FLAGS = 0, /* C, Z, N, V, S, H are in sregC .. sregH */
+    CC_OP_ADD, /* C, Z, N, V, S, H of cc_src + cc_src2 (+ C) */
+    CC_OP_SUB, /* C, Z, N, V, S, H of cc_src - cc_src2 (- C) */
+    CC_OP_LOGIC, /* Z, N, S of cc_dst, V is 0, C & H are in sregC & sregH */
+    CC_OP_INC, /* Z, N, V, S of cc_dst, C & H are in sregC & sregH */
+    CC_OP_DEC, /* Z, N, V, S of cc_dst, C & H are in sregC & sregH */
+    CC_OP_ADDW, /* C, Z, N, V, S of 16 bits cc_src + imm, H is in sregH */
+    CC_OP_SUBW, /* C, Z, N, V, S of 16 bits cc_src - imm, H is in sregH */
+
+    CC_OP_NB,
 };
 
 typedef struct CPUAVRState CPUAVRState;
+typedef struct AVRQuantum AVRQuantum;
 
 struct CPUAVRState {
     uint32_t pc_w; /* 0x003fffff up to 22 bits */
@@ -128,6 +205,11 @@ struct CPUAVRState {
     uint32_t sregT; /* 0x00000001 1 bits */
     uint32_t sregI; /* 0x00000001 1 bits */
 
+    uint32_t cc_op; /* CC_OP_xxx, how to compute C, Z, N, V, S, H */
+    uint32_t cc_dst; /* result, bit 8 keeps Z of SBC, SBCI & CPC */
+    uint32_t cc_src; /* first operand */
+    uint32_t cc_src2; /* second operand */
+
     uint32_t rampD; /* 0x00ff0000 8 bits */
     uint32_t rampX; /* 0x00ff0000 8 bits */
     uint32_t rampY; /* 0x00ff0000 8 bits */
@@ -139,10 +221,52 @@ struct CPUAVRState {
     uint32_t sp; /* 16 bits */
 
     uint64_t intsrc; /* interrupt sources */
+    void *intc; /* interrupt controller of the board, may be NULL */
+    void *flash; /* flash controller of the board, may be NULL */
     bool fullacc;/* CPU/MEM if true MEM only otherwise */
+    bool exited; /* halted by a write of EXIT, no work until the reset */
+
+    /*
+     *  with -icount the instruction counter counts clock cycles. cycles_debt
+     *  keeps cycles spent but not yet taken from the budget, e.g. by the last
+     *  instruction before a timer deadline
+     */
+    uint32_t cycles_debt;
 
     uint32_t features;
 
+    /* indexed by IO register, data space address - AVR_CPU_IO_REGS_BASE */
+    AVRIOHandler io[AVR_IO_REGS];
+    uint8_t io_ram[AVR_IO_REGS];
+
+    /*
+     *  execution trace, see exec-trace.c. trace_buf is NULL if the CPU is
+     *  not traced, the translated code appends records to it
+     */
+    uint32_t *trace_buf;
+    uint32_t trace_pos; /* records appended so far, wraps around */
+    uint32_t trace_end; /* trace_pos at which the ring buffer is full */
+    bool trace_mem; /* trace loads & stores too */
+    void *trace;
+
+    /*
+     *  edge coverage, see coverage.c. The TBs are instrumented if cov_map
+     *  is not NULL, cov_prev is the location of the last TB >> 1
+     */
+    uint8_t *cov_map;
+    uint32_t cov_prev;
+
+    /*
+     *  the quantum barrier of the board, see quantum.c. The TBs take their
+     *  cycles from quantum_left if quantum is not NULL
+     */
+    AVRQuantum *quantum;
+    int32_t quantum_left;
+    int32_t quantum_cycles; /* of a whole quantum */
+    bool quantum_parked; /* waits for the other CPUs */
+    bool quantum_released; /* was parked, runs again */
+    bool quantum_away; /* sleeps, the other CPUs do not wait for it */
+
     /* Those resources are used only in QEMU core */
     CPU_COMMON
 };
@@ -184,8 +308,19 @@ int avr_cpu_memory_rw_debug(CPUState *cs, vaddr address, uint8_t *buf,
 
 enum {
     TB_FLAGS_FULL_ACCESS = 1,
+    TB_FLAGS_CC_OP_SHIFT = 1,
+    TB_FLAGS_CC_OP_MASK = 0x7 << TB_FLAGS_CC_OP_SHIFT,
+    TB_FLAGS_COVERAGE = 1 << 4,
+    TB_FLAGS_RAMP_ZERO = 1 << 5, /* X, Y, Z & LDS/STS are 16 bit */
+    TB_FLAGS_QUANTUM = 1 << 6,
 };
 
+/*
+ *  the TBs of a trace may start with other lazy flags, the translator keeps
+ *  track of them across the TBs anyway, see tb_gen_hot
+ */
+#define TB_FLAGS_TRACE_IGNORE TB_FLAGS_CC_OP_MASK
+
 static inline void cpu_get_tb_cpu_state(CPUAVRState *env, target_ulong *pc,
                                 target_ulong *cs_base, uint32_t *pflags)
 {
@@ -197,6 +332,16 @@ static inline void cpu_get_tb_cpu_state(CPUAVRState *env, target_ulong *pc,
     if (env->fullacc) {
         flags |= TB_FLAGS_FULL_ACCESS;
     }
+    flags |= env->cc_op << TB_FLAGS_CC_OP_SHIFT;
+    if (env->cov_map) {
+        flags |= TB_FLAGS_COVERAGE;
+    }
+    if (!(env->rampD | env->rampX | env->rampY | env->rampZ)) {
+        flags |= TB_FLAGS_RAMP_ZERO;
+    }
+    if (env->quantum) {
+        flags |= TB_FLAGS_QUANTUM;
+    }
 
     *pflags = flags;
 }
@@ -206,15 +351,33 @@ static inline int cpu_interrupts_enabled(CPUAVRState *env)
     return env->sregI != 0;
 }
 
+uint32_t avr_cc_compute_all(CPUAVRState *env);
+void avr_cpu_charge_cycles(CPUAVRState *env, uint32_t cycles);
+
+void avr_cpu_map_io(AVRCPU *cpu, uint32_t addr, MemoryRegion *mr);
+void avr_cpu_map_io_ram(AVRCPU *cpu, uint32_t addr, uint32_t size);
+void avr_cpu_io_stop(AVRCPU *cpu, uint32_t addr);
+void avr_cpu_io_peek(AVRCPU *cpu, uint32_t addr, uint32_t size);
+
+/* the MCUs of a board run in quanta of virtual time, target/avr/quantum.c */
+AVRQuantum *avr_quantum_new(uint32_t quantum_ns);
+void avr_quantum_add(AVRQuantum *q, AVRCPU *cpu, Error **errp);
+uint32_t avr_quantum_now(AVRQuantum *q);
+void avr_quantum_add_notifier(AVRQuantum *q, Notifier *n);
+void avr_quantum_leave(CPUAVRState *env);
+void avr_quantum_join(CPUAVRState *env);
+
+/* interface to the interrupt controller, hw/intc/avr_intc.c */
+void avr_intc_acknowledge_irq(void *opaque, int irq);
+uint32_t avr_intc_vector_base(void *opaque);
+
+/* interface to the flash controller, hw/misc/avr_flash.c */
+void avr_flash_spm(void *opaque, uint32_t addr, uint16_t data);
+
 static inline uint8_t cpu_get_sreg(CPUAVRState *env)
 {
     uint8_t sreg;
-    sreg = (env->sregC & 0x01) << 0
-         | (env->sregZ == 0 ? 1 : 0) << 1
-         | (env->sregN) << 2
-         | (env->sregV) << 3
-         | (env->sregS) << 4
-         | (env->sregH) << 5
+    sreg = avr_cc_compute_all(env) /* C, Z, N, V, S, H */
          | (env->sregT) << 6
          | (env->sregI) << 7;
     return sreg;
@@ -230,6 +393,7 @@ static inline void cpu_set_sreg(CPUAVRState *env, uint8_t sreg)
     env->sregH = (sreg >> 5) & 0x01;
     env->sregT = (sreg >> 6) & 0x01;
     env->sregI = (sreg >> 7) & 0x01;
+    env->cc_op = CC_OP_FLAGS;
 }
 
 #include "exec/exec-all.h"
@@ -0,0 +1,17 @@
+/*
+ * AVR decode index
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+#ifndef AVR_DECODE_INDEX_H
+#define AVR_DECODE_INDEX_H
+
+/*
+ *  index into the decode table of every first opcode word, shared by the
+ *  translator (decode-table.inc.c) and the disassembler (disas.inc.c).
+ *  Both are generated by the build from avr.yaml, see scripts/avr-decode.py
+ */
+extern const uint8_t avr_decode_index[0x10000];
+
+#endif /* AVR_DECODE_INDEX_H */
@@ -0,0 +1,200 @@
+/*
+ * QEMU AVR execution trace
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+/*
+ *  Every traced CPU has a ring buffer of records, the translated code
+ *  appends to it with a few loads and stores and publishes env->trace_pos
+ *  (see gen_trace_record). A writer thread moves the records of all CPUs to
+ *  the trace file. A CPU waits only if its ring buffer is full, i.e. if the
+ *  writer is behind.
+ *
+ *  -global avr.trace=FILE turns the trace on, -global avr.trace-mem=on adds
+ *  the data addresses of loads & stores.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/error-report.h"
+#include "qemu/thread.h"
+#include "qemu/queue.h"
+#include "qemu/atomic.h"
+#include "qemu/bswap.h"
+#include "sysemu/sysemu.h"
+#include "cpu.h"
+#include "exec/helper-proto.h"
+#include "exec-trace.h"
+
+/* how long the writer sleeps if there is nothing to write */
+#define AVR_TRACE_POLL_US 1000
+
+/* records the writer converts and writes at once */
+#define AVR_TRACE_CHUNK 4096
+
+typedef struct AVRTraceRing {
+    CPUAVRState *env;
+    uint32_t *buf;
+    int cpu_index;
+    uint32_t tail; /* next record to be written, changed by the writer */
+    QLIST_ENTRY(AVRTraceRing) next;
+} AVRTraceRing;
+
+typedef struct AVRTrace {
+    char *filename;
+    FILE *file;
+    uint32_t flags;
+    bool stop;
+    QemuThread thread;
+    QemuMutex lock; /* protects rings */
+    QLIST_HEAD(, AVRTraceRing) rings;
+    Notifier exit;
+    uint32_t chunk[2 + AVR_TRACE_CHUNK];
+} AVRTrace;
+
+static AVRTrace *avr_trace;
+
+/* writes what the CPUs appended since the last call, false if nothing */
+static bool avr_trace_drain(AVRTrace *t)
+{
+    AVRTraceRing *ring;
+    bool busy = false;
+
+    qemu_mutex_lock(&t->lock);
+    QLIST_FOREACH(ring, &t->rings, next) {
+        uint32_t pos = atomic_read(&ring->env->trace_pos);
+
+        smp_rmb(); /* pairs with the barrier after storing a record */
+        while (ring->tail != pos) {
+            uint32_t n = MIN(pos - ring->tail, AVR_TRACE_CHUNK);
+            uint32_t i;
+
+            t->chunk[0] = cpu_to_le32(ring->cpu_index);
+            t->chunk[1] = cpu_to_le32(n);
+            for (i = 0; i < n; i++) {
+                t->chunk[2 + i] = cpu_to_le32(
+                    ring->buf[(ring->tail + i) & (AVR_TRACE_RECORDS - 1)]);
+            }
+            fwrite(t->chunk, sizeof(uint32_t), 2 + n, t->file);
+
+            atomic_mb_set(&ring->tail, ring->tail + n);
+            busy = true;
+        }
+    }
+    qemu_mutex_unlock(&t->lock);
+
+    return busy;
+}
+
+static void *avr_trace_thread(void *opaque)
+{
+    AVRTrace *t = opaque;
+
+    while (!atomic_read(&t->stop)) {
+        if (!avr_trace_drain(t)) {
+            g_usleep(AVR_TRACE_POLL_US);
+        }
+    }
+    return NULL;
+}
+
+static void avr_trace_exit(Notifier *n, void *data)
+{
+    AVRTrace *t = container_of(n, AVRTrace, exit);
+
+    atomic_set(&t->stop, true);
+    qemu_thread_join(&t->thread);
+
+    avr_trace_drain(t);
+    if (ferror(t->file) || fclose(t->file)) {
+        error_report("avr: cannot write trace file %s", t->filename);
+    }
+}
+
+static AVRTrace *avr_trace_open(const char *filename, uint32_t flags,
+                                Error **errp)
+{
+    AVRTrace *t;
+    uint32_t header[2] = {
+        cpu_to_le32(AVR_TRACE_VERSION),
+        cpu_to_le32(flags),
+    };
+    FILE *file;
+
+    file = fopen(filename, "wb");
+    if (file == NULL) {
+        error_setg_errno(errp, errno, "cannot open trace file %s", filename);
+        return NULL;
+    }
+    fwrite(AVR_TRACE_MAGIC, 1, strlen(AVR_TRACE_MAGIC), file);
+    fwrite(header, sizeof(header), 1, file);
+
+    t = g_new0(AVRTrace, 1);
+    t->filename = g_strdup(filename);
+    t->file = file;
+    t->flags = flags;
+    qemu_mutex_init(&t->lock);
+    QLIST_INIT(&t->rings);
+
+    qemu_thread_create(&t->thread, "avr-trace", avr_trace_thread, t,
+                       QEMU_THREAD_JOINABLE);
+    t->exit.notify = avr_trace_exit;
+    qemu_add_exit_notifier(&t->exit);
+
+    return t;
+}
+
+void avr_trace_init(AVRCPU *cpu, const char *filename, bool mem,
+                    Error **errp)
+{
+    CPUAVRState *env = &cpu->env;
+    uint32_t flags = mem ? AVR_TRACE_FLAG_MEM : 0;
+    AVRTraceRing *ring;
+
+    if (avr_trace == NULL) {
+        avr_trace = avr_trace_open(filename, flags, errp);
+        if (avr_trace == NULL) {
+            return;
+        }
+    } else if (strcmp(avr_trace->filename, filename)
+               || avr_trace->flags != flags) {
+        error_setg(errp, "all CPUs have to be traced the same way");
+        return;
+    }
+
+    ring = g_new0(AVRTraceRing, 1);
+    ring->env = env;
+    ring->buf = g_new(uint32_t, AVR_TRACE_RECORDS);
+    ring->cpu_index = CPU(cpu)->cpu_index;
+
+    env->trace_buf = ring->buf;
+    env->trace_pos = 0;
+    env->trace_end = AVR_TRACE_RECORDS;
+    env->trace_mem = mem;
+    env->trace = ring;
+
+    qemu_mutex_lock(&avr_trace->lock);
+    QLIST_INSERT_HEAD(&avr_trace->rings, ring, next);
+    qemu_mutex_unlock(&avr_trace->lock);
+}
+
+/*
+ *  the ring buffer is full, the records from trace_end - AVR_TRACE_RECORDS
+ *  on are not written yet
+ */
+void avr_trace_wait(CPUAVRState *env)
+{
+    AVRTraceRing *ring = env->trace;
+
+    while (atomic_mb_read(&ring->tail) == env->trace_end - AVR_TRACE_RECORDS) {
+        g_usleep(AVR_TRACE_POLL_US / 10);
+    }
+    env->trace_end = atomic_mb_read(&ring->tail) + AVR_TRACE_RECORDS;
+}
+
+void helper_trace_wait(CPUAVRState *env)
+{
+    avr_trace_wait(env);
+}
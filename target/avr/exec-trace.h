@@ -0,0 +1,63 @@
+/*
+ * QEMU AVR execution trace
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#ifndef AVR_EXEC_TRACE_H
+#define AVR_EXEC_TRACE_H
+
+#include "qemu/atomic.h"
+
+/*
+ *  A record is a 32 bits word, the kind in the top byte and a byte address
+ *  in the others. The trace file starts with
+ *
+ *      "AVRTRACE", version, flags      8 bytes, 2 x 32 bits
+ *
+ *  followed by chunks of records of one CPU
+ *
+ *      cpu index, number of records    2 x 32 bits
+ *      records
+ *
+ *  everything is little endian. scripts/avr-trace.py reads it.
+ */
+#define AVR_TRACE_MAGIC "AVRTRACE"
+#define AVR_TRACE_VERSION 1
+
+#define AVR_TRACE_FLAG_MEM 1 /* loads & stores are traced */
+
+enum {
+    AVR_TRACE_TB = 0, /* TB entry, the code address of the TB */
+    AVR_TRACE_LD = 1, /* data load, the data address */
+    AVR_TRACE_ST = 2, /* data store, the data address */
+    AVR_TRACE_CALL = 3, /* CALL, RCALL, ICALL, EICALL, the code address */
+    AVR_TRACE_RET = 4, /* RET, RETI, the code address */
+    AVR_TRACE_INT = 5, /* interrupt entry, the interrupted code address */
+};
+
+#define AVR_TRACE_KIND_SHIFT 24
+#define AVR_TRACE_ADDR_MASK 0x00ffffff
+
+#define AVR_TRACE_RECORD(kind, addr) \
+    ((uint32_t)(kind) << AVR_TRACE_KIND_SHIFT | (addr))
+
+/* records per CPU ring buffer, a power of 2 */
+#define AVR_TRACE_RECORDS (1 << 20)
+
+void avr_trace_init(AVRCPU *cpu, const char *filename, bool mem,
+                    Error **errp);
+void avr_trace_wait(CPUAVRState *env);
+
+static inline void avr_trace_record(CPUAVRState *env, uint32_t record)
+{
+    env->trace_buf[env->trace_pos & (AVR_TRACE_RECORDS - 1)] = record;
+    smp_wmb(); /* the writer reads the record after trace_pos */
+    atomic_set(&env->trace_pos, env->trace_pos + 1);
+    if (env->trace_pos == env->trace_end) {
+        avr_trace_wait(env);
+    }
+}
+
+#endif
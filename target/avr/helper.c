@@ -24,11 +24,13 @@
 #include "hw/irq.h"
 #include "include/hw/sysbus.h"
 #include "include/sysemu/sysemu.h"
+#include "sysemu/cpus.h"
 #include "exec/exec-all.h"
 #include "exec/cpu_ldst.h"
 #include "qemu/host-utils.h"
 #include "exec/helper-proto.h"
 #include "exec/ioport.h"
+#include "exec-trace.h"
 
 bool avr_cpu_exec_interrupt(CPUState *cs, int interrupt_request)
 {
@@ -49,12 +51,20 @@ bool avr_cpu_exec_interrupt(CPUState *cs, int interrupt_request)
     }
     if (interrupt_request & CPU_INTERRUPT_HARD) {
         if (cpu_interrupts_enabled(env) && env->intsrc != 0) {
-            int index = ctz32(env->intsrc);
+            int index = ctz64(env->intsrc);
             cs->exception_index = EXCP_INT(index);
             cc->do_interrupt(cs);
 
-            env->intsrc &= env->intsrc - 1; /* clear the interrupt */
-            cs->interrupt_request &= ~CPU_INTERRUPT_HARD;
+            if (env->intc) {
+                /*
+                 * the device clears its flag if the hardware does, which
+                 * lowers the line
+                 */
+                avr_intc_acknowledge_irq(env->intc, index);
+            } else {
+                env->intsrc &= env->intsrc - 1; /* clear the interrupt */
+                cs->interrupt_request &= ~CPU_INTERRUPT_HARD;
+            }
 
             ret = true;
         }
@@ -70,12 +80,22 @@ void avr_cpu_do_interrupt(CPUState *cs)
     uint32_t ret = env->pc_w;
     int vector = 0;
     int size = avr_feature(env, AVR_FEATURE_JMP_CALL) ? 2 : 1;
-    int base = 0; /* TODO: where to get it */
+    int base = env->intc ? avr_intc_vector_base(env->intc) : 0;
 
     if (cs->exception_index == EXCP_RESET) {
         vector = 0;
     } else if (env->intsrc != 0) {
-        vector = ctz32(env->intsrc) + 1;
+        vector = ctz64(env->intsrc) + 1;
+    }
+
+    if (env->trace_buf && cs->exception_index != EXCP_RESET) {
+        avr_trace_record(env, AVR_TRACE_RECORD(AVR_TRACE_INT, ret * 2));
+    }
+
+    if (use_icount && cs->exception_index != EXCP_RESET) {
+        /* the interrupt response takes as long as a CALL */
+        avr_cpu_charge_cycles(env,
+                              avr_feature(env, AVR_FEATURE_3_BYTE_PC) ? 5 : 4);
     }
 
     if (avr_feature(env, AVR_FEATURE_3_BYTE_PC)) {
@@ -95,6 +115,22 @@ void avr_cpu_do_interrupt(CPUState *cs)
     cs->exception_index = -1;
 }
 
+/*
+ *  takes cycles from the instruction counter budget of the current run. what
+ *  does not fit is kept and taken when the next run starts
+ */
+void avr_cpu_charge_cycles(CPUAVRState *env, uint32_t cycles)
+{
+    CPUState *cs = CPU(avr_env_get_cpu(env));
+    uint32_t n;
+
+    env->cycles_debt += cycles;
+
+    n = MIN(env->cycles_debt, cs->icount_decr.u16.low);
+    cs->icount_decr.u16.low -= n;
+    env->cycles_debt -= n;
+}
+
 int avr_cpu_memory_rw_debug(CPUState *cs, vaddr addr, uint8_t *buf,
                                 int len, bool is_write)
 {
@@ -147,14 +183,78 @@ void tlb_fill(CPUState *cs, target_ulong vaddr, MMUAccessType access_type,
     tlb_set_page_with_attrs(cs, vaddr, paddr, attrs, prot, mmu_idx, page_size);
 }
 
+/*
+ *  runs the current instruction again in a TB of its own with
+ *  TB_FLAGS_FULL_ACCESS, for the rare cases the TB was not translated for
+ */
+void helper_fullacc(CPUAVRState *env)
+{
+    env->fullacc = 1;
+    cpu_loop_exit_restore(CPU(avr_env_get_cpu(env)), GETPC());
+}
+
 void helper_sleep(CPUAVRState *env)
 {
     CPUState *cs = CPU(avr_env_get_cpu(env));
 
+    /*
+     *  the CPU waits for an interrupt, with -icount sleep=off the virtual
+     *  clock jumps to the next timer event while all CPUs are halted
+     */
+    avr_quantum_leave(env);
+    cs->halted = 1;
     cs->exception_index = EXCP_HLT;
     cpu_loop_exit(cs);
 }
 
+/*
+ *  a poll loop waits for an IO bit. When a timer event is pending the cycles
+ *  up to it are spent at once, the TB then chains to the loop again which
+ *  ends the budget there. Without one nothing is skipped, the bit may be
+ *  set by a chardev at any time. Called from the last instruction of its TB
+ *  with can_do_io set, it reads the virtual clock
+ */
+void helper_idle(CPUAVRState *env)
+{
+    CPUState *cs = CPU(avr_env_get_cpu(env));
+    int64_t deadline;
+    int64_t left;
+    int64_t skip;
+
+    deadline = qemu_clock_deadline_ns_all(QEMU_CLOCK_VIRTUAL);
+    if (use_icount && deadline >= 0) {
+        left = cs->icount_decr.u16.low + cs->icount_extra;
+        skip = MIN(left, DIV_ROUND_UP(deadline, cpu_icount_to_ns(1)));
+        left -= skip;
+        cs->icount_decr.u16.low = MIN(left, 0xffff);
+        cs->icount_extra = left - cs->icount_decr.u16.low;
+    }
+}
+
+/*
+ *  SPM passes RAMPZ:Z and R1:R0 to the flash controller, SPMCSR selects
+ *  what it does
+ */
+void helper_spm(CPUAVRState *env)
+{
+    uint32_t addr = env->rampZ | (env->r[31] << 8) | env->r[30];
+    bool locked;
+
+    if (env->flash == NULL) {
+        qemu_log_mask(LOG_UNIMP, "SPM without a flash controller\n");
+        return;
+    }
+
+    locked = qemu_mutex_iothread_locked();
+    if (!locked) {
+        qemu_mutex_lock_iothread();
+    }
+    avr_flash_spm(env->flash, addr, (env->r[1] << 8) | env->r[0]);
+    if (!locked) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
 void helper_unsupported(CPUAVRState *env)
 {
     CPUState *cs = CPU(avr_env_get_cpu(env));
@@ -188,13 +288,77 @@ void helper_wdr(CPUAVRState *env)
     cpu_loop_exit(cs);
 }
 
+/*
+ *  reads & writes IO register reg through the dispatch table, devices are
+ *  called with the iothread lock held like by the memory dispatch
+ */
+static uint8_t avr_io_read(CPUAVRState *env, uint32_t reg)
+{
+    AVRIOHandler *io = &env->io[reg];
+    bool locked;
+    uint8_t data = 0;
+
+    if (io->ram) {
+        return env->io_ram[reg];
+    }
+    if (io->read == NULL) {
+        address_space_read(CPU(avr_env_get_cpu(env))->as,
+                           PHYS_BASE_REGS + AVR_CPU_IO_REGS_BASE + reg,
+                           MEMTXATTRS_UNSPECIFIED, &data, 1);
+        return data;
+    }
+    if (!io->lock) {
+        return io->read(io->opaque, io->offset, 1);
+    }
+
+    locked = qemu_mutex_iothread_locked();
+    if (!locked) {
+        qemu_mutex_lock_iothread();
+    }
+    data = io->read(io->opaque, io->offset, 1);
+    if (!locked) {
+        qemu_mutex_unlock_iothread();
+    }
+
+    return data;
+}
+
+static void avr_io_write(CPUAVRState *env, uint32_t reg, uint8_t data)
+{
+    AVRIOHandler *io = &env->io[reg];
+    bool locked;
+
+    if (io->ram) {
+        env->io_ram[reg] = data;
+        return;
+    }
+    if (io->write == NULL) {
+        address_space_write(CPU(avr_env_get_cpu(env))->as,
+                            PHYS_BASE_REGS + AVR_CPU_IO_REGS_BASE + reg,
+                            MEMTXATTRS_UNSPECIFIED, &data, 1);
+        return;
+    }
+    if (!io->lock) {
+        io->write(io->opaque, io->offset, data, 1);
+        return;
+    }
+
+    locked = qemu_mutex_iothread_locked();
+    if (!locked) {
+        qemu_mutex_lock_iothread();
+    }
+    io->write(io->opaque, io->offset, data, 1);
+    if (!locked) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
 /*
  * This function implements IN instruction
  *
  * It does the following
  * a.  if an IO register belongs to CPU, its value is read and returned
- * b.  otherwise io address is translated to mem address and physical memory
- *     is read.
+ * b.  otherwise the register is read through the IO dispatch table
  * c.  it caches the value for sake of SBI, SBIC, SBIS & CBI implementation
  *
  */
@@ -232,53 +396,63 @@ target_ulong helper_inb(CPUAVRState *env, uint32_t port)
          * CPU does not know how to read this register, pass it to the
          * device/board
          */
-        cpu_physical_memory_read(PHYS_BASE_REGS + port + AVR_CPU_IO_REGS_BASE,
-                                 &data, 1);
+        data = avr_io_read(env, port);
     }
 
     return data;
 }
 
+/*
+ *  a TB with TB_FLAGS_RAMP_ZERO takes RAMPD, RAMPX, RAMPY & RAMPZ as 0. The
+ *  instruction which changes whether they are all 0 is executed again in a
+ *  TB of the new flags, writing the register twice does no harm. Either
+ *  way, the TB would chain to a next TB of the flags it started with
+ */
+static void avr_set_ramp(CPUAVRState *env, uint32_t *ramp, uint32_t data,
+                         uintptr_t retaddr)
+{
+    bool zero = !(env->rampD | env->rampX | env->rampY | env->rampZ);
+
+    *ramp = (data & 0xff) << 16;
+    if (zero != !(env->rampD | env->rampX | env->rampY | env->rampZ)) {
+        cpu_loop_exit_restore(CPU(avr_env_get_cpu(env)), retaddr);
+    }
+}
+
 /*
  *  This function implements OUT instruction
  *
  *  It does the following
  *  a.  if an IO register belongs to CPU, its value is written into the register
- *  b.  otherwise io address is translated to mem address and physical memory
- *      is written.
+ *  b.  otherwise the register is written through the IO dispatch table
  *  c.  it caches the value for sake of SBI, SBIC, SBIS & CBI implementation
  *
+ *  retaddr is that of the generated code, for a restart of the instruction
  */
-void helper_outb(CPUAVRState *env, uint32_t port, uint32_t data)
+static void avr_outb(CPUAVRState *env, uint32_t port, uint32_t data,
+                     uintptr_t retaddr)
 {
     data &= 0x000000ff;
 
     switch (port) {
-    case 0x04:
-        {
-            CPUState *cpu = CPU(avr_env_get_cpu(env));
-            qemu_irq irq = qdev_get_gpio_in(DEVICE(cpu), 3);
-            qemu_set_irq(irq, 1);
-        }
-        break;
     case 0x38: /* RAMPD */
         if (avr_feature(env, AVR_FEATURE_RAMPD)) {
-            env->rampD = (data & 0xff) << 16;
+            avr_set_ramp(env, &env->rampD, data, retaddr);
         }
         break;
     case 0x39: /* RAMPX */
         if (avr_feature(env, AVR_FEATURE_RAMPX)) {
-            env->rampX = (data & 0xff) << 16;
+            avr_set_ramp(env, &env->rampX, data, retaddr);
         }
         break;
     case 0x3a: /* RAMPY */
         if (avr_feature(env, AVR_FEATURE_RAMPY)) {
-            env->rampY = (data & 0xff) << 16;
+            avr_set_ramp(env, &env->rampY, data, retaddr);
         }
         break;
     case 0x3b: /* RAMPZ */
         if (avr_feature(env, AVR_FEATURE_RAMPZ)) {
-            env->rampZ = (data & 0xff) << 16;
+            avr_set_ramp(env, &env->rampZ, data, retaddr);
         }
         break;
     case 0x3c: /* EIDN */
@@ -300,9 +474,43 @@ void helper_outb(CPUAVRState *env, uint32_t port, uint32_t data)
          * CPU does not know how to write this register, pass it to the
          * device/board
          */
-        cpu_physical_memory_write(PHYS_BASE_REGS + port + AVR_CPU_IO_REGS_BASE,
-                                  &data, 1);
+        avr_io_write(env, port, data);
+    }
+}
+
+void helper_outb(CPUAVRState *env, uint32_t port, uint32_t data)
+{
+    avr_outb(env, port, data, GETPC());
+}
+
+/*
+ *  a device behind an IO register may read the virtual clock, with -icount
+ *  the TB is translated again to end at this access
+ */
+static void avr_fullacc_io(CPUAVRState *env, uintptr_t retaddr)
+{
+    CPUState *cs = CPU(avr_env_get_cpu(env));
+
+    if (use_icount && !cs->can_do_io) {
+        /* the access is executed again by a TB with full access */
+        env->fullacc = true;
+        cpu_io_recompile(cs, retaddr);
+    }
+}
+
+/*
+ *  an IO register which is plain storage, e.g. GPIOR0, has no device behind
+ *  it which could read the clock, it is accessed without full access
+ */
+static uint8_t *avr_io_ram(CPUAVRState *env, uint32_t addr)
+{
+    uint32_t reg = addr - AVR_CPU_IO_REGS_BASE;
+
+    if (addr < AVR_CPU_IO_REGS_BASE || addr > AVR_EXT_IO_REGS_LAST
+            || !env->io[reg].ram) {
+        return NULL;
     }
+    return &env->io_ram[reg];
 }
 
 /*
@@ -311,9 +519,13 @@ void helper_outb(CPUAVRState *env, uint32_t port, uint32_t data)
  */
 target_ulong helper_fullrd(CPUAVRState *env, uint32_t addr)
 {
+    uint8_t *ram = avr_io_ram(env, addr);
     uint8_t data;
 
     env->fullacc = false;
+    if (ram) {
+        return *ram;
+    }
     switch (addr) {
     case AVR_CPU_REGS_BASE ... AVR_CPU_REGS_LAST:
         /* CPU registers */
@@ -321,23 +533,39 @@ target_ulong helper_fullrd(CPUAVRState *env, uint32_t addr)
         break;
     case AVR_CPU_IO_REGS_BASE ... AVR_CPU_IO_REGS_LAST:
         /* CPU IO registers */
-        data = helper_inb(env, addr);
+        avr_fullacc_io(env, GETPC());
+        data = helper_inb(env, addr - AVR_CPU_IO_REGS_BASE);
+        break;
+    case AVR_EXT_IO_REGS_BASE ... AVR_EXT_IO_REGS_LAST:
+        /* extended IO registers */
+        avr_fullacc_io(env, GETPC());
+        data = avr_io_read(env, addr - AVR_CPU_IO_REGS_BASE);
         break;
     default:
         /* memory */
-        cpu_physical_memory_read(PHYS_BASE_DATA + addr - VIRT_BASE_DATA,
-                                 &data, 1);
+        address_space_read(CPU(avr_env_get_cpu(env))->as,
+                           PHYS_BASE_DATA + addr - VIRT_BASE_DATA,
+                           MEMTXATTRS_UNSPECIFIED, &data, 1);
     }
     return data;
 }
 
 /*
  *  this function implements LD instruction when there is a posibility to write
- *  into a CPU register
+ *  into a CPU register. last is set in a TB of TB_FLAGS_FULL_ACCESS, which
+ *  ends with this instruction
  */
-void helper_fullwr(CPUAVRState *env, uint32_t data, uint32_t addr)
+void helper_fullwr(CPUAVRState *env, uint32_t data, uint32_t addr,
+                   uint32_t last)
 {
+    uint8_t *ram = avr_io_ram(env, addr);
+    uint8_t byte;
+
     env->fullacc = false;
+    if (ram) {
+        *ram = data;
+        return;
+    }
     switch (addr) {
     case AVR_CPU_REGS_BASE ... AVR_CPU_REGS_LAST:
         /* CPU registers */
@@ -345,11 +573,33 @@ void helper_fullwr(CPUAVRState *env, uint32_t data, uint32_t addr)
         break;
     case AVR_CPU_IO_REGS_BASE ... AVR_CPU_IO_REGS_LAST:
         /* CPU IO registers */
-        helper_outb(env, data, addr);
+        avr_fullacc_io(env, GETPC());
+        if (addr == AVR_CPU_IO_REGS_BASE + 0x3f && env->cc_op != CC_OP_FLAGS) {
+            /*
+             * the TB was translated with lazy flags, writing SREG here
+             * would make them inconsistent. Compute the flags and execute
+             * this instruction again in a TB which expects them in SREG
+             */
+            cpu_set_sreg(env, cpu_get_sreg(env));
+            cpu_loop_exit_restore(CPU(avr_env_get_cpu(env)), GETPC());
+        }
+        avr_outb(env, addr - AVR_CPU_IO_REGS_BASE, data, GETPC());
+        break;
+    case AVR_EXT_IO_REGS_BASE ... AVR_EXT_IO_REGS_LAST:
+        /* extended IO registers */
+        avr_fullacc_io(env, GETPC());
+        if (env->io[addr - AVR_CPU_IO_REGS_BASE].stop && !last) {
+            /* the access is executed again by a TB which ends with it */
+            env->fullacc = true;
+            cpu_loop_exit_restore(CPU(avr_env_get_cpu(env)), GETPC());
+        }
+        avr_io_write(env, addr - AVR_CPU_IO_REGS_BASE, data);
         break;
     default:
         /* memory */
-        cpu_physical_memory_write(PHYS_BASE_DATA + addr - VIRT_BASE_DATA,
-                                  &data, 1);
+        byte = data;
+        address_space_write(CPU(avr_env_get_cpu(env))->as,
+                            PHYS_BASE_DATA + addr - VIRT_BASE_DATA,
+                            MEMTXATTRS_UNSPECIFIED, &byte, 1);
     }
 }
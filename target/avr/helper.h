@@ -21,8 +21,13 @@
 DEF_HELPER_1(wdr, void, env)
 DEF_HELPER_1(debug, void, env)
 DEF_HELPER_1(sleep, void, env)
+DEF_HELPER_1(idle, void, env)
+DEF_HELPER_1(quantum, void, env)
 DEF_HELPER_1(unsupported, void, env)
+DEF_HELPER_1(spm, void, env)
+DEF_HELPER_1(fullacc, void, env)
+DEF_HELPER_FLAGS_1(trace_wait, TCG_CALL_NO_RWG, void, env)
 DEF_HELPER_3(outb, void, env, i32, i32)
 DEF_HELPER_2(inb, tl, env, i32)
-DEF_HELPER_3(fullwr, void, env, i32, i32)
+DEF_HELPER_4(fullwr, void, env, i32, i32, i32)
 DEF_HELPER_2(fullrd, tl, env, i32)
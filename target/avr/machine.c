@@ -96,7 +96,7 @@ static const VMStateInfo vms_eind = {
 
 const VMStateDescription vms_avr_cpu = {
     .name = "cpu",
-    .version_id = 0,
+    .version_id = 2,
     .minimum_version_id = 0,
     .fields = (VMStateField[]) {
         VMSTATE_UINT32(env.pc_w, AVRCPU),
@@ -111,6 +111,10 @@ const VMStateDescription vms_avr_cpu = {
         VMSTATE_SINGLE(env.rampZ, AVRCPU, 0, vms_rampZ, uint32_t),
         VMSTATE_SINGLE(env.eind, AVRCPU, 0, vms_eind, uint32_t),
 
+        VMSTATE_UINT8_ARRAY_V(env.io_ram, AVRCPU, AVR_IO_REGS, 1),
+        VMSTATE_UINT64_V(env.intsrc, AVRCPU, 2),
+        VMSTATE_UINT32_V(env.cycles_debt, AVRCPU, 2),
+
         VMSTATE_END_OF_LIST()
     }
 };
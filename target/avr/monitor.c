@@ -0,0 +1,71 @@
+/*
+ * QEMU monitor for AVR
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qmp-commands.h"
+#include "qapi/qmp/qdict.h"
+#include "monitor/monitor.h"
+#include "cpu.h"
+#include "monitor/hmp-target.h"
+#include "profile.h"
+
+#define AVR_PROFILE_HMP_TOP 20
+
+AvrProfileList *qmp_query_avr_profile(bool has_top, int64_t top,
+                                      bool has_reset, bool reset,
+                                      Error **errp)
+{
+    AvrProfileList *head = NULL;
+    AvrProfileList **tail = &head;
+    CPUState *cs;
+
+    CPU_FOREACH(cs) {
+        AVRCPU *cpu = AVR_CPU(cs);
+        AvrProfileList *item;
+
+        if (cpu->profiler == NULL) {
+            continue;
+        }
+        item = g_new0(AvrProfileList, 1);
+        item->value = avr_profile_query(cpu, has_top ? top : 0,
+                                        has_reset && reset);
+        *tail = item;
+        tail = &item->next;
+    }
+    return head;
+}
+
+void hmp_info_avr_profile(Monitor *mon, const QDict *qdict)
+{
+    int64_t top = qdict_get_try_int(qdict, "top", AVR_PROFILE_HMP_TOP);
+    AvrProfileList *list = qmp_query_avr_profile(true, top, false, false,
+                                                 NULL);
+    AvrProfileList *p;
+
+    if (list == NULL) {
+        monitor_printf(mon, "no profiler, see -global avr.profile\n");
+        return;
+    }
+
+    for (p = list; p; p = p->next) {
+        AvrProfile *info = p->value;
+        AvrProfileSampleList *s;
+
+        monitor_printf(mon, "CPU %" PRId64 ": %" PRId64
+                       " samples, one every %" PRId64 " cycles\n",
+                       info->cpu_index, info->samples, info->period);
+        monitor_printf(mon, "%10s %7s %8s %8s\n", "count", "%", "pc", "ret");
+        for (s = info->histogram; s; s = s->next) {
+            AvrProfileSample *e = s->value;
+
+            monitor_printf(mon, "%10" PRId64 " %6.2f%% %08" PRIx64
+                           " %08" PRIx64 "\n", e->count,
+                           100.0 * e->count / info->samples, e->pc, e->ret);
+        }
+    }
+    qapi_free_AvrProfileList(list);
+}
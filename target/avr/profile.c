@@ -0,0 +1,174 @@
+/*
+ * QEMU AVR sampling profiler
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+/*
+ *  Every N cycles (-global avr.profile=N) a timer queues work on the CPU,
+ *  which kicks it out of cpu_exec at the end of its current TB. The work
+ *  then takes a sample: the PC and the return address on top of the
+ *  stack are counted in a histogram. The translated code is not
+ *  changed, so the profiler may run all the time. query-avr-profile and
+ *  "info avr-profile" show the histogram.
+ *
+ *  With -icount a cycle is what the instruction counter counts, otherwise
+ *  the period is converted with the clock-frequency of the CPU.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/timer.h"
+#include "qemu/host-utils.h"
+#include "sysemu/cpus.h"
+#include "exec/cpu-common.h"
+#include "cpu.h"
+#include "profile.h"
+
+typedef struct AVRProfileEntry {
+    uint64_t key; /* PC << 32 | return address, both in words */
+    uint64_t count;
+} AVRProfileEntry;
+
+struct AVRProfiler {
+    AVRCPU *cpu;
+    uint32_t period; /* cycles between two samples */
+    int64_t period_ns;
+    int64_t next; /* virtual time of the next sample */
+    QEMUTimer *timer;
+    GHashTable *histogram; /* of AVRProfileEntry, by key */
+    uint64_t samples;
+};
+
+/* the return address a RET would take, pushed low byte first */
+static uint32_t avr_profile_ret(CPUAVRState *env)
+{
+    uint8_t buf[3];
+    int size = 1;
+    uint32_t ret = 0;
+    int i;
+
+    if (avr_feature(env, AVR_FEATURE_3_BYTE_PC)) {
+        size = 3;
+    } else if (avr_feature(env, AVR_FEATURE_2_BYTE_PC)) {
+        size = 2;
+    }
+    address_space_read(CPU(avr_env_get_cpu(env))->as,
+                       PHYS_BASE_DATA + env->sp + 1, MEMTXATTRS_UNSPECIFIED,
+                       buf, size);
+    for (i = 0; i < size; i++) {
+        ret = ret << 8 | buf[i];
+    }
+    return ret;
+}
+
+/*
+ *  queued work, runs in the thread of the CPU after it left cpu_exec, when
+ *  the CPU state is in sync with the PC of the next TB
+ */
+static void avr_profile_sample(CPUState *cs, run_on_cpu_data data)
+{
+    AVRProfiler *p = data.host_ptr;
+    CPUAVRState *env = &p->cpu->env;
+    uint64_t key = (uint64_t)env->pc_w << 32 | avr_profile_ret(env);
+    AVRProfileEntry *e;
+
+    e = g_hash_table_lookup(p->histogram, &key);
+    if (e == NULL) {
+        e = g_new0(AVRProfileEntry, 1);
+        e->key = key;
+        g_hash_table_insert(p->histogram, &e->key, e);
+    }
+    e->count++;
+    p->samples++;
+}
+
+static void avr_profile_tick(void *opaque)
+{
+    AVRProfiler *p = opaque;
+
+    async_run_on_cpu(CPU(p->cpu), avr_profile_sample, RUN_ON_CPU_HOST_PTR(p));
+
+    p->next += p->period_ns;
+    timer_mod(p->timer, p->next);
+}
+
+void avr_profile_init(AVRCPU *cpu, uint32_t period, Error **errp)
+{
+    AVRProfiler *p;
+
+    if (!use_icount && cpu->freq_hz == 0) {
+        error_setg(errp, "the profiler needs -icount or a clock-frequency");
+        return;
+    }
+
+    p = g_new0(AVRProfiler, 1);
+    p->cpu = cpu;
+    p->period = period;
+    if (use_icount) {
+        p->period_ns = cpu_icount_to_ns(period);
+    } else {
+        p->period_ns = muldiv64(period, NANOSECONDS_PER_SECOND, cpu->freq_hz);
+    }
+    p->period_ns = MAX(p->period_ns, 1);
+    p->histogram = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                         NULL, g_free);
+    p->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, avr_profile_tick, p);
+    p->next = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + p->period_ns;
+    timer_mod(p->timer, p->next);
+
+    cpu->profiler = p;
+}
+
+static gint avr_profile_compare(gconstpointer a, gconstpointer b)
+{
+    const AVRProfileEntry *ea = *(AVRProfileEntry * const *)a;
+    const AVRProfileEntry *eb = *(AVRProfileEntry * const *)b;
+
+    if (ea->count != eb->count) {
+        return ea->count < eb->count ? 1 : -1;
+    }
+    return ea->key < eb->key ? -1 : ea->key > eb->key;
+}
+
+AvrProfile *avr_profile_query(AVRCPU *cpu, int64_t top, bool reset)
+{
+    AVRProfiler *p = cpu->profiler;
+    AvrProfile *info = g_new0(AvrProfile, 1);
+    AvrProfileSampleList **tail = &info->histogram;
+    GPtrArray *entries;
+    GHashTableIter iter;
+    gpointer value;
+    guint i;
+
+    info->cpu_index = CPU(cpu)->cpu_index;
+    info->period = p->period;
+    info->samples = p->samples;
+
+    entries = g_ptr_array_sized_new(g_hash_table_size(p->histogram));
+    g_hash_table_iter_init(&iter, p->histogram);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        g_ptr_array_add(entries, value);
+    }
+    g_ptr_array_sort(entries, avr_profile_compare);
+
+    for (i = 0; i < entries->len && (top <= 0 || i < top); i++) {
+        AVRProfileEntry *e = g_ptr_array_index(entries, i);
+        AvrProfileSampleList *item = g_new0(AvrProfileSampleList, 1);
+
+        item->value = g_new0(AvrProfileSample, 1);
+        item->value->pc = (e->key >> 32) * 2;
+        item->value->ret = (uint32_t)e->key * 2;
+        item->value->count = e->count;
+        *tail = item;
+        tail = &item->next;
+    }
+    g_ptr_array_free(entries, true);
+
+    if (reset) {
+        g_hash_table_remove_all(p->histogram);
+        p->samples = 0;
+    }
+    return info;
+}
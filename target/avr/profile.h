@@ -0,0 +1,18 @@
+/*
+ * QEMU AVR sampling profiler
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#ifndef AVR_PROFILE_H
+#define AVR_PROFILE_H
+
+#include "qapi-types.h"
+
+void avr_profile_init(AVRCPU *cpu, uint32_t period, Error **errp);
+
+/* the @top most frequent samples, all if @top is 0 */
+AvrProfile *avr_profile_query(AVRCPU *cpu, int64_t top, bool reset);
+
+#endif
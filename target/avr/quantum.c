@@ -0,0 +1,221 @@
+/*
+ * QEMU AVR quantum barrier
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+/*
+ *  The MCUs of a board (sample-multi) run in quanta. With MTTCG each CPU
+ *  has a thread of its own, a quantum bounds how far one may run ahead of
+ *  the others: no CPU starts quantum N + 1 before all have ended quantum N.
+ *
+ *  A quantum is a number of cycles of the CPU, the quantum in ns converted
+ *  with its clock-frequency. A TB takes the cycles of its longest path from
+ *  env->quantum_left when it starts (TB_FLAGS_QUANTUM, see gen_quantum_start
+ *  in translate.c), so a quantum ends at the first TB which starts with no
+ *  cycles left. What the last TB took more is taken from the next quantum.
+ *
+ *  The CPU which ends a quantum calls helper_quantum. Unless it is the last
+ *  one it parks: it halts and has no work until the last CPU releases all,
+ *  its thread waits on the halt condition meanwhile. Pausing the VM still
+ *  stops a parked CPU, it stays parked when the VM runs again. Only the
+ *  thread of a CPU ends its halt, a released CPU has work until it runs.
+ *
+ *  A sleeping CPU waits for an interrupt, which may come from another MCU
+ *  in a later quantum. It leaves the barrier on SLEEP and joins it again
+ *  with a full quantum when it wakes up, the others do not wait for it.
+ *
+ *  The quantum number advances on every release, the notifiers are called
+ *  then, e.g. avr_link.c delivers the bytes sent in the quantum before.
+ *  Everything is changed with the BQL.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/host-utils.h"
+#include "qemu/main-loop.h"
+#include "qemu/notify.h"
+#include "qemu/timer.h"
+#include "sysemu/sysemu.h"
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "exec/helper-proto.h"
+
+#define AVR_QUANTUM_MAX_CPUS 64
+
+struct AVRQuantum {
+    uint32_t quantum_ns;
+    AVRCPU *cpu[AVR_QUANTUM_MAX_CPUS];
+    int cpus;
+    int active; /* CPUs which are not sleeping */
+    int arrived; /* active CPUs parked at the end of the quantum */
+    uint32_t now; /* number of the quantum, read without the BQL */
+    NotifierList notifiers;
+};
+
+/* takes the BQL unless the caller holds it, returns whether it did */
+static bool avr_quantum_lock(void)
+{
+    if (qemu_mutex_iothread_locked()) {
+        return false;
+    }
+    qemu_mutex_lock_iothread();
+    return true;
+}
+
+static void avr_quantum_unlock(bool taken)
+{
+    if (taken) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
+/* all active CPUs ended the quantum, they start the next one */
+static void avr_quantum_release(AVRQuantum *q)
+{
+    CPUAVRState *env;
+    int i;
+
+    q->arrived = 0;
+    atomic_set(&q->now, q->now + 1);
+    for (i = 0; i < q->cpus; i++) {
+        env = &q->cpu[i]->env;
+        if (env->quantum_away) {
+            continue;
+        }
+        env->quantum_left += env->quantum_cycles;
+        if (env->quantum_parked) {
+            /* it has work now, its own thread ends the halt */
+            env->quantum_parked = false;
+            env->quantum_released = true;
+            qemu_cpu_kick(CPU(q->cpu[i]));
+        }
+    }
+    notifier_list_notify(&q->notifiers, q);
+}
+
+/* returns true if the CPU starts the next quantum, false if it parks */
+static bool avr_quantum_arrive(CPUAVRState *env)
+{
+    AVRQuantum *q = env->quantum;
+
+    if (++q->arrived == q->active) {
+        avr_quantum_release(q);
+        return true;
+    }
+    env->quantum_parked = true;
+    CPU(avr_env_get_cpu(env))->halted = 1;
+    return false;
+}
+
+/* the TB at pc_w starts with no cycles left */
+void helper_quantum(CPUAVRState *env)
+{
+    CPUState *cs = CPU(avr_env_get_cpu(env));
+    bool taken = avr_quantum_lock();
+    bool next = avr_quantum_arrive(env);
+
+    avr_quantum_unlock(taken);
+    if (!next) {
+        cs->exception_index = EXCP_HLT;
+        cpu_loop_exit(cs);
+    }
+}
+
+/* on SLEEP */
+void avr_quantum_leave(CPUAVRState *env)
+{
+    AVRQuantum *q = env->quantum;
+    bool taken;
+
+    if (q == NULL || env->quantum_away) {
+        return;
+    }
+    taken = avr_quantum_lock();
+    env->quantum_away = true;
+    q->active--;
+    /* the others may all wait for this CPU, or all CPUs sleep */
+    if (q->arrived == q->active) {
+        avr_quantum_release(q);
+    }
+    avr_quantum_unlock(taken);
+}
+
+/* the CPU woke up after a SLEEP, see avr_cpu_exec_enter */
+void avr_quantum_join(CPUAVRState *env)
+{
+    bool taken = avr_quantum_lock();
+
+    env->quantum_away = false;
+    env->quantum_left = env->quantum_cycles;
+    env->quantum->active++;
+    avr_quantum_unlock(taken);
+}
+
+/* the CPUs are stopped and reset, which ends their halt, all start quantum 0 */
+static void avr_quantum_reset(void *opaque)
+{
+    AVRQuantum *q = opaque;
+    CPUAVRState *env;
+    int i;
+
+    for (i = 0; i < q->cpus; i++) {
+        env = &q->cpu[i]->env;
+        env->quantum_parked = false;
+        env->quantum_released = false;
+        env->quantum_away = false;
+        env->quantum_left = env->quantum_cycles;
+    }
+    q->active = q->cpus;
+    q->arrived = 0;
+    atomic_set(&q->now, 0);
+}
+
+AVRQuantum *avr_quantum_new(uint32_t quantum_ns)
+{
+    AVRQuantum *q = g_new0(AVRQuantum, 1);
+
+    q->quantum_ns = quantum_ns;
+    notifier_list_init(&q->notifiers);
+    qemu_register_reset(avr_quantum_reset, q);
+    return q;
+}
+
+/* before the CPU runs, each CPU is added once */
+void avr_quantum_add(AVRQuantum *q, AVRCPU *cpu, Error **errp)
+{
+    CPUAVRState *env = &cpu->env;
+    uint64_t cycles;
+
+    cycles = muldiv64(q->quantum_ns, cpu->freq_hz, NANOSECONDS_PER_SECOND);
+    if (cycles == 0 || cycles > INT32_MAX) {
+        error_setg(errp, "a quantum of %" PRIu32 " ns is %" PRIu64
+                   " cycles at %" PRIu32 " Hz", q->quantum_ns, cycles,
+                   cpu->freq_hz);
+        return;
+    }
+    if (q->cpus == AVR_QUANTUM_MAX_CPUS) {
+        error_setg(errp, "a quantum takes at most %d CPUs",
+                   AVR_QUANTUM_MAX_CPUS);
+        return;
+    }
+
+    q->cpu[q->cpus++] = cpu;
+    q->active++;
+    env->quantum = q;
+    env->quantum_cycles = cycles;
+    env->quantum_left = cycles;
+}
+
+/* the number of the current quantum, from any thread */
+uint32_t avr_quantum_now(AVRQuantum *q)
+{
+    return atomic_read(&q->now);
+}
+
+/* n is called with the BQL when a quantum starts */
+void avr_quantum_add_notifier(AVRQuantum *q, Notifier *n)
+{
+    notifier_list_add(&q->notifiers, n);
+}
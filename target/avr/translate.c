@@ -29,6 +29,9 @@
 #include "exec/helper-proto.h"
 #include "exec/helper-gen.h"
 #include "exec/log.h"
+#include "exec-trace.h"
+#include "coverage.h"
+#include "tb-worker.h"
 
 static TCGv_env cpu_env;
 
@@ -43,6 +46,11 @@ static TCGv cpu_Hf;
 static TCGv cpu_Tf;
 static TCGv cpu_If;
 
+static TCGv cpu_cc_op;
+static TCGv cpu_cc_dst;
+static TCGv cpu_cc_src;
+static TCGv cpu_cc_src2;
+
 static TCGv cpu_rampD;
 static TCGv cpu_rampX;
 static TCGv cpu_rampY;
@@ -73,6 +81,7 @@ struct InstInfo {
     uint32_t opcode;
     translate_function_t translate;
     unsigned length;
+    unsigned cycles;
 };
 
 /* This is the state at translation time. */
@@ -86,13 +95,70 @@ struct DisasContext {
     int memidx;
     int bstate;
     int singlestep;
+
+    int cc_op; /* CC_OP_xxx of the last flag setting instruction */
+    bool ramp_zero; /* RAMPD, RAMPX, RAMPY & RAMPZ are 0, see TB_FLAGS */
+    bool ramp_exit; /* a RAMP register may change, the TB is not chained */
+
+    int cycles; /* clock cycles of the instructions translated so far */
+    int extra_cycles; /* most cycles an exit of the TB adds to them */
+    int max_cycles; /* cycles the TB may take, 0 if not limited */
+    int quantum_idx; /* op of the cycles taken from the quantum, or -1 */
+
+    /* CF_TRACE, see tb_gen_hot */
+    int trace_idx; /* next TB in tcg_ctx.trace_pc, 0 if not a trace */
+    int follow; /* where the translation goes on, or -1 */
+    int goto_tb_used; /* the jump slots taken so far */
+    int side_exits;
+    TCGLabel *side_label[TCG_MAX_TRACE];
+    target_ulong side_dest[TCG_MAX_TRACE];
+    int side_slot[TCG_MAX_TRACE];
+    int side_cc_op[TCG_MAX_TRACE];
 };
 
+/*
+ *  a trace has more exits than jump slots. Slot 0 is kept for the jump back
+ *  to its start, the first other exit in guest order takes slot 1. Returns
+ *  the slot of an exit to dest or -1 if it is not chained
+ */
+static int gen_trace_slot(DisasContext *ctx, target_ulong dest)
+{
+    int n = dest * 2 == ctx->tb->pc ? 0 : 1;
+
+    if (ctx->goto_tb_used & (1 << n)) {
+        return -1;
+    }
+    ctx->goto_tb_used |= 1 << n;
+
+    return n;
+}
+
 static void gen_goto_tb(DisasContext *ctx, int n, target_ulong dest)
 {
     TranslationBlock *tb = ctx->tb;
 
-    if (ctx->singlestep == 0) {
+    if (ctx->ramp_exit) {
+        /*
+         *  whether the next TB has TB_FLAGS_RAMP_ZERO is known when it runs
+         *  only, a chained jump would keep the flags of the first time
+         */
+        n = -1;
+    } else {
+        /* the next TB starts with the lazy flags as they are here */
+        tb_worker_hint(CPU(avr_env_get_cpu(ctx->env)), dest * 2, 0,
+                       (tb->flags
+                        & ~(TB_FLAGS_FULL_ACCESS | TB_FLAGS_CC_OP_MASK))
+                       | ctx->cc_op << TB_FLAGS_CC_OP_SHIFT);
+    }
+
+    if (ctx->trace_idx && n >= 0) {
+        n = gen_trace_slot(ctx, dest);
+    }
+
+    if (n < 0) {
+        tcg_gen_movi_i32(cpu_pc, dest);
+        tcg_gen_exit_tb(0);
+    } else if (ctx->singlestep == 0) {
         tcg_gen_goto_tb(n);
         tcg_gen_movi_i32(cpu_pc, dest);
         tcg_gen_exit_tb((uintptr_t)tb + n);
@@ -103,94 +169,608 @@ static void gen_goto_tb(DisasContext *ctx, int n, target_ulong dest)
     }
 }
 
+/*
+ *  in a trace the translation goes on at dest instead of leaving the TB,
+ *  when dest is where the next TB of the trace starts
+ */
+static bool gen_trace_follow(DisasContext *ctx, target_ulong dest)
+{
+    if (ctx->trace_idx == 0 || ctx->trace_idx >= tcg_ctx.trace_len
+            || tcg_ctx.trace_pc[ctx->trace_idx] != dest * 2) {
+        return false;
+    }
+    ctx->trace_idx++;
+    ctx->follow = dest;
+
+    return true;
+}
+
+/*
+ *  the exit of a trace where the branch to label is taken, it is generated
+ *  after the trace. Traces are not built with icount, so there are no
+ *  cycles to give back
+ */
+static void gen_trace_side_exit(DisasContext *ctx, TCGLabel *label,
+                                target_ulong dest)
+{
+    ctx->side_label[ctx->side_exits] = label;
+    ctx->side_dest[ctx->side_exits] = dest;
+    ctx->side_slot[ctx->side_exits] = gen_trace_slot(ctx, dest);
+    ctx->side_cc_op[ctx->side_exits] = ctx->cc_op;
+    ctx->side_exits++;
+}
+
 #include "exec/gen-icount.h"
 #include "translate-inst.h"
 
-static void gen_add_CHf(TCGv R, TCGv Rd, TCGv Rr)
+/*
+ *  with -icount the instruction counter counts clock cycles. A TB takes the
+ *  cycles of its longest path when it starts and every exit gives back what
+ *  its own path did not use. The instructions with a conditional cost, i.e.
+ *  branches and skips, set extra_cycles and take care of their exits
+ */
+static int gen_cycles_charged(DisasContext *ctx)
 {
-    TCGv t1 = tcg_temp_new_i32();
-    TCGv t2 = tcg_temp_new_i32();
-    TCGv t3 = tcg_temp_new_i32();
+    int cycles = ctx->cycles + ctx->extra_cycles;
 
-    tcg_gen_and_tl(t1, Rd, Rr); /* t1 = Rd & Rr */
-    tcg_gen_andc_tl(t2, Rd, R); /* t2 = Rd & ~R */
-    tcg_gen_andc_tl(t3, Rr, R); /* t3 = Rr & ~R */
-    tcg_gen_or_tl(t1, t1, t2); /* t1 = t1 | t2 | t3 */
-    tcg_gen_or_tl(t1, t1, t3);
+    if (ctx->max_cycles && cycles > ctx->max_cycles) {
+        cycles = ctx->max_cycles;
+    }
 
-    tcg_gen_shri_tl(cpu_Cf, t1, 7); /* Cf = t1(7) */
-    tcg_gen_shri_tl(cpu_Hf, t1, 3); /* Hf = t1(3) */
-    tcg_gen_andi_tl(cpu_Hf, cpu_Hf, 1);
+    return cycles;
+}
 
-    tcg_temp_free_i32(t3);
-    tcg_temp_free_i32(t2);
-    tcg_temp_free_i32(t1);
+static void gen_cycles_exit(DisasContext *ctx, int extra)
+{
+    int charged = gen_cycles_charged(ctx);
+    int spent = ctx->cycles + extra;
+    TCGv_i32 t0;
+
+    if ((ctx->tb->cflags & CF_USE_ICOUNT) == 0 || spent == charged) {
+        return;
+    }
+
+    t0 = tcg_temp_new_i32();
+    if (spent < charged) {
+        tcg_gen_ld16u_i32(t0, cpu_env,
+                -ENV_OFFSET + offsetof(CPUState, icount_decr.u16.low));
+        tcg_gen_addi_i32(t0, t0, charged - spent);
+        tcg_gen_st16_i32(t0, cpu_env,
+                -ENV_OFFSET + offsetof(CPUState, icount_decr.u16.low));
+    } else {
+        /* the budget is smaller than the cost, the rest is taken later */
+        tcg_gen_ld_i32(t0, cpu_env, offsetof(CPUAVRState, cycles_debt));
+        tcg_gen_addi_i32(t0, t0, spent - charged);
+        tcg_gen_st_i32(t0, cpu_env, offsetof(CPUAVRState, cycles_debt));
+    }
+    tcg_temp_free_i32(t0);
 }
 
-static void gen_add_Vf(TCGv R, TCGv Rd, TCGv Rr)
+/*
+ *  with TB_FLAGS_QUANTUM a TB takes the cycles of its longest path from the
+ *  quantum of the CPU when it starts, like from the -icount budget. If
+ *  nothing is left the CPU waits for the others to end the quantum first,
+ *  see quantum.c. The cycles are set by gen_quantum_end
+ */
+static void gen_quantum_start(DisasContext *ctx, target_ulong pc)
 {
-    TCGv t1 = tcg_temp_new_i32();
-    TCGv t2 = tcg_temp_new_i32();
+    TCGv_i32 left = tcg_temp_local_new_i32();
+    TCGv_i32 imm = tcg_temp_new_i32();
+    TCGLabel *run = gen_new_label();
 
-        /* t1 = Rd & Rr & ~R | ~Rd & ~Rr & R = (Rd ^ R) & ~(Rd ^ Rr) */
-    tcg_gen_xor_tl(t1, Rd, R);
-    tcg_gen_xor_tl(t2, Rd, Rr);
-    tcg_gen_andc_tl(t1, t1, t2);
+    tcg_gen_ld_i32(left, cpu_env, offsetof(CPUAVRState, quantum_left));
+    tcg_gen_brcondi_i32(TCG_COND_GT, left, 0, run);
+    tcg_gen_movi_tl(cpu_pc, pc);
+    gen_helper_quantum(cpu_env);
+    tcg_gen_ld_i32(left, cpu_env, offsetof(CPUAVRState, quantum_left));
+    gen_set_label(run);
 
-    tcg_gen_shri_tl(cpu_Vf, t1, 7); /* Vf = t1(7) */
+    ctx->quantum_idx = tcg_op_buf_count();
+    tcg_gen_movi_i32(imm, 0xdeadbeef);
+    tcg_gen_sub_i32(left, left, imm);
+    tcg_gen_st_i32(left, cpu_env, offsetof(CPUAVRState, quantum_left));
 
-    tcg_temp_free_i32(t2);
-    tcg_temp_free_i32(t1);
+    tcg_temp_free_i32(imm);
+    tcg_temp_free_i32(left);
 }
 
-static void gen_sub_CHf(TCGv R, TCGv Rd, TCGv Rr)
+static void gen_quantum_end(DisasContext *ctx)
+{
+    if (ctx->quantum_idx >= 0) {
+        tcg_set_insn_param(ctx->quantum_idx, 1, gen_cycles_charged(ctx));
+    }
+}
+
+/*
+ *  the skip instructions end the TB, the next instruction is skipped when
+ *  the branch to the skip label is taken. Both outcomes are chained.
+ *  poll is the start of the poll loop the skip is part of, or -1
+ */
+static int gen_skip_exits(DisasContext *ctx, TCGLabel *skip, int poll)
+{
+    ctx->extra_cycles = ctx->inst[1].length / 16;
+
+        /* next inst is not skipped */
+    gen_cycles_exit(ctx, 0);
+    if (poll >= 0) {
+        /* the skip is the last instruction, it may read the virtual clock */
+        gen_io_start();
+        gen_helper_idle(cpu_env);
+        gen_io_end();
+    } else if (gen_trace_follow(ctx, ctx->inst[0].npc)) {
+        gen_trace_side_exit(ctx, skip, ctx->inst[1].npc);
+        return BS_NONE;
+    }
+    gen_goto_tb(ctx, 1, ctx->inst[0].npc);
+
+    gen_set_label(skip);
+        /* next inst is skipped */
+    gen_cycles_exit(ctx, ctx->extra_cycles);
+    if (gen_trace_follow(ctx, ctx->inst[1].npc)) {
+        return BS_NONE;
+    }
+    gen_goto_tb(ctx, 0, ctx->inst[1].npc);
+
+    return BS_BRANCH;
+}
+
+/*
+ *  with -icount devices may read the virtual clock only from the last
+ *  instruction of a TB
+ */
+static void gen_port_start(DisasContext *ctx)
+{
+    if (ctx->tb->cflags & CF_USE_ICOUNT) {
+        gen_io_start();
+    }
+}
+
+static int gen_port_end(DisasContext *ctx)
+{
+    if (ctx->tb->cflags & CF_USE_ICOUNT) {
+        gen_io_end();
+        return BS_STOP;
+    }
+
+    return BS_NONE;
+}
+
+/*
+ *  plain IO registers have no side effects, IN/OUT & friends access their
+ *  storage in env directly
+ */
+static bool avr_io_plain(DisasContext *ctx, int port)
+{
+    return ctx->env->io[port].ram;
+}
+
+static void gen_io_plain_ld(TCGv data, int port)
+{
+    tcg_gen_ld8u_tl(data, cpu_env, offsetof(CPUAVRState, io_ram) + port);
+}
+
+static void gen_io_plain_st(TCGv data, int port)
+{
+    tcg_gen_st8_tl(data, cpu_env, offsetof(CPUAVRState, io_ram) + port);
+}
+
+/*
+ *  appends a record to the execution trace, see exec-trace.h. When
+ *  trace_pos reaches trace_end the ring buffer is full and the helper waits
+ *  for the writer
+ */
+static void gen_trace_record(TCGv record)
+{
+    TCGLabel *room = gen_new_label();
+    TCGv pos = tcg_temp_new_i32();
+    TCGv t0 = tcg_temp_new_i32();
+    TCGv_ptr buf = tcg_temp_new_ptr();
+    TCGv_ptr ofs = tcg_temp_new_ptr();
+
+    tcg_gen_ld_i32(pos, cpu_env, offsetof(CPUAVRState, trace_pos));
+    tcg_gen_andi_i32(t0, pos, AVR_TRACE_RECORDS - 1);
+    tcg_gen_shli_i32(t0, t0, 2);
+    tcg_gen_ext_i32_ptr(ofs, t0);
+    tcg_gen_ld_ptr(buf, cpu_env, offsetof(CPUAVRState, trace_buf));
+    tcg_gen_add_ptr(buf, buf, ofs);
+    tcg_gen_st_i32(record, buf, 0);
+
+    /*
+     *  the writer thread reads the ring buffer concurrently even without
+     *  MTTCG, the record has to be visible before trace_pos
+     */
+    tcg_gen_op1(&tcg_ctx, INDEX_op_mb, TCG_MO_ST_ST | TCG_BAR_SC);
+
+    tcg_gen_addi_i32(pos, pos, 1);
+    tcg_gen_st_i32(pos, cpu_env, offsetof(CPUAVRState, trace_pos));
+    tcg_gen_ld_i32(t0, cpu_env, offsetof(CPUAVRState, trace_end));
+    tcg_gen_brcond_i32(TCG_COND_NE, pos, t0, room);
+    gen_helper_trace_wait(cpu_env);
+    gen_set_label(room);
+
+    tcg_temp_free_ptr(ofs);
+    tcg_temp_free_ptr(buf);
+    tcg_temp_free_i32(t0);
+    tcg_temp_free_i32(pos);
+}
+
+/* records a code address, i.e. a TB entry, a call or a return */
+static void gen_trace_code(DisasContext *ctx, int kind, target_ulong pc)
+{
+    TCGv record;
+
+    if (ctx->env->trace_buf == NULL) {
+        return;
+    }
+    record = tcg_const_i32(AVR_TRACE_RECORD(kind, pc * 2));
+    gen_trace_record(record);
+    tcg_temp_free_i32(record);
+}
+
+static void gen_trace_data(DisasContext *ctx, int kind, TCGv addr)
+{
+    TCGv record;
+
+    if (ctx->env->trace_mem == false) {
+        return;
+    }
+    record = tcg_temp_new_i32();
+    tcg_gen_ori_i32(record, addr, AVR_TRACE_RECORD(kind, 0));
+    gen_trace_record(record);
+    tcg_temp_free_i32(record);
+}
+
+/* counts the edge from the previous TB to this one, see coverage.c */
+static void gen_coverage(target_ulong pc)
+{
+    uint32_t cur = AVR_COVERAGE_LOC(pc);
+    TCGv t0 = tcg_temp_new_i32();
+    TCGv_ptr map = tcg_temp_new_ptr();
+    TCGv_ptr ofs = tcg_temp_new_ptr();
+
+    tcg_gen_ld_i32(t0, cpu_env, offsetof(CPUAVRState, cov_prev));
+    tcg_gen_xori_i32(t0, t0, cur);
+    tcg_gen_ext_i32_ptr(ofs, t0);
+    tcg_gen_ld_ptr(map, cpu_env, offsetof(CPUAVRState, cov_map));
+    tcg_gen_add_ptr(map, map, ofs);
+    tcg_gen_ld8u_i32(t0, map, 0);
+    tcg_gen_addi_i32(t0, t0, 1);
+    tcg_gen_st8_i32(t0, map, 0);
+    tcg_gen_movi_i32(t0, cur >> 1);
+    tcg_gen_st_i32(t0, cpu_env, offsetof(CPUAVRState, cov_prev));
+
+    tcg_temp_free_ptr(ofs);
+    tcg_temp_free_ptr(map);
+    tcg_temp_free_i32(t0);
+}
+
+static void set_cc_op(DisasContext *ctx, int op)
+{
+    if (ctx->cc_op != op) {
+        tcg_gen_movi_tl(cpu_cc_op, op);
+        ctx->cc_op = op;
+    }
+}
+
+static void gen_set_cc_arith(DisasContext *ctx, int op, TCGv R, TCGv Rd,
+                                TCGv Rr)
+{
+    tcg_gen_mov_tl(cpu_cc_dst, R);
+    tcg_gen_mov_tl(cpu_cc_src, Rd);
+    tcg_gen_mov_tl(cpu_cc_src2, Rr);
+    set_cc_op(ctx, op);
+}
+
+static void gen_set_cc_result(DisasContext *ctx, int op, TCGv R)
+{
+    tcg_gen_mov_tl(cpu_cc_dst, R);
+    set_cc_op(ctx, op);
+}
+
+/*
+ *  SBC, SBCI & CPC leave Zf unchanged when the result is zero and clear it
+ *  otherwise, bit 8 of cc_dst keeps the previous value of Zf
+ */
+static void gen_set_cc_sbc(DisasContext *ctx, TCGv R, TCGv Rd, TCGv Rr,
+                                TCGv Zf)
+{
+    gen_set_cc_arith(ctx, CC_OP_SUB, R, Rd, Rr);
+
+    tcg_gen_setcondi_tl(TCG_COND_NE, Zf, Zf, 0);
+    tcg_gen_shli_tl(Zf, Zf, 8);
+    tcg_gen_or_tl(cpu_cc_dst, cpu_cc_dst, Zf);
+}
+
+static void gen_add_carry(TCGv t, TCGv R, TCGv Rd, TCGv Rr)
 {
     TCGv t1 = tcg_temp_new_i32();
-    TCGv t2 = tcg_temp_new_i32();
-    TCGv t3 = tcg_temp_new_i32();
 
-    /* Cf & Hf */
-    tcg_gen_not_tl(t1, Rd); /* t1 = ~Rd */
-    tcg_gen_and_tl(t2, t1, Rr); /* t2 = ~Rd & Rr */
-    tcg_gen_or_tl(t3, t1, Rr); /* t3 = (~Rd | Rr) & R */
-    tcg_gen_and_tl(t3, t3, R);
-    tcg_gen_or_tl(t2, t2, t3); /* t2 = ~Rd & Rr | ~Rd & R | R & Rr */
-    tcg_gen_shri_tl(cpu_Cf, t2, 7); /* Cf = t2(7) */
-    tcg_gen_shri_tl(cpu_Hf, t2, 3); /* Hf = t2(3) */
-    tcg_gen_andi_tl(cpu_Hf, cpu_Hf, 1);
-
-    tcg_temp_free_i32(t3);
-    tcg_temp_free_i32(t2);
+    tcg_gen_and_tl(t, Rd, Rr); /* t = Rd & Rr */
+    tcg_gen_andc_tl(t1, Rd, R); /* t1 = Rd & ~R */
+    tcg_gen_or_tl(t, t, t1);
+    tcg_gen_andc_tl(t1, Rr, R); /* t1 = Rr & ~R */
+    tcg_gen_or_tl(t, t, t1);
+
     tcg_temp_free_i32(t1);
 }
 
-static void gen_sub_Vf(TCGv R, TCGv Rd, TCGv Rr)
+static void gen_sub_carry(TCGv t, TCGv R, TCGv Rd, TCGv Rr)
 {
     TCGv t1 = tcg_temp_new_i32();
-    TCGv t2 = tcg_temp_new_i32();
 
-    /* Vf */
-        /* t1 = Rd & ~Rr & ~R | ~Rd & Rr & R = (Rd ^ R) & (Rd ^ R) */
-    tcg_gen_xor_tl(t1, Rd, R);
-    tcg_gen_xor_tl(t2, Rd, Rr);
-    tcg_gen_and_tl(t1, t1, t2);
-    tcg_gen_shri_tl(cpu_Vf, t1, 7); /* Vf = t1(7) */
+    tcg_gen_not_tl(t1, Rd); /* t1 = ~Rd */
+    tcg_gen_or_tl(t, t1, Rr); /* t = (~Rd | Rr) & R */
+    tcg_gen_and_tl(t, t, R);
+    tcg_gen_and_tl(t1, t1, Rr); /* t = ~Rd & Rr | ~Rd & R | R & Rr */
+    tcg_gen_or_tl(t, t, t1);
 
-    tcg_temp_free_i32(t2);
     tcg_temp_free_i32(t1);
 }
 
-static void gen_NSf(TCGv R)
+/*
+ *  the gen_compute_XXf functions put the value of a flag into dst, the value
+ *  of Zf has negative logic (i.e. Z flag is set when the value is zero)
+ */
+static void gen_compute_Cf(DisasContext *ctx, TCGv dst)
 {
-    tcg_gen_shri_tl(cpu_Nf, R, 7); /* Nf = R(7) */
+    switch (ctx->cc_op) {
+    case CC_OP_ADD:
+        gen_add_carry(dst, cpu_cc_dst, cpu_cc_src, cpu_cc_src2);
+        tcg_gen_extract_tl(dst, dst, 7, 1); /* Cf = t(7) */
+        break;
+    case CC_OP_SUB:
+        gen_sub_carry(dst, cpu_cc_dst, cpu_cc_src, cpu_cc_src2);
+        tcg_gen_extract_tl(dst, dst, 7, 1); /* Cf = t(7) */
+        break;
+    case CC_OP_ADDW:
+        tcg_gen_andc_tl(dst, cpu_cc_src, cpu_cc_dst); /* Cf = Rd & ~R */
+        tcg_gen_extract_tl(dst, dst, 15, 1);
+        break;
+    case CC_OP_SUBW:
+        tcg_gen_andc_tl(dst, cpu_cc_dst, cpu_cc_src); /* Cf = R & ~Rd */
+        tcg_gen_extract_tl(dst, dst, 15, 1);
+        break;
+    default:
+        tcg_gen_mov_tl(dst, cpu_Cf);
+        break;
+    }
+}
+
+static void gen_compute_Hf(DisasContext *ctx, TCGv dst)
+{
+    switch (ctx->cc_op) {
+    case CC_OP_ADD:
+        gen_add_carry(dst, cpu_cc_dst, cpu_cc_src, cpu_cc_src2);
+        tcg_gen_extract_tl(dst, dst, 3, 1); /* Hf = t(3) */
+        break;
+    case CC_OP_SUB:
+        gen_sub_carry(dst, cpu_cc_dst, cpu_cc_src, cpu_cc_src2);
+        tcg_gen_extract_tl(dst, dst, 3, 1); /* Hf = t(3) */
+        break;
+    default:
+        tcg_gen_mov_tl(dst, cpu_Hf);
+        break;
+    }
+}
+
+static void gen_compute_Vf(DisasContext *ctx, TCGv dst)
+{
+    TCGv t1;
+
+    switch (ctx->cc_op) {
+    case CC_OP_ADD:
+        /* t = Rd & Rr & ~R | ~Rd & ~Rr & R = (Rd ^ R) & ~(Rd ^ Rr) */
+        t1 = tcg_temp_new_i32();
+        tcg_gen_xor_tl(dst, cpu_cc_src, cpu_cc_dst);
+        tcg_gen_xor_tl(t1, cpu_cc_src, cpu_cc_src2);
+        tcg_gen_andc_tl(dst, dst, t1);
+        tcg_gen_extract_tl(dst, dst, 7, 1); /* Vf = t(7) */
+        tcg_temp_free_i32(t1);
+        break;
+    case CC_OP_SUB:
+        /* t = Rd & ~Rr & ~R | ~Rd & Rr & R = (Rd ^ R) & (Rd ^ Rr) */
+        t1 = tcg_temp_new_i32();
+        tcg_gen_xor_tl(dst, cpu_cc_src, cpu_cc_dst);
+        tcg_gen_xor_tl(t1, cpu_cc_src, cpu_cc_src2);
+        tcg_gen_and_tl(dst, dst, t1);
+        tcg_gen_extract_tl(dst, dst, 7, 1); /* Vf = t(7) */
+        tcg_temp_free_i32(t1);
+        break;
+    case CC_OP_LOGIC:
+        tcg_gen_movi_tl(dst, 0);
+        break;
+    case CC_OP_INC:
+        tcg_gen_setcondi_tl(TCG_COND_EQ, dst, cpu_cc_dst, 0x80);
+        break;
+    case CC_OP_DEC:
+        tcg_gen_setcondi_tl(TCG_COND_EQ, dst, cpu_cc_dst, 0x7f);
+        break;
+    case CC_OP_ADDW:
+        tcg_gen_andc_tl(dst, cpu_cc_dst, cpu_cc_src); /* Vf = R & ~Rd */
+        tcg_gen_extract_tl(dst, dst, 15, 1);
+        break;
+    case CC_OP_SUBW:
+        tcg_gen_andc_tl(dst, cpu_cc_src, cpu_cc_dst); /* Vf = Rd & ~R */
+        tcg_gen_extract_tl(dst, dst, 15, 1);
+        break;
+    default:
+        tcg_gen_mov_tl(dst, cpu_Vf);
+        break;
+    }
+}
+
+static void gen_compute_Nf(DisasContext *ctx, TCGv dst)
+{
+    switch (ctx->cc_op) {
+    case CC_OP_FLAGS:
+        tcg_gen_mov_tl(dst, cpu_Nf);
+        break;
+    case CC_OP_ADDW:
+    case CC_OP_SUBW:
+        tcg_gen_extract_tl(dst, cpu_cc_dst, 15, 1); /* Nf = R(15) */
+        break;
+    default:
+        tcg_gen_extract_tl(dst, cpu_cc_dst, 7, 1); /* Nf = R(7) */
+        break;
+    }
+}
+
+static void gen_compute_Sf(DisasContext *ctx, TCGv dst)
+{
+    TCGv t1;
+
+    switch (ctx->cc_op) {
+    case CC_OP_FLAGS:
+        tcg_gen_mov_tl(dst, cpu_Sf);
+        break;
+    case CC_OP_LOGIC:
+        gen_compute_Nf(ctx, dst); /* Sf = Nf ^ 0 */
+        break;
+    default:
+        t1 = tcg_temp_new_i32();
+        gen_compute_Nf(ctx, t1);
+        gen_compute_Vf(ctx, dst);
+        tcg_gen_xor_tl(dst, dst, t1); /* Sf = Nf ^ Vf */
+        tcg_temp_free_i32(t1);
+        break;
+    }
+}
+
+static void gen_compute_Zf(DisasContext *ctx, TCGv dst)
+{
+    if (ctx->cc_op == CC_OP_FLAGS) {
+        tcg_gen_mov_tl(dst, cpu_Zf);
+    } else {
+        tcg_gen_mov_tl(dst, cpu_cc_dst); /* Zf = R */
+    }
+}
+
+/*
+ *  puts all the flags into Cf, Zf, Nf, Vf, Sf & Hf. This is needed before
+ *  an instruction which changes only some of them
+ */
+static void gen_compute_flags(DisasContext *ctx)
+{
+    if (ctx->cc_op == CC_OP_FLAGS) {
+        return;
+    }
+
+    gen_compute_Cf(ctx, cpu_Cf);
+    gen_compute_Hf(ctx, cpu_Hf);
+    gen_compute_Nf(ctx, cpu_Nf);
+    gen_compute_Vf(ctx, cpu_Vf);
     tcg_gen_xor_tl(cpu_Sf, cpu_Nf, cpu_Vf); /* Sf = Nf ^ Vf */
+    gen_compute_Zf(ctx, cpu_Zf);
+
+    set_cc_op(ctx, CC_OP_FLAGS);
 }
 
-static void gen_ZNSf(TCGv R)
+/*
+ *  keeps Cf & Hf for the instructions which do not change them
+ */
+static void gen_keep_CHf(DisasContext *ctx)
+{
+    switch (ctx->cc_op) {
+    case CC_OP_ADD:
+    case CC_OP_SUB:
+        gen_compute_Cf(ctx, cpu_Cf);
+        gen_compute_Hf(ctx, cpu_Hf);
+        break;
+    case CC_OP_ADDW:
+    case CC_OP_SUBW:
+        gen_compute_Cf(ctx, cpu_Cf);
+        break;
+    }
+}
+
+static void gen_keep_Hf(DisasContext *ctx)
+{
+    switch (ctx->cc_op) {
+    case CC_OP_ADD:
+    case CC_OP_SUB:
+        gen_compute_Hf(ctx, cpu_Hf);
+        break;
+    }
+}
+
+static void gen_compute_flag(DisasContext *ctx, TCGv dst, int bit)
+{
+    switch (bit) {
+    case 0x00:
+        gen_compute_Cf(ctx, dst);
+        break;
+    case 0x01:
+        gen_compute_Zf(ctx, dst);
+        break;
+    case 0x02:
+        gen_compute_Nf(ctx, dst);
+        break;
+    case 0x03:
+        gen_compute_Vf(ctx, dst);
+        break;
+    case 0x04:
+        gen_compute_Sf(ctx, dst);
+        break;
+    case 0x05:
+        gen_compute_Hf(ctx, dst);
+        break;
+    case 0x06:
+        tcg_gen_mov_tl(dst, cpu_Tf);
+        break;
+    case 0x07:
+        tcg_gen_mov_tl(dst, cpu_If);
+        break;
+    }
+}
+
+/*
+ *  sets Zf, Nf, Vf & Sf after ASR, LSR & ROR, Cf is expected to be set
+ */
+static void gen_shift_ZNVSf(DisasContext *ctx, TCGv R)
 {
     tcg_gen_mov_tl(cpu_Zf, R); /* Zf = R */
     tcg_gen_shri_tl(cpu_Nf, R, 7); /* Nf = R(7) */
+    tcg_gen_xor_tl(cpu_Vf, cpu_Nf, cpu_Cf); /* Vf = Nf ^ Cf */
     tcg_gen_xor_tl(cpu_Sf, cpu_Nf, cpu_Vf); /* Sf = Nf ^ Vf */
+
+    set_cc_op(ctx, CC_OP_FLAGS);
+}
+
+/*
+ *  the MUL family: R1:R0 = Rd * Rr, with Rd and/or Rr signed, shifted one
+ *  bit left for the FMULs. Cf is bit 15 of the product before the shift and
+ *  Zf the 16 bit result, the other flags are unchanged
+ */
+static void gen_mul(DisasContext *ctx, TCGv Rd, TCGv Rr, bool Rd_signed,
+                    bool Rr_signed, bool fractional)
+{
+    TCGv R = tcg_temp_new_i32();
+    TCGv t0;
+
+    gen_compute_flags(ctx);
+
+    if (Rd_signed && Rr_signed) {
+        t0 = tcg_temp_new_i32();
+        tcg_gen_ext8s_tl(t0, Rd);
+        tcg_gen_ext8s_tl(R, Rr);
+        tcg_gen_mul_tl(R, t0, R); /* R = Rd * Rr */
+        tcg_temp_free_i32(t0);
+    } else if (Rd_signed) {
+        tcg_gen_ext8s_tl(R, Rd);
+        tcg_gen_mul_tl(R, R, Rr); /* R = Rd * Rr */
+    } else {
+        tcg_gen_mul_tl(R, Rd, Rr); /* R = Rd * Rr */
+    }
+
+    tcg_gen_extract_tl(cpu_Cf, R, 15, 1); /* Cf = R(15) */
+    if (fractional) {
+        tcg_gen_shli_tl(R, R, 1);
+    }
+    tcg_gen_ext16u_tl(cpu_Zf, R);
+    tcg_gen_ext8u_tl(cpu_r[0], R);
+    tcg_gen_extract_tl(cpu_r[1], R, 8, 8);
+
+    tcg_temp_free_i32(R);
 }
 
 static void gen_push_ret(DisasContext *ctx, int ret)
@@ -218,6 +798,8 @@ static void gen_push_ret(DisasContext *ctx, int ret)
         TCGv lo = tcg_const_i32((ret & 0x0000ff));
         TCGv hi = tcg_const_i32((ret & 0xffff00) >> 8);
 
+        ctx->cycles++; /* one more byte of PC */
+
         tcg_gen_qemu_st_tl(lo, cpu_sp, MMU_DATA_IDX, MO_UB);
         tcg_gen_subi_tl(cpu_sp, cpu_sp, 2);
         tcg_gen_qemu_st_tl(hi, cpu_sp, MMU_DATA_IDX, MO_BEUW);
@@ -246,6 +828,8 @@ static void gen_pop_ret(DisasContext *ctx, TCGv ret)
         TCGv lo = tcg_temp_new_i32();
         TCGv hi = tcg_temp_new_i32();
 
+        ctx->cycles++; /* one more byte of PC */
+
         tcg_gen_addi_tl(cpu_sp, cpu_sp, 1);
         tcg_gen_qemu_ld_tl(hi, cpu_sp, MMU_DATA_IDX, MO_BEUW);
 
@@ -259,74 +843,147 @@ static void gen_pop_ret(DisasContext *ctx, TCGv ret)
     }
 }
 
-static void gen_jmp_ez(void)
+static void gen_jmp_ez(DisasContext *ctx)
 {
     tcg_gen_deposit_tl(cpu_pc, cpu_r[30], cpu_r[31], 8, 8);
     tcg_gen_or_tl(cpu_pc, cpu_pc, cpu_eind);
+    gen_cycles_exit(ctx, 0);
     tcg_gen_exit_tb(0);
 }
 
-static void gen_jmp_z(void)
+static void gen_jmp_z(DisasContext *ctx)
 {
     tcg_gen_deposit_tl(cpu_pc, cpu_r[30], cpu_r[31], 8, 8);
+    gen_cycles_exit(ctx, 0);
     tcg_gen_exit_tb(0);
 }
 
 /*
- *  in the gen_set_addr & gen_get_addr functions
- *  H assumed to be in 0x00ff0000 format
- *  M assumed to be in 0x000000ff format
- *  L assumed to be in 0x000000ff format
+ *  X, Y & Z are RAMPX:R27:R26, RAMPY:R29:R28 & RAMPZ:R31:R30, the RAMP
+ *  registers are kept in 0x00ff0000 format. Without the RAMP register the
+ *  pointer wraps around at 64KB. In a TB with TB_FLAGS_RAMP_ZERO the RAMP
+ *  registers are 0 and the pointers are plain 16 bit values, a pointer that
+ *  would carry into its RAMP register runs its instruction again with
+ *  TB_FLAGS_FULL_ACCESS, which does not assume that. So does a carry into or
+ *  a borrow from the RAMP register in a TB without the flag, the TB would
+ *  go on with the flag it started with. A full access TB which may change
+ *  a RAMP register is not chained, see ramp_exit
  */
-static void gen_set_addr(TCGv addr, TCGv H, TCGv M, TCGv L)
+static bool gen_ramp_used(DisasContext *ctx, int ramp)
 {
+    return avr_feature(ctx->env, ramp) && !ctx->ramp_zero;
+}
+
+static void gen_set_addr(DisasContext *ctx, TCGv addr, TCGv H, TCGv M, TCGv L,
+                         int ramp)
+{
+    TCGLabel *inside;
+    TCGv t0;
+
+    if (gen_ramp_used(ctx, ramp)) {
+        if (ctx->tb->flags & TB_FLAGS_FULL_ACCESS) {
+            ctx->ramp_exit = true;
+        } else if (!ctx->ramp_exit) {
+            t0 = tcg_temp_new_i32();
+            inside = gen_new_label();
+            tcg_gen_andi_tl(t0, addr, 0x00ff0000);
+            tcg_gen_brcond_tl(TCG_COND_EQ, t0, H, inside);
+            gen_helper_fullacc(cpu_env);
+            gen_set_label(inside);
+            tcg_temp_free_i32(t0);
+        }
+        tcg_gen_andi_tl(H, addr, 0x00ff0000);
+    } else if (avr_feature(ctx->env, ramp)) {
+        inside = gen_new_label();
+        tcg_gen_brcondi_tl(TCG_COND_LTU, addr, 0x00010000, inside);
+        gen_helper_fullacc(cpu_env);
+        gen_set_label(inside);
+    }
 
     tcg_gen_andi_tl(L, addr, 0x000000ff);
 
     tcg_gen_andi_tl(M, addr, 0x0000ff00);
     tcg_gen_shri_tl(M, M, 8);
-
-    tcg_gen_andi_tl(H, addr, 0x00ff0000);
 }
 
-static void gen_set_xaddr(TCGv addr)
+static void gen_set_xaddr(DisasContext *ctx, TCGv addr)
 {
-    gen_set_addr(addr, cpu_rampX, cpu_r[27], cpu_r[26]);
+    gen_set_addr(ctx, addr, cpu_rampX, cpu_r[27], cpu_r[26], AVR_FEATURE_RAMPX);
 }
 
-static void gen_set_yaddr(TCGv addr)
+static void gen_set_yaddr(DisasContext *ctx, TCGv addr)
 {
-    gen_set_addr(addr, cpu_rampY, cpu_r[29], cpu_r[28]);
+    gen_set_addr(ctx, addr, cpu_rampY, cpu_r[29], cpu_r[28], AVR_FEATURE_RAMPY);
 }
 
-static void gen_set_zaddr(TCGv addr)
+static void gen_set_zaddr(DisasContext *ctx, TCGv addr)
 {
-    gen_set_addr(addr, cpu_rampZ, cpu_r[31], cpu_r[30]);
+    gen_set_addr(ctx, addr, cpu_rampZ, cpu_r[31], cpu_r[30], AVR_FEATURE_RAMPZ);
 }
 
-static TCGv gen_get_addr(TCGv H, TCGv M, TCGv L)
+static TCGv gen_get_addr(DisasContext *ctx, TCGv H, TCGv M, TCGv L, int ramp)
 {
-    TCGv addr = tcg_temp_new_i32();
+    TCGv addr = tcg_temp_local_new_i32(); /* see gen_data_load */
 
-    tcg_gen_deposit_tl(addr, M, H, 8, 8);
-    tcg_gen_deposit_tl(addr, L, addr, 8, 16);
+    tcg_gen_deposit_tl(addr, L, M, 8, 8); /* addr = M:L */
+    if (gen_ramp_used(ctx, ramp)) {
+        tcg_gen_or_tl(addr, addr, H); /* addr = H:M:L */
+    }
 
     return addr;
 }
 
-static TCGv gen_get_xaddr(void)
+static TCGv gen_get_xaddr(DisasContext *ctx)
+{
+    return gen_get_addr(ctx, cpu_rampX, cpu_r[27], cpu_r[26],
+                        AVR_FEATURE_RAMPX);
+}
+
+static TCGv gen_get_yaddr(DisasContext *ctx)
 {
-    return gen_get_addr(cpu_rampX, cpu_r[27], cpu_r[26]);
+    return gen_get_addr(ctx, cpu_rampY, cpu_r[29], cpu_r[28],
+                        AVR_FEATURE_RAMPY);
 }
 
-static TCGv gen_get_yaddr(void)
+static TCGv gen_get_zaddr(DisasContext *ctx)
 {
-    return gen_get_addr(cpu_rampY, cpu_r[29], cpu_r[28]);
+    return gen_get_addr(ctx, cpu_rampZ, cpu_r[31], cpu_r[30],
+                        AVR_FEATURE_RAMPZ);
 }
 
-static TCGv gen_get_zaddr(void)
+/*
+ *  decrements the pointer of the pre-decrement forms before their access,
+ *  which goes to the address the pointer register will hold: it wraps
+ *  around at 64KB or 16MB. A borrow from a RAMP register this TB assumes is
+ *  0 runs the instruction again with TB_FLAGS_FULL_ACCESS before the access
+ */
+static void gen_dec_addr(DisasContext *ctx, TCGv addr, int ramp)
 {
-    return gen_get_addr(cpu_rampZ, cpu_r[31], cpu_r[30]);
+    TCGLabel *inside;
+
+    tcg_gen_subi_tl(addr, addr, 1);
+    if (gen_ramp_used(ctx, ramp)) {
+        tcg_gen_andi_tl(addr, addr, 0x00ffffff);
+    } else if (avr_feature(ctx->env, ramp)) {
+        inside = gen_new_label();
+        tcg_gen_brcondi_tl(TCG_COND_LTU, addr, 0x00010000, inside);
+        gen_helper_fullacc(cpu_env);
+        gen_set_label(inside);
+    } else {
+        tcg_gen_andi_tl(addr, addr, 0x0000ffff);
+    }
+}
+
+/*
+ *  the address of LDS & STS, RAMPD:k
+ */
+static void gen_get_daddr(DisasContext *ctx, TCGv addr, int k)
+{
+    if (gen_ramp_used(ctx, AVR_FEATURE_RAMPD)) {
+        tcg_gen_ori_tl(addr, cpu_rampD, k);
+    } else {
+        tcg_gen_movi_tl(addr, k);
+    }
 }
 
 /*
@@ -340,13 +997,12 @@ static int avr_translate_ADC(DisasContext *ctx, uint32_t opcode)
     TCGv R = tcg_temp_new_i32();
 
     /* op */
-    tcg_gen_add_tl(R, Rd, Rr); /* R = Rd + Rr + Cf */
-    tcg_gen_add_tl(R, R, cpu_Cf);
+    gen_compute_Cf(ctx, R); /* R = Rd + Rr + Cf */
+    tcg_gen_add_tl(R, R, Rd);
+    tcg_gen_add_tl(R, R, Rr);
     tcg_gen_andi_tl(R, R, 0xff); /* make it 8 bits */
 
-    gen_add_CHf(R, Rd, Rr);
-    gen_add_Vf(R, Rd, Rr);
-    gen_ZNSf(R);
+    gen_set_cc_arith(ctx, CC_OP_ADD, R, Rd, Rr);
 
     /* R */
     tcg_gen_mov_tl(Rd, R);
@@ -370,9 +1026,7 @@ static int avr_translate_ADD(DisasContext *ctx, uint32_t opcode)
     tcg_gen_add_tl(R, Rd, Rr); /* Rd = Rd + Rr */
     tcg_gen_andi_tl(R, R, 0xff); /* make it 8 bits */
 
-    gen_add_CHf(R, Rd, Rr);
-    gen_add_Vf(R, Rd, Rr);
-    gen_ZNSf(R);
+    gen_set_cc_arith(ctx, CC_OP_ADD, R, Rd, Rr);
 
     /* R */
     tcg_gen_mov_tl(Rd, R);
@@ -403,27 +1057,15 @@ static int avr_translate_ADIW(DisasContext *ctx, uint32_t opcode)
     TCGv R = tcg_temp_new_i32();
     TCGv Rd = tcg_temp_new_i32();
 
+    gen_keep_Hf(ctx);
+
     /* op */
     tcg_gen_deposit_tl(Rd, RdL, RdH, 8, 8); /* Rd = RdH:RdL */
     tcg_gen_addi_tl(R, Rd, Imm); /* R = Rd + Imm */
     tcg_gen_andi_tl(R, R, 0xffff); /* make it 16 bits */
 
-    /* Cf */
-    tcg_gen_andc_tl(cpu_Cf, Rd, R); /* Cf = Rd & ~R */
-    tcg_gen_shri_tl(cpu_Cf, cpu_Cf, 15);
-
-    /* Vf */
-    tcg_gen_andc_tl(cpu_Vf, R, Rd); /* Vf = R & ~Rd */
-    tcg_gen_shri_tl(cpu_Vf, cpu_Vf, 15);
-
-    /* Zf */
-    tcg_gen_mov_tl(cpu_Zf, R); /* Zf = R */
-
-    /* Nf */
-    tcg_gen_shri_tl(cpu_Nf, R, 15); /* Nf = R(15) */
-
-    /* Sf */
-    tcg_gen_xor_tl(cpu_Sf, cpu_Nf, cpu_Vf);/* Sf = Nf ^ Vf */
+    tcg_gen_mov_tl(cpu_cc_src, Rd);
+    gen_set_cc_result(ctx, CC_OP_ADDW, R);
 
     /* R */
     tcg_gen_andi_tl(RdL, R, 0xff);
@@ -445,16 +1087,12 @@ static int avr_translate_AND(DisasContext *ctx, uint32_t opcode)
     TCGv Rr = cpu_r[AND_Rr(opcode)];
     TCGv R = tcg_temp_new_i32();
 
+    gen_keep_CHf(ctx);
+
     /* op */
     tcg_gen_and_tl(R, Rd, Rr); /* Rd = Rd and Rr */
 
-    /* Vf */
-    tcg_gen_movi_tl(cpu_Vf, 0x00); /* Vf = 0 */
-
-    /* Zf */
-    tcg_gen_mov_tl(cpu_Zf, R); /* Zf = R */
-
-    gen_ZNSf(R);
+    gen_set_cc_result(ctx, CC_OP_LOGIC, R);
 
     /* R */
     tcg_gen_mov_tl(Rd, R);
@@ -473,11 +1111,12 @@ static int avr_translate_ANDI(DisasContext *ctx, uint32_t opcode)
     TCGv Rd = cpu_r[16 + ANDI_Rd(opcode)];
     int Imm = (ANDI_Imm(opcode));
 
+    gen_keep_CHf(ctx);
+
     /* op */
     tcg_gen_andi_tl(Rd, Rd, Imm); /* Rd = Rd & Imm */
 
-    tcg_gen_movi_tl(cpu_Vf, 0x00); /* Vf = 0 */
-    gen_ZNSf(Rd);
+    gen_set_cc_result(ctx, CC_OP_LOGIC, Rd);
 
     return BS_NONE;
 }
@@ -494,6 +1133,8 @@ static int avr_translate_ASR(DisasContext *ctx, uint32_t opcode)
     TCGv t1 = tcg_temp_new_i32();
     TCGv t2 = tcg_temp_new_i32();
 
+    gen_keep_Hf(ctx);
+
     /* op */
     tcg_gen_andi_tl(t1, Rd, 0x80); /* t1 = (Rd & 0x80) | (Rd >> 1) */
     tcg_gen_shri_tl(t2, Rd, 1);
@@ -502,10 +1143,7 @@ static int avr_translate_ASR(DisasContext *ctx, uint32_t opcode)
     /* Cf */
     tcg_gen_andi_tl(cpu_Cf, Rd, 1); /* Cf = Rd(0) */
 
-    /* Vf */
-    tcg_gen_and_tl(cpu_Vf, cpu_Nf, cpu_Cf);/* Vf = Nf & Cf */
-
-    gen_ZNSf(t1);
+    gen_shift_ZNVSf(ctx, t1);
 
     /* op */
     tcg_gen_mov_tl(Rd, t1);
@@ -521,6 +1159,10 @@ static int avr_translate_ASR(DisasContext *ctx, uint32_t opcode)
  */
 static int avr_translate_BCLR(DisasContext *ctx, uint32_t opcode)
 {
+    if (BCLR_Bit(opcode) < 6) {
+        gen_compute_flags(ctx); /* C, Z, N, V, S & H are evaluated lazily */
+    }
+
     switch (BCLR_Bit(opcode)) {
     case 0x00:
         tcg_gen_movi_tl(cpu_Cf, 0x00);
@@ -579,36 +1221,32 @@ static int avr_translate_BRBC(DisasContext *ctx, uint32_t opcode)
 {
     TCGLabel *taken = gen_new_label();
     int Imm = sextract32(BRBC_Imm(opcode), 0, 7);
+    TCGv t0 = tcg_temp_new_i32();
+
+    ctx->extra_cycles = 1; /* branch taken */
 
-    switch (BRBC_Bit(opcode)) {
-    case 0x00:
-        tcg_gen_brcondi_i32(TCG_COND_EQ, cpu_Cf, 0, taken);
-        break;
-    case 0x01:
-        tcg_gen_brcondi_i32(TCG_COND_NE, cpu_Zf, 0, taken);
-        break;
-    case 0x02:
-        tcg_gen_brcondi_i32(TCG_COND_EQ, cpu_Nf, 0, taken);
-        break;
-    case 0x03:
-        tcg_gen_brcondi_i32(TCG_COND_EQ, cpu_Vf, 0, taken);
-        break;
-    case 0x04:
-        tcg_gen_brcondi_i32(TCG_COND_EQ, cpu_Sf, 0, taken);
-        break;
-    case 0x05:
-        tcg_gen_brcondi_i32(TCG_COND_EQ, cpu_Hf, 0, taken);
-        break;
-    case 0x06:
-        tcg_gen_brcondi_i32(TCG_COND_EQ, cpu_Tf, 0, taken);
-        break;
-    case 0x07:
-        tcg_gen_brcondi_i32(TCG_COND_EQ, cpu_If, 0, taken);
-        break;
+    gen_compute_flag(ctx, t0, BRBC_Bit(opcode));
+
+    if (BRBC_Bit(opcode) == 0x01) {
+        /* Zf has negative logic */
+        tcg_gen_brcondi_i32(TCG_COND_NE, t0, 0, taken);
+    } else {
+        tcg_gen_brcondi_i32(TCG_COND_EQ, t0, 0, taken);
     }
 
+    tcg_temp_free_i32(t0);
+
+    gen_cycles_exit(ctx, 0);
+    if (gen_trace_follow(ctx, ctx->inst[0].npc)) {
+        gen_trace_side_exit(ctx, taken, ctx->inst[0].npc + Imm);
+        return BS_NONE;
+    }
     gen_goto_tb(ctx, 1, ctx->inst[0].npc);
     gen_set_label(taken);
+    gen_cycles_exit(ctx, 1);
+    if (gen_trace_follow(ctx, ctx->inst[0].npc + Imm)) {
+        return BS_NONE;
+    }
     gen_goto_tb(ctx, 0, ctx->inst[0].npc + Imm);
 
     return BS_BRANCH;
@@ -624,36 +1262,32 @@ static int avr_translate_BRBS(DisasContext *ctx, uint32_t opcode)
 {
     TCGLabel *taken = gen_new_label();
     int Imm = sextract32(BRBS_Imm(opcode), 0, 7);
+    TCGv t0 = tcg_temp_new_i32();
 
-    switch (BRBS_Bit(opcode)) {
-    case 0x00:
-        tcg_gen_brcondi_i32(TCG_COND_EQ, cpu_Cf, 1, taken);
-        break;
-    case 0x01:
-        tcg_gen_brcondi_i32(TCG_COND_EQ, cpu_Zf, 0, taken);
-        break;
-    case 0x02:
-        tcg_gen_brcondi_i32(TCG_COND_EQ, cpu_Nf, 1, taken);
-        break;
-    case 0x03:
-        tcg_gen_brcondi_i32(TCG_COND_EQ, cpu_Vf, 1, taken);
-        break;
-    case 0x04:
-        tcg_gen_brcondi_i32(TCG_COND_EQ, cpu_Sf, 1, taken);
-        break;
-    case 0x05:
-        tcg_gen_brcondi_i32(TCG_COND_EQ, cpu_Hf, 1, taken);
-        break;
-    case 0x06:
-        tcg_gen_brcondi_i32(TCG_COND_EQ, cpu_Tf, 1, taken);
-        break;
-    case 0x07:
-        tcg_gen_brcondi_i32(TCG_COND_EQ, cpu_If, 1, taken);
-        break;
+    ctx->extra_cycles = 1; /* branch taken */
+
+    gen_compute_flag(ctx, t0, BRBS_Bit(opcode));
+
+    if (BRBS_Bit(opcode) == 0x01) {
+        /* Zf has negative logic */
+        tcg_gen_brcondi_i32(TCG_COND_EQ, t0, 0, taken);
+    } else {
+        tcg_gen_brcondi_i32(TCG_COND_NE, t0, 0, taken);
     }
 
+    tcg_temp_free_i32(t0);
+
+    gen_cycles_exit(ctx, 0);
+    if (gen_trace_follow(ctx, ctx->inst[0].npc)) {
+        gen_trace_side_exit(ctx, taken, ctx->inst[0].npc + Imm);
+        return BS_NONE;
+    }
     gen_goto_tb(ctx, 1, ctx->inst[0].npc);
     gen_set_label(taken);
+    gen_cycles_exit(ctx, 1);
+    if (gen_trace_follow(ctx, ctx->inst[0].npc + Imm)) {
+        return BS_NONE;
+    }
     gen_goto_tb(ctx, 0, ctx->inst[0].npc + Imm);
 
     return BS_BRANCH;
@@ -664,6 +1298,10 @@ static int avr_translate_BRBS(DisasContext *ctx, uint32_t opcode)
  */
 static int avr_translate_BSET(DisasContext *ctx, uint32_t opcode)
 {
+    if (BSET_Bit(opcode) < 6) {
+        gen_compute_flags(ctx); /* C, Z, N, V, S & H are evaluated lazily */
+    }
+
     switch (BSET_Bit(opcode)) {
     case 0x00:
         tcg_gen_movi_tl(cpu_Cf, 0x01);
@@ -748,6 +1386,11 @@ static int avr_translate_CALL(DisasContext *ctx, uint32_t opcode)
     int ret = ctx->inst[0].npc;
 
     gen_push_ret(ctx, ret);
+    gen_trace_code(ctx, AVR_TRACE_CALL, ctx->inst[0].cpc);
+    gen_cycles_exit(ctx, 0);
+    if (gen_trace_follow(ctx, Imm)) {
+        return BS_NONE;
+    }
     gen_goto_tb(ctx, 0, Imm);
 
     return BS_BRANCH;
@@ -759,9 +1402,22 @@ static int avr_translate_CALL(DisasContext *ctx, uint32_t opcode)
  */
 static int avr_translate_CBI(DisasContext *ctx, uint32_t opcode)
 {
-    TCGv data = tcg_temp_new_i32();
-    TCGv port = tcg_const_i32(CBI_Imm(opcode));
+    TCGv data;
+    TCGv port;
+
+    if (avr_io_plain(ctx, CBI_Imm(opcode))) {
+        data = tcg_temp_new_i32();
+        gen_io_plain_ld(data, CBI_Imm(opcode));
+        tcg_gen_andi_tl(data, data, ~(1 << CBI_Bit(opcode)));
+        gen_io_plain_st(data, CBI_Imm(opcode));
+        tcg_temp_free_i32(data);
+        return BS_NONE;
+    }
 
+    data = tcg_temp_new_i32();
+    port = tcg_const_i32(CBI_Imm(opcode));
+
+    gen_port_start(ctx);
     gen_helper_inb(data, cpu_env, port);
     tcg_gen_andi_tl(data, data, ~(1 << CBI_Bit(opcode)));
     gen_helper_outb(cpu_env, port, data);
@@ -769,7 +1425,7 @@ static int avr_translate_CBI(DisasContext *ctx, uint32_t opcode)
     tcg_temp_free_i32(data);
     tcg_temp_free_i32(port);
 
-    return BS_NONE;
+    return gen_port_end(ctx);
 }
 
 /*
@@ -780,15 +1436,13 @@ static int avr_translate_CBI(DisasContext *ctx, uint32_t opcode)
 static int avr_translate_COM(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[COM_Rd(opcode)];
-    TCGv R = tcg_temp_new_i32();
+
+    gen_keep_CHf(ctx);
 
     tcg_gen_xori_tl(Rd, Rd, 0xff);
 
     tcg_gen_movi_tl(cpu_Cf, 1); /* Cf = 1 */
-    tcg_gen_movi_tl(cpu_Vf, 0); /* Vf = 0 */
-    gen_ZNSf(Rd);
-
-    tcg_temp_free_i32(R);
+    gen_set_cc_result(ctx, CC_OP_LOGIC, Rd);
 
     return BS_NONE;
 }
@@ -808,9 +1462,7 @@ static int avr_translate_CP(DisasContext *ctx, uint32_t opcode)
     tcg_gen_sub_tl(R, Rd, Rr); /* R = Rd - Rr */
     tcg_gen_andi_tl(R, R, 0xff); /* make it 8 bits */
 
-    gen_sub_CHf(R, Rd, Rr);
-    gen_sub_Vf(R, Rd, Rr);
-    gen_ZNSf(R);
+    gen_set_cc_arith(ctx, CC_OP_SUB, R, Rd, Rr);
 
     tcg_temp_free_i32(R);
 
@@ -827,21 +1479,18 @@ static int avr_translate_CPC(DisasContext *ctx, uint32_t opcode)
     TCGv Rd = cpu_r[CPC_Rd(opcode)];
     TCGv Rr = cpu_r[CPC_Rr(opcode)];
     TCGv R = tcg_temp_new_i32();
+    TCGv Zf = tcg_temp_new_i32();
 
     /* op */
-    tcg_gen_sub_tl(R, Rd, Rr); /* R = Rd - Rr - Cf */
-    tcg_gen_sub_tl(R, R, cpu_Cf);
+    gen_compute_Zf(ctx, Zf);
+    gen_compute_Cf(ctx, R); /* R = Rd - Rr - Cf */
+    tcg_gen_sub_tl(R, Rd, R);
+    tcg_gen_sub_tl(R, R, Rr);
     tcg_gen_andi_tl(R, R, 0xff); /* make it 8 bits */
 
-    gen_sub_CHf(R, Rd, Rr);
-    gen_sub_Vf(R, Rd, Rr);
-    gen_NSf(R);
-
-    /* Previous value remains unchanged when the result is zero;
-     * cleared otherwise.
-     */
-    tcg_gen_or_tl(cpu_Zf, cpu_Zf, R);
+    gen_set_cc_sbc(ctx, R, Rd, Rr, Zf);
 
+    tcg_temp_free_i32(Zf);
     tcg_temp_free_i32(R);
 
     return BS_NONE;
@@ -863,9 +1512,7 @@ static int avr_translate_CPI(DisasContext *ctx, uint32_t opcode)
     tcg_gen_sub_tl(R, Rd, Rr); /* R = Rd - Rr */
     tcg_gen_andi_tl(R, R, 0xff); /* make it 8 bits */
 
-    gen_sub_CHf(R, Rd, Rr);
-    gen_sub_Vf(R, Rd, Rr);
-    gen_ZNSf(R);
+    gen_set_cc_arith(ctx, CC_OP_SUB, R, Rd, Rr);
 
     tcg_temp_free_i32(R);
     tcg_temp_free_i32(Rr);
@@ -883,14 +1530,9 @@ static int avr_translate_CPSE(DisasContext *ctx, uint32_t opcode)
     TCGv Rr = cpu_r[CPSE_Rr(opcode)];
     TCGLabel *skip = gen_new_label();
 
-        /* PC if next inst is skipped */
-    tcg_gen_movi_tl(cpu_pc, ctx->inst[1].npc);
     tcg_gen_brcond_i32(TCG_COND_EQ, Rd, Rr, skip);
-        /* PC if next inst is not skipped */
-    tcg_gen_movi_tl(cpu_pc, ctx->inst[0].npc);
-    gen_set_label(skip);
 
-    return BS_BRANCH;
+    return gen_skip_exits(ctx, skip, -1);
 }
 
 /*
@@ -905,12 +1547,12 @@ static int avr_translate_DEC(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[DEC_Rd(opcode)];
 
+    gen_keep_CHf(ctx);
+
     tcg_gen_subi_tl(Rd, Rd, 1); /* Rd = Rd - 1 */
     tcg_gen_andi_tl(Rd, Rd, 0xff); /* make it 8 bits */
 
-        /* cpu_Vf = Rd == 0x7f */
-    tcg_gen_setcondi_tl(TCG_COND_EQ, cpu_Vf, Rd, 0x7f);
-    gen_ZNSf(Rd);
+    gen_set_cc_result(ctx, CC_OP_DEC, Rd); /* Vf = Rd == 0x7f */
 
     return BS_NONE;
 }
@@ -966,8 +1608,9 @@ static int avr_translate_EICALL(DisasContext *ctx, uint32_t opcode)
     int ret = ctx->inst[0].npc;
 
     gen_push_ret(ctx, ret);
+    gen_trace_code(ctx, AVR_TRACE_CALL, ctx->inst[0].cpc);
 
-    gen_jmp_ez();
+    gen_jmp_ez(ctx);
 
     return BS_BRANCH;
 }
@@ -987,7 +1630,7 @@ static int avr_translate_EIJMP(DisasContext *ctx, uint32_t opcode)
         return BS_EXCP;
     }
 
-    gen_jmp_ez();
+    gen_jmp_ez(ctx);
 
     return BS_BRANCH;
 }
@@ -1017,7 +1660,7 @@ static int avr_translate_ELPM1(DisasContext *ctx, uint32_t opcode)
     }
 
     TCGv Rd = cpu_r[0];
-    TCGv addr = gen_get_zaddr();
+    TCGv addr = gen_get_zaddr(ctx);
 
     tcg_gen_qemu_ld8u(Rd, addr, MMU_CODE_IDX); /* Rd = mem[addr] */
 
@@ -1035,7 +1678,7 @@ static int avr_translate_ELPM2(DisasContext *ctx, uint32_t opcode)
     }
 
     TCGv Rd = cpu_r[ELPM2_Rd(opcode)];
-    TCGv addr = gen_get_zaddr();
+    TCGv addr = gen_get_zaddr(ctx);
 
     tcg_gen_qemu_ld8u(Rd, addr, MMU_CODE_IDX); /* Rd = mem[addr] */
 
@@ -1053,13 +1696,13 @@ static int avr_translate_ELPMX(DisasContext *ctx, uint32_t opcode)
     }
 
     TCGv Rd = cpu_r[ELPMX_Rd(opcode)];
-    TCGv addr = gen_get_zaddr();
+    TCGv addr = gen_get_zaddr(ctx);
 
     tcg_gen_qemu_ld8u(Rd, addr, MMU_CODE_IDX); /* Rd = mem[addr] */
 
     tcg_gen_addi_tl(addr, addr, 1); /* addr = addr + 1 */
 
-    gen_set_zaddr(addr);
+    gen_set_zaddr(ctx, addr);
 
     tcg_temp_free_i32(addr);
 
@@ -1075,10 +1718,11 @@ static int avr_translate_EOR(DisasContext *ctx, uint32_t opcode)
     TCGv Rd = cpu_r[EOR_Rd(opcode)];
     TCGv Rr = cpu_r[EOR_Rr(opcode)];
 
+    gen_keep_CHf(ctx);
+
     tcg_gen_xor_tl(Rd, Rd, Rr);
 
-    tcg_gen_movi_tl(cpu_Vf, 0);
-    gen_ZNSf(Rd);
+    gen_set_cc_result(ctx, CC_OP_LOGIC, Rd);
 
     return BS_NONE;
 }
@@ -1095,23 +1739,8 @@ static int avr_translate_FMUL(DisasContext *ctx, uint32_t opcode)
         return BS_EXCP;
     }
 
-    TCGv R0 = cpu_r[0];
-    TCGv R1 = cpu_r[1];
-    TCGv Rd = cpu_r[16 + FMUL_Rd(opcode)];
-    TCGv Rr = cpu_r[16 + FMUL_Rr(opcode)];
-    TCGv R = tcg_temp_new_i32();
-
-    tcg_gen_mul_tl(R, Rd, Rr); /* R = Rd *Rr */
-    tcg_gen_shli_tl(R, R, 1);
-
-    tcg_gen_andi_tl(R0, R, 0xff);
-    tcg_gen_shri_tl(R, R, 8);
-    tcg_gen_andi_tl(R1, R, 0xff);
-
-    tcg_gen_shri_tl(cpu_Cf, R, 16); /* Cf = R(16) */
-    tcg_gen_andi_tl(cpu_Zf, R, 0x0000ffff);
-
-    tcg_temp_free_i32(R);
+    gen_mul(ctx, cpu_r[16 + FMUL_Rd(opcode)], cpu_r[16 + FMUL_Rr(opcode)],
+            false, false, true);
 
     return BS_NONE;
 }
@@ -1128,29 +1757,8 @@ static int avr_translate_FMULS(DisasContext *ctx, uint32_t opcode)
         return BS_EXCP;
     }
 
-    TCGv R0 = cpu_r[0];
-    TCGv R1 = cpu_r[1];
-    TCGv Rd = cpu_r[16 + FMULS_Rd(opcode)];
-    TCGv Rr = cpu_r[16 + FMULS_Rr(opcode)];
-    TCGv R = tcg_temp_new_i32();
-    TCGv t0 = tcg_temp_new_i32();
-    TCGv t1 = tcg_temp_new_i32();
-
-    tcg_gen_ext8s_tl(t0, Rd); /* make Rd full 32 bit signed */
-    tcg_gen_ext8s_tl(t1, Rr); /* make Rr full 32 bit signed */
-    tcg_gen_mul_tl(R, t0, t1); /* R = Rd *Rr */
-    tcg_gen_shli_tl(R, R, 1);
-
-    tcg_gen_andi_tl(R0, R, 0xff);
-    tcg_gen_shri_tl(R, R, 8);
-    tcg_gen_andi_tl(R1, R, 0xff);
-
-    tcg_gen_shri_tl(cpu_Cf, R, 16); /* Cf = R(16) */
-    tcg_gen_andi_tl(cpu_Zf, R, 0x0000ffff);
-
-    tcg_temp_free_i32(t1);
-    tcg_temp_free_i32(t0);
-    tcg_temp_free_i32(R);
+    gen_mul(ctx, cpu_r[16 + FMULS_Rd(opcode)], cpu_r[16 + FMULS_Rr(opcode)],
+            true, true, true);
 
     return BS_NONE;
 }
@@ -1167,26 +1775,8 @@ static int avr_translate_FMULSU(DisasContext *ctx, uint32_t opcode)
         return BS_EXCP;
     }
 
-    TCGv R0 = cpu_r[0];
-    TCGv R1 = cpu_r[1];
-    TCGv Rd = cpu_r[16 + FMULSU_Rd(opcode)];
-    TCGv Rr = cpu_r[16 + FMULSU_Rr(opcode)];
-    TCGv R = tcg_temp_new_i32();
-    TCGv t0 = tcg_temp_new_i32();
-
-    tcg_gen_ext8s_tl(t0, Rd); /* make Rd full 32 bit signed */
-    tcg_gen_mul_tl(R, t0, Rr); /* R = Rd *Rr */
-    tcg_gen_shli_tl(R, R, 1);
-
-    tcg_gen_andi_tl(R0, R, 0xff);
-    tcg_gen_shri_tl(R, R, 8);
-    tcg_gen_andi_tl(R1, R, 0xff);
-
-    tcg_gen_shri_tl(cpu_Cf, R, 16); /* Cf = R(16) */
-    tcg_gen_andi_tl(cpu_Zf, R, 0x0000ffff);
-
-    tcg_temp_free_i32(t0);
-    tcg_temp_free_i32(R);
+    gen_mul(ctx, cpu_r[16 + FMULSU_Rd(opcode)],
+            cpu_r[16 + FMULSU_Rr(opcode)], true, false, true);
 
     return BS_NONE;
 }
@@ -1209,7 +1799,8 @@ static int avr_translate_ICALL(DisasContext *ctx, uint32_t opcode)
     int ret = ctx->inst[0].npc;
 
     gen_push_ret(ctx, ret);
-    gen_jmp_z();
+    gen_trace_code(ctx, AVR_TRACE_CALL, ctx->inst[0].cpc);
+    gen_jmp_z(ctx);
 
     return BS_BRANCH;
 }
@@ -1229,7 +1820,7 @@ static int avr_translate_IJMP(DisasContext *ctx, uint32_t opcode)
         return BS_EXCP;
     }
 
-    gen_jmp_z();
+    gen_jmp_z(ctx);
 
     return BS_BRANCH;
 }
@@ -1242,13 +1833,20 @@ static int avr_translate_IN(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[IN_Rd(opcode)];
     int Imm = IN_Imm(opcode);
-    TCGv port = tcg_const_i32(Imm);
+    TCGv port;
+
+    if (avr_io_plain(ctx, Imm)) {
+        gen_io_plain_ld(Rd, Imm);
+        return BS_NONE;
+    }
 
+    port = tcg_const_i32(Imm);
+    gen_port_start(ctx);
     gen_helper_inb(Rd, cpu_env, port);
 
     tcg_temp_free_i32(port);
 
-    return BS_NONE;
+    return gen_port_end(ctx);
 }
 
 /*
@@ -1263,12 +1861,12 @@ static int avr_translate_INC(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[INC_Rd(opcode)];
 
+    gen_keep_CHf(ctx);
+
     tcg_gen_addi_tl(Rd, Rd, 1);
     tcg_gen_andi_tl(Rd, Rd, 0xff);
 
-        /* cpu_Vf = Rd == 0x80 */
-    tcg_gen_setcondi_tl(TCG_COND_EQ, cpu_Vf, Rd, 0x80);
-    gen_ZNSf(Rd);
+    gen_set_cc_result(ctx, CC_OP_INC, Rd); /* Vf = Rd == 0x80 */
     return BS_NONE;
 }
 
@@ -1285,6 +1883,10 @@ static int avr_translate_JMP(DisasContext *ctx, uint32_t opcode)
         return BS_EXCP;
     }
 
+    gen_cycles_exit(ctx, 0);
+    if (gen_trace_follow(ctx, JMP_Imm(opcode))) {
+        return BS_NONE;
+    }
     gen_goto_tb(ctx, 0, JMP_Imm(opcode));
     return BS_BRANCH;
 }
@@ -1299,22 +1901,71 @@ static int avr_translate_JMP(DisasContext *ctx, uint32_t opcode)
  *  changed.  The Z-pointer Register is left unchanged by the operation. This
  *  instruction is especially suited for clearing status bits stored in SRAM.
  */
+
+/*
+ *  the first page of the data space holds CPU registers, IO registers and
+ *  extended IO registers. Accesses to it are done by fullrd/fullwr helpers,
+ *  all other addresses are SRAM and go directly to the softmmu fast path.
+ *  The check is done by the generated code, so a pointer which
+ *  occasionally hits the IO page does not cause a TLB miss followed by a
+ *  retranslation of the instruction with TB_FLAGS_FULL_ACCESS.
+ *
+ *  NOTE: addr & data have to be local temps or globals as their values are
+ *  used across the branch
+ */
 static void gen_data_store(DisasContext *ctx, TCGv data, TCGv addr)
 {
+    TCGLabel *io;
+    TCGLabel *done;
+    TCGv t0;
+
+    gen_trace_data(ctx, AVR_TRACE_ST, addr);
+
     if (ctx->tb->flags & TB_FLAGS_FULL_ACCESS) {
-        gen_helper_fullwr(cpu_env, data, addr);
-    } else {
-        tcg_gen_qemu_st8(data, addr, MMU_DATA_IDX); /* mem[addr] = data */
+        t0 = tcg_const_i32(1);
+        gen_helper_fullwr(cpu_env, data, addr, t0);
+        tcg_temp_free_i32(t0);
+        return;
     }
+
+    io = gen_new_label();
+    done = gen_new_label();
+
+    tcg_gen_brcondi_tl(TCG_COND_LTU, addr, TARGET_PAGE_SIZE, io);
+    tcg_gen_qemu_st8(data, addr, MMU_DATA_IDX); /* mem[addr] = data */
+    tcg_gen_br(done);
+
+    gen_set_label(io);
+    t0 = tcg_const_i32(0);
+    gen_helper_fullwr(cpu_env, data, addr, t0);
+    tcg_temp_free_i32(t0);
+
+    gen_set_label(done);
 }
 
 static void gen_data_load(DisasContext *ctx, TCGv data, TCGv addr)
 {
+    TCGLabel *io;
+    TCGLabel *done;
+
+    gen_trace_data(ctx, AVR_TRACE_LD, addr);
+
     if (ctx->tb->flags & TB_FLAGS_FULL_ACCESS) {
         gen_helper_fullrd(data, cpu_env, addr);
-    } else {
-        tcg_gen_qemu_ld8u(data, addr, MMU_DATA_IDX); /* data = mem[addr] */
+        return;
     }
+
+    io = gen_new_label();
+    done = gen_new_label();
+
+    tcg_gen_brcondi_tl(TCG_COND_LTU, addr, TARGET_PAGE_SIZE, io);
+    tcg_gen_qemu_ld8u(data, addr, MMU_DATA_IDX); /* data = mem[addr] */
+    tcg_gen_br(done);
+
+    gen_set_label(io);
+    gen_helper_fullrd(data, cpu_env, addr);
+
+    gen_set_label(done);
 }
 
 static int avr_translate_LAC(DisasContext *ctx, uint32_t opcode)
@@ -1326,9 +1977,9 @@ static int avr_translate_LAC(DisasContext *ctx, uint32_t opcode)
     }
 
     TCGv Rr = cpu_r[LAC_Rr(opcode)];
-    TCGv addr = gen_get_zaddr();
-    TCGv t0 = tcg_temp_new_i32();
-    TCGv t1 = tcg_temp_new_i32();
+    TCGv addr = gen_get_zaddr(ctx);
+    TCGv t0 = tcg_temp_local_new_i32();
+    TCGv t1 = tcg_temp_local_new_i32();
 
     gen_data_load(ctx, t0, addr); /* t0 = mem[addr] */
         /* t1 = t0 & (0xff - Rr) = t0 and ~Rr */
@@ -1363,9 +2014,9 @@ static int avr_translate_LAS(DisasContext *ctx, uint32_t opcode)
     }
 
     TCGv Rr = cpu_r[LAS_Rr(opcode)];
-    TCGv addr = gen_get_zaddr();
-    TCGv t0 = tcg_temp_new_i32();
-    TCGv t1 = tcg_temp_new_i32();
+    TCGv addr = gen_get_zaddr(ctx);
+    TCGv t0 = tcg_temp_local_new_i32();
+    TCGv t1 = tcg_temp_local_new_i32();
 
     gen_data_load(ctx, t0, addr); /* t0 = mem[addr] */
     tcg_gen_or_tl(t1, t0, Rr);
@@ -1399,9 +2050,9 @@ static int avr_translate_LAT(DisasContext *ctx, uint32_t opcode)
     }
 
     TCGv Rr = cpu_r[LAT_Rr(opcode)];
-    TCGv addr = gen_get_zaddr();
-    TCGv t0 = tcg_temp_new_i32();
-    TCGv t1 = tcg_temp_new_i32();
+    TCGv addr = gen_get_zaddr(ctx);
+    TCGv t0 = tcg_temp_local_new_i32();
+    TCGv t1 = tcg_temp_local_new_i32();
 
     gen_data_load(ctx, t0, addr); /* t0 = mem[addr] */
     tcg_gen_xor_tl(t1, t0, Rr);
@@ -1444,7 +2095,7 @@ static int avr_translate_LAT(DisasContext *ctx, uint32_t opcode)
 static int avr_translate_LDX1(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[LDX1_Rd(opcode)];
-    TCGv addr = gen_get_xaddr();
+    TCGv addr = gen_get_xaddr(ctx);
 
     gen_data_load(ctx, Rd, addr);
 
@@ -1456,12 +2107,12 @@ static int avr_translate_LDX1(DisasContext *ctx, uint32_t opcode)
 static int avr_translate_LDX2(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[LDX2_Rd(opcode)];
-    TCGv addr = gen_get_xaddr();
+    TCGv addr = gen_get_xaddr(ctx);
 
     gen_data_load(ctx, Rd, addr);
     tcg_gen_addi_tl(addr, addr, 1); /* addr = addr + 1 */
 
-    gen_set_xaddr(addr);
+    gen_set_xaddr(ctx, addr);
 
     tcg_temp_free_i32(addr);
 
@@ -1471,11 +2122,11 @@ static int avr_translate_LDX2(DisasContext *ctx, uint32_t opcode)
 static int avr_translate_LDX3(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[LDX3_Rd(opcode)];
-    TCGv addr = gen_get_xaddr();
+    TCGv addr = gen_get_xaddr(ctx);
 
-    tcg_gen_subi_tl(addr, addr, 1); /* addr = addr - 1 */
+    gen_dec_addr(ctx, addr, AVR_FEATURE_RAMPX);
     gen_data_load(ctx, Rd, addr);
-    gen_set_xaddr(addr);
+    gen_set_xaddr(ctx, addr);
 
     tcg_temp_free_i32(addr);
 
@@ -1510,12 +2161,12 @@ static int avr_translate_LDX3(DisasContext *ctx, uint32_t opcode)
 static int avr_translate_LDY2(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[LDY2_Rd(opcode)];
-    TCGv addr = gen_get_yaddr();
+    TCGv addr = gen_get_yaddr(ctx);
 
     gen_data_load(ctx, Rd, addr);
     tcg_gen_addi_tl(addr, addr, 1); /* addr = addr + 1 */
 
-    gen_set_yaddr(addr);
+    gen_set_yaddr(ctx, addr);
 
     tcg_temp_free_i32(addr);
 
@@ -1525,11 +2176,11 @@ static int avr_translate_LDY2(DisasContext *ctx, uint32_t opcode)
 static int avr_translate_LDY3(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[LDY3_Rd(opcode)];
-    TCGv addr = gen_get_yaddr();
+    TCGv addr = gen_get_yaddr(ctx);
 
-    tcg_gen_subi_tl(addr, addr, 1); /* addr = addr - 1 */
+    gen_dec_addr(ctx, addr, AVR_FEATURE_RAMPY);
     gen_data_load(ctx, Rd, addr);
-    gen_set_yaddr(addr);
+    gen_set_yaddr(ctx, addr);
 
     tcg_temp_free_i32(addr);
 
@@ -1539,7 +2190,7 @@ static int avr_translate_LDY3(DisasContext *ctx, uint32_t opcode)
 static int avr_translate_LDDY(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[LDDY_Rd(opcode)];
-    TCGv addr = gen_get_yaddr();
+    TCGv addr = gen_get_yaddr(ctx);
 
     tcg_gen_addi_tl(addr, addr, LDDY_Imm(opcode)); /* addr = addr + q */
     gen_data_load(ctx, Rd, addr);
@@ -1581,12 +2232,12 @@ static int avr_translate_LDDY(DisasContext *ctx, uint32_t opcode)
 static int avr_translate_LDZ2(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[LDZ2_Rd(opcode)];
-    TCGv addr = gen_get_zaddr();
+    TCGv addr = gen_get_zaddr(ctx);
 
     gen_data_load(ctx, Rd, addr);
     tcg_gen_addi_tl(addr, addr, 1); /* addr = addr + 1 */
 
-    gen_set_zaddr(addr);
+    gen_set_zaddr(ctx, addr);
 
     tcg_temp_free_i32(addr);
 
@@ -1596,12 +2247,12 @@ static int avr_translate_LDZ2(DisasContext *ctx, uint32_t opcode)
 static int avr_translate_LDZ3(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[LDZ3_Rd(opcode)];
-    TCGv addr = gen_get_zaddr();
+    TCGv addr = gen_get_zaddr(ctx);
 
-    tcg_gen_subi_tl(addr, addr, 1); /* addr = addr - 1 */
+    gen_dec_addr(ctx, addr, AVR_FEATURE_RAMPZ);
     gen_data_load(ctx, Rd, addr);
 
-    gen_set_zaddr(addr);
+    gen_set_zaddr(ctx, addr);
 
     tcg_temp_free_i32(addr);
 
@@ -1611,7 +2262,7 @@ static int avr_translate_LDZ3(DisasContext *ctx, uint32_t opcode)
 static int avr_translate_LDDZ(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[LDDZ_Rd(opcode)];
-    TCGv addr = gen_get_zaddr();
+    TCGv addr = gen_get_zaddr(ctx);
 
     tcg_gen_addi_tl(addr, addr, LDDZ_Imm(opcode));
                                                     /* addr = addr + q */
@@ -1650,12 +2301,9 @@ static int avr_translate_LDI(DisasContext *ctx, uint32_t opcode)
 static int avr_translate_LDS(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[LDS_Rd(opcode)];
-    TCGv addr = tcg_temp_new_i32();
-    TCGv H = cpu_rampD;
+    TCGv addr = tcg_temp_local_new_i32();
 
-    tcg_gen_mov_tl(addr, H); /* addr = H:M:L */
-    tcg_gen_shli_tl(addr, addr, 16);
-    tcg_gen_ori_tl(addr, addr, LDS_Imm(opcode));
+    gen_get_daddr(ctx, addr, LDS_Imm(opcode));
 
     gen_data_load(ctx, Rd, addr);
 
@@ -1764,12 +2412,13 @@ static int avr_translate_LSR(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[LSR_Rd(opcode)];
 
+    gen_keep_Hf(ctx);
+
     tcg_gen_andi_tl(cpu_Cf, Rd, 1);
 
     tcg_gen_shri_tl(Rd, Rd, 1);
 
-    gen_ZNSf(Rd);
-    tcg_gen_xor_tl(cpu_Vf, cpu_Nf, cpu_Cf);
+    gen_shift_ZNVSf(ctx, Rd);
     return BS_NONE;
 }
 
@@ -1825,23 +2474,8 @@ static int avr_translate_MUL(DisasContext *ctx, uint32_t opcode)
         return BS_EXCP;
     }
 
-    TCGv R0 = cpu_r[0];
-    TCGv R1 = cpu_r[1];
-    TCGv Rd = cpu_r[MUL_Rd(opcode)];
-    TCGv Rr = cpu_r[MUL_Rr(opcode)];
-    TCGv R = tcg_temp_new_i32();
-
-    tcg_gen_mul_tl(R, Rd, Rr); /* R = Rd *Rr */
-
-    tcg_gen_mov_tl(R0, R);
-    tcg_gen_andi_tl(R0, R0, 0xff);
-    tcg_gen_shri_tl(R, R, 8);
-    tcg_gen_mov_tl(R1, R);
-
-    tcg_gen_shri_tl(cpu_Cf, R, 15); /* Cf = R(16) */
-    tcg_gen_mov_tl(cpu_Zf, R);
-
-    tcg_temp_free_i32(R);
+    gen_mul(ctx, cpu_r[MUL_Rd(opcode)], cpu_r[MUL_Rr(opcode)],
+            false, false, false);
 
     return BS_NONE;
 }
@@ -1857,30 +2491,8 @@ static int avr_translate_MULS(DisasContext *ctx, uint32_t opcode)
         return BS_EXCP;
     }
 
-    TCGv R0 = cpu_r[0];
-    TCGv R1 = cpu_r[1];
-    TCGv Rd = cpu_r[16 + MULS_Rd(opcode)];
-    TCGv Rr = cpu_r[16 + MULS_Rr(opcode)];
-    TCGv R = tcg_temp_new_i32();
-    TCGv t0 = tcg_temp_new_i32();
-    TCGv t1 = tcg_temp_new_i32();
-
-    tcg_gen_ext8s_tl(t0, Rd); /* make Rd full 32 bit signed */
-    tcg_gen_ext8s_tl(t1, Rr); /* make Rr full 32 bit signed */
-    tcg_gen_mul_tl(R, t0, t1); /* R = Rd * Rr */
-
-    tcg_gen_mov_tl(R0, R);
-    tcg_gen_andi_tl(R0, R0, 0xff);
-    tcg_gen_shri_tl(R, R, 8);
-    tcg_gen_mov_tl(R1, R);
-    tcg_gen_andi_tl(R1, R0, 0xff);
-
-    tcg_gen_shri_tl(cpu_Cf, R, 15); /* Cf = R(16) */
-    tcg_gen_mov_tl(cpu_Zf, R);
-
-    tcg_temp_free_i32(t1);
-    tcg_temp_free_i32(t0);
-    tcg_temp_free_i32(R);
+    gen_mul(ctx, cpu_r[16 + MULS_Rd(opcode)], cpu_r[16 + MULS_Rr(opcode)],
+            true, true, false);
 
     return BS_NONE;
 }
@@ -1897,27 +2509,8 @@ static int avr_translate_MULSU(DisasContext *ctx, uint32_t opcode)
         return BS_EXCP;
     }
 
-    TCGv R0 = cpu_r[0];
-    TCGv R1 = cpu_r[1];
-    TCGv Rd = cpu_r[16 + MULSU_Rd(opcode)];
-    TCGv Rr = cpu_r[16 + MULSU_Rr(opcode)];
-    TCGv R = tcg_temp_new_i32();
-    TCGv t0 = tcg_temp_new_i32();
-
-    tcg_gen_ext8s_tl(t0, Rd); /* make Rd full 32 bit signed */
-    tcg_gen_mul_tl(R, t0, Rr); /* R = Rd *Rr */
-
-    tcg_gen_mov_tl(R0, R);
-    tcg_gen_andi_tl(R0, R0, 0xff);
-    tcg_gen_shri_tl(R, R, 8);
-    tcg_gen_mov_tl(R1, R);
-    tcg_gen_andi_tl(R1, R0, 0xff);
-
-    tcg_gen_shri_tl(cpu_Cf, R, 16); /* Cf = R(16) */
-    tcg_gen_mov_tl(cpu_Zf, R);
-
-    tcg_temp_free_i32(t0);
-    tcg_temp_free_i32(R);
+    gen_mul(ctx, cpu_r[16 + MULSU_Rd(opcode)], cpu_r[16 + MULSU_Rr(opcode)],
+            true, false, false);
 
     return BS_NONE;
 }
@@ -1936,9 +2529,7 @@ static int avr_translate_NEG(DisasContext *ctx, uint32_t opcode)
     tcg_gen_sub_tl(R, t0, Rd); /* R = 0 - Rd */
     tcg_gen_andi_tl(R, R, 0xff); /* make it 8 bits */
 
-    gen_sub_CHf(R, t0, Rd);
-    gen_sub_Vf(R, t0, Rd);
-    gen_ZNSf(R);
+    gen_set_cc_arith(ctx, CC_OP_SUB, R, t0, Rd);
 
     /* R */
     tcg_gen_mov_tl(Rd, R);
@@ -1970,10 +2561,14 @@ static int avr_translate_OR(DisasContext *ctx, uint32_t opcode)
     TCGv Rr = cpu_r[OR_Rr(opcode)];
     TCGv R = tcg_temp_new_i32();
 
+    gen_keep_CHf(ctx);
+
     tcg_gen_or_tl(R, Rd, Rr);
 
-    tcg_gen_movi_tl(cpu_Vf, 0);
-    gen_ZNSf(R);
+    gen_set_cc_result(ctx, CC_OP_LOGIC, R);
+
+    /* R */
+    tcg_gen_mov_tl(Rd, R);
 
     tcg_temp_free_i32(R);
 
@@ -1989,10 +2584,11 @@ static int avr_translate_ORI(DisasContext *ctx, uint32_t opcode)
     TCGv Rd = cpu_r[16 + ORI_Rd(opcode)];
     int Imm = (ORI_Imm(opcode));
 
+    gen_keep_CHf(ctx);
+
     tcg_gen_ori_tl(Rd, Rd, Imm); /* Rd = Rd | Imm */
 
-    tcg_gen_movi_tl(cpu_Vf, 0x00); /* Vf = 0 */
-    gen_ZNSf(Rd);
+    gen_set_cc_result(ctx, CC_OP_LOGIC, Rd);
 
     return BS_NONE;
 }
@@ -2005,13 +2601,24 @@ static int avr_translate_OUT(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[OUT_Rd(opcode)];
     int Imm = OUT_Imm(opcode);
-    TCGv port = tcg_const_i32(Imm);
+    TCGv port;
+
+    if (avr_io_plain(ctx, Imm)) {
+        gen_io_plain_st(Rd, Imm);
+        return BS_NONE;
+    }
+
+    if (Imm == 0x3f) {
+        gen_compute_flags(ctx); /* SREG is written by the helper */
+    }
 
+    port = tcg_const_i32(Imm);
+    gen_port_start(ctx);
     gen_helper_outb(cpu_env, port, Rd);
 
     tcg_temp_free_i32(port);
 
-    return BS_NONE;
+    return gen_port_end(ctx);
 }
 
 /*
@@ -2060,6 +2667,11 @@ static int avr_translate_RCALL(DisasContext *ctx, uint32_t opcode)
     int dst = ctx->inst[0].npc + sextract32(RCALL_Imm(opcode), 0, 12);
 
     gen_push_ret(ctx, ret);
+    gen_trace_code(ctx, AVR_TRACE_CALL, ctx->inst[0].cpc);
+    gen_cycles_exit(ctx, 0);
+    if (gen_trace_follow(ctx, dst)) {
+        return BS_NONE;
+    }
     gen_goto_tb(ctx, 0, dst);
 
     return BS_BRANCH;
@@ -2071,8 +2683,10 @@ static int avr_translate_RCALL(DisasContext *ctx, uint32_t opcode)
  */
 static int avr_translate_RET(DisasContext *ctx, uint32_t opcode)
 {
+    gen_trace_code(ctx, AVR_TRACE_RET, ctx->inst[0].cpc);
     gen_pop_ret(ctx, cpu_pc);
 
+    gen_cycles_exit(ctx, 0);
     tcg_gen_exit_tb(0);
 
     return BS_BRANCH;
@@ -2088,10 +2702,12 @@ static int avr_translate_RET(DisasContext *ctx, uint32_t opcode)
  */
 static int avr_translate_RETI(DisasContext *ctx, uint32_t opcode)
 {
+    gen_trace_code(ctx, AVR_TRACE_RET, ctx->inst[0].cpc);
     gen_pop_ret(ctx, cpu_pc);
 
     tcg_gen_movi_tl(cpu_If, 1);
 
+    gen_cycles_exit(ctx, 0);
     tcg_gen_exit_tb(0);
 
     return BS_BRANCH;
@@ -2107,6 +2723,10 @@ static int avr_translate_RJMP(DisasContext *ctx, uint32_t opcode)
 {
     int dst = ctx->inst[0].npc + sextract32(RJMP_Imm(opcode), 0, 12);
 
+    gen_cycles_exit(ctx, 0);
+    if (gen_trace_follow(ctx, dst)) {
+        return BS_NONE;
+    }
     gen_goto_tb(ctx, 0, dst);
 
     return BS_BRANCH;
@@ -2124,13 +2744,15 @@ static int avr_translate_ROR(DisasContext *ctx, uint32_t opcode)
     TCGv Rd = cpu_r[ROR_Rd(opcode)];
     TCGv t0 = tcg_temp_new_i32();
 
-    tcg_gen_shli_tl(t0, cpu_Cf, 7);
-    tcg_gen_andi_tl(cpu_Cf, Rd, 0);
+    gen_compute_Cf(ctx, t0);
+    gen_keep_Hf(ctx);
+
+    tcg_gen_shli_tl(t0, t0, 7);
+    tcg_gen_andi_tl(cpu_Cf, Rd, 1);
     tcg_gen_shri_tl(Rd, Rd, 1);
     tcg_gen_or_tl(Rd, Rd, t0);
 
-    gen_ZNSf(Rd);
-    tcg_gen_xor_tl(cpu_Vf, cpu_Nf, cpu_Cf);
+    gen_shift_ZNVSf(ctx, Rd);
 
     tcg_temp_free_i32(t0);
 
@@ -2146,19 +2768,21 @@ static int avr_translate_SBC(DisasContext *ctx, uint32_t opcode)
     TCGv Rd = cpu_r[SBC_Rd(opcode)];
     TCGv Rr = cpu_r[SBC_Rr(opcode)];
     TCGv R = tcg_temp_new_i32();
+    TCGv Zf = tcg_temp_new_i32();
 
     /* op */
-    tcg_gen_sub_tl(R, Rd, Rr); /* R = Rd - Rr - Cf */
-    tcg_gen_sub_tl(R, R, cpu_Cf);
+    gen_compute_Zf(ctx, Zf);
+    gen_compute_Cf(ctx, R); /* R = Rd - Rr - Cf */
+    tcg_gen_sub_tl(R, Rd, R);
+    tcg_gen_sub_tl(R, R, Rr);
     tcg_gen_andi_tl(R, R, 0xff); /* make it 8 bits */
 
-    gen_sub_CHf(R, Rd, Rr);
-    gen_sub_Vf(R, Rd, Rr);
-    gen_ZNSf(R);
+    gen_set_cc_sbc(ctx, R, Rd, Rr, Zf);
 
     /* R */
     tcg_gen_mov_tl(Rd, R);
 
+    tcg_temp_free_i32(Zf);
     tcg_temp_free_i32(R);
 
     return BS_NONE;
@@ -2172,19 +2796,21 @@ static int avr_translate_SBCI(DisasContext *ctx, uint32_t opcode)
     TCGv Rd = cpu_r[16 + SBCI_Rd(opcode)];
     TCGv Rr = tcg_const_i32(SBCI_Imm(opcode));
     TCGv R = tcg_temp_new_i32();
+    TCGv Zf = tcg_temp_new_i32();
 
     /* op */
-    tcg_gen_sub_tl(R, Rd, Rr); /* R = Rd - Rr - Cf */
-    tcg_gen_sub_tl(R, R, cpu_Cf);
+    gen_compute_Zf(ctx, Zf);
+    gen_compute_Cf(ctx, R); /* R = Rd - Rr - Cf */
+    tcg_gen_sub_tl(R, Rd, R);
+    tcg_gen_sub_tl(R, R, Rr);
     tcg_gen_andi_tl(R, R, 0xff); /* make it 8 bits */
 
-    gen_sub_CHf(R, Rd, Rr);
-    gen_sub_Vf(R, Rd, Rr);
-    gen_ZNSf(R);
+    gen_set_cc_sbc(ctx, R, Rd, Rr, Zf);
 
     /* R */
     tcg_gen_mov_tl(Rd, R);
 
+    tcg_temp_free_i32(Zf);
     tcg_temp_free_i32(R);
     tcg_temp_free_i32(Rr);
 
@@ -2197,9 +2823,22 @@ static int avr_translate_SBCI(DisasContext *ctx, uint32_t opcode)
  */
 static int avr_translate_SBI(DisasContext *ctx, uint32_t opcode)
 {
-    TCGv data = tcg_temp_new_i32();
-    TCGv port = tcg_const_i32(SBI_Imm(opcode));
+    TCGv data;
+    TCGv port;
+
+    if (avr_io_plain(ctx, SBI_Imm(opcode))) {
+        data = tcg_temp_new_i32();
+        gen_io_plain_ld(data, SBI_Imm(opcode));
+        tcg_gen_ori_tl(data, data, 1 << SBI_Bit(opcode));
+        gen_io_plain_st(data, SBI_Imm(opcode));
+        tcg_temp_free_i32(data);
+        return BS_NONE;
+    }
+
+    data = tcg_temp_new_i32();
+    port = tcg_const_i32(SBI_Imm(opcode));
 
+    gen_port_start(ctx);
     gen_helper_inb(data, cpu_env, port);
     tcg_gen_ori_tl(data, data, 1 << SBI_Bit(opcode));
     gen_helper_outb(cpu_env, port, data);
@@ -2207,7 +2846,64 @@ static int avr_translate_SBI(DisasContext *ctx, uint32_t opcode)
     tcg_temp_free_i32(port);
     tcg_temp_free_i32(data);
 
-    return BS_NONE;
+    return gen_port_end(ctx);
+}
+
+/* two opcode words from pc, which counts words */
+static uint32_t avr_code_load(DisasContext *ctx, uint32_t pc)
+{
+    if (tb_worker_thread) {
+        /* the TLB is the vCPU's, the flash is read as ROM, see tb-worker.c */
+        return ldl_phys(CPU(avr_env_get_cpu(ctx->env))->as,
+                        PHYS_BASE_CODE + pc * 2);
+    }
+
+    return cpu_ldl_code(ctx->env, pc * 2);
+}
+
+/*
+ *  plain IO registers and those the board marks with avr_cpu_io_peek can be
+ *  read any number of times with the same effect as once
+ */
+static bool avr_io_peek(DisasContext *ctx, int port)
+{
+    return ctx->env->io[port].ram || ctx->env->io[port].peek;
+}
+
+/*
+ *  A poll loop waits for an IO bit, it is a SBIC/SBIS of port followed by a
+ *  RJMP back to it, or a SBRC/SBRS of reg followed by a RJMP back to an IN
+ *  of reg right before it. Nothing in the loop has side effects, reading
+ *  the IO register neither, so with -icount the bit cannot change before
+ *  the next timer event and the loop jumps there at once. Returns the start
+ *  of the loop or -1.
+ */
+static int avr_poll_loop(DisasContext *ctx, int port, int reg)
+{
+    InstInfo *rjmp = &ctx->inst[1];
+    uint32_t opcode;
+    int start;
+
+    if ((ctx->tb->cflags & CF_USE_ICOUNT) == 0
+            || rjmp->translate != &avr_translate_RJMP) {
+        return -1;
+    }
+    start = rjmp->npc + sextract32(RJMP_Imm(rjmp->opcode), 0, 12);
+
+    if (reg < 0) {
+        return start == ctx->inst[0].cpc && avr_io_peek(ctx, port)
+            ? start : -1;
+    }
+    if (start != ctx->inst[0].cpc - 1) {
+        return -1;
+    }
+    opcode = extract32(avr_code_load(ctx, start), 0, 16);
+    if ((opcode & 0xf800) != 0xb000 /* IN */ || IN_Rd(opcode) != reg
+            || !avr_io_peek(ctx, IN_Imm(opcode))) {
+        return -1;
+    }
+
+    return start;
 }
 
 /*
@@ -2218,23 +2914,26 @@ static int avr_translate_SBI(DisasContext *ctx, uint32_t opcode)
 static int avr_translate_SBIC(DisasContext *ctx, uint32_t opcode)
 {
     TCGv data = tcg_temp_new_i32();
-    TCGv port = tcg_const_i32(SBIC_Imm(opcode));
     TCGLabel *skip = gen_new_label();
+    TCGv port;
 
-    gen_helper_inb(data, cpu_env, port);
+    if (avr_io_plain(ctx, SBIC_Imm(opcode))) {
+        gen_io_plain_ld(data, SBIC_Imm(opcode));
+    } else {
+        port = tcg_const_i32(SBIC_Imm(opcode));
+        gen_port_start(ctx);
+        gen_helper_inb(data, cpu_env, port);
+        gen_port_end(ctx);
+        tcg_temp_free_i32(port);
+    }
 
-        /* PC if next inst is skipped */
-    tcg_gen_movi_tl(cpu_pc, ctx->inst[1].npc);
     tcg_gen_andi_tl(data, data, 1 << SBIC_Bit(opcode));
     tcg_gen_brcondi_i32(TCG_COND_EQ, data, 0, skip);
-        /* PC if next inst is not skipped */
-    tcg_gen_movi_tl(cpu_pc, ctx->inst[0].npc);
-    gen_set_label(skip);
 
-    tcg_temp_free_i32(port);
     tcg_temp_free_i32(data);
 
-    return BS_BRANCH;
+    return gen_skip_exits(ctx, skip,
+                          avr_poll_loop(ctx, SBIC_Imm(opcode), -1));
 }
 
 /*
@@ -2245,23 +2944,26 @@ static int avr_translate_SBIC(DisasContext *ctx, uint32_t opcode)
 static int avr_translate_SBIS(DisasContext *ctx, uint32_t opcode)
 {
     TCGv data = tcg_temp_new_i32();
-    TCGv port = tcg_const_i32(SBIS_Imm(opcode));
     TCGLabel *skip = gen_new_label();
+    TCGv port;
 
-    gen_helper_inb(data, cpu_env, port);
+    if (avr_io_plain(ctx, SBIS_Imm(opcode))) {
+        gen_io_plain_ld(data, SBIS_Imm(opcode));
+    } else {
+        port = tcg_const_i32(SBIS_Imm(opcode));
+        gen_port_start(ctx);
+        gen_helper_inb(data, cpu_env, port);
+        gen_port_end(ctx);
+        tcg_temp_free_i32(port);
+    }
 
-        /* PC if next inst is skipped */
-    tcg_gen_movi_tl(cpu_pc, ctx->inst[1].npc);
     tcg_gen_andi_tl(data, data, 1 << SBIS_Bit(opcode));
     tcg_gen_brcondi_i32(TCG_COND_NE, data, 0, skip);
-        /* PC if next inst is not skipped */
-    tcg_gen_movi_tl(cpu_pc, ctx->inst[0].npc);
-    gen_set_label(skip);
 
-    tcg_temp_free_i32(port);
     tcg_temp_free_i32(data);
 
-    return BS_BRANCH;
+    return gen_skip_exits(ctx, skip,
+                          avr_poll_loop(ctx, SBIS_Imm(opcode), -1));
 }
 
 /*
@@ -2285,27 +2987,15 @@ static int avr_translate_SBIW(DisasContext *ctx, uint32_t opcode)
     TCGv R = tcg_temp_new_i32();
     TCGv Rd = tcg_temp_new_i32();
 
+    gen_keep_Hf(ctx);
+
     /* op */
     tcg_gen_deposit_tl(Rd, RdL, RdH, 8, 8); /* Rd = RdH:RdL */
     tcg_gen_subi_tl(R, Rd, Imm); /* R = Rd - Imm */
     tcg_gen_andi_tl(R, R, 0xffff); /* make it 16 bits */
 
-    /* Cf */
-    tcg_gen_andc_tl(cpu_Cf, R, Rd);
-    tcg_gen_shri_tl(cpu_Cf, cpu_Cf, 15); /* Cf = R & ~Rd */
-
-    /* Vf */
-    tcg_gen_andc_tl(cpu_Vf, Rd, R);
-    tcg_gen_shri_tl(cpu_Vf, cpu_Vf, 15); /* Vf = Rd & ~R */
-
-    /* Zf */
-    tcg_gen_mov_tl(cpu_Zf, R); /* Zf = R */
-
-    /* Nf */
-    tcg_gen_shri_tl(cpu_Nf, R, 15); /* Nf = R(15) */
-
-    /* Sf */
-    tcg_gen_xor_tl(cpu_Sf, cpu_Nf, cpu_Vf); /* Sf = Nf ^ Vf */
+    tcg_gen_mov_tl(cpu_cc_src, Rd);
+    gen_set_cc_result(ctx, CC_OP_SUBW, R);
 
     /* R */
     tcg_gen_andi_tl(RdL, R, 0xff);
@@ -2327,17 +3017,12 @@ static int avr_translate_SBRC(DisasContext *ctx, uint32_t opcode)
     TCGv t0 = tcg_temp_new_i32();
     TCGLabel *skip = gen_new_label();
 
-        /* PC if next inst is skipped */
-    tcg_gen_movi_tl(cpu_pc, ctx->inst[1].npc);
     tcg_gen_andi_tl(t0, Rr, 1 << SBRC_Bit(opcode));
     tcg_gen_brcondi_i32(TCG_COND_EQ, t0, 0, skip);
-        /* PC if next inst is not skipped */
-    tcg_gen_movi_tl(cpu_pc, ctx->inst[0].npc);
-    gen_set_label(skip);
 
     tcg_temp_free_i32(t0);
 
-    return BS_BRANCH;
+    return gen_skip_exits(ctx, skip, avr_poll_loop(ctx, -1, SBRC_Rr(opcode)));
 }
 
 /*
@@ -2350,17 +3035,12 @@ static int avr_translate_SBRS(DisasContext *ctx, uint32_t opcode)
     TCGv t0 = tcg_temp_new_i32();
     TCGLabel *skip = gen_new_label();
 
-        /* PC if next inst is skipped */
-    tcg_gen_movi_tl(cpu_pc, ctx->inst[1].npc);
     tcg_gen_andi_tl(t0, Rr, 1 << SBRS_Bit(opcode));
     tcg_gen_brcondi_i32(TCG_COND_NE, t0, 0, skip);
-        /* PC if next inst is not skipped */
-    tcg_gen_movi_tl(cpu_pc, ctx->inst[0].npc);
-    gen_set_label(skip);
 
     tcg_temp_free_i32(t0);
 
-    return BS_BRANCH;
+    return gen_skip_exits(ctx, skip, avr_poll_loop(ctx, -1, SBRS_Rr(opcode)));
 }
 
 /*
@@ -2369,6 +3049,7 @@ static int avr_translate_SBRS(DisasContext *ctx, uint32_t opcode)
  */
 static int avr_translate_SLEEP(DisasContext *ctx, uint32_t opcode)
 {
+    tcg_gen_movi_tl(cpu_pc, ctx->inst[0].npc);
     gen_helper_sleep(cpu_env);
 
     return BS_EXCP;
@@ -2399,8 +3080,10 @@ static int avr_translate_SPM(DisasContext *ctx, uint32_t opcode)
         return BS_EXCP;
     }
 
-    /* TODO:   ??? */
-    return BS_NONE;
+    gen_helper_spm(cpu_env);
+
+    /* the flash may have changed, including the rest of this TB */
+    return BS_STOP;
 }
 
 static int avr_translate_SPMX(DisasContext *ctx, uint32_t opcode)
@@ -2411,14 +3094,30 @@ static int avr_translate_SPMX(DisasContext *ctx, uint32_t opcode)
         return BS_EXCP;
     }
 
-    /* TODO:   ??? */
-    return BS_NONE;
+    TCGv addr = gen_get_zaddr(ctx);
+
+    gen_helper_spm(cpu_env);
+
+    tcg_gen_addi_tl(addr, addr, 2); /* addr = addr + 2 */
+
+    /*
+     *  the SPM cannot run again, the TB ends here without a chained jump
+     *  as it may change RAMPZ
+     */
+    ctx->ramp_zero = false;
+    ctx->ramp_exit = true;
+    gen_set_zaddr(ctx, addr);
+
+    tcg_temp_free_i32(addr);
+
+    /* the flash may have changed, including the rest of this TB */
+    return BS_STOP;
 }
 
 static int avr_translate_STX1(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[STX1_Rr(opcode)];
-    TCGv addr = gen_get_xaddr();
+    TCGv addr = gen_get_xaddr(ctx);
 
     gen_data_store(ctx, Rd, addr);
 
@@ -2430,11 +3129,11 @@ static int avr_translate_STX1(DisasContext *ctx, uint32_t opcode)
 static int avr_translate_STX2(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[STX2_Rr(opcode)];
-    TCGv addr = gen_get_xaddr();
+    TCGv addr = gen_get_xaddr(ctx);
 
     gen_data_store(ctx, Rd, addr);
     tcg_gen_addi_tl(addr, addr, 1); /* addr = addr + 1 */
-    gen_set_xaddr(addr);
+    gen_set_xaddr(ctx, addr);
 
     tcg_temp_free_i32(addr);
 
@@ -2444,11 +3143,11 @@ static int avr_translate_STX2(DisasContext *ctx, uint32_t opcode)
 static int avr_translate_STX3(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[STX3_Rr(opcode)];
-    TCGv addr = gen_get_xaddr();
+    TCGv addr = gen_get_xaddr(ctx);
 
-    tcg_gen_subi_tl(addr, addr, 1); /* addr = addr - 1 */
+    gen_dec_addr(ctx, addr, AVR_FEATURE_RAMPX);
     gen_data_store(ctx, Rd, addr);
-    gen_set_xaddr(addr);
+    gen_set_xaddr(ctx, addr);
 
     tcg_temp_free_i32(addr);
 
@@ -2458,11 +3157,11 @@ static int avr_translate_STX3(DisasContext *ctx, uint32_t opcode)
 static int avr_translate_STY2(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[STY2_Rd(opcode)];
-    TCGv addr = gen_get_yaddr();
+    TCGv addr = gen_get_yaddr(ctx);
 
     gen_data_store(ctx, Rd, addr);
     tcg_gen_addi_tl(addr, addr, 1); /* addr = addr + 1 */
-    gen_set_yaddr(addr);
+    gen_set_yaddr(ctx, addr);
 
     tcg_temp_free_i32(addr);
 
@@ -2472,11 +3171,11 @@ static int avr_translate_STY2(DisasContext *ctx, uint32_t opcode)
 static int avr_translate_STY3(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[STY3_Rd(opcode)];
-    TCGv addr = gen_get_yaddr();
+    TCGv addr = gen_get_yaddr(ctx);
 
-    tcg_gen_subi_tl(addr, addr, 1); /* addr = addr - 1 */
+    gen_dec_addr(ctx, addr, AVR_FEATURE_RAMPY);
     gen_data_store(ctx, Rd, addr);
-    gen_set_yaddr(addr);
+    gen_set_yaddr(ctx, addr);
 
     tcg_temp_free_i32(addr);
 
@@ -2486,7 +3185,7 @@ static int avr_translate_STY3(DisasContext *ctx, uint32_t opcode)
 static int avr_translate_STDY(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[STDY_Rd(opcode)];
-    TCGv addr = gen_get_yaddr();
+    TCGv addr = gen_get_yaddr(ctx);
 
     tcg_gen_addi_tl(addr, addr, STDY_Imm(opcode));
                                                 /* addr = addr + q */
@@ -2500,12 +3199,12 @@ static int avr_translate_STDY(DisasContext *ctx, uint32_t opcode)
 static int avr_translate_STZ2(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[STZ2_Rd(opcode)];
-    TCGv addr = gen_get_zaddr();
+    TCGv addr = gen_get_zaddr(ctx);
 
     gen_data_store(ctx, Rd, addr);
     tcg_gen_addi_tl(addr, addr, 1); /* addr = addr + 1 */
 
-    gen_set_zaddr(addr);
+    gen_set_zaddr(ctx, addr);
 
     tcg_temp_free_i32(addr);
 
@@ -2515,12 +3214,12 @@ static int avr_translate_STZ2(DisasContext *ctx, uint32_t opcode)
 static int avr_translate_STZ3(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[STZ3_Rd(opcode)];
-    TCGv addr = gen_get_zaddr();
+    TCGv addr = gen_get_zaddr(ctx);
 
-    tcg_gen_subi_tl(addr, addr, 1); /* addr = addr - 1 */
+    gen_dec_addr(ctx, addr, AVR_FEATURE_RAMPZ);
     gen_data_store(ctx, Rd, addr);
 
-    gen_set_zaddr(addr);
+    gen_set_zaddr(ctx, addr);
 
     tcg_temp_free_i32(addr);
 
@@ -2530,7 +3229,7 @@ static int avr_translate_STZ3(DisasContext *ctx, uint32_t opcode)
 static int avr_translate_STDZ(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[STDZ_Rd(opcode)];
-    TCGv addr = gen_get_zaddr();
+    TCGv addr = gen_get_zaddr(ctx);
 
     tcg_gen_addi_tl(addr, addr, STDZ_Imm(opcode));
                                                     /* addr = addr + q */
@@ -2556,12 +3255,9 @@ static int avr_translate_STDZ(DisasContext *ctx, uint32_t opcode)
 static int avr_translate_STS(DisasContext *ctx, uint32_t opcode)
 {
     TCGv Rd = cpu_r[STS_Rd(opcode)];
-    TCGv addr = tcg_temp_new_i32();
-    TCGv H = cpu_rampD;
+    TCGv addr = tcg_temp_local_new_i32();
 
-    tcg_gen_mov_tl(addr, H); /* addr = H:M:L */
-    tcg_gen_shli_tl(addr, addr, 16);
-    tcg_gen_ori_tl(addr, addr, STS_Imm(opcode));
+    gen_get_daddr(ctx, addr, STS_Imm(opcode));
 
     gen_data_store(ctx, Rd, addr);
 
@@ -2584,9 +3280,7 @@ static int avr_translate_SUB(DisasContext *ctx, uint32_t opcode)
     tcg_gen_sub_tl(R, Rd, Rr); /* R = Rd - Rr */
     tcg_gen_andi_tl(R, R, 0xff); /* make it 8 bits */
 
-    gen_sub_CHf(R, Rd, Rr);
-    gen_sub_Vf(R, Rd, Rr);
-    gen_ZNSf(R);
+    gen_set_cc_arith(ctx, CC_OP_SUB, R, Rd, Rr);
 
     /* R */
     tcg_gen_mov_tl(Rd, R);
@@ -2612,9 +3306,7 @@ static int avr_translate_SUBI(DisasContext *ctx, uint32_t opcode)
                                                     /* R = Rd - Imm */
     tcg_gen_andi_tl(R, R, 0xff); /* make it 8 bits */
 
-    gen_sub_CHf(R, Rd, Rr);
-    gen_sub_Vf(R, Rd, Rr);
-    gen_ZNSf(R);
+    gen_set_cc_arith(ctx, CC_OP_SUB, R, Rd, Rr);
 
     /* R */
     tcg_gen_mov_tl(Rd, R);
@@ -2676,8 +3368,8 @@ static int avr_translate_XCH(DisasContext *ctx, uint32_t opcode)
     }
 
     TCGv Rd = cpu_r[XCH_Rd(opcode)];
-    TCGv t0 = tcg_temp_new_i32();
-    TCGv addr = gen_get_zaddr();
+    TCGv t0 = tcg_temp_local_new_i32();
+    TCGv addr = gen_get_zaddr(ctx);
 
     gen_data_load(ctx, t0, addr);
     gen_data_store(ctx, Rd, addr);
@@ -2689,7 +3381,8 @@ static int avr_translate_XCH(DisasContext *ctx, uint32_t opcode)
     return BS_NONE;
 }
 
-#include "decode.inc.c"
+#include "decode-index.h"
+#include "target/avr/decode-table.inc.c"
 
 void avr_translate_init(void)
 {
@@ -2710,6 +3403,13 @@ void avr_translate_init(void)
     cpu_Hf = tcg_global_mem_new_i32(cpu_env, AVR_REG_OFFS(sregH), "Hf");
     cpu_Tf = tcg_global_mem_new_i32(cpu_env, AVR_REG_OFFS(sregT), "Tf");
     cpu_If = tcg_global_mem_new_i32(cpu_env, AVR_REG_OFFS(sregI), "If");
+    cpu_cc_op = tcg_global_mem_new_i32(cpu_env, AVR_REG_OFFS(cc_op), "cc_op");
+    cpu_cc_dst = tcg_global_mem_new_i32(cpu_env, AVR_REG_OFFS(cc_dst),
+                                                                "cc_dst");
+    cpu_cc_src = tcg_global_mem_new_i32(cpu_env, AVR_REG_OFFS(cc_src),
+                                                                "cc_src");
+    cpu_cc_src2 = tcg_global_mem_new_i32(cpu_env, AVR_REG_OFFS(cc_src2),
+                                                                "cc_src2");
     cpu_rampD = tcg_global_mem_new_i32(cpu_env, AVR_REG_OFFS(rampD), "rampD");
     cpu_rampX = tcg_global_mem_new_i32(cpu_env, AVR_REG_OFFS(rampX), "rampX");
     cpu_rampY = tcg_global_mem_new_i32(cpu_env, AVR_REG_OFFS(rampY), "rampY");
@@ -2731,11 +3431,13 @@ void avr_translate_init(void)
 static void decode_opc(DisasContext *ctx, InstInfo *inst)
 {
     /* PC points to words.  */
-    inst->opcode = cpu_ldl_code(ctx->env, inst->cpc * 2);
+    inst->opcode = avr_code_load(ctx, inst->cpc);
     inst->length = 16;
     inst->translate = NULL;
 
-    avr_decode(inst->cpc, &inst->length, inst->opcode, &inst->translate);
+    avr_decode_table(inst->cpc, &inst->length, inst->opcode, &inst->translate);
+    inst->cycles = avr_decode_cycles(inst->opcode,
+                                     avr_feature(ctx->env, AVR_FEATURE_XMEGA));
 
     if (inst->length == 16) {
         inst->npc = inst->cpc + 1;
@@ -2758,8 +3460,12 @@ void gen_intermediate_code(CPUAVRState *env, struct TranslationBlock *tb)
     DisasContext ctx;
     target_ulong pc_start;
     int num_insns, max_insns;
+    int insn_idx[TCG_MAX_INSNS];
+    int insn_cycles[TCG_MAX_INSNS];
     target_ulong cpc;
     target_ulong npc;
+    target_ulong end;
+    int i;
 
     pc_start = tb->pc / 2;
     ctx.tb = tb;
@@ -2767,9 +3473,30 @@ void gen_intermediate_code(CPUAVRState *env, struct TranslationBlock *tb)
     ctx.memidx = 0;
     ctx.bstate = BS_NONE;
     ctx.singlestep = cs->singlestep_enabled;
+    ctx.cc_op = (tb->flags & TB_FLAGS_CC_OP_MASK) >> TB_FLAGS_CC_OP_SHIFT;
+    ctx.ramp_zero = (tb->flags & TB_FLAGS_RAMP_ZERO)
+                    && !(tb->flags & TB_FLAGS_FULL_ACCESS);
+    ctx.ramp_exit = false;
+    ctx.cycles = 0;
+    ctx.extra_cycles = 0;
+    ctx.max_cycles = 0;
+    ctx.quantum_idx = -1;
+    ctx.trace_idx = (tb->cflags & CF_TRACE) && !ctx.singlestep;
+    ctx.follow = -1;
+    ctx.goto_tb_used = 0;
+    ctx.side_exits = 0;
     num_insns = 0;
     max_insns = tb->cflags & CF_COUNT_MASK;
 
+    if (max_insns && (tb->cflags & CF_USE_ICOUNT)
+            && !(tb->cflags & CF_LAST_IO)) {
+        /*
+         * the count is what is left of the cycle budget, e.g. for
+         * cpu_exec_nocache, the TB stops before it runs out
+         */
+        ctx.max_cycles = max_insns;
+        max_insns = 0;
+    }
     if (max_insns == 0) {
         max_insns = CF_COUNT_MASK;
     }
@@ -2786,21 +3513,45 @@ void gen_intermediate_code(CPUAVRState *env, struct TranslationBlock *tb)
     }
 
     gen_tb_start(tb);
+    /*
+     *  a full access TB only redoes the LD/ST the TB before gave up on,
+     *  counting it would make an edge which is not in the program and the
+     *  TB before took its cycles from the quantum already
+     */
+    if ((tb->flags & TB_FLAGS_QUANTUM)
+            && !(tb->flags & TB_FLAGS_FULL_ACCESS)) {
+        gen_quantum_start(&ctx, pc_start);
+    }
+    if ((tb->flags & TB_FLAGS_COVERAGE)
+            && !(tb->flags & TB_FLAGS_FULL_ACCESS)) {
+        gen_coverage(pc_start);
+    }
+    /*
+     *  neither is entered by the program, the full access TB and the
+     *  CF_LAST_IO TB redo instructions whose TB was recorded already
+     */
+    if (!(tb->flags & TB_FLAGS_FULL_ACCESS) && !(tb->cflags & CF_LAST_IO)) {
+        gen_trace_code(&ctx, AVR_TRACE_TB, pc_start);
+    }
 
     /* decode first instruction */
     ctx.inst[0].cpc = pc_start;
     decode_opc(&ctx, &ctx.inst[0]);
+    end = pc_start;
     do {
         /* set curr/next PCs */
         cpc = ctx.inst[0].cpc;
         npc = ctx.inst[0].npc;
+        end = MAX(end, npc);
 
         /* decode next instruction */
         ctx.inst[1].cpc = ctx.inst[0].npc;
         decode_opc(&ctx, &ctx.inst[1]);
 
         /* translate current instruction */
-        tcg_gen_insn_start(cpc);
+        insn_idx[num_insns] = tcg_op_buf_count();
+        insn_cycles[num_insns] = ctx.cycles;
+        tcg_gen_insn_start(cpc, 0);
         num_insns++;
 
         /*
@@ -2817,18 +3568,44 @@ void gen_intermediate_code(CPUAVRState *env, struct TranslationBlock *tb)
             goto done_generating;
         }
 
+        if (num_insns == max_insns && (tb->cflags & CF_LAST_IO)) {
+            gen_io_start();
+        }
+
+        ctx.cycles += ctx.inst[0].cycles;
         if (ctx.inst[0].translate) {
             ctx.bstate = ctx.inst[0].translate(&ctx, ctx.inst[0].opcode);
         }
+        if (ctx.follow >= 0) {
+            /* the next TB of the trace, see gen_trace_follow */
+            if (tb->flags & TB_FLAGS_COVERAGE) {
+                gen_coverage(ctx.follow);
+            }
+            gen_trace_code(&ctx, AVR_TRACE_TB, ctx.follow);
+            npc = ctx.follow;
+            ctx.inst[1].cpc = npc;
+            decode_opc(&ctx, &ctx.inst[1]);
+            ctx.follow = -1;
+        }
 
         if (num_insns >= max_insns) {
             break; /* max translated instructions limit reached */
         }
+        if (ctx.max_cycles
+                && ctx.cycles + ctx.inst[1].cycles + 3 > ctx.max_cycles) {
+            break; /* cycle budget reached, 3 is the most an exit adds */
+        }
         if (ctx.singlestep) {
             break; /* single step */
         }
-        if ((cpc & (TARGET_PAGE_SIZE - 1)) == 0) {
-            break; /* page boundary */
+        if (ctx.inst[1].npc * 2 - 1 - (tb->pc & TARGET_PAGE_MASK)
+                >= 2 * TARGET_PAGE_SIZE) {
+            /*
+             * a TB may span two pages, the code mapping is fixed, see
+             * TARGET_FIXED_CODE_MAPPING, and SPM to either page
+             * invalidates it
+             */
+            break; /* next inst would reach a third page */
         }
 
         ctx.inst[0] = ctx.inst[1]; /* make next inst curr */
@@ -2838,6 +3615,10 @@ void gen_intermediate_code(CPUAVRState *env, struct TranslationBlock *tb)
         gen_io_end();
     }
 
+    if (ctx.extra_cycles == 0) {
+        gen_cycles_exit(&ctx, 0);
+    }
+
     if (ctx.singlestep) {
         if (ctx.bstate == BS_STOP || ctx.bstate == BS_NONE) {
             tcg_gen_movi_tl(cpu_pc, npc);
@@ -2860,9 +3641,28 @@ void gen_intermediate_code(CPUAVRState *env, struct TranslationBlock *tb)
     }
 
 done_generating:
-    gen_tb_end(tb, num_insns);
+    /* the side exits of the trace have their jump slots already */
+    ctx.trace_idx = 0;
+    for (i = 0; i < ctx.side_exits; i++) {
+        gen_set_label(ctx.side_label[i]);
+        ctx.cc_op = ctx.side_cc_op[i];
+        gen_goto_tb(&ctx, ctx.side_slot[i], ctx.side_dest[i]);
+    }
+    gen_tb_end(tb, gen_cycles_charged(&ctx));
+    gen_quantum_end(&ctx);
+
+    if (tb->cflags & CF_USE_ICOUNT) {
+        /*
+         *  cpu_restore_state_from_tb counts one unit per insn, the second
+         *  word of insn_start corrects that to the cycles of the insns
+         */
+        for (i = 0; i < num_insns; i++) {
+            tcg_set_insn_param(insn_idx[i], 1, gen_cycles_charged(&ctx)
+                               - insn_cycles[i] - (num_insns - i));
+        }
+    }
 
-    tb->size = (npc - pc_start) * 2;
+    tb->size = (end - pc_start) * 2;
     tb->icount = num_insns;
 }
 
@@ -2870,6 +3670,10 @@ void restore_state_to_opc(CPUAVRState *env, TranslationBlock *tb,
                             target_ulong *data)
 {
     env->pc_w = data[0];
+
+    if (tb->cflags & CF_USE_ICOUNT) {
+        CPU(avr_env_get_cpu(env))->icount_decr.u16.low += (int32_t)data[1];
+    }
 }
 
 void avr_cpu_dump_state(CPUState *cs, FILE *f, fprintf_function cpu_fprintf,
@@ -2877,6 +3681,7 @@ void avr_cpu_dump_state(CPUState *cs, FILE *f, fprintf_function cpu_fprintf,
 {
     AVRCPU *cpu = AVR_CPU(cs);
     CPUAVRState *env = &cpu->env;
+    uint8_t sreg = cpu_get_sreg(env);
     int i;
 
     cpu_fprintf(f, "\n");
@@ -2891,14 +3696,14 @@ void avr_cpu_dump_state(CPUState *cs, FILE *f, fprintf_function cpu_fprintf,
     cpu_fprintf(f, "Y:       %02x%02x\n", env->r[29], env->r[28]);
     cpu_fprintf(f, "Z:       %02x%02x\n", env->r[31], env->r[30]);
     cpu_fprintf(f, "SREG:    [ %c %c %c %c %c %c %c %c ]\n",
-                        env->sregI ? 'I' : '-',
-                        env->sregT ? 'T' : '-',
-                        env->sregH ? 'H' : '-',
-                        env->sregS ? 'S' : '-',
-                        env->sregV ? 'V' : '-',
-                        env->sregN ? '-' : 'N', /* Zf has negative logic */
-                        env->sregZ ? 'Z' : '-',
-                        env->sregC ? 'I' : '-');
+                        sreg & 0x80 ? 'I' : '-',
+                        sreg & 0x40 ? 'T' : '-',
+                        sreg & 0x20 ? 'H' : '-',
+                        sreg & 0x10 ? 'S' : '-',
+                        sreg & 0x08 ? 'V' : '-',
+                        sreg & 0x04 ? 'N' : '-',
+                        sreg & 0x02 ? 'Z' : '-',
+                        sreg & 0x01 ? 'C' : '-');
 
     cpu_fprintf(f, "\n");
     for (i = 0; i < ARRAY_SIZE(env->r); i++) {
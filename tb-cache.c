@@ -0,0 +1,565 @@
+/*
+ * Persistent TB cache
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+/*
+ *  -tb-cache FILE keeps the translated code of a run in FILE and starts the
+ *  next run with it, e.g. for a CI which runs the same firmware many times.
+ *
+ *  The file is an image of the code buffer: the prologue and the host code
+ *  of the TBs with their search data, followed by the TBs. The host code
+ *  holds absolute addresses of helpers, of the prologue and of the TBs
+ *  themselves, so it is not relocated: it is valid only in the same QEMU
+ *  binary with the code buffer at the same address. The code buffer is
+ *  mapped at the address of the image and the TBs are kept at its end.
+ *  That needs a binary which is not position independent (configure
+ *  --disable-pie) or a run without address space randomization (setarch
+ *  -R), otherwise the image is ignored.
+ *
+ *  The image is loaded at the first translation, when the machine is set
+ *  up: it is used if the machine, the CPUs, their properties and the RAM
+ *  blocks are the same as in the run which saved it. A TB is kept if its
+ *  guest code, which is saved with it, is still in RAM; the others are
+ *  translated again when they are reached. All jumps between TBs are reset,
+ *  TBs are chained again as they run. The image is saved at exit.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#define NO_CPU_IO_DEFS
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "exec/memory.h"
+#include "tcg.h"
+#include "hw/boards.h"
+#include "sysemu/cpus.h"
+#include "sysemu/sysemu.h"
+#include "qemu/error-report.h"
+#include "qemu/timer.h"
+#include "translate-all.h"
+#include "tb-cache.h"
+
+#define TB_CACHE_MAGIC "QEMUTBC1"
+
+/* the file: header, entries, guest code, image of the code buffer */
+typedef struct TBCacheHeader {
+    char magic[8];
+    uint64_t host_key;      /* of the QEMU binary and the code buffer */
+    uint64_t guest_key;     /* of the machine, the CPUs and the RAM */
+    uint64_t prologue;      /* address of the code buffer */
+    uint64_t tbs;           /* address of the TBs */
+    uint32_t prologue_size;
+    uint32_t nb_tbs;        /* TBs in use, including invalid ones */
+    uint32_t nb_entries;    /* saved TBs */
+    uint32_t guest_size;
+    uint64_t code_size;     /* after the prologue */
+} TBCacheHeader;
+
+typedef struct TBCacheEntry {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint64_t page_addr[2];
+    uint32_t flags;
+    uint32_t cflags;
+    uint32_t index;         /* in the TBs */
+    uint32_t tc_offset;     /* in the code buffer, from the prologue */
+    uint32_t search_offset;
+    uint32_t guest_offset;  /* in the guest code of the file */
+    uint32_t gen_ns;        /* translation time */
+    uint16_t size;
+    uint16_t icount;
+    uint16_t jmp_reset_offset[2];
+    uint16_t jmp_insn_offset[2];
+} TBCacheEntry;
+
+typedef struct TBCache {
+    char *filename;
+    GMappedFile *file;
+    const TBCacheHeader *hdr;   /* of the image until it is loaded */
+    const char *status;
+    uint32_t *gen_ns;           /* translation time of each TB */
+    Notifier exit;
+
+    int loaded;
+    int rejected;
+    int saved;
+    int64_t saved_ns;           /* translation time of the loaded TBs */
+    int64_t load_ns;
+} TBCache;
+
+static TBCache tb_cache;
+
+static void tb_cache_exit(Notifier *n, void *data);
+
+/* FNV-1a */
+static uint64_t tb_cache_hash(const char *str)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+
+    while (*str) {
+        h = (h ^ (uint8_t)*str++) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+static uint64_t tb_cache_host_key(void)
+{
+    struct stat st;
+    char *key;
+    uint64_t h;
+
+    if (stat("/proc/self/exe", &st) < 0) {
+        memset(&st, 0, sizeof(st));
+    }
+    key = g_strdup_printf("%s %s %" PRId64 " %" PRId64 " %" PRIu64 " %p %zu",
+                          QEMU_VERSION, TARGET_NAME, (int64_t)st.st_size,
+                          (int64_t)st.st_mtime, (uint64_t)st.st_ino,
+                          (void *)(uintptr_t)tb_gen_code,
+                          tcg_ctx.code_gen_buffer_size);
+    h = tb_cache_hash(key);
+    g_free(key);
+    return h;
+}
+
+static int tb_cache_key_ram(const char *name, void *host, ram_addr_t offset,
+                            ram_addr_t length, void *opaque)
+{
+    g_string_append_printf(opaque, " %s@%" PRIx64 "+%" PRIx64, name,
+                           (uint64_t)offset, (uint64_t)length);
+    return 0;
+}
+
+/* the properties which can change the code, e.g. avr.trace */
+static void tb_cache_key_props(GString *key, Object *obj)
+{
+    ObjectPropertyIterator iter;
+    ObjectProperty *prop;
+    char *value;
+
+    object_property_iter_init(&iter, obj);
+    while ((prop = object_property_iter_next(&iter))) {
+        if (strcmp(prop->type, "bool") && strcmp(prop->type, "str")
+                && !g_str_has_prefix(prop->type, "int")
+                && !g_str_has_prefix(prop->type, "uint")) {
+            continue;
+        }
+        value = object_property_print(obj, prop->name, false, NULL);
+        if (value) {
+            g_string_append_printf(key, " %s=%s", prop->name, value);
+            g_free(value);
+        }
+    }
+}
+
+static uint64_t tb_cache_guest_key(void)
+{
+    GString *key = g_string_new(MACHINE_GET_CLASS(current_machine)->name);
+    CPUState *cpu;
+    uint64_t h;
+
+    g_string_append_printf(key, " icount=%d mttcg=%d", use_icount,
+                           qemu_tcg_mttcg_enabled());
+    CPU_FOREACH(cpu) {
+        g_string_append_printf(key, " %s", object_get_typename(OBJECT(cpu)));
+        tb_cache_key_props(key, OBJECT(cpu));
+    }
+    qemu_ram_foreach_block(tb_cache_key_ram, key);
+
+    h = tb_cache_hash(key->str);
+    g_string_free(key, true);
+    return h;
+}
+
+static void tb_cache_drop(TBCache *c, const char *status)
+{
+    if (c->file) {
+        g_mapped_file_unref(c->file);
+        c->file = NULL;
+    }
+    c->hdr = NULL;
+    c->status = status;
+}
+
+static const TBCacheEntry *tb_cache_entries(const TBCacheHeader *hdr)
+{
+    return (const TBCacheEntry *)(hdr + 1);
+}
+
+static const uint8_t *tb_cache_guest(const TBCacheHeader *hdr)
+{
+    return (const uint8_t *)(tb_cache_entries(hdr) + hdr->nb_entries);
+}
+
+static const uint8_t *tb_cache_image(const TBCacheHeader *hdr)
+{
+    return tb_cache_guest(hdr) + hdr->guest_size;
+}
+
+void tb_cache_open(const char *filename)
+{
+    TBCache *c = &tb_cache;
+    const TBCacheHeader *hdr;
+    GError *gerr = NULL;
+    size_t len;
+
+    c->filename = g_strdup(filename);
+    c->exit.notify = tb_cache_exit;
+    qemu_add_exit_notifier(&c->exit);
+
+    c->file = g_mapped_file_new(filename, FALSE, &gerr);
+    if (c->file == NULL) {
+        /* the first run */
+        g_error_free(gerr);
+        tb_cache_drop(c, "no image");
+        return;
+    }
+
+    hdr = (const TBCacheHeader *)g_mapped_file_get_contents(c->file);
+    len = g_mapped_file_get_length(c->file);
+    if (len < sizeof(*hdr) || memcmp(hdr->magic, TB_CACHE_MAGIC, 8)
+            || len != sizeof(*hdr) + hdr->nb_entries * sizeof(TBCacheEntry)
+                      + hdr->guest_size + hdr->prologue_size
+                      + hdr->code_size) {
+        tb_cache_drop(c, "bad image");
+        return;
+    }
+    c->hdr = hdr;
+    c->status = "image found";
+}
+
+bool tb_cache_enabled(void)
+{
+    return tb_cache.filename != NULL;
+}
+
+void *tb_cache_buffer_hint(void)
+{
+    return tb_cache.hdr ? (void *)(uintptr_t)tb_cache.hdr->prologue : NULL;
+}
+
+void tb_cache_init(void)
+{
+    TBCache *c = &tb_cache;
+    const TBCacheHeader *hdr = c->hdr;
+    size_t prologue_size = tcg_ctx.code_gen_buffer - tcg_ctx.code_gen_prologue;
+
+    if (!tb_cache_enabled()) {
+        return;
+    }
+    c->gen_ns = g_new0(uint32_t, tcg_ctx.code_gen_max_blocks);
+    if (hdr == NULL) {
+        return;
+    }
+
+    if (hdr->host_key != tb_cache_host_key()
+            || hdr->prologue != (uintptr_t)tcg_ctx.code_gen_prologue
+            || hdr->tbs != (uintptr_t)tcg_ctx.tb_ctx.tbs
+            || hdr->prologue_size != prologue_size
+            || memcmp(tb_cache_image(hdr), tcg_ctx.code_gen_prologue,
+                      prologue_size)) {
+        tb_cache_drop(c, "other binary or code buffer address");
+    } else if (hdr->nb_tbs > tcg_ctx.code_gen_max_blocks
+               || hdr->code_size > tcg_ctx.code_gen_highwater
+                                   - tcg_ctx.code_gen_buffer) {
+        tb_cache_drop(c, "bad image");
+    }
+}
+
+static bool tb_cache_entry_valid(const TBCacheHeader *hdr,
+                                 const TBCacheEntry *e)
+{
+    uint64_t image_size = hdr->prologue_size + hdr->code_size;
+    uint64_t end = (e->pc & ~TARGET_PAGE_MASK) + e->size;
+    int n;
+
+    /* a TB spans up to two pages, page_addr[1] is -1 unless it spans two */
+    if (e->index >= hdr->nb_tbs
+            || e->tc_offset < hdr->prologue_size
+            || e->tc_offset >= image_size
+            || e->search_offset >= image_size
+            || (uint64_t)e->guest_offset + e->size > hdr->guest_size
+            || end > 2 * TARGET_PAGE_SIZE
+            || (end > TARGET_PAGE_SIZE)
+               != ((tb_page_addr_t)e->page_addr[1] != -1)) {
+        return false;
+    }
+    for (n = 0; n < 2; n++) {
+        if (e->jmp_reset_offset[n] != TB_JMP_RESET_OFFSET_INVALID
+                && (e->tc_offset + e->jmp_reset_offset[n] >= image_size
+                    || e->tc_offset + e->jmp_insn_offset[n] >= image_size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* the guest code of a TB in RAM, in up to two pieces */
+static bool tb_cache_guest_code(tb_page_addr_t page_addr[2], target_ulong pc,
+                                unsigned size, uint8_t *p[2], unsigned len[2])
+{
+    target_ulong offset = pc & ~TARGET_PAGE_MASK;
+
+    len[0] = MIN(size, TARGET_PAGE_SIZE - offset);
+    len[1] = size - len[0];
+    if (len[1] && page_addr[1] == -1) {
+        return false;
+    }
+    p[0] = qemu_map_ram_ptr(NULL, page_addr[0] + offset);
+    p[1] = len[1] ? qemu_map_ram_ptr(NULL, page_addr[1]) : NULL;
+    return true;
+}
+
+static bool tb_cache_load_tb(TBCache *c, const TBCacheEntry *e)
+{
+    const TBCacheHeader *hdr = c->hdr;
+    TranslationBlock *tb = &tcg_ctx.tb_ctx.tbs[e->index];
+    tb_page_addr_t page_addr[2] = { e->page_addr[0], e->page_addr[1] };
+    const uint8_t *code = tb_cache_guest(hdr) + e->guest_offset;
+    uint8_t *image = tcg_ctx.code_gen_prologue;
+    uint8_t *p[2];
+    unsigned len[2];
+    int n;
+
+    if (!tb_cache_entry_valid(hdr, e) || !tb->invalid
+            || !tb_cache_guest_code(page_addr, e->pc, e->size, p, len)
+            || memcmp(p[0], code, len[0])
+            || memcmp(p[1], code + len[0], len[1])) {
+        return false;
+    }
+
+    tb->pc = e->pc;
+    tb->cs_base = e->cs_base;
+    tb->flags = e->flags;
+    tb->cflags = e->cflags;
+    tb->size = e->size;
+    tb->icount = e->icount;
+    tb->hot_left = tcg_tb_hot;
+    tb->tc_ptr = image + e->tc_offset;
+    tb->tc_search = image + e->search_offset;
+    for (n = 0; n < 2; n++) {
+        tb->jmp_reset_offset[n] = e->jmp_reset_offset[n];
+#ifdef USE_DIRECT_JUMP
+        tb->jmp_insn_offset[n] = e->jmp_insn_offset[n];
+#endif
+    }
+    tb->invalid = false;
+    tb_install(tb, page_addr[0] + (e->pc & ~TARGET_PAGE_MASK), page_addr[1]);
+
+    c->gen_ns[e->index] = e->gen_ns;
+    c->saved_ns += e->gen_ns;
+    return true;
+}
+
+/* the physical page of the second page of tb, -1 if it spans one page */
+static tb_page_addr_t tb_cache_page2(CPUState *cpu, TranslationBlock *tb)
+{
+    target_ulong virt_page2 = (tb->pc + tb->size - 1) & TARGET_PAGE_MASK;
+
+    if ((tb->pc & TARGET_PAGE_MASK) == virt_page2) {
+        return -1;
+    }
+    return get_page_addr_code(cpu->env_ptr, virt_page2);
+}
+
+/*
+ * Loads the image at the first translation and returns the TB of the
+ * translation if it is one of the image.
+ *
+ * Called with tb_lock held.
+ */
+TranslationBlock *tb_cache_load(CPUState *cpu, tb_page_addr_t phys_pc,
+                                target_ulong pc, target_ulong cs_base,
+                                uint32_t flags, uint32_t cflags)
+{
+    TBCache *c = &tb_cache;
+    const TBCacheHeader *hdr = c->hdr;
+    const TBCacheEntry *e;
+    TranslationBlock *tb, *found = NULL;
+    int64_t start;
+    uint32_t i;
+
+    if (hdr == NULL) {
+        return NULL;
+    }
+    if (tcg_ctx.tb_ctx.nb_tbs != 0) {
+        tb_cache_drop(c, "code buffer in use");
+        return NULL;
+    }
+    if (hdr->guest_key != tb_cache_guest_key()) {
+        tb_cache_drop(c, "other machine, CPUs or RAM");
+        return NULL;
+    }
+
+    start = get_clock();
+    memcpy(tcg_ctx.code_gen_buffer, tb_cache_image(hdr) + hdr->prologue_size,
+           hdr->code_size);
+    tcg_ctx.code_gen_ptr = tcg_ctx.code_gen_buffer + hdr->code_size;
+
+    /* the TBs which are not loaded stay invalid and out of the hash table */
+    for (i = 0; i < hdr->nb_tbs; i++) {
+        memset(&tcg_ctx.tb_ctx.tbs[i], 0, sizeof(TranslationBlock));
+        tcg_ctx.tb_ctx.tbs[i].invalid = true;
+    }
+    tcg_ctx.tb_ctx.nb_tbs = hdr->nb_tbs;
+
+    for (i = 0, e = tb_cache_entries(hdr); i < hdr->nb_entries; i++, e++) {
+        if (!tb_cache_load_tb(c, e)) {
+            c->rejected++;
+            continue;
+        }
+        c->loaded++;
+
+        tb = &tcg_ctx.tb_ctx.tbs[e->index];
+        if (tb->pc == pc && tb->cs_base == cs_base && tb->flags == flags
+                && tb->cflags == cflags
+                && tb->page_addr[0] == (phys_pc & TARGET_PAGE_MASK)
+                && tb->page_addr[1] == tb_cache_page2(cpu, tb)) {
+            found = tb;
+        }
+    }
+    flush_icache_range((uintptr_t)tcg_ctx.code_gen_buffer,
+                       (uintptr_t)tcg_ctx.code_gen_ptr);
+    c->load_ns = get_clock() - start;
+
+    tb_cache_drop(c, "loaded");
+    return found;
+}
+
+void tb_cache_set_gen_time(TranslationBlock *tb, int64_t ns)
+{
+    tb_cache.gen_ns[tb - tcg_ctx.tb_ctx.tbs] = MIN(ns, UINT32_MAX);
+}
+
+/* breakpoints are translated into the code */
+static bool tb_cache_debugged(void)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        if (cpu->singlestep_enabled || !QTAILQ_EMPTY(&cpu->breakpoints)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Called with tb_lock held.  */
+static bool tb_cache_save(TBCache *c)
+{
+    uint8_t *image = tcg_ctx.code_gen_prologue;
+    TBCacheHeader hdr = {
+        .host_key = tb_cache_host_key(),
+        .guest_key = tb_cache_guest_key(),
+        .prologue = (uintptr_t)image,
+        .tbs = (uintptr_t)tcg_ctx.tb_ctx.tbs,
+        .prologue_size = (uint8_t *)tcg_ctx.code_gen_buffer - image,
+        .nb_tbs = tcg_ctx.tb_ctx.nb_tbs,
+        .code_size = tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer,
+    };
+    GArray *entries = g_array_new(false, true, sizeof(TBCacheEntry));
+    GByteArray *guest = g_byte_array_new();
+    char *tmp = g_strdup_printf("%s.%d", c->filename, getpid());
+    bool ok = false;
+    uint8_t *p[2];
+    unsigned len[2];
+    FILE *f;
+    int i, n;
+
+    memcpy(hdr.magic, TB_CACHE_MAGIC, sizeof(hdr.magic));
+    for (i = 0; i < tcg_ctx.tb_ctx.nb_tbs; i++) {
+        TranslationBlock *tb = &tcg_ctx.tb_ctx.tbs[i];
+        TBCacheEntry e = {
+            .pc = tb->pc,
+            .cs_base = tb->cs_base,
+            .page_addr = { tb->page_addr[0], tb->page_addr[1] },
+            .flags = tb->flags,
+            .cflags = tb->cflags,
+            .index = i,
+            .tc_offset = (uint8_t *)tb->tc_ptr - image,
+            .search_offset = tb->tc_search - image,
+            .guest_offset = guest->len,
+            .gen_ns = c->gen_ns[i],
+            .size = tb->size,
+            .icount = tb->icount,
+        };
+
+        if (tb->invalid || (tb->cflags & CF_NOCACHE)
+                || !tb_cache_guest_code(tb->page_addr, tb->pc, tb->size,
+                                        p, len)) {
+            continue;
+        }
+        for (n = 0; n < 2; n++) {
+            e.jmp_reset_offset[n] = tb->jmp_reset_offset[n];
+#ifdef USE_DIRECT_JUMP
+            e.jmp_insn_offset[n] = tb->jmp_insn_offset[n];
+#endif
+        }
+        g_byte_array_append(guest, p[0], len[0]);
+        g_byte_array_append(guest, p[1], len[1]);
+        g_array_append_val(entries, e);
+    }
+    hdr.nb_entries = entries->len;
+    hdr.guest_size = guest->len;
+
+    f = fopen(tmp, "wb");
+    if (f) {
+        ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1
+             && fwrite(entries->data, sizeof(TBCacheEntry), entries->len, f)
+                == entries->len
+             && fwrite(guest->data, 1, guest->len, f) == guest->len
+             && fwrite(image, 1, hdr.prologue_size + hdr.code_size, f)
+                == hdr.prologue_size + hdr.code_size;
+        ok = !fclose(f) && ok;
+    }
+    /* runs sharing the file see the old or the new image */
+    if (!ok || rename(tmp, c->filename) < 0) {
+        error_report("tb-cache: cannot save %s: %s", c->filename,
+                     strerror(errno));
+        unlink(tmp);
+        ok = false;
+    } else {
+        c->saved = entries->len;
+    }
+
+    g_array_free(entries, true);
+    g_byte_array_free(guest, true);
+    g_free(tmp);
+    return ok;
+}
+
+static void tb_cache_exit(Notifier *n, void *data)
+{
+    TBCache *c = &tb_cache;
+
+    if (c->gen_ns == NULL) {
+        return;
+    }
+    tb_lock();
+    if (!tb_cache_debugged()) {
+        tb_cache_save(c);
+    }
+    tb_unlock();
+
+    fprintf(stderr, "tb-cache: %s: %s, %d TBs loaded in %.1f ms, "
+            "%d rejected, %.1f ms of translation saved, %d TBs saved\n",
+            c->filename, c->status, c->loaded, c->load_ns / 1e6,
+            c->rejected, c->saved_ns / 1e6, c->saved);
+}
+
+/* Called with tb_lock held.  */
+void tb_cache_dump_info(FILE *f, fprintf_function cpu_fprintf)
+{
+    TBCache *c = &tb_cache;
+
+    if (!tb_cache_enabled()) {
+        return;
+    }
+    cpu_fprintf(f, "\nTB cache:\n");
+    cpu_fprintf(f, "file                %s (%s)\n", c->filename, c->status);
+    cpu_fprintf(f, "TBs loaded          %d in %.1f ms, %d rejected\n",
+                c->loaded, c->load_ns / 1e6, c->rejected);
+    cpu_fprintf(f, "translation saved   %.1f ms\n", c->saved_ns / 1e6);
+}
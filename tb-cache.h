@@ -0,0 +1,50 @@
+/*
+ * Persistent TB cache
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+#ifndef TB_CACHE_H
+#define TB_CACHE_H
+
+#include "exec/exec-all.h"
+
+#ifdef CONFIG_SOFTMMU
+/* before the code buffer is allocated */
+void tb_cache_open(const char *filename);
+/* after the prologue is generated */
+void tb_cache_init(void);
+
+bool tb_cache_enabled(void);
+void *tb_cache_buffer_hint(void);
+TranslationBlock *tb_cache_load(CPUState *cpu, tb_page_addr_t phys_pc,
+                                target_ulong pc, target_ulong cs_base,
+                                uint32_t flags, uint32_t cflags);
+void tb_cache_set_gen_time(TranslationBlock *tb, int64_t ns);
+void tb_cache_dump_info(FILE *f, fprintf_function cpu_fprintf);
+#else
+static inline bool tb_cache_enabled(void)
+{
+    return false;
+}
+
+static inline void *tb_cache_buffer_hint(void)
+{
+    return NULL;
+}
+
+static inline TranslationBlock *tb_cache_load(CPUState *cpu,
+                                              tb_page_addr_t phys_pc,
+                                              target_ulong pc,
+                                              target_ulong cs_base,
+                                              uint32_t flags, uint32_t cflags)
+{
+    return NULL;
+}
+
+static inline void tb_cache_set_gen_time(TranslationBlock *tb, int64_t ns)
+{
+}
+#endif
+
+#endif /* TB_CACHE_H */
@@ -0,0 +1,200 @@
+/*
+ * Translation ahead of execution
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+/*
+ *  -accel tcg,prefetch=N translates code before a vCPU reaches it. The
+ *  translator passes the targets of the direct jumps of a TB, i.e. the
+ *  fall through and the branch targets, to tb_worker_hint. A translator
+ *  thread translates them, and the targets of the TBs it translates, up to
+ *  N jumps away from the code the vCPU runs. The hints beyond are parked.
+ *  When a vCPU reaches a TB translated d jumps ahead, the parked hints are
+ *  d jumps closer and are queued again. A TB is published with qht_insert
+ *  like any other, and tb_htable_lookup of the vCPU finds it without taking
+ *  tb_lock. The vCPU then no longer stalls in tb_find to translate the code.
+ *
+ *  There is one TCG context, so the thread translates under tb_lock like a
+ *  vCPU, and one thread is all there is to gain. The vCPU keeps running
+ *  translated code meanwhile. Only the vCPU may fill its TLB, so the thread
+ *  reads code through the physical address space. That needs a target
+ *  whose code mapping never changes (TARGET_FIXED_CODE_MAPPING).
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#define NO_CPU_IO_DEFS
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "tcg.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "tb-worker.h"
+
+#define TB_WORKER_HINTS 256
+
+typedef struct TBWorkerHint {
+    CPUState *cpu;
+    target_ulong pc;
+    target_ulong cs_base;
+    uint32_t flags;
+    unsigned int depth;         /* jumps away from code a vCPU runs */
+    unsigned int flush_count;   /* hints from before a flush are stale */
+} TBWorkerHint;
+
+typedef struct TBWorker {
+    QemuThread thread;
+    bool started;
+
+    QemuMutex lock;             /* for the rings of hints */
+    QemuCond cond;
+    TBWorkerHint hints[TB_WORKER_HINTS];
+    unsigned int head;
+    unsigned int tail;
+    TBWorkerHint parked[TB_WORKER_HINTS]; /* too far ahead, the oldest go */
+    unsigned int parked_head;
+    unsigned int parked_tail;
+    unsigned int dropped;
+
+    /* under tb_lock */
+    unsigned int depth;         /* of the TB the thread translates */
+    unsigned int translated;
+    int64_t gen_ns;
+} TBWorker;
+
+static TBWorker tb_worker;
+
+__thread bool tb_worker_thread;
+
+static void tb_worker_gen(TBWorker *w, TBWorkerHint *h)
+{
+    CPUArchState *env = h->cpu->env_ptr;
+    TranslationBlock *tb;
+    int64_t start;
+
+    mmap_lock();
+    tb_lock();
+    if (h->flush_count == tcg_ctx.tb_ctx.tb_flush_count
+        && get_page_addr_code(env, h->pc) != -1
+        && !tb_htable_lookup(h->cpu, h->pc, h->cs_base, h->flags)) {
+        w->depth = h->depth;
+        start = get_clock();
+        tb = tb_gen_code(h->cpu, h->pc, h->cs_base, h->flags,
+                         tcg_tb_hot ? CF_COLD : 0);
+        if (tb) {
+            atomic_set(&tb->prefetch, h->depth);
+            w->translated++;
+            w->gen_ns += get_clock() - start;
+        }
+    }
+    tb_unlock();
+    mmap_unlock();
+}
+
+static void *tb_worker_run(void *arg)
+{
+    TBWorker *w = arg;
+    TBWorkerHint h;
+
+    rcu_register_thread();
+    tb_worker_thread = true;
+
+    for (;;) {
+        qemu_mutex_lock(&w->lock);
+        while (w->tail == w->head) {
+            qemu_cond_wait(&w->cond, &w->lock);
+        }
+        h = w->hints[w->tail++ % TB_WORKER_HINTS];
+        qemu_mutex_unlock(&w->lock);
+
+        tb_worker_gen(w, &h);
+    }
+
+    return NULL;
+}
+
+/* called with w->lock held */
+static void tb_worker_queue(TBWorker *w, const TBWorkerHint *h)
+{
+    if (h->depth > tcg_tb_prefetch) {
+        w->parked[w->parked_head++ % TB_WORKER_HINTS] = *h;
+        if (w->parked_head - w->parked_tail > TB_WORKER_HINTS) {
+            w->parked_tail++;
+        }
+    } else if (w->head - w->tail == TB_WORKER_HINTS) {
+        w->dropped++;
+    } else {
+        w->hints[w->head++ % TB_WORKER_HINTS] = *h;
+        qemu_cond_signal(&w->cond);
+    }
+}
+
+/*
+ * Called by the translator with tb_lock held, for the target of a direct
+ * jump of the TB it translates.
+ */
+void tb_worker_hint(CPUState *cpu, target_ulong pc, target_ulong cs_base,
+                    uint32_t flags)
+{
+    TBWorker *w = &tb_worker;
+    TBWorkerHint h;
+
+    if (!tcg_tb_prefetch) {
+        return;
+    }
+    if (!w->started) {
+        qemu_mutex_init(&w->lock);
+        qemu_cond_init(&w->cond);
+        qemu_thread_create(&w->thread, "TCG translator", tb_worker_run, w,
+                           QEMU_THREAD_DETACHED);
+        w->started = true;
+    }
+
+    h.cpu = cpu;
+    h.pc = pc;
+    h.cs_base = cs_base;
+    h.flags = flags;
+    h.depth = tb_worker_thread ? w->depth + 1 : 1;
+    h.flush_count = tcg_ctx.tb_ctx.tb_flush_count;
+
+    qemu_mutex_lock(&w->lock);
+    tb_worker_queue(w, &h);
+    qemu_mutex_unlock(&w->lock);
+}
+
+/* Called by a vCPU which reaches a TB of the translator thread. */
+void tb_worker_reached(TranslationBlock *tb)
+{
+    TBWorker *w = &tb_worker;
+    unsigned int d = atomic_xchg(&tb->prefetch, 0);
+    unsigned int i, n;
+    TBWorkerHint h;
+
+    if (d == 0) {
+        return;
+    }
+
+    qemu_mutex_lock(&w->lock);
+    n = w->parked_head - w->parked_tail;
+    for (i = 0; i < n; i++) {
+        h = w->parked[w->parked_tail++ % TB_WORKER_HINTS];
+        h.depth = h.depth > d ? h.depth - d : 1;
+        tb_worker_queue(w, &h);
+    }
+    qemu_mutex_unlock(&w->lock);
+}
+
+void tb_worker_dump_info(FILE *f, fprintf_function cpu_fprintf)
+{
+    TBWorker *w = &tb_worker;
+
+    if (!tcg_tb_prefetch) {
+        return;
+    }
+    cpu_fprintf(f, "TB prefetch count   %u in %.1f ms, %u hints dropped "
+                "(%u jumps ahead)\n", w->translated, w->gen_ns / 1e6,
+                w->dropped, tcg_tb_prefetch);
+}
@@ -0,0 +1,33 @@
+/*
+ * Translation ahead of execution
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+#ifndef TB_WORKER_H
+#define TB_WORKER_H
+
+#include "exec/exec-all.h"
+
+#ifdef CONFIG_SOFTMMU
+/* true on the translator thread, which must not use the TLB of a vCPU */
+extern __thread bool tb_worker_thread;
+
+void tb_worker_hint(CPUState *cpu, target_ulong pc, target_ulong cs_base,
+                    uint32_t flags);
+void tb_worker_reached(TranslationBlock *tb);
+void tb_worker_dump_info(FILE *f, fprintf_function cpu_fprintf);
+#else
+#define tb_worker_thread false
+
+static inline void tb_worker_hint(CPUState *cpu, target_ulong pc,
+                                  target_ulong cs_base, uint32_t flags)
+{
+}
+
+static inline void tb_worker_reached(TranslationBlock *tb)
+{
+}
+#endif
+
+#endif /* TB_WORKER_H */
@@ -2542,7 +2542,10 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
 #endif
 
 #ifdef USE_TCG_OPTIMIZATIONS
-    tcg_optimize(s);
+    /* cold code is translated quickly, see tb_gen_hot */
+    if (!(tb->cflags & CF_COLD)) {
+        tcg_optimize(s);
+    }
 #endif
 
 #ifdef CONFIG_PROFILER
@@ -2686,6 +2689,8 @@ void tcg_dump_info(FILE *f, fprintf_function cpu_fprintf)
     int64_t tb_count = s->tb_count;
     int64_t tb_div_count = tb_count ? tb_count : 1;
     int64_t tot = s->interm_time + s->code_time;
+    uint64_t tb_find_count = 0;
+    CPUState *cpu;
 
     cpu_fprintf(f, "JIT cycles          %" PRId64 " (%0.3f s at 2.4 GHz)\n",
                 tot, tot / 2.4e9);
@@ -2728,6 +2733,10 @@ void tcg_dump_info(FILE *f, fprintf_function cpu_fprintf)
                 s->restore_count);
     cpu_fprintf(f, "  avg cycles        %0.1f\n",
                 s->restore_count ? (double)s->restore_time / s->restore_count : 0);
+    CPU_FOREACH(cpu) {
+        tb_find_count += cpu->tb_find_count;
+    }
+    cpu_fprintf(f, "TB lookup count     %" PRIu64 "\n", tb_find_count);
 }
 #else
 void tcg_dump_info(FILE *f, fprintf_function cpu_fprintf)
@@ -248,6 +248,7 @@ typedef struct TCGPool {
 
 #define TCG_MAX_TEMPS 512
 #define TCG_MAX_INSNS 512
+#define TCG_MAX_TRACE 8
 
 /* when the size of the arguments of a called function is smaller than
    this value, they are statically allocated in the TB stack frame */
@@ -727,10 +728,17 @@ struct TCGContext {
 
     uint16_t gen_insn_end_off[TCG_MAX_INSNS];
     target_ulong gen_insn_data[TCG_MAX_INSNS][TARGET_INSN_START_WORDS];
+
+    /* CF_TRACE: the pc of each TB of the trace, the first is the TB's own */
+    int trace_len;
+    target_ulong trace_pc[TCG_MAX_TRACE];
 };
 
 extern TCGContext tcg_ctx;
 extern bool parallel_cpus;
+extern unsigned int tcg_tb_hot;
+extern bool tcg_tb_trace;
+extern unsigned int tcg_tb_prefetch;
 
 static inline void tcg_set_insn_param(int op_idx, int arg, TCGArg v)
 {
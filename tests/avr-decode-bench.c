@@ -0,0 +1,176 @@
+/*
+ * AVR instruction decoder benchmark
+ *
+ * Compares the switch based decoder (target/avr/decode.inc.c) against the
+ * flat table decoder (target/avr/decode-table.inc.c) used by the translator.
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/bitops.h"
+#include "qemu/timer.h"
+
+#define FLASH_SIZE (128 * 1024)
+
+typedef struct DisasContext DisasContext;
+typedef int (*translate_function_t)(DisasContext *ctx, uint32_t opcode);
+
+/*
+ * the decoders only need the addresses of the translation functions, each
+ * stub returns its own line number so that no two of them get merged
+ */
+#define AVR_INSN(name) \
+    static int avr_translate_##name(DisasContext *ctx, uint32_t opcode) \
+    { \
+        return __LINE__; \
+    }
+#include "avr-decode-stubs.h"
+#undef AVR_INSN
+
+#include "../target/avr/decode.inc.c"
+#include "../target/avr/decode-index.h"
+#include "target/avr/decode-table.inc.c"
+
+typedef void (*decode_function_t)(uint32_t pc, uint32_t *l, uint32_t c,
+                                  translate_function_t *t);
+
+static uint16_t flash[FLASH_SIZE / 2 + 1];
+static unsigned int repeat = 100;
+static const char *image;
+
+static const char commands_string[] =
+    " -f = flash image to decode (default: random contents)\n"
+    " -n = number of passes over the flash image";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+/*
+ * From: https://en.wikipedia.org/wiki/Xorshift
+ */
+static uint64_t xorshift64star(uint64_t x)
+{
+    x ^= x >> 12; /* a */
+    x ^= x << 25; /* b */
+    x ^= x >> 27; /* c */
+    return x * UINT64_C(2685821657736338717);
+}
+
+static void load_flash(void)
+{
+    uint64_t r = 1;
+    size_t i;
+
+    if (image) {
+        FILE *f = fopen(image, "rb");
+
+        if (f == NULL) {
+            fprintf(stderr, "cannot open %s: %s\n", image, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        i = fread(flash, 1, FLASH_SIZE, f);
+        fclose(f);
+        printf("loaded %zu bytes from %s\n", i, image);
+        return;
+    }
+
+    for (i = 0; i < FLASH_SIZE / 2; i++) {
+        r = xorshift64star(r);
+        flash[i] = r >> 32;
+    }
+}
+
+/* both decoders have to agree on every possible first opcode word */
+static void check_decoders(void)
+{
+    uint32_t c;
+
+    for (c = 0; c < 0x10000; c++) {
+        uint32_t l0 = 16;
+        uint32_t l1 = 16;
+        translate_function_t t0 = NULL;
+        translate_function_t t1 = NULL;
+
+        avr_decode(0, &l0, c, &t0);
+        avr_decode_table(0, &l1, c, &t1);
+
+        if (t0 != t1 || l0 != l1) {
+            fprintf(stderr, "decoders disagree on opcode 0x%04x\n", c);
+            exit(EXIT_FAILURE);
+        }
+        if (avr_decode_cycles(c, false) == 0 ||
+            avr_decode_cycles(c, true) == 0) {
+            fprintf(stderr, "no cycle count for opcode 0x%04x\n", c);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void run_test(const char *name, decode_function_t decode)
+{
+    uintptr_t sum = 0;
+    uint64_t insns = 0;
+    int64_t start;
+    int64_t ns;
+    unsigned int i;
+
+    start = get_clock();
+    for (i = 0; i < repeat; i++) {
+        uint32_t pc = 0;
+
+        while (pc < FLASH_SIZE / 2) {
+            uint32_t c = flash[pc] | flash[pc + 1] << 16;
+            uint32_t l = 16;
+            translate_function_t t = NULL;
+
+            decode(pc, &l, c, &t);
+
+            sum += (uintptr_t)t;
+            pc += l / 16;
+            insns++;
+        }
+    }
+    ns = get_clock() - start;
+
+    printf("%-8s %" PRIu64 " insns, %.3f ns/insn (checksum %" PRIxPTR ")\n",
+           name, insns, (double)ns / insns, sum);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hf:n:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'f':
+            image = optarg;
+            break;
+        case 'n':
+            repeat = atoi(optarg);
+            break;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parse_args(argc, argv);
+    load_flash();
+    check_decoders();
+
+    run_test("switch", avr_decode);
+    run_test("table", avr_decode_table);
+
+    return 0;
+}
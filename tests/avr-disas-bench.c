@@ -0,0 +1,172 @@
+/*
+ * AVR disassembler benchmark
+ *
+ * Disassembles a flash image with print_insn_avr (disas/avr.c), the
+ * disassembler used by -d in_asm and the gdbstub.
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "disas/bfd.h"
+
+#define FLASH_SIZE (256 * 1024)
+
+static uint8_t flash[FLASH_SIZE + 2];
+static unsigned int repeat = 10;
+static const char *image;
+static bool verbose;
+
+static const char commands_string[] =
+    " -f = flash image to disassemble (default: random contents)\n"
+    " -n = number of passes over the flash image\n"
+    " -v = print the disassembly of the first pass";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+/*
+ * From: https://en.wikipedia.org/wiki/Xorshift
+ */
+static uint64_t xorshift64star(uint64_t x)
+{
+    x ^= x >> 12; /* a */
+    x ^= x << 25; /* b */
+    x ^= x >> 27; /* c */
+    return x * UINT64_C(2685821657736338717);
+}
+
+static void load_flash(void)
+{
+    uint64_t r = 1;
+    size_t i;
+
+    if (image) {
+        FILE *f = fopen(image, "rb");
+
+        if (f == NULL) {
+            fprintf(stderr, "cannot open %s: %s\n", image, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        i = fread(flash, 1, FLASH_SIZE, f);
+        fclose(f);
+        printf("loaded %zu bytes from %s\n", i, image);
+        return;
+    }
+
+    for (i = 0; i < FLASH_SIZE; i += 4) {
+        r = xorshift64star(r);
+        stl_le_p(&flash[i], r >> 32);
+    }
+}
+
+static int read_flash(bfd_vma addr, bfd_byte *buf, int length,
+                      struct disassemble_info *info)
+{
+    if (addr + length > sizeof(flash)) {
+        return -1;
+    }
+    memcpy(buf, &flash[addr], length);
+    return 0;
+}
+
+static void memory_error(int status, bfd_vma addr,
+                         struct disassemble_info *info)
+{
+    fprintf(stderr, "cannot read flash at 0x%" PRIx64 "\n", (uint64_t)addr);
+    exit(EXIT_FAILURE);
+}
+
+/* format into a buffer like the monitor does, but do not print it */
+static char line[128];
+
+static int sink_printf(FILE *stream, const char *fmt, ...)
+{
+    va_list ap;
+    int ret;
+
+    va_start(ap, fmt);
+    ret = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (stream) {
+        fprintf(stream, "%s", line);
+    }
+    return ret;
+}
+
+static void run_test(void)
+{
+    disassemble_info info;
+    uint64_t insns = 0;
+    uint64_t sum = 0;
+    int64_t start;
+    int64_t ns;
+    unsigned int i;
+
+    memset(&info, 0, sizeof(info));
+    info.fprintf_func = sink_printf;
+    info.read_memory_func = read_flash;
+    info.memory_error_func = memory_error;
+    info.mach = bfd_arch_avr;
+
+    start = get_clock();
+    for (i = 0; i < repeat; i++) {
+        bfd_vma pc = 0;
+
+        info.stream = verbose && i == 0 ? stdout : NULL;
+        while (pc < FLASH_SIZE) {
+            if (info.stream) {
+                fprintf(info.stream, "%06" PRIx64 ":\t", (uint64_t)pc);
+            }
+            pc += print_insn_avr(pc, &info);
+            if (info.stream) {
+                fprintf(info.stream, "\n");
+            }
+            sum += line[0];
+            insns++;
+        }
+    }
+    ns = get_clock() - start;
+
+    printf("%" PRIu64 " insns, %.3f ns/insn (checksum %" PRIx64 ")\n",
+           insns, (double)ns / insns, sum);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hf:n:v");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'f':
+            image = optarg;
+            break;
+        case 'n':
+            repeat = atoi(optarg);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parse_args(argc, argv);
+    load_flash();
+    run_test();
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+#
+#  parses "info registers" output and prints loop iterations per second,
+#  the loop counter is kept in r2..r5. The counters of several dumps, one
+#  per CPU of sample-multi, are added up. If insns (guest instructions per
+#  iteration) is set, TB lookups from "info jit" are printed per million
+#  guest instructions. If outs (OUT instructions per iteration) is set, the
+#  time per OUT is printed. The traces built are printed with trace=on, the
+#  time the vCPU waited for code with a QEMU which reports it, the hits of
+#  the TB jump cache and the TBs of a pc translated again for other TB
+#  flags, e.g. the cc_op of AVR
+#
+function hex(s,    i, v) {
+    v = 0
+    for (i = 1; i <= length(s); i++) {
+        v = v * 16 + index("0123456789abcdef", tolower(substr(s, i, 1))) - 1
+    }
+    return v
+}
+
+/R\[0[2-5]\]:/ {
+    for (i = 1; i <= NF; i++) {
+        if ($i ~ /^R\[0[2-5]\]:$/) {
+            n = substr($i, 3, 2) + 0
+            iters += hex($(i + 1)) * 256 ^ (n - 2)
+            if (n == 2) {
+                cpus++
+            }
+        }
+    }
+}
+/^TB count/ {
+    split($3, tbs, "/")
+}
+/^TB pc copies/ {
+    pc_copies = $4
+}
+/^TB lookup count/ {
+    lookups = $4
+}
+/^TB stall time/ {
+    stall_ms = $4
+    misses = $7
+}
+/^TB jmp cache hits/ {
+    jmp_hits = $5
+    jmp_lookups = $7
+    jmp_size = $11
+    jmp_ways = $13
+}
+/^TB trace count/ {
+    traces = $4
+    trace_len = $5
+}
+END {
+    if (cpus > 1) {
+        printf "%s: %d iterations on %d CPUs in %d s, %.0f iterations/s\n",
+                name, iters, cpus, secs, iters / secs
+    } else {
+        printf "%s: %d iterations in %d s, %.0f iterations/s\n",
+                name, iters, secs, iters / secs
+    }
+    if (pc_copies != "") {
+        printf "%s: %d TBs, %d of them for a pc translated with other flags\n",
+                name, tbs[1], pc_copies
+    }
+    if (insns && iters && lookups != "") {
+        printf "%s: %d TB lookups, %.1f per million insns\n",
+                name, lookups, lookups * 1000000 / (iters * insns)
+    }
+    if (stall_ms != "") {
+        printf "%s: %s ms waiting for code in %d misses\n", name, stall_ms,
+                misses
+    }
+    if (jmp_lookups) {
+        printf "%s: %.1f%% of %d TB lookups hit the %d entry %s jump cache\n",
+                name, jmp_hits * 100 / jmp_lookups, jmp_lookups, jmp_size,
+                jmp_ways
+    }
+    if (traces != "") {
+        printf "%s: %d traces of %s TBs on average\n", name, traces,
+                substr(trace_len, 2)
+    }
+    if (outs && iters) {
+        printf "%s: %.1f ns per OUT\n", name, secs * 1e9 / (iters * outs)
+    }
+}
@@ -0,0 +1,12 @@
+#
+#  counts TCG ops per guest instruction in a -d op_opt log
+#
+/^OP/ { next }
+/^ ---- / { insns++; next }
+NF { ops++ }
+END {
+    if (insns) {
+        printf "%s: %d insns, %d ops, %.2f ops/insn\n",
+                name, insns, ops, ops / insns
+    }
+}
@@ -48,11 +48,14 @@
 #endif
 #else
 #include "exec/address-spaces.h"
+#include "sysemu/accel.h"
 #endif
 
 #include "exec/cputlb.h"
 #include "exec/tb-hash.h"
 #include "translate-all.h"
+#include "tb-cache.h"
+#include "tb-worker.h"
 #include "qemu/bitmap.h"
 #include "qemu/timer.h"
 #include "qemu/main-loop.h"
@@ -134,6 +137,12 @@ static void *l1_map[V_L1_MAX_SIZE];
 /* code generation context */
 TCGContext tcg_ctx;
 bool parallel_cpus;
+/* executions after which a TB is optimized, 0 optimizes them all at once */
+unsigned int tcg_tb_hot;
+/* hot TBs are translated together with the TBs they loop through */
+bool tcg_tb_trace;
+/* jumps ahead of the vCPUs the translator thread translates, see tb-worker.c */
+unsigned int tcg_tb_prefetch;
 
 /* translation block context */
 __thread int have_tb_lock;
@@ -278,6 +287,7 @@ static int encode_search(TranslationBlock *tb, uint8_t *block)
 }
 
 /* The cpu state corresponding to 'searched_pc' is restored.
+ * Returns the index of the insn within the TB, or -1 if not found.
  * Called with tb_lock held.
  */
 static int cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
@@ -326,7 +336,7 @@ static int cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
     tcg_ctx.restore_time += profile_getclock() - ti;
     tcg_ctx.restore_count++;
 #endif
-    return 0;
+    return i;
 }
 
 bool cpu_restore_state(CPUState *cpu, uintptr_t retaddr)
@@ -542,12 +552,28 @@ static inline PageDesc *page_find(tb_page_addr_t index)
   (DEFAULT_CODE_GEN_BUFFER_SIZE_1 < MAX_CODE_GEN_BUFFER_SIZE \
    ? DEFAULT_CODE_GEN_BUFFER_SIZE_1 : MAX_CODE_GEN_BUFFER_SIZE)
 
+/*
+ * Targets with a small code space, e.g. microcontrollers, define
+ * TARGET_CODE_SIZE to the most guest code a CPU can have in bytes.  The
+ * default code buffer then holds all of it translated, at about
+ * CODE_GEN_EXPANSION bytes of host code per byte of guest code, and the
+ * TB array and the TB hash table are sized for it, instead of for the RAM
+ * of the machine.  This keeps the start & the memory of a QEMU process
+ * small when many of them run at once.
+ */
+#define CODE_GEN_EXPANSION 32
+
+/* a TB per CODE_GEN_HTABLE_CODE bytes of guest code, the table may grow */
+#define CODE_GEN_HTABLE_CODE 32
+
 static inline size_t size_code_gen_buffer(size_t tb_size)
 {
     /* Size the buffer.  */
     if (tb_size == 0) {
 #ifdef USE_STATIC_CODE_GEN_BUFFER
         tb_size = DEFAULT_CODE_GEN_BUFFER_SIZE;
+#elif defined(TARGET_CODE_SIZE)
+        tb_size = (size_t)TARGET_CODE_SIZE * CODE_GEN_EXPANSION;
 #else
         /* ??? Needs adjustments.  */
         /* ??? If we relax the requirement that CONFIG_USER_ONLY use the
@@ -721,6 +747,10 @@ static inline void *alloc_code_gen_buffer(void)
     start = 0x08000000ul;
 #  endif
 # endif
+    /* where the code of the TB cache was generated */
+    if (tb_cache_buffer_hint()) {
+        start = (uintptr_t)tb_cache_buffer_hint();
+    }
 
     buf = mmap((void *)start, size + qemu_real_host_page_size,
                PROT_NONE, flags, -1, 0);
@@ -784,18 +814,43 @@ static inline void code_gen_alloc(size_t tb_size)
     /* Estimate a good size for the number of TBs we can support.  We
        still haven't deducted the prologue from the buffer size here,
        but that's minimal and won't affect the estimate much.  */
-    tcg_ctx.code_gen_max_blocks
-        = tcg_ctx.code_gen_buffer_size / CODE_GEN_AVG_BLOCK_SIZE;
-    tcg_ctx.tb_ctx.tbs = g_new(TranslationBlock, tcg_ctx.code_gen_max_blocks);
+    if (tb_cache_enabled()) {
+        /* The TBs are part of the image of the TB cache, they are kept at
+           the end of the buffer so that its address places both.  */
+        size_t tbs_size;
+
+        tcg_ctx.code_gen_max_blocks = tcg_ctx.code_gen_buffer_size
+            / (CODE_GEN_AVG_BLOCK_SIZE + sizeof(TranslationBlock));
+        tbs_size = ROUND_UP(tcg_ctx.code_gen_max_blocks
+                            * sizeof(TranslationBlock), 64);
+        tcg_ctx.code_gen_buffer_size -= tbs_size;
+        tcg_ctx.tb_ctx.tbs = tcg_ctx.code_gen_buffer
+                             + tcg_ctx.code_gen_buffer_size;
+    } else {
+        tcg_ctx.code_gen_max_blocks
+            = tcg_ctx.code_gen_buffer_size / CODE_GEN_AVG_BLOCK_SIZE;
+        tcg_ctx.tb_ctx.tbs = g_new(TranslationBlock,
+                                   tcg_ctx.code_gen_max_blocks);
+    }
 
     qemu_mutex_init(&tcg_ctx.tb_ctx.tb_lock);
 }
 
+static size_t tb_htable_size(void)
+{
+#ifdef TARGET_CODE_SIZE
+    return MIN(pow2ceil(TARGET_CODE_SIZE / CODE_GEN_HTABLE_CODE),
+               CODE_GEN_HTABLE_SIZE);
+#else
+    return CODE_GEN_HTABLE_SIZE;
+#endif
+}
+
 static void tb_htable_init(void)
 {
     unsigned int mode = QHT_MODE_AUTO_RESIZE;
 
-    qht_init(&tcg_ctx.tb_ctx.htable, CODE_GEN_HTABLE_SIZE, mode);
+    qht_init(&tcg_ctx.tb_ctx.htable, tb_htable_size(), mode);
 }
 
 /* Must be called before using the QEMU cpus. 'tb_size' is the size
@@ -806,11 +861,17 @@ void tcg_exec_init(unsigned long tb_size)
     cpu_gen_init();
     page_init();
     tb_htable_init();
+#if defined(CONFIG_SOFTMMU)
+    if (tcg_tb_cache) {
+        tb_cache_open(tcg_tb_cache);
+    }
+#endif
     code_gen_alloc(tb_size);
 #if defined(CONFIG_SOFTMMU)
     /* There's no guest base to take into account, so go ahead and
        initialize the prologue now.  */
     tcg_prologue_init(&tcg_ctx);
+    tb_cache_init();
 #endif
 }
 
@@ -931,7 +992,7 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
     }
 
     tcg_ctx.tb_ctx.nb_tbs = 0;
-    qht_reset_size(&tcg_ctx.tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
+    qht_reset_size(&tcg_ctx.tb_ctx.htable, tb_htable_size());
     page_flush_tb();
 
     tcg_ctx.code_gen_ptr = tcg_ctx.code_gen_buffer;
@@ -1054,6 +1115,23 @@ static inline void tb_reset_jump(TranslationBlock *tb, int n)
     tb_set_jmp_target(tb, n, addr);
 }
 
+/* init the jump list and the jumps of a TB which is not chained yet */
+static void tb_init_jumps(TranslationBlock *tb)
+{
+    assert(((uintptr_t)tb & 3) == 0);
+    tb->jmp_list_first = (uintptr_t)tb | 2;
+    tb->jmp_list_next[0] = (uintptr_t)NULL;
+    tb->jmp_list_next[1] = (uintptr_t)NULL;
+
+    /* init original jump addresses wich has been set during tcg_gen_code() */
+    if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
+        tb_reset_jump(tb, 0);
+    }
+    if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
+        tb_reset_jump(tb, 1);
+    }
+}
+
 /* remove any jumps to the TB */
 static inline void tb_jmp_unlink(TranslationBlock *tb)
 {
@@ -1075,6 +1153,47 @@ static inline void tb_jmp_unlink(TranslationBlock *tb)
     }
 }
 
+/* move the jumps to a TB onto the TB which replaces it */
+static void tb_jmp_move(TranslationBlock *tb, TranslationBlock *new_tb)
+{
+    TranslationBlock *tb1;
+    uintptr_t *ptb, ntb;
+    unsigned int n1;
+
+    ptb = &tb->jmp_list_first;
+    for (;;) {
+        ntb = *ptb;
+        n1 = ntb & 3;
+        tb1 = (TranslationBlock *)(ntb & ~3);
+        if (n1 == 2) {
+            break;
+        }
+        *ptb = tb1->jmp_list_next[n1];
+        tb_set_jmp_target(tb1, n1, (uintptr_t)new_tb->tc_ptr);
+        tb1->jmp_list_next[n1] = new_tb->jmp_list_first;
+        new_tb->jmp_list_first = (uintptr_t)tb1 | n1;
+    }
+}
+
+/* the TB the jump n of a TB is chained to, or NULL */
+static TranslationBlock *tb_jmp_dest(TranslationBlock *tb, int n)
+{
+    TranslationBlock *tb1;
+    uintptr_t ntb;
+    unsigned int n1;
+
+    ntb = tb->jmp_list_next[n];
+    while (ntb) {
+        n1 = ntb & 3;
+        tb1 = (TranslationBlock *)(ntb & ~3);
+        if (n1 == 2) {
+            return tb1;
+        }
+        ntb = tb1->jmp_list_next[n1];
+    }
+    return NULL;
+}
+
 /* invalidate one TB
  *
  * Called with tb_lock held.
@@ -1085,6 +1204,7 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     PageDesc *p;
     uint32_t h;
     tb_page_addr_t phys_pc;
+    int i;
 
     assert_tb_locked();
 
@@ -1107,11 +1227,13 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
         invalidate_page_bitmap(p);
     }
 
-    /* remove the TB from the hash list */
+    /* remove the TB from the set of its pc in the jump caches */
     h = tb_jmp_cache_hash_func(tb->pc);
     CPU_FOREACH(cpu) {
-        if (atomic_read(&cpu->tb_jmp_cache[h]) == tb) {
-            atomic_set(&cpu->tb_jmp_cache[h], NULL);
+        for (i = 0; i < TB_JMP_CACHE_WAYS; i++) {
+            if (atomic_read(&cpu->tb_jmp_cache[h + i]) == tb) {
+                atomic_set(&cpu->tb_jmp_cache[h + i], NULL);
+            }
         }
     }
 
@@ -1256,6 +1378,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     target_ulong virt_page2;
     tcg_insn_unit *gen_code_buf;
     int gen_code_size, search_size;
+    int64_t gen_start = 0;
 #ifdef CONFIG_PROFILER
     int64_t ti;
 #endif
@@ -1266,11 +1389,23 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         cflags |= CF_USE_ICOUNT;
     }
 
+    if (unlikely(tb_cache_enabled())) {
+        tb = tb_cache_load(cpu, phys_pc, pc, cs_base, flags, cflags);
+        if (tb) {
+            return tb;
+        }
+        gen_start = get_clock();
+    }
+
     tb = tb_alloc(pc);
     if (unlikely(!tb)) {
  buffer_overflow:
         /* flush must be done */
         tb_flush(cpu);
+        if (tb_worker_thread) {
+            /* the vCPU flushes as it runs the work queued by tb_flush */
+            return NULL;
+        }
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -1282,6 +1417,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->cs_base = cs_base;
     tb->flags = flags;
     tb->cflags = cflags;
+    tb->prefetch = 0;
+    tb->hot_left = tcg_tb_hot;
 
 #ifdef CONFIG_PROFILER
     tcg_ctx.tb_count1++; /* includes aborted translations because of
@@ -1352,19 +1489,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
                  CODE_GEN_ALIGN);
 
-    /* init jump list */
-    assert(((uintptr_t)tb & 3) == 0);
-    tb->jmp_list_first = (uintptr_t)tb | 2;
-    tb->jmp_list_next[0] = (uintptr_t)NULL;
-    tb->jmp_list_next[1] = (uintptr_t)NULL;
-
-    /* init original jump addresses wich has been set during tcg_gen_code() */
-    if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
-        tb_reset_jump(tb, 0);
-    }
-    if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
-        tb_reset_jump(tb, 1);
-    }
+    tb_init_jumps(tb);
 
     /* check next page if needed */
     virt_page2 = (pc + tb->size - 1) & TARGET_PAGE_MASK;
@@ -1378,9 +1503,137 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
      * through the physical hash table and physical page list.
      */
     tb_link_page(tb, phys_pc, phys_page2);
+    if (unlikely(gen_start)) {
+        tb_cache_set_gen_time(tb, get_clock() - gen_start);
+    }
     return tb;
 }
 
+#ifndef TB_FLAGS_TRACE_IGNORE
+#define TB_FLAGS_TRACE_IGNORE 0
+#endif
+
+/* how often a TB ran, as far as it is known */
+static unsigned int tb_runs(TranslationBlock *tb)
+{
+    if (tb->cflags & CF_COLD) {
+        return tcg_tb_hot - atomic_read(&tb->hot_left);
+    }
+    return UINT_MAX;
+}
+
+/* whether tb may be part of a trace starting with head. A trace takes the
+ * place of its head, it has to fit on the pages of a TB starting there.
+ */
+static bool tb_trace_fits(TranslationBlock *head, TranslationBlock *tb)
+{
+    target_ulong page = head->pc & TARGET_PAGE_MASK;
+    int i;
+
+    if (tb->invalid || tb->cs_base != head->cs_base
+        || ((tb->flags ^ head->flags) & ~TB_FLAGS_TRACE_IGNORE)
+        || (tb->cflags & (CF_COUNT_MASK | CF_LAST_IO | CF_NOCACHE))
+        || tb->pc < head->pc
+        || tb->pc + tb->size - page > 2 * TARGET_PAGE_SIZE) {
+        return false;
+    }
+    for (i = 0; i < tcg_ctx.trace_len; i++) {
+        if (tcg_ctx.trace_pc[i] == tb->pc) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Looks for a loop from head through the TBs chained to each other,
+ * following the jump to the TB which ran more often first. On success
+ * tcg_ctx.trace_pc holds the start of each TB of the loop.
+ */
+static bool tb_trace_find(TranslationBlock *head, TranslationBlock *tb)
+{
+    TranslationBlock *next[2];
+    int len = tcg_ctx.trace_len;
+    int i;
+
+    tcg_ctx.trace_pc[tcg_ctx.trace_len++] = tb->pc;
+    next[0] = tb_jmp_dest(tb, 0);
+    next[1] = tb_jmp_dest(tb, 1);
+    if (next[0] && next[1] && tb_runs(next[1]) > tb_runs(next[0])) {
+        next[0] = next[1];
+        next[1] = tb_jmp_dest(tb, 0);
+    }
+    for (i = 0; i < 2; i++) {
+        if (next[i] == NULL) {
+            continue;
+        }
+        if (next[i] == head) {
+            if (tcg_ctx.trace_len > 1) {
+                return true;
+            }
+        } else if (tcg_ctx.trace_len < TCG_MAX_TRACE
+                   && tb_trace_fits(head, next[i])
+                   && tb_trace_find(head, next[i])) {
+            return true;
+        }
+    }
+    tcg_ctx.trace_len = len;
+    return false;
+}
+
+/* Translates a CF_COLD TB which became hot again with the optimizer. The
+ * new TB takes the place of the old one, the TBs chained to the old one
+ * jump to the new one from now on.
+ *
+ * With tcg_tb_trace, a TB which starts a loop of chained TBs is translated
+ * together with them as a CF_TRACE TB, if the target supports it. The
+ * translator goes on at the next TB of the trace where the TB it is at
+ * jumps there, the other exits of the TB become side exits of the trace.
+ * The guest state is then kept in host registers across the jump, and
+ * the trace loops without leaving its code. The exits give back the cycles
+ * a path did not use with icount, which a trace does not know, so traces
+ * are not built then.
+ *
+ * Called from the execution loop, once the TB has exited.
+ */
+void tb_gen_hot(CPUState *cpu, TranslationBlock *tb)
+{
+    TranslationBlock *hot;
+    uint32_t cflags;
+
+    mmap_lock();
+    tb_lock();
+    if (!tb->invalid) {
+        cflags = tb->cflags & ~CF_COLD;
+        tcg_ctx.trace_len = 0;
+        if (tcg_tb_trace && !(cflags & CF_USE_ICOUNT)
+            && tb_trace_find(tb, tb)) {
+            cflags |= CF_TRACE;
+            tcg_ctx.tb_ctx.tb_trace_count++;
+            tcg_ctx.tb_ctx.tb_trace_len += tcg_ctx.trace_len;
+        }
+        hot = tb_gen_code(cpu, tb->pc, tb->cs_base, tb->flags, cflags);
+        tb_jmp_move(tb, hot);
+        tb_phys_invalidate(tb, -1);
+        tcg_ctx.tb_ctx.tb_hot_count++;
+    }
+    tb_unlock();
+    mmap_unlock();
+}
+
+/* Links a TB whose host code is already in the code buffer, e.g. one
+ * loaded by the TB cache, like tb_gen_code does with a new one.
+ *
+ * Called with tb_lock held.
+ */
+void tb_install(TranslationBlock *tb, tb_page_addr_t phys_pc,
+                tb_page_addr_t phys_page2)
+{
+    assert_memory_lock();
+
+    tb_init_jumps(tb);
+    tb_link_page(tb, phys_pc, phys_page2);
+}
+
 /*
  * Invalidate all TBs which intersect with the target physical address range
  * [start;end[. NOTE: start and end may refer to *different* physical pages.
@@ -1747,11 +2000,10 @@ void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr)
         cpu_abort(cpu, "cpu_io_recompile: could not find TB for pc=%p",
                   (void *)retaddr);
     }
-    n = cpu->icount_decr.u16.low + tb->icount;
-    cpu_restore_state_from_tb(cpu, tb, retaddr);
     /* Calculate how many instructions had been executed before the fault
-       occurred.  */
-    n = n - cpu->icount_decr.u16.low;
+       occurred.  This is not the difference in icount_decr, targets may
+       count more than one unit per insn.  */
+    n = cpu_restore_state_from_tb(cpu, tb, retaddr);
     /* Generate a new TB ending on the I/O insn.  */
     n++;
     /* On MIPS and SH, delay slot instructions can only be restarted if
@@ -1814,11 +2066,11 @@ void tb_flush_jmp_cache(CPUState *cpu, target_ulong addr)
        overlap the flushed page.  */
     i = tb_jmp_cache_hash_page(addr - TARGET_PAGE_SIZE);
     memset(&cpu->tb_jmp_cache[i], 0,
-           TB_JMP_PAGE_SIZE * sizeof(TranslationBlock *));
+           TB_JMP_PAGE_SIZE * TB_JMP_CACHE_WAYS * sizeof(TranslationBlock *));
 
     i = tb_jmp_cache_hash_page(addr);
     memset(&cpu->tb_jmp_cache[i], 0,
-           TB_JMP_PAGE_SIZE * sizeof(TranslationBlock *));
+           TB_JMP_PAGE_SIZE * TB_JMP_CACHE_WAYS * sizeof(TranslationBlock *));
 }
 
 static void print_qht_statistics(FILE *f, fprintf_function cpu_fprintf,
@@ -1859,12 +2111,57 @@ static void print_qht_statistics(FILE *f, fprintf_function cpu_fprintf,
     g_free(hgram);
 }
 
+/* TB guest size histogram, bucket i counts sizes up to 2^i bytes */
+#define TB_SIZE_HIST_BUCKETS 12
+
+static void print_tb_size_histogram(FILE *f, fprintf_function cpu_fprintf)
+{
+    int hist[TB_SIZE_HIST_BUCKETS] = { 0 };
+    int nb_tbs = tcg_ctx.tb_ctx.nb_tbs;
+    int i, b;
+
+    for (i = 0; i < nb_tbs; i++) {
+        uint32_t size = tcg_ctx.tb_ctx.tbs[i].size;
+
+        b = size > 1 ? 32 - clz32(size - 1) : 0;
+        hist[MIN(b, TB_SIZE_HIST_BUCKETS - 1)]++;
+    }
+
+    cpu_fprintf(f, "TB size histogram (target bytes):\n");
+    for (b = 0; b < TB_SIZE_HIST_BUCKETS; b++) {
+        if (hist[b] == 0) {
+            continue;
+        }
+        if (b == TB_SIZE_HIST_BUCKETS - 1) {
+            cpu_fprintf(f, "  >  %5d  %d (%d%%)\n", 1 << (b - 1), hist[b],
+                        hist[b] * 100 / nb_tbs);
+        } else {
+            cpu_fprintf(f, "  <= %5d  %d (%d%%)\n", 1 << b, hist[b],
+                        hist[b] * 100 / nb_tbs);
+        }
+    }
+}
+
+static int tb_pc_cmp(const void *a, const void *b)
+{
+    target_ulong pa = *(const target_ulong *)a;
+    target_ulong pb = *(const target_ulong *)b;
+
+    return pa < pb ? -1 : pa > pb;
+}
+
 void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
 {
     int i, target_code_size, max_target_code_size;
     int direct_jmp_count, direct_jmp2_count, cross_page;
+    int nb_pcs, pc_copies;
+    target_ulong *pcs;
     TranslationBlock *tb;
     struct qht_stats hst;
+#ifdef CONFIG_PROFILER
+    uint64_t jmp_cache_hits, jmp_cache_lookups;
+    CPUState *cpu;
+#endif
 
     tb_lock();
 
@@ -1873,8 +2170,13 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     cross_page = 0;
     direct_jmp_count = 0;
     direct_jmp2_count = 0;
+    pcs = g_new(target_ulong, tcg_ctx.tb_ctx.nb_tbs);
+    nb_pcs = 0;
     for (i = 0; i < tcg_ctx.tb_ctx.nb_tbs; i++) {
         tb = &tcg_ctx.tb_ctx.tbs[i];
+        if (!tb->invalid) {
+            pcs[nb_pcs++] = tb->pc;
+        }
         target_code_size += tb->size;
         if (tb->size > max_target_code_size) {
             max_target_code_size = tb->size;
@@ -1889,6 +2191,16 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
             }
         }
     }
+    /* TBs of a pc which was translated for other flags as well */
+    qsort(pcs, nb_pcs, sizeof(pcs[0]), tb_pc_cmp);
+    pc_copies = 0;
+    for (i = 1; i < nb_pcs; i++) {
+        if (pcs[i] == pcs[i - 1]) {
+            pc_copies++;
+        }
+    }
+    g_free(pcs);
+
     /* XXX: avoid using doubles ? */
     cpu_fprintf(f, "Translation buffer state:\n");
     cpu_fprintf(f, "gen code size       %td/%zd\n",
@@ -1907,6 +2219,8 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
                 target_code_size ? (double) (tcg_ctx.code_gen_ptr -
                                              tcg_ctx.code_gen_buffer) /
                                              target_code_size : 0);
+    cpu_fprintf(f, "TB pc copies        %d (%d%%) for other flags\n",
+                pc_copies, nb_pcs ? pc_copies * 100 / nb_pcs : 0);
     cpu_fprintf(f, "cross page TB count %d (%d%%)\n", cross_page,
             tcg_ctx.tb_ctx.nb_tbs ? (cross_page * 100) /
                                     tcg_ctx.tb_ctx.nb_tbs : 0);
@@ -1917,6 +2231,7 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
                 direct_jmp2_count,
                 tcg_ctx.tb_ctx.nb_tbs ? (direct_jmp2_count * 100) /
                         tcg_ctx.tb_ctx.nb_tbs : 0);
+    print_tb_size_histogram(f, cpu_fprintf);
 
     qht_statistics_init(&tcg_ctx.tb_ctx.htable, &hst);
     print_qht_statistics(f, cpu_fprintf, hst);
@@ -1927,8 +2242,42 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
             atomic_read(&tcg_ctx.tb_ctx.tb_flush_count));
     cpu_fprintf(f, "TB invalidate count %d\n",
             tcg_ctx.tb_ctx.tb_phys_invalidate_count);
+    if (tcg_tb_hot) {
+        cpu_fprintf(f, "TB hot count        %d (after %u executions)\n",
+                    tcg_ctx.tb_ctx.tb_hot_count, tcg_tb_hot);
+    }
+    if (tcg_tb_trace) {
+        cpu_fprintf(f, "TB trace count      %d (%d TBs on average)\n",
+                    tcg_ctx.tb_ctx.tb_trace_count,
+                    tcg_ctx.tb_ctx.tb_trace_count ?
+                    tcg_ctx.tb_ctx.tb_trace_len /
+                    tcg_ctx.tb_ctx.tb_trace_count : 0);
+    }
+#ifdef CONFIG_PROFILER
+    cpu_fprintf(f, "TB stall time       %.1f ms in %u misses\n",
+                tcg_ctx.tb_ctx.tb_stall_ns / 1e6,
+                tcg_ctx.tb_ctx.tb_stall_count);
+
+    jmp_cache_hits = 0;
+    jmp_cache_lookups = 0;
+    CPU_FOREACH(cpu) {
+        jmp_cache_hits += cpu->tb_jmp_cache_hits;
+        jmp_cache_lookups += cpu->tb_jmp_cache_hits + cpu->tb_jmp_cache_misses;
+    }
+    cpu_fprintf(f, "TB jmp cache hits   %" PRIu64 " of %" PRIu64
+                " lookups (%d%%) in %d entries, %d-way\n",
+                jmp_cache_hits, jmp_cache_lookups,
+                jmp_cache_lookups ?
+                (int)(jmp_cache_hits * 100 / jmp_cache_lookups) : 0,
+                TB_JMP_CACHE_SIZE, TB_JMP_CACHE_WAYS);
+#else
+    cpu_fprintf(f, "TB jmp cache        %d entries, %d-way\n",
+                TB_JMP_CACHE_SIZE, TB_JMP_CACHE_WAYS);
+#endif
+    tb_worker_dump_info(f, cpu_fprintf);
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
     tcg_dump_info(f, cpu_fprintf);
+    tb_cache_dump_info(f, cpu_fprintf);
 
     tb_unlock();
 }
@@ -322,6 +322,31 @@ static QemuOptsList qemu_accel_opts = {
             .type = QEMU_OPT_STRING,
             .help = "Enable/disable multi-threaded TCG",
         },
+        {
+            .name = "hot",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Optimize TBs after this many executions",
+        },
+        {
+            .name = "trace",
+            .type = QEMU_OPT_BOOL,
+            .help = "Translate hot loops of TBs as one TB",
+        },
+        {
+            .name = "prefetch",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Translate TBs this many jumps ahead in a thread",
+        },
+        {
+            .name = "jmp-cache",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Entries of the TB jump cache of a CPU",
+        },
+        {
+            .name = "jmp-cache-ways",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Entries of a set of the TB jump cache (1, 2 or 4)",
+        },
         { /* end of list */ }
     },
 };
@@ -1606,6 +1631,7 @@ void vm_state_notify(int running, RunState state)
 
 static ShutdownCause reset_requested;
 static ShutdownCause shutdown_requested;
+static int shutdown_status;
 static int shutdown_signal;
 static pid_t shutdown_pid;
 static int powerdown_requested;
@@ -1832,6 +1858,17 @@ void qemu_system_shutdown_request(ShutdownCause reason)
     qemu_notify_event();
 }
 
+/*
+ *  a shutdown requested by the guest after which QEMU exits with status,
+ *  e.g. by a test device. Unlike exit() it may be called from any thread,
+ *  QEMU is cleaned up and the exit notifiers run as for every shutdown
+ */
+void qemu_system_exit_request(int status)
+{
+    shutdown_status = status;
+    qemu_system_shutdown_request(SHUTDOWN_CAUSE_GUEST_SHUTDOWN);
+}
+
 static void qemu_system_powerdown(void)
 {
     qapi_event_send_powerdown(&error_abort);
@@ -3757,8 +3794,9 @@ int main(int argc, char **argv, char **envp)
                 break;
             }
             case QEMU_OPTION_accel: {
-                QemuOpts *accel_opts;
+                QemuOpts *machine_opts;
 
+                /* kept for qemu_tcg_configure */
                 accel_opts = qemu_opts_parse_noisily(qemu_find_opts("accel"),
                                                      optarg, true);
                 optarg = qemu_opt_get(accel_opts, "accel");
@@ -3766,9 +3804,9 @@ int main(int argc, char **argv, char **envp)
                     error_printf("Possible accelerators: kvm, xen, hax, tcg\n");
                     exit(1);
                 }
-                accel_opts = qemu_opts_create(qemu_find_opts("machine"), NULL,
-                                              false, &error_abort);
-                qemu_opt_set(accel_opts, "accel", optarg, &error_abort);
+                machine_opts = qemu_opts_create(qemu_find_opts("machine"), NULL,
+                                                false, &error_abort);
+                qemu_opt_set(machine_opts, "accel", optarg, &error_abort);
                 break;
             }
             case QEMU_OPTION_usb:
@@ -3922,6 +3960,9 @@ int main(int argc, char **argv, char **envp)
                     tcg_tb_size = 0;
                 }
                 break;
+            case QEMU_OPTION_tb_cache:
+                tcg_tb_cache = optarg;
+                break;
             case QEMU_OPTION_icount:
                 icount_opts = qemu_opts_parse_noisily(qemu_find_opts("icount"),
                                                       optarg, true);
@@ -4763,5 +4804,5 @@ int main(int argc, char **argv, char **envp)
     qemu_chr_cleanup();
     /* TODO: unref root container, check all devices are ok */
 
-    return 0;
+    return shutdown_status;
 }